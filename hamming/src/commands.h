@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+// the subcommands of the hamming executable; argv[0] is the subcommand, and
+// the return value is the exit status
+
+// hamming serve <address> (<database> | <codes file> <code bytes>)
+//               [<first index>]; a shard (of a coordinator) is a server given
+// the index of its first code
+int run_server(int argc, char* argv[]);
+
+// hamming coordinator <address> <shard address>...
+int run_coordinator(int argc, char* argv[]);
+
+// hamming query <address> <query file> (knn <k> | radius <max distance> |
+//                                       distance <index>)
+int run_query(int argc, char* argv[]);
+
+// hamming db create <codes file> <code bytes> <database> [--ids <ids file>]
+//                   [--weights]
+// hamming db info <database> [--verify]
+int run_database(int argc, char* argv[]);
+
+// whether the file starts as a code database does (or may be corrupt)
+bool is_database(const char* path);
+
+// the whole file; prints the error and returns false on failure
+bool read_file(const char* path, std::vector<unsigned char>& data);
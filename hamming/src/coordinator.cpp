@@ -0,0 +1,199 @@
+#include <cstddef>
+#include <hamming/hamming.h>
+#include "commands.h"
+#include "protocol.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace{
+    struct coordinator
+    {
+        vector<string> shard_addresses;
+        size_t n_codes;
+        size_t code_bytes;
+    };
+
+    // scatter-gather over the shards, on connections of the client's own
+    // (so that concurrent clients don't wait for one another); a broken
+    // connection is reopened on the next request
+    class shard_connections
+    {
+    public:
+        explicit shard_connections(const coordinator& coord)
+            : coord_(coord), sockets_(coord.shard_addresses.size(), -1) {}
+
+        ~shard_connections()
+        {
+            for (size_t shard_idx = 0; shard_idx < sockets_.size(); ++shard_idx)
+                protocol::close_socket(sockets_[shard_idx]);
+        }
+
+        protocol::response search(const protocol::request& req)
+        {
+            protocol::response resp;
+            resp.status = hamming_c::HAMMING_STATUS_SUCCESS;
+            resp.n_codes = coord_.n_codes;
+            resp.code_bytes = coord_.code_bytes;
+
+            // all the requests go out before any response is read, so that
+            // the shards search in parallel
+            vector<bool> sent(sockets_.size(), false);
+            for (size_t shard_idx = 0; shard_idx < sockets_.size(); ++shard_idx)
+            {
+                if (sockets_[shard_idx] < 0)
+                    sockets_[shard_idx] = protocol::connect_to(coord_.shard_addresses[shard_idx]);
+                sent[shard_idx] = sockets_[shard_idx] >= 0 && protocol::write_request(sockets_[shard_idx], req);
+            }
+
+            vector<vector<hamming::match> > lists(sockets_.size());
+            for (size_t shard_idx = 0; shard_idx < sockets_.size(); ++shard_idx)
+            {
+                protocol::response shard_resp;
+                if (!sent[shard_idx] || !protocol::read_response(sockets_[shard_idx], shard_resp))
+                {
+                    protocol::close_socket(sockets_[shard_idx]);
+                    sockets_[shard_idx] = -1;
+                    resp.status = protocol::status_shard_unavailable;
+                    continue;
+                }
+                // only one shard has the code of a distance request; the
+                // others find the index out of their range
+                const bool not_held = req.type == protocol::request_distance &&
+                                      shard_resp.status == hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE;
+                if (shard_resp.status != hamming_c::HAMMING_STATUS_SUCCESS && !not_held &&
+                    resp.status == hamming_c::HAMMING_STATUS_SUCCESS)
+                    resp.status = shard_resp.status;
+                lists[shard_idx].swap(shard_resp.matches);
+            }
+
+            if (resp.status == hamming_c::HAMMING_STATUS_SUCCESS)
+                // the shards report the indexes of the whole database
+                resp.matches = hamming::merge_matches(lists, vector<size_t>(),
+                                                      req.type == protocol::request_knn ? req.param : 0);
+            if (resp.status == hamming_c::HAMMING_STATUS_SUCCESS && req.type == protocol::request_distance &&
+                resp.matches.empty())
+                resp.status = hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE;
+            return resp;
+        }
+
+    private:
+        const coordinator& coord_;
+        vector<int> sockets_;
+    };
+
+    void serve_coordinator(const int connection, void* context)
+    {
+        try
+        {
+            shard_connections shards(*static_cast<const coordinator*>(context));
+            protocol::request req;
+            while (protocol::read_request(connection, req))
+                if (!protocol::write_response(connection, shards.search(req)))
+                    break;
+        }
+        catch (const exception&)
+        {
+            // e.g. no memory for the merge: only this client is dropped,
+            // rather than the detached thread terminating the coordinator
+        }
+        protocol::close_socket(connection);
+    }
+}
+
+int run_coordinator(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: hamming coordinator <address> <shard address>..." << endl;
+        return EXIT_FAILURE;
+    }
+
+    // never freed: the server runs until it is killed
+    coordinator* coord = new coordinator();
+    coord->shard_addresses.assign(argv + 2, argv + argc);
+    coord->n_codes = 0;
+    coord->code_bytes = 0;
+
+    // the shards must be up, and agree on the code size
+    for (size_t shard_idx = 0; shard_idx < coord->shard_addresses.size(); ++shard_idx)
+    {
+        const string& address = coord->shard_addresses[shard_idx];
+        const int shard = protocol::connect_to(address);
+        protocol::request req = {protocol::request_knn, 0, vector<unsigned char>()};
+        protocol::response resp;
+        if (shard < 0 || !protocol::write_request(shard, req) || !protocol::read_response(shard, resp))
+        {
+            cerr << "Error querying shard " << address << ":" << strerror(errno) << endl;
+            return EXIT_FAILURE;
+        }
+        protocol::close_socket(shard);
+
+        if (shard_idx && resp.code_bytes != coord->code_bytes)
+        {
+            cerr << "Shard " << address << " has codes of " << resp.code_bytes << " bytes, instead of "
+                 << coord->code_bytes << endl;
+            return EXIT_FAILURE;
+        }
+        coord->code_bytes = resp.code_bytes;
+        coord->n_codes += resp.n_codes;
+    }
+
+    const int listener = protocol::listen_on(argv[1]);
+    if (listener < 0)
+    {
+        cerr << "Error listening on " << argv[1] << ":" << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
+
+    cerr << "Coordinating " << coord->shard_addresses.size() << " shards (" << coord->n_codes << " codes) on "
+         << argv[1] << endl;
+    protocol::accept_loop(listener, serve_coordinator, coord);
+    return EXIT_SUCCESS;
+}
+
+int run_query(int argc, char* argv[])
+{
+    if (argc < 5 || (strcmp(argv[3], "knn") && strcmp(argv[3], "radius") && strcmp(argv[3], "distance")))
+    {
+        cerr << "Usage: hamming query <address> <query file> (knn <k> | radius <max distance> | distance <index>)"
+             << endl;
+        return EXIT_FAILURE;
+    }
+
+    protocol::request req;
+    req.type = !strcmp(argv[3], "knn") ? protocol::request_knn :
+               !strcmp(argv[3], "radius") ? protocol::request_radius : protocol::request_distance;
+    req.param = strtoul(argv[4], nullptr, 10);
+    if (!read_file(argv[2], req.query))
+        return EXIT_FAILURE;
+
+    const int server = protocol::connect_to(argv[1]);
+    protocol::response resp;
+    if (server < 0 || !protocol::write_request(server, req) || !protocol::read_response(server, resp))
+    {
+        cerr << "Error querying " << argv[1] << ":" << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
+    protocol::close_socket(server);
+
+    if (resp.status != hamming_c::HAMMING_STATUS_SUCCESS)
+    {
+        cerr << "Query failed: "
+             << (resp.status == protocol::status_shard_unavailable ? "shard unavailable" :
+                 resp.status == protocol::status_bad_request ? "bad request" :
+                 hamming_c::get_hamming_error_string(static_cast<hamming_c::hamming_status_t>(resp.status)))
+             << endl;
+        return EXIT_FAILURE;
+    }
+
+    for (size_t match_idx = 0; match_idx < resp.matches.size(); ++match_idx)
+        cout << resp.matches[match_idx].index << " " << resp.matches[match_idx].distance << "\n";
+    return EXIT_SUCCESS;
+}
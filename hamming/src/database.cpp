@@ -0,0 +1,113 @@
+#include <cstddef>
+#include <hamming/hamming.h>
+#include "commands.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+
+namespace{
+    // hamming db create <codes file> <code bytes> <database> [--ids <ids file>] [--weights]
+    int create_database(int argc, char* argv[])
+    {
+        const size_t code_bytes = strtoul(argv[2], nullptr, 10);
+        vector<unsigned char> data;
+        if (!read_file(argv[1], data))
+            return EXIT_FAILURE;
+        if (!code_bytes || data.size() % code_bytes)
+        {
+            cerr << "The size of " << argv[1] << " must be a multiple of the code size" << endl;
+            return EXIT_FAILURE;
+        }
+        const hamming::code_set_view codes = hamming::make_code_set(data.data(), data.size() / code_bytes,
+                                                                    code_bytes);
+
+        vector<unsigned long long> ids;
+        bool with_weights = false;
+        for (int arg_idx = 4; arg_idx < argc; ++arg_idx)
+        {
+            if (!strcmp(argv[arg_idx], "--weights"))
+            {
+                with_weights = true;
+                continue;
+            }
+
+            if (strcmp(argv[arg_idx], "--ids") || arg_idx + 1 == argc)
+            {
+                cerr << "Unknown option " << argv[arg_idx] << endl;
+                return EXIT_FAILURE;
+            }
+            vector<unsigned char> id_bytes;
+            if (!read_file(argv[++arg_idx], id_bytes))
+                return EXIT_FAILURE;
+            // one u64 per code, in the byte order of this machine
+            if (id_bytes.size() != codes.n_codes * sizeof(unsigned long long))
+            {
+                cerr << "The ids file must hold one 8 byte id per code" << endl;
+                return EXIT_FAILURE;
+            }
+            ids.resize(codes.n_codes);
+            if (!ids.empty())
+                memcpy(ids.data(), id_bytes.data(), id_bytes.size());
+        }
+
+        try
+        {
+            hamming::write_database(argv[3], codes, ids, with_weights);
+        }
+        catch (const system_error& error)
+        {
+            cerr << "Error writing " << argv[3] << ":" << error.what() << endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // hamming db info <database> [--verify]
+    int print_database_info(int argc, char* argv[])
+    {
+        const bool verify = argc > 2 && !strcmp(argv[2], "--verify");
+        try
+        {
+            const hamming::database db(argv[1], verify);
+            const hamming::code_set_view codes = db.codes();
+            cout << "version: " << db.version() << "\n"
+                 << "codes: " << codes.n_codes << "\n"
+                 << "code bytes: " << codes.code_bytes << "\n"
+                 << "stride: " << codes.stride << "\n"
+                 << "ids: " << (db.ids() ? "yes" : "no") << "\n"
+                 << "weights: " << (db.weights() ? "yes" : "no") << "\n";
+            if (verify)
+                cout << "checksum: ok\n";
+        }
+        catch (const system_error& error)
+        {
+            cerr << "Error opening " << argv[1] << ":" << error.what() << endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+}
+
+bool is_database(const char* path)
+{
+    char magic[sizeof(HAMMING_DB_MAGIC) - 1];
+    ifstream f(path, ios::binary);
+    return f.read(magic, sizeof(magic)) && !memcmp(magic, HAMMING_DB_MAGIC, sizeof(magic));
+}
+
+int run_database(int argc, char* argv[])
+{
+    if (argc >= 5 && !strcmp(argv[1], "create"))
+        return create_database(argc - 1, argv + 1);
+    if (argc >= 3 && !strcmp(argv[1], "info"))
+        return print_database_info(argc - 1, argv + 1);
+
+    cerr << "Usage: hamming db create <codes file> <code bytes> <database> [--ids <ids file>] [--weights]" << endl;
+    cerr << "       hamming db info <database> [--verify]" << endl;
+    return EXIT_FAILURE;
+}
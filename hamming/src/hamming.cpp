@@ -6,15 +6,61 @@
 #include <cerrno>
 #include <cstring>
 #include <vector>
+#include <csignal>
+#include "commands.h"
 
 using namespace std;
 using namespace hamming;
 
+bool read_file(const char* path, vector<unsigned char>& data)
+{
+    ifstream f(path, ios::binary);
+    if (!f)
+    {
+        cerr << "Error opening file " << path << ":" << strerror(errno) << endl;
+        return false;
+    }
+
+    f.seekg(0, std::ios_base::end);
+    const std::streamsize n_bytes = f.tellg();
+    f.seekg(0); // reset stream
+
+    data.resize(static_cast<size_t>(n_bytes));
+    if (!f.read(reinterpret_cast<char*>(data.data()), n_bytes))
+    {
+        cerr << "Error reading file " << path << endl;
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
+#ifdef SIGPIPE
+    // a client going away mid-response is reported by send instead
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if (argc > 1 && (!strcmp(argv[1], "serve") || !strcmp(argv[1], "shard")))
+        return run_server(argc - 1, argv + 1);
+    if (argc > 1 && !strcmp(argv[1], "coordinator"))
+        return run_coordinator(argc - 1, argv + 1);
+    if (argc > 1 && !strcmp(argv[1], "query"))
+        return run_query(argc - 1, argv + 1);
+    if (argc > 1 && !strcmp(argv[1], "db"))
+        return run_database(argc - 1, argv + 1);
+
     if (argc < 3)
     {
         cerr << "Usage:" << argv[0] << " <file1> <file2>" << endl;
+        cerr << "       " << argv[0] << " serve <address> (<database> | <codes file> <code bytes>) [<first index>]"
+             << endl;
+        cerr << "       " << argv[0] << " coordinator <address> <shard address>..." << endl;
+        cerr << "       " << argv[0] << " query <address> <query file> (knn <k> | radius <max distance> |"
+             << " distance <index>)" << endl;
+        cerr << "       " << argv[0] << " db create <codes file> <code bytes> <database> [--ids <ids file>]"
+             << " [--weights]" << endl;
+        cerr << "       " << argv[0] << " db info <database> [--verify]" << endl;
         return EXIT_FAILURE;
     }
 
@@ -0,0 +1,396 @@
+#include "protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace{
+    const size_t request_header_bytes = 24;
+    const size_t response_header_bytes = 32;
+
+    void put_u32(unsigned char* out, const unsigned int value)
+    {
+        for (int byte_idx = 0; byte_idx < 4; ++byte_idx)
+            out[byte_idx] = static_cast<unsigned char>(value >> (8 * byte_idx));
+    }
+
+    void put_u64(unsigned char* out, const unsigned long long value)
+    {
+        for (int byte_idx = 0; byte_idx < 8; ++byte_idx)
+            out[byte_idx] = static_cast<unsigned char>(value >> (8 * byte_idx));
+    }
+
+    unsigned int get_u32(const unsigned char* in)
+    {
+        unsigned int value = 0;
+        for (int byte_idx = 3; byte_idx >= 0; --byte_idx)
+            value = (value << 8) | in[byte_idx];
+        return value;
+    }
+
+    unsigned long long get_u64(const unsigned char* in)
+    {
+        unsigned long long value = 0;
+        for (int byte_idx = 7; byte_idx >= 0; --byte_idx)
+            value = (value << 8) | in[byte_idx];
+        return value;
+    }
+
+#ifndef _WIN32
+    bool read_all(const int socket, unsigned char* data, size_t n_bytes)
+    {
+        while (n_bytes)
+        {
+            const ssize_t n_read = recv(socket, data, n_bytes, 0);
+            if (n_read < 0 && errno == EINTR)
+                continue;
+            if (n_read <= 0)
+                return false;
+            data += n_read;
+            n_bytes -= static_cast<size_t>(n_read);
+        }
+        return true;
+    }
+
+    bool write_all(const int socket, const unsigned char* data, size_t n_bytes)
+    {
+        while (n_bytes)
+        {
+            const ssize_t n_written = send(socket, data, n_bytes, 0);
+            if (n_written < 0 && errno == EINTR)
+                continue;
+            if (n_written <= 0)
+                return false;
+            data += n_written;
+            n_bytes -= static_cast<size_t>(n_written);
+        }
+        return true;
+    }
+
+    bool is_unix_address(const string& address, string& path)
+    {
+        if (address.compare(0, 5, "unix:") == 0)
+        {
+            path = address.substr(5);
+            return true;
+        }
+        path = address;
+        return address.find('/') != string::npos;
+    }
+
+    bool fill_unix_address(const string& path, sockaddr_un& unix_address)
+    {
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(unix_address.sun_path))
+        {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        memcpy(unix_address.sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+    // host:port; an empty host (":port") is 127.0.0.1, both to listen on and
+    // to connect to: listening on every interface takes an explicit wildcard
+    // host (0.0.0.0 or ::)
+    addrinfo* resolve(const string& address)
+    {
+        const size_t colon = address.rfind(':');
+        if (colon == string::npos)
+        {
+            errno = EINVAL;
+            return nullptr;
+        }
+        const string host = colon ? address.substr(0, colon) : "127.0.0.1", port = address.substr(colon + 1);
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses))
+        {
+            errno = EINVAL;
+            return nullptr;
+        }
+        return addresses;
+    }
+
+    // the requests and responses are small, and each waits for the other
+    void set_no_delay(const int socket)
+    {
+        const int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+#endif
+}
+
+int protocol::listen_on(const string& address)
+{
+#ifdef _WIN32
+    (void)address;
+    errno = ENOSYS;
+    return -1;
+#else
+    string path;
+    if (is_unix_address(address, path))
+    {
+        sockaddr_un unix_address;
+        if (!fill_unix_address(path, unix_address))
+            return -1;
+        // a socket file left behind by a previous server is replaced, but
+        // nothing else is
+        struct stat existing;
+        if (!lstat(path.c_str(), &existing))
+        {
+            if (!S_ISSOCK(existing.st_mode))
+            {
+                errno = EADDRINUSE;
+                return -1;
+            }
+            unlink(path.c_str());
+        }
+        const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            return -1;
+        if (bind(listener, reinterpret_cast<const sockaddr*>(&unix_address), sizeof(unix_address)) ||
+            listen(listener, SOMAXCONN))
+        {
+            const int error = errno;
+            close(listener);
+            errno = error;
+            return -1;
+        }
+        return listener;
+    }
+
+    addrinfo* addresses = resolve(address);
+    if (!addresses)
+        return -1;
+    int listener = -1;
+    for (addrinfo* candidate = addresses; candidate && listener < 0; candidate = candidate->ai_next)
+    {
+        listener = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (listener < 0)
+            continue;
+        const int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(listener, candidate->ai_addr, candidate->ai_addrlen) || listen(listener, SOMAXCONN))
+        {
+            close(listener);
+            listener = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return listener;
+#endif
+}
+
+int protocol::connect_to(const string& address)
+{
+#ifdef _WIN32
+    (void)address;
+    errno = ENOSYS;
+    return -1;
+#else
+    string path;
+    if (is_unix_address(address, path))
+    {
+        sockaddr_un unix_address;
+        if (!fill_unix_address(path, unix_address))
+            return -1;
+        const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection < 0)
+            return -1;
+        if (connect(connection, reinterpret_cast<const sockaddr*>(&unix_address), sizeof(unix_address)))
+        {
+            const int error = errno;
+            close(connection);
+            errno = error;
+            return -1;
+        }
+        return connection;
+    }
+
+    addrinfo* addresses = resolve(address);
+    if (!addresses)
+        return -1;
+    int connection = -1;
+    for (addrinfo* candidate = addresses; candidate && connection < 0; candidate = candidate->ai_next)
+    {
+        connection = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (connection < 0)
+            continue;
+        if (connect(connection, candidate->ai_addr, candidate->ai_addrlen))
+        {
+            close(connection);
+            connection = -1;
+        }
+        else
+            set_no_delay(connection);
+    }
+    freeaddrinfo(addresses);
+    return connection;
+#endif
+}
+
+void protocol::close_socket(const int socket)
+{
+#ifndef _WIN32
+    if (socket >= 0)
+        close(socket);
+#else
+    (void)socket;
+#endif
+}
+
+bool protocol::read_request(const int socket, request& req)
+{
+#ifdef _WIN32
+    (void)socket; (void)req;
+    return false;
+#else
+    unsigned char header[request_header_bytes];
+    if (!read_all(socket, header, sizeof(header)) || get_u32(header) != magic)
+        return false;
+
+    req.type = get_u32(header + 4);
+    req.param = static_cast<size_t>(get_u64(header + 8));
+    const unsigned long long query_bytes = get_u64(header + 16);
+    if (query_bytes > max_query_bytes)
+        return false;
+    req.query.resize(static_cast<size_t>(query_bytes));
+    return read_all(socket, req.query.data(), req.query.size());
+#endif
+}
+
+bool protocol::write_request(const int socket, const request& req)
+{
+#ifdef _WIN32
+    (void)socket; (void)req;
+    return false;
+#else
+    vector<unsigned char> frame(request_header_bytes + req.query.size());
+    put_u32(frame.data(), magic);
+    put_u32(frame.data() + 4, req.type);
+    put_u64(frame.data() + 8, req.param);
+    put_u64(frame.data() + 16, req.query.size());
+    copy(req.query.begin(), req.query.end(), frame.begin() + request_header_bytes);
+    return write_all(socket, frame.data(), frame.size());
+#endif
+}
+
+bool protocol::read_response(const int socket, response& resp)
+{
+#ifdef _WIN32
+    (void)socket; (void)resp;
+    return false;
+#else
+    unsigned char header[response_header_bytes];
+    if (!read_all(socket, header, sizeof(header)) || get_u32(header) != magic)
+        return false;
+
+    resp.status = get_u32(header + 4);
+    resp.n_codes = static_cast<size_t>(get_u64(header + 8));
+    resp.code_bytes = static_cast<size_t>(get_u64(header + 16));
+    const unsigned long long n_matches = get_u64(header + 24);
+    // no more matches than codes
+    if (n_matches > resp.n_codes)
+        return false;
+
+    // both counts come from the peer, so the matches are read a chunk at a
+    // time: what is allocated is bounded by what was actually received
+    const size_t chunk_matches = 4096;
+    unsigned char payload[16 * chunk_matches];
+    resp.matches.clear();
+    for (unsigned long long n_read = 0; n_read < n_matches;)
+    {
+        const size_t n_chunk = static_cast<size_t>(min<unsigned long long>(n_matches - n_read, chunk_matches));
+        if (!read_all(socket, payload, 16 * n_chunk))
+            return false;
+        for (size_t match_idx = 0; match_idx < n_chunk; ++match_idx)
+        {
+            hamming::match match;
+            match.index = static_cast<size_t>(get_u64(payload + 16 * match_idx));
+            match.distance = static_cast<size_t>(get_u64(payload + 16 * match_idx + 8));
+            resp.matches.push_back(match);
+        }
+        n_read += n_chunk;
+    }
+    return true;
+#endif
+}
+
+bool protocol::write_response(const int socket, const response& resp)
+{
+#ifdef _WIN32
+    (void)socket; (void)resp;
+    return false;
+#else
+    vector<unsigned char> frame(response_header_bytes + 16 * resp.matches.size());
+    put_u32(frame.data(), magic);
+    put_u32(frame.data() + 4, resp.status);
+    put_u64(frame.data() + 8, resp.n_codes);
+    put_u64(frame.data() + 16, resp.code_bytes);
+    put_u64(frame.data() + 24, resp.matches.size());
+    for (size_t match_idx = 0; match_idx < resp.matches.size(); ++match_idx)
+    {
+        put_u64(frame.data() + response_header_bytes + 16 * match_idx, resp.matches[match_idx].index);
+        put_u64(frame.data() + response_header_bytes + 16 * match_idx + 8, resp.matches[match_idx].distance);
+    }
+    return write_all(socket, frame.data(), frame.size());
+#endif
+}
+
+void protocol::accept_loop(const int listener, void (*serve)(int connection, void* context), void* context)
+{
+#ifdef _WIN32
+    (void)listener; (void)serve; (void)context;
+#else
+    // the wait after a failed accept, doubled while they keep failing (out of
+    // file descriptors, say), so that they don't spin a core
+    const chrono::milliseconds min_backoff(10), max_backoff(1000);
+    chrono::milliseconds backoff = min_backoff;
+    for (;;)
+    {
+        const int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            this_thread::sleep_for(backoff);
+            backoff = min(2 * backoff, max_backoff);
+            continue;
+        }
+        backoff = min_backoff;
+
+        // no-op on Unix domain sockets
+        set_no_delay(connection);
+        try
+        {
+            thread(serve, connection, context).detach();
+        }
+        catch (const system_error&)
+        {
+            // no thread for it: the client sees the connection closed
+            close(connection);
+        }
+    }
+#endif
+}
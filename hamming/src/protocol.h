@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <hamming/hamming.h>
+#include <string>
+#include <vector>
+
+// the search protocol spoken by the servers and the coordinator (which
+// serves the same requests, over all its shards), over stream sockets.
+// A connection carries any number of requests, each answered in order:
+//
+//     request:  u32 magic, u32 type, u64 param, u64 query_bytes,
+//               query_bytes bytes of query
+//     response: u32 magic, u32 status, u64 n_codes, u64 code_bytes,
+//               u64 n_matches, n_matches x (u64 index, u64 distance)
+//
+// Integers are little endian. param is k for the k-NN requests (0 only asks
+// for n_codes and code_bytes, the size of the database), max_distance for
+// the radius ones and the index of a code for the distance ones (whose
+// single match is that code). status is a hamming_status_t, or one of the
+// protocol_status values below; the indexes are those of the whole database.
+// Malformed frames (bad magic, oversized queries) close the connection.
+
+namespace protocol
+{
+    const unsigned int magic = 0x314d4148; // "HAM1"
+
+    enum request_type
+    {
+        request_knn = 1,
+        request_radius = 2,
+        request_distance = 3
+    };
+
+    enum protocol_status
+    {
+        // unknown request type
+        status_bad_request = 256,
+        // the coordinator couldn't reach one of its shards
+        status_shard_unavailable = 257
+    };
+
+    // queries are codes, so this is plenty
+    const size_t max_query_bytes = 1 << 20;
+
+    struct request
+    {
+        unsigned int type;
+        size_t param;
+        std::vector<unsigned char> query;
+    };
+
+    struct response
+    {
+        unsigned int status;
+        size_t n_codes;
+        size_t code_bytes;
+        std::vector<hamming::match> matches;
+    };
+
+    // "unix:<path>", or any address with a '/' in it, is a Unix domain
+    // socket; "<host>:<port>" is TCP, and ":<port>" is TCP on loopback
+    int listen_on(const std::string& address);
+    // -1 on failure
+    int connect_to(const std::string& address);
+    void close_socket(int socket);
+
+    // false when the connection is closed or broken, or the frame is
+    // malformed
+    bool read_request(int socket, request& req);
+    bool write_request(int socket, const request& req);
+    bool read_response(int socket, response& resp);
+    bool write_response(int socket, const response& resp);
+
+    // calls serve(connection) on a thread of its own for every connection
+    // accepted on listener; never returns
+    void accept_loop(int listener, void (*serve)(int connection, void* context), void* context);
+}
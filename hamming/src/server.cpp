@@ -0,0 +1,452 @@
+#include <cstddef>
+#include <hamming/hamming.h>
+#include "commands.h"
+#include "protocol.h"
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace{
+    // the database, mapped read-only for the life of the server: it is
+    // loaded (and shared with other servers of the same file) by the page
+    // cache rather than copied into the process
+    class mapped_file
+    {
+    public:
+        mapped_file() : data_(nullptr), size_(0) {}
+
+        // prints the error and returns false on failure
+        bool open(const char* path)
+        {
+#ifdef _WIN32
+            if (!read_file(path, copy_))
+                return false;
+            data_ = copy_.data();
+            size_ = copy_.size();
+            return true;
+#else
+            const int file = ::open(path, O_RDONLY);
+            struct stat file_stat;
+            if (file < 0 || fstat(file, &file_stat))
+            {
+                cerr << "Error opening file " << path << ":" << strerror(errno) << endl;
+                if (file >= 0)
+                    close(file);
+                return false;
+            }
+
+            size_ = static_cast<size_t>(file_stat.st_size);
+            if (size_)
+            {
+                int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+                // fault it all in now rather than during the first queries
+                flags |= MAP_POPULATE;
+#endif
+                void* mapping = mmap(nullptr, size_, PROT_READ, flags, file, 0);
+                if (mapping == MAP_FAILED)
+                {
+                    cerr << "Error mapping file " << path << ":" << strerror(errno) << endl;
+                    close(file);
+                    return false;
+                }
+                data_ = static_cast<const unsigned char*>(mapping);
+                // best effort: only kernels with THP for files grant it
+                hamming_c::hamming_advise_huge_pages(data_, size_);
+            }
+            close(file);
+            return true;
+#endif
+        }
+
+        const unsigned char* data() const {return data_;}
+        size_t size() const {return size_;}
+
+    private:
+        const unsigned char* data_;
+        size_t size_;
+#ifdef _WIN32
+        vector<unsigned char> copy_;
+#endif
+    };
+
+    // the codes being served: a raw file, fixed for the life of the
+    // server, or the current version of a database, which SIGHUP reloads
+    class served_codes
+    {
+    public:
+        served_codes(const hamming::code_set_view& fixed, hamming::versioned_database* versions)
+            : fixed_(fixed), versions_(versions) {}
+
+        // the codes, which stay valid as long as pin is kept
+        hamming::code_set_view pin(unique_ptr<hamming::versioned_database::snapshot>& pinned) const
+        {
+            if (!versions_)
+                return fixed_;
+            pinned.reset(new hamming::versioned_database::snapshot(*versions_));
+            return pinned->codes();
+        }
+
+    private:
+        const hamming::code_set_view fixed_;
+        hamming::versioned_database* versions_;
+    };
+
+    // searches submitted while a scan runs are queued, and all of them are
+    // answered by the next (shared) scan, so concurrent clients cost one
+    // pass over the database per batch rather than one each
+    class search_batcher
+    {
+    public:
+        explicit search_batcher(const served_codes& codes)
+            : codes_(codes), stop_(false)
+        {
+            thread_ = thread(&search_batcher::run, this);
+        }
+
+        ~search_batcher()
+        {
+            {
+                lock_guard<mutex> lock(mutex_);
+                stop_ = true;
+            }
+            queued_.notify_all();
+            thread_.join();
+        }
+
+        // blocks until the batch the search is part of is done; throws
+        // system_error
+        vector<hamming::match> search(const hamming::search_query& query, const size_t query_bytes)
+        {
+            pending request;
+            request.query = query;
+            request.query_bytes = query_bytes;
+            request.status = hamming_c::HAMMING_STATUS_SUCCESS;
+            request.done = false;
+
+            unique_lock<mutex> lock(mutex_);
+            queue_.push_back(&request);
+            queued_.notify_one();
+            done_.wait(lock, [&request] {return request.done;});
+
+            if (request.status != hamming_c::HAMMING_STATUS_SUCCESS)
+                throw system_error(request.status, hamming::hamming_error_category::instance());
+            return request.results;
+        }
+
+    private:
+        struct pending
+        {
+            hamming::search_query query;
+            size_t query_bytes;
+            vector<hamming::match> results;
+            int status;
+            bool done;
+        };
+
+        // bounds the per-thread state of a scan
+        static size_t max_batch() {return 64;}
+
+        void run()
+        {
+            unique_lock<mutex> lock(mutex_);
+            for (;;)
+            {
+                queued_.wait(lock, [this] {return !queue_.empty() || stop_;});
+                if (stop_)
+                    return;
+
+                const size_t n_taken = min(queue_.size(), max_batch());
+                vector<pending*> batch(queue_.begin(), queue_.begin() + n_taken);
+                queue_.erase(queue_.begin(), queue_.begin() + n_taken);
+                lock.unlock();
+
+                // the whole batch scans one version; the queries sized for
+                // another one (the version was reloaded since they were
+                // checked) are turned down
+                int status = hamming_c::HAMMING_STATUS_SUCCESS;
+                vector<pending*> scanned;
+                vector<vector<hamming::match> > results;
+                try
+                {
+                    unique_ptr<hamming::versioned_database::snapshot> pinned;
+                    const hamming::code_set_view codes = codes_.pin(pinned);
+                    vector<hamming::search_query> queries;
+                    for (size_t request_idx = 0; request_idx < batch.size(); ++request_idx)
+                        if (batch[request_idx]->query_bytes == codes.code_bytes)
+                        {
+                            scanned.push_back(batch[request_idx]);
+                            queries.push_back(batch[request_idx]->query);
+                        }
+                        else
+                            batch[request_idx]->status = hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE;
+                    results = hamming::search_batch(queries, codes);
+                }
+                catch (const system_error& error)
+                {
+                    status = error.code().value();
+                }
+                catch (const bad_alloc&)
+                {
+                    status = hamming_c::HAMMING_STATUS_OUT_OF_MEMORY;
+                }
+
+                // a failure fails every request which was to be scanned,
+                // including those it struck before they were queued for it
+                lock.lock();
+                for (size_t request_idx = 0; request_idx < batch.size(); ++request_idx)
+                {
+                    if (status != hamming_c::HAMMING_STATUS_SUCCESS &&
+                        batch[request_idx]->status != hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE)
+                        batch[request_idx]->status = status;
+                    batch[request_idx]->done = true;
+                }
+                if (status == hamming_c::HAMMING_STATUS_SUCCESS)
+                    for (size_t request_idx = 0; request_idx < scanned.size(); ++request_idx)
+                        scanned[request_idx]->results.swap(results[request_idx]);
+                done_.notify_all();
+            }
+        }
+
+        const served_codes& codes_;
+        mutex mutex_;
+        condition_variable queued_, done_;
+        vector<pending*> queue_;
+        bool stop_;
+        thread thread_;
+    };
+
+    struct server
+    {
+        // one of them
+        hamming::versioned_database* versions;
+        mapped_file file;
+        served_codes* served;
+        size_t first_index;
+        search_batcher* batcher;
+
+        // runs on a detached connection thread, which an exception would
+        // terminate along with the whole server, so every failure of the
+        // request is answered as a status
+        protocol::response answer(const protocol::request& req)
+        {
+            try
+            {
+                return answer_request(req);
+            }
+            catch (const system_error& error)
+            {
+                return failure(static_cast<unsigned int>(error.code().value()));
+            }
+            catch (const bad_alloc&)
+            {
+                return failure(hamming_c::HAMMING_STATUS_OUT_OF_MEMORY);
+            }
+        }
+
+        static protocol::response failure(const unsigned int status)
+        {
+            protocol::response resp;
+            resp.status = status;
+            resp.n_codes = 0;
+            resp.code_bytes = 0;
+            return resp;
+        }
+
+        protocol::response answer_request(const protocol::request& req)
+        {
+            // the version the request is checked against, and a distance
+            // is computed on
+            unique_ptr<hamming::versioned_database::snapshot> pinned;
+            const hamming::code_set_view codes = served->pin(pinned);
+
+            protocol::response resp;
+            resp.status = hamming_c::HAMMING_STATUS_SUCCESS;
+            resp.n_codes = codes.n_codes;
+            resp.code_bytes = codes.code_bytes;
+
+            if (req.type != protocol::request_knn && req.type != protocol::request_radius &&
+                req.type != protocol::request_distance)
+            {
+                resp.status = protocol::status_bad_request;
+                return resp;
+            }
+            if (req.type == protocol::request_knn && !req.param)
+                return resp;
+            if (req.query.size() != codes.code_bytes ||
+                (req.type == protocol::request_distance &&
+                 (req.param < first_index || req.param - first_index >= codes.n_codes)))
+            {
+                resp.status = hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE;
+                return resp;
+            }
+
+            try
+            {
+                if (req.type == protocol::request_distance)
+                {
+                    // a single code, which takes no scan
+                    hamming::match match;
+                    match.index = req.param;
+                    const size_t stride = codes.stride ? codes.stride : codes.code_bytes;
+                    match.distance = hamming::distance(req.query.data(),
+                                                       codes.data + (req.param - first_index) * stride,
+                                                       codes.code_bytes);
+                    resp.matches.push_back(match);
+                    return resp;
+                }
+
+                hamming::search_query query;
+                query.query = req.query.data();
+                query.kind = req.type == protocol::request_knn ? hamming::search_kind::Knn :
+                             hamming::search_kind::Radius;
+                query.param = req.param;
+                resp.matches = batcher->search(query, req.query.size());
+            }
+            catch (const system_error& error)
+            {
+                resp.status = static_cast<unsigned int>(error.code().value());
+            }
+            for (size_t match_idx = 0; match_idx < resp.matches.size(); ++match_idx)
+                resp.matches[match_idx].index += first_index;
+            return resp;
+        }
+    };
+
+    void serve_connection(const int connection, void* context)
+    {
+        server& served = *static_cast<server*>(context);
+        try
+        {
+            protocol::request req;
+            while (protocol::read_request(connection, req))
+                if (!protocol::write_response(connection, served.answer(req)))
+                    break;
+        }
+        catch (const exception&)
+        {
+            // e.g. no memory for a request: only this client is dropped
+        }
+        protocol::close_socket(connection);
+    }
+
+#ifndef _WIN32
+    // reloads the database on SIGHUP; the searches keep reading the previous
+    // version until the new one is mapped, checked and swapped in
+    void reload_on_hangup(hamming::versioned_database* versions, const string path)
+    {
+        sigset_t hangup;
+        sigemptyset(&hangup);
+        sigaddset(&hangup, SIGHUP);
+        for (;;)
+        {
+            int signal = 0;
+            if (sigwait(&hangup, &signal))
+                return;
+            try
+            {
+                versions->load(path, true);
+                versions->wait();
+                const hamming::versioned_database::snapshot current(*versions);
+                cerr << "Reloaded " << path << " (version " << current.version() << ", "
+                     << current.codes().n_codes << " codes)" << endl;
+            }
+            catch (const system_error& error)
+            {
+                cerr << "Error reloading database " << path << ":" << error.what() << endl;
+            }
+        }
+    }
+#endif
+}
+
+int run_server(int argc, char* argv[])
+{
+    const bool from_database = argc >= 3 && is_database(argv[2]);
+    if (argc < (from_database ? 3 : 4))
+    {
+        cerr << "Usage: hamming serve <address> (<database> | <codes file> <code bytes>) [<first index>]" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // never freed: the server runs until it is killed
+    server* served = new server();
+    served->versions = nullptr;
+    hamming::code_set_view codes = hamming::make_code_set(nullptr, 0, 0);
+    if (from_database)
+    {
+#ifndef _WIN32
+        // blocked before any other thread (the loader's included) starts, so
+        // that they all leave it to the reloader
+        sigset_t hangup;
+        sigemptyset(&hangup);
+        sigaddset(&hangup, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &hangup, nullptr);
+#endif
+
+        // used in place: no copy nor realignment of the codes
+        try
+        {
+            served->versions = new hamming::versioned_database();
+            served->versions->load(argv[2]);
+            served->versions->wait();
+            codes = hamming::versioned_database::snapshot(*served->versions).codes();
+        }
+        catch (const system_error& error)
+        {
+            cerr << "Error opening database " << argv[2] << ":" << error.what() << endl;
+            return EXIT_FAILURE;
+        }
+        served->first_index = argc > 3 ? strtoul(argv[3], nullptr, 10) : 0;
+#ifndef _WIN32
+        thread(reload_on_hangup, served->versions, string(argv[2])).detach();
+#endif
+    }
+    else
+    {
+        if (!served->file.open(argv[2]))
+            return EXIT_FAILURE;
+
+        const size_t code_bytes = strtoul(argv[3], nullptr, 10);
+        if (!code_bytes || served->file.size() % code_bytes)
+        {
+            cerr << "The size of " << argv[2] << " must be a multiple of the code size" << endl;
+            return EXIT_FAILURE;
+        }
+        codes = hamming::make_code_set(served->file.data(), served->file.size() / code_bytes, code_bytes);
+        served->first_index = argc > 4 ? strtoul(argv[4], nullptr, 10) : 0;
+    }
+    served->served = new served_codes(codes, served->versions);
+    served->batcher = new search_batcher(*served->served);
+
+    const int listener = protocol::listen_on(argv[1]);
+    if (listener < 0)
+    {
+        cerr << "Error listening on " << argv[1] << ":" << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
+
+    cerr << "Serving codes " << served->first_index << " to " << served->first_index + codes.n_codes
+         << " on " << argv[1] << endl;
+    protocol::accept_loop(listener, serve_connection, served);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+#include <cstddef>
+#include <hamming/hamming.h>
+#include <hamming/hamming.hpp>
+#include "perf_counters.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    struct options
+    {
+        size_t n_bytes;
+        size_t code_bytes;
+        size_t repeats;
+        // run the scan options sweep instead of the implementations
+        bool scan;
+    };
+
+    // one call of the library over n_bytes bytes of data, with the given
+    // implementation
+    struct workload
+    {
+        string name;
+        unsigned long long n_bytes;
+        function<hamming_c::hamming_status_t(hamming_c::hamming_impl_t)> run;
+    };
+
+    void usage(const char* program)
+    {
+        cerr << "Usage: " << program << " [--bytes <n>] [--code-bytes <n>] [--repeats <n>] [--scan]\n"
+             << "  --bytes       size of the data scanned by every call (default 64 MiB)\n"
+             << "  --code-bytes  code size of the batch workloads (default 32)\n"
+             << "  --repeats     calls measured per implementation (default 10)\n"
+             << "  --scan        instead, time the batch scan with every scan option (prefetch\n"
+             << "                distance, non-temporal hint) on databases of 1 MiB up to --bytes" << endl;
+    }
+
+    bool parse_options(int argc, char* argv[], options& opts)
+    {
+        opts.n_bytes = 64 << 20;
+        opts.code_bytes = 32;
+        opts.repeats = 10;
+        opts.scan = false;
+        for (int arg_idx = 1; arg_idx < argc; ++arg_idx)
+        {
+            if (!strcmp(argv[arg_idx], "--scan"))
+            {
+                opts.scan = true;
+                continue;
+            }
+
+            size_t* target = nullptr;
+            if (!strcmp(argv[arg_idx], "--bytes"))
+                target = &opts.n_bytes;
+            else if (!strcmp(argv[arg_idx], "--code-bytes"))
+                target = &opts.code_bytes;
+            else if (!strcmp(argv[arg_idx], "--repeats"))
+                target = &opts.repeats;
+
+            if (!target || arg_idx + 1 == argc)
+                return false;
+            *target = static_cast<size_t>(strtoull(argv[++arg_idx], nullptr, 10));
+        }
+        // the query of the batch workloads is a code of the first buffer
+        return opts.n_bytes && opts.code_bytes && opts.code_bytes <= opts.n_bytes && opts.repeats;
+    }
+
+    // per-byte metric, or n/a
+    string per_byte(double value, unsigned long long n_bytes)
+    {
+        if (value < 0)
+            return "n/a";
+        char text[32];
+        snprintf(text, sizeof(text), "%.4g", value / n_bytes);
+        return text;
+    }
+
+    // nanoseconds per cache line of a pass over the working set; after a
+    // scan, this grows with the part of it the scan evicted
+    double touch_ns_per_line(const vector<unsigned char>& working_set)
+    {
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        unsigned int sum = 0;
+        for (size_t byte_idx = 0; byte_idx < working_set.size(); byte_idx += 64)
+            sum += working_set[byte_idx];
+        const double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        // keeps the loop from being optimized away
+#if defined(__GNUC__)
+        __asm__ volatile("" : : "r"(sum) : "memory");
+#else
+        static volatile unsigned int sink;
+        sink = sum;
+#endif
+        return ns / (working_set.size() / 64);
+    }
+
+    // the batch scan over databases of growing size, with every scan
+    // option: throughput, LLC misses, and how much of a caller's working
+    // set survives the scan
+    void scan_sweep(const options& opts, perf_counters& counters, const vector<unsigned char>& query,
+                    const vector<unsigned char>& database)
+    {
+        struct scan_mode
+        {
+            const char* name;
+            size_t prefetch_bytes;
+            int non_temporal;
+        };
+        const scan_mode modes[] = {{"off", 0, 0}, {"pf256", 256, 0}, {"pf1k", 1024, 0}, {"pf4k", 4096, 0},
+                                   {"nta1k", 1024, 1}, {"nta4k", 4096, 1}};
+
+        // the caller's data, which should stay in the caches
+        vector<unsigned char> working_set(1 << 20, 1);
+
+        printf("%-10s %-8s %9s %11s %12s\n", "db", "scan", "GB/s", "LLCmiss/B", "ws ns/line");
+        // at least one code, even when codes are larger than the smallest database
+        for (size_t db_bytes = min(max(static_cast<size_t>(1) << 20, opts.code_bytes), opts.n_bytes); ;
+             db_bytes = min(4 * db_bytes, opts.n_bytes))
+        {
+            const size_t n_codes = db_bytes / opts.code_bytes;
+            const hamming_c::hamming_code_set_t codes = hamming::make_code_set(database.data(), n_codes,
+                                                                               opts.code_bytes);
+            vector<size_t> distances(n_codes);
+            const unsigned long long n_bytes = static_cast<unsigned long long>(n_codes) * opts.code_bytes;
+
+            for (size_t mode_idx = 0; mode_idx < sizeof(modes) / sizeof(modes[0]); ++mode_idx)
+            {
+                hamming_c::hamming_scan_options_t scan_options;
+                scan_options.prefetch_bytes = modes[mode_idx].prefetch_bytes;
+                scan_options.non_temporal = modes[mode_idx].non_temporal;
+                hamming_c::hamming_set_scan_options(&scan_options);
+
+                // warm up
+                hamming_c::hamming_distance_batch(query.data(), &codes, distances.data());
+
+                double seconds = 0, ws_ns = 0, llc_misses = 0;
+                bool llc_available = true;
+                for (size_t repeat = 0; repeat < opts.repeats; ++repeat)
+                {
+                    touch_ns_per_line(working_set);
+                    counters.start();
+                    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                    hamming_c::hamming_distance_batch(query.data(), &codes, distances.data());
+                    seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                    counters.stop();
+                    const double misses = counters.value(perf_counters::llc_misses);
+                    llc_available = llc_available && misses >= 0;
+                    llc_misses += misses;
+                    ws_ns += touch_ns_per_line(working_set);
+                }
+
+                char db_name[32];
+                if (db_bytes >= 1 << 20)
+                    snprintf(db_name, sizeof(db_name), "%zuMiB", db_bytes >> 20);
+                else
+                    snprintf(db_name, sizeof(db_name), "%zuKiB", db_bytes >> 10);
+                printf("%-10s %-8s %9.2f %11s %12.2f\n", db_name, modes[mode_idx].name,
+                       n_bytes * opts.repeats / seconds * 1e-9,
+                       per_byte(llc_available ? llc_misses : -1, n_bytes * opts.repeats).c_str(),
+                       ws_ns / opts.repeats);
+            }
+
+            if (db_bytes == opts.n_bytes)
+                break;
+        }
+
+        hamming_c::hamming_scan_options_t defaults = {0, 0};
+        hamming_c::hamming_set_scan_options(&defaults);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // before anything starts the OpenMP threads, so that they inherit them
+    perf_counters counters;
+    if (!counters.any_available())
+        cerr << "hardware counters not available (" << counters.error() << "); reporting wall time only" << endl;
+    else if (!counters.error().empty())
+        cerr << "some hardware counters not available (" << counters.error() << ")" << endl;
+
+    mt19937_64 generator(42);
+    vector<unsigned char> data1(opts.n_bytes), data2(opts.n_bytes);
+    for (size_t byte_idx = 0; byte_idx < opts.n_bytes; ++byte_idx)
+    {
+        data1[byte_idx] = static_cast<unsigned char>(generator());
+        data2[byte_idx] = static_cast<unsigned char>(generator());
+    }
+
+    if (opts.scan)
+    {
+        scan_sweep(opts, counters, data1, data2);
+        return EXIT_SUCCESS;
+    }
+
+    const size_t n_codes = opts.n_bytes / opts.code_bytes;
+    const hamming_c::hamming_code_set_t codes = hamming::make_code_set(data2.data(), n_codes, opts.code_bytes);
+    vector<size_t> distances(n_codes);
+    size_t result = 0;
+
+    vector<workload> workloads;
+    workloads.push_back(workload{"distance", opts.n_bytes, [&](hamming_c::hamming_impl_t impl)
+    {
+        return hamming_c::hamming_distance(data1.data(), data2.data(), opts.n_bytes, &result, impl);
+    }});
+    workloads.push_back(workload{"weight", opts.n_bytes, [&](hamming_c::hamming_impl_t impl)
+    {
+        return hamming_c::hamming_weight(data1.data(), opts.n_bytes, &result, impl);
+    }});
+    workloads.push_back(workload{"batch/" + to_string(opts.code_bytes) + "B",
+                                 static_cast<unsigned long long>(n_codes) * opts.code_bytes,
+                                 [&](hamming_c::hamming_impl_t impl)
+    {
+        return hamming_c::hamming_distance_batch(data1.data(), &codes, distances.data(), impl);
+    }});
+
+    printf("%-14s %-12s %9s %9s %9s %7s %11s %11s %11s\n", "workload", "impl", "GB/s", "cycles/B", "instr/B",
+           "IPC", "brmiss/B", "L1Dmiss/B", "LLCmiss/B");
+
+    for (size_t workload_idx = 0; workload_idx < workloads.size(); ++workload_idx)
+    {
+        const workload& work = workloads[workload_idx];
+        for (int impl_idx = 0; impl_idx < HAMMING_N_IMPLS; ++impl_idx)
+        {
+            const hamming_c::hamming_impl_t impl = static_cast<hamming_c::hamming_impl_t>(impl_idx);
+
+            // warm up (page faults, lookup tables, thread pool), and skip the
+            // implementations which were not compiled in
+            hamming_c::hamming_status_t status = work.run(impl);
+            if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+            {
+                printf("%-14s %-12s %s\n", work.name.c_str(), hamming_c::hamming_impl_name(impl),
+                       hamming_c::get_hamming_error_string(status));
+                continue;
+            }
+
+            counters.start();
+            const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for (size_t repeat = 0; repeat < opts.repeats; ++repeat)
+                work.run(impl);
+            const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            counters.stop();
+
+            const unsigned long long n_bytes = work.n_bytes * opts.repeats;
+            const double cycles = counters.value(perf_counters::cycles);
+            const double instructions = counters.value(perf_counters::instructions);
+            string ipc = "n/a";
+            if (cycles > 0 && instructions >= 0)
+            {
+                char text[32];
+                snprintf(text, sizeof(text), "%.2f", instructions / cycles);
+                ipc = text;
+            }
+
+            printf("%-14s %-12s %9.2f %9s %9s %7s %11s %11s %11s\n", work.name.c_str(),
+                   hamming_c::hamming_impl_name(impl), n_bytes / seconds * 1e-9,
+                   per_byte(cycles, n_bytes).c_str(), per_byte(instructions, n_bytes).c_str(), ipc.c_str(),
+                   per_byte(counters.value(perf_counters::branch_misses), n_bytes).c_str(),
+                   per_byte(counters.value(perf_counters::l1d_misses), n_bytes).c_str(),
+                   per_byte(counters.value(perf_counters::llc_misses), n_bytes).c_str());
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
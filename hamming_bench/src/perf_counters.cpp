@@ -0,0 +1,152 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+namespace
+{
+    struct event_config
+    {
+        unsigned int type;
+        unsigned long long config;
+        // the event whose group it joins, or itself if it leads a group
+        perf_counters::event leader;
+    };
+
+    // two groups, each scheduled onto the pmu as a whole, so that the ratios
+    // within a group (e.g. ipc) are measured over the same intervals; the
+    // cache events are apart, as they are the ones most often missing
+    const event_config event_configs[perf_counters::n_events] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, perf_counters::cycles},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, perf_counters::cycles},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, perf_counters::cycles},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), perf_counters::l1d_misses},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), perf_counters::l1d_misses}};
+
+    int open_event(const event_config& config, int group_fd)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = config.type;
+        attr.config = config.config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        // user space only, which is all that perf_event_paranoid <= 2 allows
+        // unprivileged processes to count
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // a group read is not possible on inherited counters, so every
+        // counter is read on its own, with the times needed for scaling
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+}
+#endif // __linux__
+
+perf_counters::perf_counters()
+{
+    for (int event_idx = 0; event_idx < n_events; ++event_idx)
+        fds_[event_idx] = -1;
+
+#ifdef __linux__
+    for (int event_idx = 0; event_idx < n_events; ++event_idx)
+    {
+        const event_config& config = event_configs[event_idx];
+        // a member whose leader is missing is opened on its own
+        const int group_fd = config.leader == event_idx ? -1 : fds_[config.leader];
+        fds_[event_idx] = open_event(config, group_fd);
+        if (fds_[event_idx] < 0 && error_.empty())
+        {
+            error_ = string(name(static_cast<event>(event_idx))) + ": " + strerror(errno);
+            if (errno == EACCES || errno == EPERM)
+                error_ += " (see /proc/sys/kernel/perf_event_paranoid)";
+            else if (errno == ENOENT || errno == EOPNOTSUPP)
+                error_ += " (the cpu or hypervisor doesn't expose this event)";
+        }
+    }
+#else
+    error_ = "hardware counters are only supported on linux";
+#endif
+}
+
+perf_counters::~perf_counters()
+{
+#ifdef __linux__
+    // members before their leaders
+    for (int event_idx = n_events - 1; event_idx >= 0; --event_idx)
+        if (fds_[event_idx] >= 0)
+            close(fds_[event_idx]);
+#endif
+}
+
+bool perf_counters::available(event e) const
+{
+    return fds_[e] >= 0;
+}
+
+bool perf_counters::any_available() const
+{
+    for (int event_idx = 0; event_idx < n_events; ++event_idx)
+        if (available(static_cast<event>(event_idx)))
+            return true;
+    return false;
+}
+
+void perf_counters::start()
+{
+#ifdef __linux__
+    for (int event_idx = 0; event_idx < n_events; ++event_idx)
+        if (fds_[event_idx] >= 0)
+        {
+            ioctl(fds_[event_idx], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds_[event_idx], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+}
+
+void perf_counters::stop()
+{
+#ifdef __linux__
+    for (int event_idx = 0; event_idx < n_events; ++event_idx)
+        if (fds_[event_idx] >= 0)
+            ioctl(fds_[event_idx], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+double perf_counters::value(event e) const
+{
+#ifdef __linux__
+    if (fds_[e] < 0)
+        return -1;
+
+    // value, time enabled, time running
+    unsigned long long values[3] = {0, 0, 0};
+    if (read(fds_[e], values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)) || !values[2])
+        return -1;
+
+    return static_cast<double>(values[0]) * values[1] / values[2];
+#else
+    (void)e;
+    return -1;
+#endif
+}
+
+const char* perf_counters::name(event e)
+{
+    static const char* const names[n_events] = {"cycles", "instructions", "branch-misses",
+                                                 "L1-dcache-load-misses", "LLC-load-misses"};
+    return names[e];
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+// hardware event counters of the whole process, through perf_event_open
+// (linux only). The counters are inherited by the threads created after
+// they are opened, so open them before the first call into the library,
+// which is when the OpenMP threads are started.
+// Each event which can't be opened (no PMU, e.g. in a VM, or a restrictive
+// kernel.perf_event_paranoid) is reported as unavailable, and the rest keep
+// working.
+class perf_counters
+{
+public:
+    enum event
+    {
+        cycles,
+        instructions,
+        branch_misses,
+        l1d_misses,
+        llc_misses,
+        n_events
+    };
+
+    perf_counters();
+    ~perf_counters();
+
+    bool available(event e) const;
+    bool any_available() const;
+    // why the first event that failed could not be opened
+    const std::string& error() const {return error_;}
+
+    // resets and enables all the counters
+    void start();
+    void stop();
+
+    // count since the last start(), scaled up if the kernel had to multiplex
+    // the counters; negative if not available
+    double value(event e) const;
+
+    static const char* name(event e);
+
+private:
+    perf_counters(const perf_counters&);
+    perf_counters& operator=(const perf_counters&);
+
+    int fds_[n_events];
+    std::string error_;
+};
@@ -5,9 +5,17 @@
 #include <algorithm>
 #include <functional>
 #include <vector>
+#include <numeric>
+#include <bitset>
+#include <cstdio>
+#include <fstream>
+#include <atomic>
+#include <thread>
 #include <hamming/hamming.h>
 #include <hamming/hamming.hpp>
 #include <hamming/internal/popcount.h>
+#include <hamming/rank_select.h>
+#include <hamming/kernels.hpp>
 
 using namespace std;
 
@@ -58,9 +66,50 @@ TEST(popcount, simple)
 
     EXPECT_EQ(alt_x, popcount_x);
 
+    alt_x = popcount64_lut16(x);
+
+    EXPECT_EQ(alt_x, popcount_x);
+
     // etc.
 }
 
+TEST(popcount, kernels)
+{
+    namespace kernels = hamming::kernels;
+
+    const unsigned long long int xs[5] = {0, 1, 10, 0x8000000000000001ULL, 0xFFFFFFFFFFFFFFFFULL};
+    const unsigned int ones[5] = {0, 1, 2, 2, 64};
+    for (size_t i = 0; i < 5; ++i)
+    {
+        EXPECT_EQ(kernels::popcount64(xs[i]), ones[i]);
+        EXPECT_EQ(kernels::popcount64_vanilla(xs[i]), ones[i]);
+        EXPECT_EQ(kernels::popcount64_2x32(xs[i]), ones[i]);
+        EXPECT_EQ(kernels::popcount64_lut(xs[i]), ones[i]);
+        EXPECT_EQ(kernels::popcount64_lut16(xs[i]), ones[i]);
+        EXPECT_EQ(kernels::popcount64_sparse(xs[i]), ones[i]);
+        EXPECT_EQ(kernels::popcount64_nodep(xs[i]), ones[i]);
+#if HAMMING_KERNELS_POPCNT_ASM
+        if (kernels::cpu_has_popcnt())
+            EXPECT_EQ(kernels::popcount64_popcnt(xs[i]), ones[i]);
+#endif
+    }
+    EXPECT_EQ(kernels::select64(0x8000000000000001ULL, 1), 63);
+
+    // the header-only kernels agree with the library, tail included
+    vector<unsigned char> str1 = rand_vect(203), str2 = rand_vect(203);
+    reverse(str2.begin(), str2.end());
+    for (size_t n_bytes : {0, 5, 8, 37, 203})
+    {
+        EXPECT_EQ(kernels::distance(str1.data(), str2.data(), n_bytes),
+                  hamming::distance(str1.data(), str2.data(), n_bytes));
+        EXPECT_EQ(kernels::distance<kernels::popcount64_lut>(str1.data(), str2.data(), n_bytes),
+                  hamming::distance(str1.data(), str2.data(), n_bytes));
+        EXPECT_EQ(kernels::weight(str1.data(), n_bytes), hamming::weight(str1.data(), n_bytes));
+    }
+    EXPECT_EQ(kernels::distance<32>(str1.data(), str2.data()),
+              hamming::distance(str1.data(), str2.data(), 32));
+}
+
 TEST(hamming, low_level_param_check)
 {
     // ASSERT_TRUE
@@ -117,6 +166,51 @@ TEST(hamming, low_level_simple)
     // etc.
 }
 
+TEST(hamming, implementations_agree)
+{
+    // every implementation which was compiled in, on sizes around the word
+    // and block boundaries
+    auto v1 = rand_vect(1031), v2 = rand_vect(1031);
+    reverse(v2.begin(), v2.end());
+    for (size_t n_bytes : {1, 7, 8, 9, 31, 32, 33, 63, 64, 65, 255, 256, 1031})
+    {
+        const size_t expected = hamming::kernels::distance<hamming::kernels::popcount64_vanilla>(
+                v1.data(), v2.data(), n_bytes);
+        for (int impl_idx = 0; impl_idx < HAMMING_N_IMPLS; ++impl_idx)
+        {
+            const hamming_c::hamming_impl_t impl = static_cast<hamming_c::hamming_impl_t>(impl_idx);
+            size_t dist = 0;
+            hamming_c::hamming_status_t status = hamming_c::hamming_distance(v1.data(), v2.data(), n_bytes,
+                                                                             &dist, impl);
+            if (status == hamming_c::HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE)
+                continue;
+            EXPECT_EQ(status, hamming_c::HAMMING_STATUS_SUCCESS) << hamming_c::hamming_impl_name(impl);
+            EXPECT_EQ(dist, expected) << hamming_c::hamming_impl_name(impl) << ", " << n_bytes << " bytes";
+
+            std::vector<size_t> distances = hamming::distance_batch(
+                    v1.data(), hamming::make_code_set(v2.data(), 1031 / n_bytes, n_bytes),
+                    static_cast<hamming::implementation>(impl_idx));
+            for (size_t code_idx = 0; code_idx < distances.size(); ++code_idx)
+                EXPECT_EQ(distances[code_idx], hamming::kernels::distance(v1.data(), v2.data() + code_idx * n_bytes,
+                                                                          n_bytes))
+                        << hamming_c::hamming_impl_name(impl) << ", " << n_bytes << " bytes";
+        }
+    }
+
+    // all ones saturate every level of the carry-save adders
+    const vector<unsigned char> ones(1031, 0xFF);
+    for (int impl_idx = 0; impl_idx < HAMMING_N_IMPLS; ++impl_idx)
+    {
+        const hamming_c::hamming_impl_t impl = static_cast<hamming_c::hamming_impl_t>(impl_idx);
+        size_t weight = 0;
+        const hamming_c::hamming_status_t status = hamming_c::hamming_weight(ones.data(), ones.size(), &weight, impl);
+        if (status == hamming_c::HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE)
+            continue;
+        ASSERT_EQ(status, hamming_c::HAMMING_STATUS_SUCCESS) << hamming_c::hamming_impl_name(impl);
+        EXPECT_EQ(weight, 8 * ones.size()) << hamming_c::hamming_impl_name(impl);
+    }
+}
+
 TEST(hamming, high_level_simple)
 {
     auto v1 = rand_vect(100), v2 = rand_vect(100);
@@ -131,6 +225,1079 @@ TEST(hamming, high_level_simple)
     EXPECT_EQ(dist, dist_orig);
 }
 
+bool get_bit(const vector<unsigned char>& v, size_t bit)
+{
+    return (v[bit / 8] >> (bit % 8)) & 1;
+}
+
+TEST(hamming, low_level_bits)
+{
+    auto v1 = rand_vect(100), v2 = rand_vect(100);
+    v2[0] ^= 0x5A; // rand_vect always yields the same sequence
+
+    default_random_engine generator;
+    for (unsigned int trial = 0; trial < 200; ++trial)
+    {
+        const size_t n_bits = uniform_int_distribution<size_t>(0, 8 * 100 - 8)(generator);
+        const size_t offset1 = uniform_int_distribution<size_t>(0, 8 * 100 - n_bits)(generator);
+        const size_t offset2 = uniform_int_distribution<size_t>(0, 8 * 100 - n_bits)(generator);
+
+        size_t expected = 0;
+        for (size_t bit = 0; bit < n_bits; ++bit)
+            expected += get_bit(v1, offset1 + bit) != get_bit(v2, offset2 + bit);
+
+        // the buffers are copied into exactly sized ones, to catch reads past
+        // the last byte which holds any of the compared bits
+        vector<unsigned char> s1(v1.begin() + offset1 / 8, v1.begin() + (offset1 + n_bits + 7) / 8);
+        vector<unsigned char> s2(v2.begin() + offset2 / 8, v2.begin() + (offset2 + n_bits + 7) / 8);
+        // no bits: nothing is read, but the pointers must not be null
+        if (!n_bits)
+        {
+            s1.resize(1);
+            s2.resize(1);
+        }
+
+        size_t dist = 0;
+        EXPECT_EQ(hamming_c::hamming_distance_bits(s1.data(), offset1 % 8, s2.data(), offset2 % 8,
+                                                   n_bits, &dist),
+                  hamming_c::HAMMING_STATUS_SUCCESS);
+        EXPECT_EQ(dist, expected);
+
+        EXPECT_EQ(hamming::distance_bits(v1.data(), offset1, v2.data(), offset2, n_bits,
+                                         hamming::implementation::Lut), expected);
+    }
+
+    // byte-aligned offsets must agree with the byte api
+    EXPECT_EQ(hamming::distance_bits(v1.data(), 80, v2.data(), 80, 8 * 50),
+              hamming::distance(v1.data() + 10, v2.data() + 10, 50));
+
+    size_t out = 0;
+    EXPECT_EQ(hamming_c::hamming_distance_bits(nullptr, 0, v2.data(), 0, 8, &out),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_1);
+    EXPECT_EQ(hamming_c::hamming_distance_bits(v1.data(), 0, v2.data(), 0, 8, nullptr),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_DISTANCE);
+}
+
+TEST(hamming, batch)
+{
+    const size_t code_bytes = 13, stride = 16, n_codes = 50;
+    auto data = rand_vect(stride * n_codes);
+    auto query = rand_vect(code_bytes);
+    auto codes = hamming::make_code_set(data.data(), n_codes, code_bytes, stride);
+
+    auto dists = hamming::distance_batch(query.data(), codes);
+    ASSERT_EQ(dists.size(), n_codes);
+    for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+        EXPECT_EQ(dists[code_idx], hamming::distance(query.data(), data.data() + stride * code_idx, code_bytes));
+
+#ifdef HAMMING_WITH_INTERLEAVED
+    // whole groups of 8 codes, then the rest one by one
+    EXPECT_EQ(hamming::distance_batch(query.data(), codes, hamming::implementation::Interleaved), dists);
+#endif
+
+    // prefetching doesn't change the results, up to the last rows
+    hamming::scan_options options = hamming::get_scan_options();
+    EXPECT_EQ(options.prefetch_bytes, 0);
+    options.prefetch_bytes = 5 * stride;
+    options.non_temporal = 1;
+    hamming::set_scan_options(options);
+    EXPECT_EQ(hamming::get_scan_options().prefetch_bytes, 5 * stride);
+    EXPECT_EQ(hamming::distance_batch(query.data(), codes), dists);
+#ifdef HAMMING_WITH_INTERLEAVED
+    EXPECT_EQ(hamming::distance_batch(query.data(), codes, hamming::implementation::Interleaved), dists);
+#endif
+    options.prefetch_bytes = 0;
+    options.non_temporal = 0;
+    hamming::set_scan_options(options);
+
+    size_t out = 0;
+    codes.stride = 5; // shorter than a code
+    EXPECT_EQ(hamming_c::hamming_distance_batch(query.data(), &codes, &out),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE);
+    EXPECT_EQ(hamming_c::hamming_distance_batch(query.data(), nullptr, &out),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_2);
+}
+
+TEST(hamming, buffer)
+{
+    // large enough for huge pages, if the system has any
+    const size_t code_bytes = 64, n_codes = (8 << 20) / code_bytes;
+    hamming::buffer codes(n_codes * code_bytes);
+    ASSERT_EQ(codes.size(), n_codes * code_bytes);
+    EXPECT_EQ(count(codes.data(), codes.data() + codes.size(), 0), codes.size());
+    EXPECT_GE(codes.page_kind(), hamming_c::HAMMING_PAGES_NORMAL);
+    EXPECT_LE(codes.page_kind(), hamming_c::HAMMING_PAGES_HUGE_1GB);
+
+    auto query = rand_vect(code_bytes);
+    copy(query.begin(), query.end(), codes.data() + 5 * code_bytes);
+    auto dists = hamming::distance_batch(query.data(), hamming::make_code_set(codes.data(), n_codes, code_bytes));
+    EXPECT_EQ(dists[5], 0);
+    EXPECT_EQ(dists[6], hamming::weight(query.data(), code_bytes));
+
+    // touched now, so transparent huge pages may back it; never more than
+    // the mapping
+    size_t huge_bytes = 0;
+    const hamming_c::hamming_status_t status = hamming_c::hamming_huge_page_bytes(codes.data(), codes.size(),
+                                                                                  &huge_bytes);
+    if (status != hamming_c::HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE)
+    {
+        ASSERT_EQ(status, hamming_c::HAMMING_STATUS_SUCCESS);
+        EXPECT_LE(huge_bytes, codes.size());
+    }
+    EXPECT_LE(codes.huge_page_bytes(), codes.size() + (2 << 20));
+
+    hamming::buffer empty(0);
+    EXPECT_EQ(empty.size(), 0);
+    EXPECT_EQ(empty.huge_page_bytes(), 0);
+}
+
+TEST(hamming, numa)
+{
+    const size_t code_bytes = 13, stride = 16, n_codes = 1000;
+    auto data = rand_vect(stride * n_codes);
+    auto query = rand_vect(code_bytes);
+    auto codes = hamming::make_code_set(data.data(), n_codes, code_bytes, stride);
+    const auto dists = hamming::distance_batch(query.data(), codes);
+
+    // the system's nodes, then emulated ones (more of them than cpus, too)
+    for (size_t n_nodes : {0, 1, 3, 64})
+    {
+        hamming::numa_code_set numa_codes(codes, n_nodes);
+        // as many as emulated, or at least the one of the system
+        if (n_nodes)
+        {
+            ASSERT_EQ(numa_codes.nodes(), n_nodes);
+        }
+        else
+        {
+            ASSERT_GE(numa_codes.nodes(), 1);
+        }
+
+        // the shards are packed, and cover the codes in order
+        size_t next_code = 0;
+        for (size_t node = 0; node < numa_codes.nodes(); ++node)
+        {
+            size_t first_code = 0;
+            auto shard = numa_codes.shard(node, &first_code);
+            EXPECT_EQ(first_code, next_code);
+            EXPECT_EQ(shard.code_bytes, code_bytes);
+            ASSERT_LE(first_code + shard.n_codes, n_codes);
+            // the emulated nodes without cpus get no codes
+            for (size_t code_idx = 0; code_idx < shard.n_codes; ++code_idx)
+                EXPECT_TRUE(equal(shard.data + code_bytes * code_idx, shard.data + code_bytes * (code_idx + 1),
+                                  data.data() + stride * (first_code + code_idx)));
+            next_code += shard.n_codes;
+        }
+        EXPECT_EQ(next_code, n_codes);
+
+        EXPECT_EQ(numa_codes.distance_batch(query.data()), dists);
+        EXPECT_EQ(numa_codes.distance_batch(query.data(), hamming::implementation::Lut), dists);
+    }
+
+    size_t out = 0;
+    hamming_c::hamming_numa_code_set_t* numa_codes = nullptr;
+    EXPECT_EQ(hamming_c::hamming_numa_code_set_create(nullptr, 2, &numa_codes),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_1);
+    EXPECT_EQ(hamming_c::hamming_numa_distance_batch(nullptr, query.data(), &out),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_2);
+    EXPECT_THROW(hamming::numa_code_set(codes, 2).shard(2), std::system_error);
+}
+
+TEST(hamming, search)
+{
+    const size_t code_bytes = 5, stride = 8, n_codes = 3000;
+    auto data = rand_vect(stride * n_codes);
+    auto query = rand_vect(code_bytes);
+    // the same generator drew the first code
+    negate_vect(query);
+    // exact duplicates of the query, so that there are ties at distance 0
+    copy(query.begin(), query.end(), data.begin() + 7 * stride);
+    copy(query.begin(), query.end(), data.begin() + 2000 * stride);
+    auto codes = hamming::make_code_set(data.data(), n_codes, code_bytes, stride);
+
+    // brute force reference: by distance, then by index
+    const auto dists = hamming::distance_batch(query.data(), codes);
+    vector<hamming::match> expected(n_codes);
+    for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+        expected[code_idx] = {code_idx, dists[code_idx]};
+    stable_sort(expected.begin(), expected.end(),
+                [](const hamming::match& m1, const hamming::match& m2) {return m1.distance < m2.distance;});
+    const auto same = [](const vector<hamming::match>& ms1, const vector<hamming::match>& ms2)
+    {
+        return ms1.size() == ms2.size() && equal(ms1.begin(), ms1.end(), ms2.begin(),
+            [](const hamming::match& m1, const hamming::match& m2)
+            {return m1.index == m2.index && m1.distance == m2.distance;});
+    };
+
+    for (size_t k : {size_t(0), size_t(1), size_t(2), size_t(10), size_t(500), n_codes, n_codes + 10})
+    {
+        const vector<hamming::match> top(expected.begin(), expected.begin() + min(k, n_codes));
+        EXPECT_TRUE(same(hamming::knn_search(query.data(), codes, k), top)) << k;
+        EXPECT_TRUE(same(hamming::knn_search(query.data(), codes, k, hamming::implementation::Lut), top)) << k;
+    }
+    EXPECT_EQ(hamming::knn_search(query.data(), codes, 2)[1].index, 2000);
+
+    for (size_t max_distance : {0, 8, 40})
+    {
+        vector<hamming::match> within;
+        for (const auto& m : expected)
+            if (m.distance <= max_distance)
+                within.push_back(m);
+        EXPECT_TRUE(same(hamming::radius_search(query.data(), codes, max_distance), within)) << max_distance;
+    }
+
+    // sharded: the merged results of the shards are those of the whole set
+    const size_t split = 1234;
+    const auto first = hamming::make_code_set(data.data(), split, code_bytes, stride);
+    const auto second = hamming::make_code_set(data.data() + split * stride, n_codes - split, code_bytes, stride);
+    const vector<hamming::match> top(expected.begin(), expected.begin() + 50);
+    EXPECT_TRUE(same(hamming::merge_matches({hamming::knn_search(query.data(), first, 50),
+                                             hamming::knn_search(query.data(), second, 50)}, {0, split}, 50), top));
+    EXPECT_TRUE(same(hamming::merge_matches({}), {}));
+
+    // a batch gives the same results as the searches one by one, with more
+    // radius matches than the first guess of the wrapper
+    auto other_query = rand_vect(code_bytes);
+    const vector<hamming::search_query> batch = {{query.data(), hamming::search_kind::Knn, 10},
+                                                 {other_query.data(), hamming::search_kind::Radius, 16},
+                                                 {query.data(), hamming::search_kind::Knn, 0},
+                                                 {other_query.data(), hamming::search_kind::Knn, n_codes + 1},
+                                                 {query.data(), hamming::search_kind::Radius, 0}};
+    const auto batch_results = hamming::search_batch(batch, codes);
+    ASSERT_EQ(batch_results.size(), batch.size());
+    EXPECT_TRUE(same(batch_results[0], hamming::knn_search(query.data(), codes, 10)));
+    EXPECT_GT(batch_results[1].size(), 16);
+    EXPECT_TRUE(same(batch_results[1], hamming::radius_search(other_query.data(), codes, 16)));
+    EXPECT_TRUE(batch_results[2].empty());
+    EXPECT_TRUE(same(batch_results[3], hamming::knn_search(other_query.data(), codes, n_codes)));
+    EXPECT_EQ(batch_results[4].size(), 2);
+    EXPECT_TRUE(hamming::search_batch({}, codes).empty());
+
+    size_t n_results = 0;
+    hamming::match result;
+    EXPECT_EQ(hamming_c::hamming_knn_search(query.data(), nullptr, 1, &result, &n_results),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_2);
+    EXPECT_EQ(hamming_c::hamming_radius_search(query.data(), &codes, 3, nullptr, 1, &n_results),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_OUTPUT);
+    // a capacity of 0 only counts the matches
+    EXPECT_EQ(hamming_c::hamming_radius_search(query.data(), &codes, 0, nullptr, 0, &n_results),
+              hamming_c::HAMMING_STATUS_SUCCESS);
+    EXPECT_EQ(n_results, 2);
+}
+
+TEST(hamming, mutable_set)
+{
+    const size_t code_bytes = 7;
+    auto data = rand_vect(code_bytes * 20000);
+    auto query = rand_vect(code_bytes);
+    negate_vect(query);
+    hamming::mutable_code_set set(code_bytes);
+
+    // the codes in the set, by id, for the brute force reference
+    vector<bool> alive;
+    const auto check = [&]()
+    {
+        vector<hamming::match> expected;
+        for (size_t id = 0; id < alive.size(); ++id)
+            if (alive[id])
+                expected.push_back({id, hamming::distance(query.data(), data.data() + id * code_bytes, code_bytes)});
+        stable_sort(expected.begin(), expected.end(),
+                    [](const hamming::match& m1, const hamming::match& m2) {return m1.distance < m2.distance;});
+        const auto same = [](const vector<hamming::match>& ms1, const vector<hamming::match>& ms2)
+        {
+            return ms1.size() == ms2.size() && equal(ms1.begin(), ms1.end(), ms2.begin(),
+                [](const hamming::match& m1, const hamming::match& m2)
+                {return m1.index == m2.index && m1.distance == m2.distance;});
+        };
+
+        EXPECT_EQ(set.size(), expected.size());
+        for (size_t k : {size_t(1), size_t(10), size_t(300), expected.size() + 1})
+        {
+            const vector<hamming::match> top(expected.begin(), expected.begin() + min(k, expected.size()));
+            EXPECT_TRUE(same(set.knn_search(query.data(), k), top)) << k;
+            EXPECT_TRUE(same(set.knn_search(query.data(), k, hamming::implementation::Lut), top)) << k;
+        }
+        for (size_t max_distance : {size_t(0), size_t(15), size_t(20), 8 * code_bytes})
+        {
+            vector<hamming::match> within;
+            for (const auto& m : expected)
+                if (m.distance <= max_distance)
+                    within.push_back(m);
+            EXPECT_TRUE(same(set.radius_search(query.data(), max_distance), within)) << max_distance;
+        }
+    };
+    const auto append = [&](size_t n_codes)
+    {
+        EXPECT_EQ(set.append(hamming::make_code_set(data.data() + alive.size() * code_bytes, n_codes, code_bytes)),
+                  alive.size());
+        alive.resize(alive.size() + n_codes, true);
+    };
+
+    check();
+    // across segment boundaries, with the query among the codes
+    append(3000);
+    copy(query.begin(), query.end(), data.begin() + 3000 * code_bytes);
+    append(5001);
+    append(1);
+    check();
+
+    // a whole segment, then every third code of the others
+    vector<size_t> ids;
+    for (size_t id = 0; id < 4096; ++id)
+        ids.push_back(id);
+    for (size_t id = 4096; id < alive.size(); id += 3)
+        ids.push_back(id);
+    EXPECT_EQ(set.remove(ids), ids.size());
+    for (size_t id : ids)
+        alive[id] = false;
+    EXPECT_EQ(set.remove({5, 4096, alive.size(), 1000000}), 0);
+    EXPECT_EQ(set.slots(), alive.size());
+    check();
+
+    // the slots are reclaimed, the ids stay
+    set.compact();
+    EXPECT_EQ(set.slots(), set.size());
+    check();
+    append(4000);
+    EXPECT_EQ(set.remove({4097, 4098, alive.size() - 1}), 3);
+    alive[4097] = alive[4098] = alive[alive.size() - 1] = false;
+    check();
+    set.compact();
+    EXPECT_EQ(set.slots(), set.size());
+    check();
+
+    // searches while another thread appends and deletes: they only report
+    // codes which were appended, and not deleted before they started
+    hamming::mutable_code_set shared(code_bytes, true);
+    shared.append(hamming::make_code_set(data.data(), 5000, code_bytes));
+    atomic<size_t> n_appended(5000), removed_below(0);
+    atomic<bool> done(false);
+    vector<thread> readers;
+    atomic<size_t> n_errors(0);
+    for (size_t reader_idx = 0; reader_idx < 4; ++reader_idx)
+        readers.push_back(thread([&]()
+        {
+            while (!done)
+            {
+                const size_t first_alive = removed_below;
+                const auto found = shared.knn_search(query.data(), 20);
+                const size_t last_appended = n_appended;
+                for (size_t match_idx = 0; match_idx < found.size(); ++match_idx)
+                    if (found[match_idx].index < first_alive || found[match_idx].index >= last_appended ||
+                        (match_idx && found[match_idx].distance < found[match_idx - 1].distance))
+                        ++n_errors;
+            }
+        }));
+    for (size_t round = 0; round < 60; ++round)
+    {
+        // the bound goes up before the codes can be found
+        const size_t first = n_appended.fetch_add(250);
+        shared.append(hamming::make_code_set(data.data() + (first % 15000) * code_bytes, 250, code_bytes));
+        ids.clear();
+        for (size_t id = removed_below; id < removed_below + 250; ++id)
+            ids.push_back(id);
+        EXPECT_EQ(shared.remove(ids), 250);
+        removed_below += 250;
+    }
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+    EXPECT_EQ(n_errors, 0);
+    EXPECT_EQ(shared.size(), 5000);
+    shared.compact();
+    EXPECT_EQ(shared.slots(), 5000);
+
+    size_t n_results = 0;
+    hamming_c::hamming_mutable_set_t* raw_set = nullptr;
+    EXPECT_EQ(hamming_c::hamming_mutable_set_create(0, 0, &raw_set), hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE);
+    EXPECT_EQ(hamming_c::hamming_mutable_knn_search(query.data(), nullptr, 1, nullptr, &n_results),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_2);
+    EXPECT_THROW(set.append(hamming::make_code_set(data.data(), 1, code_bytes + 1)), std::system_error);
+}
+
+TEST(hamming, database)
+{
+    const string path = "hamming_test.db";
+    // small codes are aligned to a power of two, large ones to 64 bytes
+    for (size_t code_bytes : {1, 3, 8, 13, 100})
+    {
+        const size_t stride = code_bytes + 5, n_codes = 777;
+        auto data = rand_vect(stride * n_codes);
+        auto codes = hamming::make_code_set(data.data(), n_codes, code_bytes, stride);
+        vector<unsigned long long> ids(n_codes);
+        for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+            ids[code_idx] = 1000000007ULL * code_idx;
+
+        hamming::write_database(path, codes, ids, true);
+        {
+            hamming::database db(path, true);
+            EXPECT_EQ(db.version(), HAMMING_VERSION);
+            const auto mapped = db.codes();
+            ASSERT_EQ(mapped.n_codes, n_codes);
+            ASSERT_EQ(mapped.code_bytes, code_bytes);
+            EXPECT_EQ(mapped.stride, code_bytes == 3 ? 4 : code_bytes == 13 ? 16 :
+                                     code_bytes == 100 ? 128 : code_bytes);
+            EXPECT_EQ(reinterpret_cast<size_t>(mapped.data) % 64, 0);
+            for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+                ASSERT_TRUE(equal(data.begin() + code_idx * stride, data.begin() + code_idx * stride + code_bytes,
+                                  mapped.data + code_idx * mapped.stride));
+            ASSERT_NE(db.ids(), nullptr);
+            EXPECT_TRUE(equal(ids.begin(), ids.end(), db.ids()));
+            const auto weights = hamming::weights(codes);
+            ASSERT_NE(db.weights(), nullptr);
+            EXPECT_TRUE(equal(weights.begin(), weights.end(), db.weights()));
+
+            // the mapped codes are searched in place
+            auto query = rand_vect(code_bytes);
+            EXPECT_EQ(hamming::distance_batch(query.data(), mapped), hamming::distance_batch(query.data(), codes));
+        }
+    }
+
+    // no optional sections, and no codes
+    auto data = rand_vect(40);
+    hamming::write_database(path, hamming::make_code_set(data.data(), 10, 4));
+    {
+        hamming::database db(path);
+        EXPECT_EQ(db.ids(), nullptr);
+        EXPECT_EQ(db.weights(), nullptr);
+        EXPECT_EQ(db.codes().n_codes, 10);
+        db.verify();
+    }
+    hamming::write_database(path, hamming::make_code_set(data.data(), 0, 4));
+    EXPECT_EQ(hamming::database(path, true).codes().n_codes, 0);
+
+    // a flipped bit is only found by verifying
+    hamming::write_database(path, hamming::make_code_set(data.data(), 10, 4));
+    {
+        fstream file(path, ios::in | ios::out | ios::binary);
+        file.seekp(HAMMING_DB_HEADER_BYTES + 5);
+        file.put(static_cast<char>(data[5] ^ 4));
+    }
+    EXPECT_NO_THROW(hamming::database db(path));
+    try
+    {
+        hamming::database db(path, true);
+        ADD_FAILURE();
+    }
+    catch (const std::system_error& error)
+    {
+        EXPECT_EQ(error.code().value(), hamming_c::HAMMING_STATUS_BAD_FORMAT);
+    }
+
+    // not a database, or truncated
+    {
+        ofstream file(path, ios::binary | ios::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+    hamming_c::hamming_db_t* db = nullptr;
+    EXPECT_EQ(hamming_c::hamming_db_open(path.c_str(), 0, &db), hamming_c::HAMMING_STATUS_BAD_FORMAT);
+    remove(path.c_str());
+    EXPECT_EQ(hamming_c::hamming_db_open(path.c_str(), 0, &db), hamming_c::HAMMING_STATUS_IO_ERROR);
+    EXPECT_EQ(hamming_c::hamming_db_open(path.c_str(), 0, nullptr), hamming_c::HAMMING_STATUS_BAD_PARAM_OUTPUT);
+    EXPECT_EQ(hamming_c::hamming_db_write(path.c_str(), nullptr, nullptr, 0),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_2);
+    EXPECT_THROW(hamming::write_database(path, hamming::make_code_set(data.data(), 10, 4), {1, 2}),
+                 std::system_error);
+}
+
+TEST(hamming, versioned)
+{
+    const size_t code_bytes = 8;
+    auto first = rand_vect(code_bytes * 1000), second = first;
+    negate_vect(second);
+    hamming::versioned_database handle;
+    {
+        hamming::versioned_database::snapshot empty(handle);
+        EXPECT_EQ(empty.version(), 0);
+        EXPECT_EQ(empty.codes().n_codes, 0);
+    }
+
+    handle.publish(hamming::make_code_set(first.data(), 1000, code_bytes));
+    hamming::versioned_database::snapshot published(handle);
+    EXPECT_EQ(published.version(), 1);
+    EXPECT_EQ(published.ids(), nullptr);
+
+    // a database replaces it, while the snapshot keeps the previous version
+    const string path = "hamming_test_versioned.db";
+    vector<unsigned long long> ids(500);
+    iota(ids.begin(), ids.end(), 7);
+    hamming::write_database(path, hamming::make_code_set(second.data(), 500, code_bytes), ids);
+    handle.load(path, true);
+    handle.wait();
+    {
+        hamming::versioned_database::snapshot loaded(handle);
+        EXPECT_EQ(loaded.version(), 2);
+        ASSERT_EQ(loaded.codes().n_codes, 500);
+        EXPECT_TRUE(equal(second.begin(), second.begin() + 500 * code_bytes, loaded.codes().data));
+        ASSERT_NE(loaded.ids(), nullptr);
+        EXPECT_EQ(loaded.ids()[499], 506);
+    }
+    ASSERT_EQ(published.codes().n_codes, 1000);
+    EXPECT_TRUE(equal(first.begin(), first.end(), published.codes().data));
+    remove(path.c_str());
+
+    // a failed load leaves the current version alone
+    handle.load(path);
+    try
+    {
+        handle.wait();
+        ADD_FAILURE();
+    }
+    catch (const std::system_error& error)
+    {
+        EXPECT_EQ(error.code().value(), hamming_c::HAMMING_STATUS_IO_ERROR);
+    }
+    EXPECT_EQ(hamming::versioned_database::snapshot(handle).version(), 2);
+
+    // readers scan whichever version is current while others are swapped
+    // in; the odd versions are first, the even ones second
+    auto query = rand_vect(code_bytes);
+    const auto first_dists = hamming::distance_batch(query.data(), hamming::make_code_set(first.data(), 1000,
+                                                                                          code_bytes));
+    const auto second_dists = hamming::distance_batch(query.data(), hamming::make_code_set(second.data(), 1000,
+                                                                                           code_bytes));
+    handle.publish(hamming::make_code_set(first.data(), 1000, code_bytes));
+    atomic<bool> done(false);
+    atomic<size_t> n_errors(0);
+    vector<thread> readers;
+    for (size_t reader_idx = 0; reader_idx < 4; ++reader_idx)
+        readers.push_back(thread([&]()
+        {
+            while (!done)
+            {
+                hamming::versioned_database::snapshot current(handle);
+                if (current.codes().n_codes != 1000 ||
+                    hamming::distance_batch(query.data(), current.codes()) !=
+                    (current.version() % 2 ? first_dists : second_dists))
+                    ++n_errors;
+            }
+        }));
+    for (size_t round = 0; round < 100; ++round)
+        handle.publish(hamming::make_code_set(round % 2 ? first.data() : second.data(), 1000, code_bytes));
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+    EXPECT_EQ(n_errors, 0);
+
+    hamming_c::hamming_snapshot_t* snapshot = nullptr;
+    EXPECT_EQ(hamming_c::hamming_snapshot_acquire(nullptr, &snapshot), hamming_c::HAMMING_STATUS_BAD_PARAM_STR_1);
+    EXPECT_EQ(hamming_c::hamming_versioned_publish(nullptr, nullptr), hamming_c::HAMMING_STATUS_BAD_PARAM_STR_1);
+}
+
+TEST(hamming, weight)
+{
+    const unsigned char str[3] = {0xFF, 0x0F, 0x01};
+    EXPECT_EQ(hamming::weight(str, 3), 13);
+    EXPECT_EQ(hamming::weight(str, 0), 0);
+
+    // spans several parallel blocks, with a ragged tail
+    auto v = rand_vect(200003);
+    const vector<unsigned char> zeros(v.size(), 0);
+    EXPECT_EQ(hamming::weight(v.data(), v.size()), hamming::distance(v.data(), zeros.data(), v.size()));
+    EXPECT_EQ(hamming::weight(v.data(), v.size(), hamming::implementation::Lut),
+              hamming::weight(v.data(), v.size(), hamming::implementation::Vanilla));
+
+    const size_t code_bytes = 9, stride = 12, n_codes = 40;
+    auto weights = hamming::weights(hamming::make_code_set(v.data(), n_codes, code_bytes, stride));
+    ASSERT_EQ(weights.size(), n_codes);
+    for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+        EXPECT_EQ(weights[code_idx], hamming::weight(v.data() + stride * code_idx, code_bytes));
+}
+
+TEST(hamming, stats)
+{
+    EXPECT_STREQ(hamming_c::hamming_impl_name(hamming_c::HAMMING_IMPL_LUT), "lut");
+    EXPECT_STREQ(hamming::implementation_name(hamming::implementation::Default_impl), "default");
+    EXPECT_STREQ(hamming_c::hamming_entry_point_name(hamming_c::HAMMING_ENTRY_TANIMOTO_TOP_K), "tanimoto_top_k");
+
+    // log-linear buckets: exact, then 16 per power of two
+    EXPECT_EQ(hamming_c::hamming_latency_bucket_lower(31), 31);
+    EXPECT_EQ(hamming_c::hamming_latency_bucket_lower(32), 32);
+    EXPECT_EQ(hamming_c::hamming_latency_bucket_lower(33), 34);
+    EXPECT_EQ(hamming_c::hamming_latency_bucket_lower(48), 64);
+    EXPECT_EQ(hamming_c::hamming_latency_bucket_lower(HAMMING_LATENCY_BUCKETS), 1ULL << 44);
+    vector<unsigned long long> histogram(HAMMING_LATENCY_BUCKETS);
+    histogram[10] = 99;
+    histogram[48] = 1;
+    EXPECT_EQ(hamming::latency_quantile(histogram, 0.99), 10);
+    EXPECT_EQ(hamming::latency_quantile(histogram, 1), 67);
+
+    hamming_c::hamming_stats_t stats;
+    if (hamming_c::hamming_get_stats(&stats) == hamming_c::HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE)
+    {
+        // built without HAMMING_WITH_STATS
+        EXPECT_THROW(hamming::stats_text(), std::system_error);
+        return;
+    }
+
+    hamming::reset_stats();
+    vector<unsigned char> codes = rand_vect(10 * 24);
+    for (int i = 0; i < 3; ++i)
+        hamming::distance(codes.data(), codes.data() + 24, 24, hamming::implementation::Lut);
+    hamming::distance_batch(codes.data(), hamming::make_code_set(codes.data(), 10, 24),
+                            hamming::implementation::Lut);
+    // failed calls are not counted
+    size_t out = 0;
+    EXPECT_EQ(hamming_c::hamming_distance(codes.data(), nullptr, 24, &out, hamming_c::HAMMING_IMPL_LUT),
+              hamming_c::HAMMING_STATUS_BAD_PARAM_STR_2);
+
+    stats = hamming::get_stats();
+    EXPECT_EQ(stats.impls[hamming_c::HAMMING_IMPL_LUT].n_calls, 4);
+    EXPECT_EQ(stats.impls[hamming_c::HAMMING_IMPL_LUT].n_bytes, 3 * 24 + 10 * 24);
+    EXPECT_EQ(stats.impls[hamming_c::HAMMING_IMPL_VANILLA].n_calls, 0);
+
+    const string text = hamming::stats_text();
+    EXPECT_NE(text.find("hamming_calls_total{impl=\"lut\"} 4\n"), string::npos);
+    EXPECT_NE(text.find("hamming_bytes_total{impl=\"lut\"} 312\n"), string::npos);
+
+    // truncated, but the full length is reported
+    char small[8];
+    size_t length = 0;
+    EXPECT_EQ(hamming_c::hamming_stats_text(small, sizeof(small), &length), hamming_c::HAMMING_STATUS_SUCCESS);
+    EXPECT_EQ(length, text.size());
+    EXPECT_EQ(string(small), text.substr(0, 7));
+
+    // the 3 distance calls, and the failed one
+    vector<unsigned long long> latencies = hamming::latency_histogram(hamming_c::HAMMING_ENTRY_DISTANCE);
+    ASSERT_EQ(latencies.size(), HAMMING_LATENCY_BUCKETS);
+    EXPECT_EQ(accumulate(latencies.begin(), latencies.end(), 0ULL), 4);
+    EXPECT_GT(hamming::latency_quantile(latencies, 1), 0);
+    EXPECT_NE(text.find("hamming_latency_seconds_count{entry_point=\"distance_batch\"} 1\n"), string::npos);
+
+    // the default calls are counted under the implementation which ran them
+    hamming::distance(codes.data(), codes.data() + 24, 24);
+    stats = hamming::get_stats();
+#if HAMMING_KERNELS_POPCOUNT_INTRINSIC
+    EXPECT_EQ(stats.impls[hamming_c::HAMMING_IMPL_DEFAULT].n_calls, 1);
+#else
+    EXPECT_EQ(stats.impls[hamming_c::HAMMING_IMPL_DEFAULT].n_calls, 0);
+    EXPECT_EQ(stats.impls[hamming_c::HAMMING_IMPL_VANILLA].n_calls, 1);
+#endif
+
+    // the latencies of the threads which exited are kept, in the blocks the
+    // next threads take over
+    for (int i = 0; i < 3; ++i)
+        thread([&]() {hamming::distance(codes.data(), codes.data() + 24, 24);}).join();
+    latencies = hamming::latency_histogram(hamming_c::HAMMING_ENTRY_DISTANCE);
+    EXPECT_EQ(accumulate(latencies.begin(), latencies.end(), 0ULL), 8);
+
+    // the searches of mutable sets have entry points of their own, and
+    // count the bytes of their live codes
+    hamming::reset_stats();
+    hamming::mutable_code_set mutable_set(24);
+    mutable_set.append(hamming::make_code_set(codes.data(), 10, 24));
+    EXPECT_EQ(mutable_set.remove({0, 1}), 2);
+    mutable_set.knn_search(codes.data(), 3, hamming::implementation::Lut);
+    mutable_set.radius_search(codes.data(), 10, hamming::implementation::Lut);
+    EXPECT_EQ(hamming::get_stats().impls[hamming_c::HAMMING_IMPL_LUT].n_bytes, 2 * 8 * 24);
+    for (auto entry_point : {hamming_c::HAMMING_ENTRY_MUTABLE_KNN_SEARCH,
+                             hamming_c::HAMMING_ENTRY_MUTABLE_RADIUS_SEARCH})
+    {
+        latencies = hamming::latency_histogram(entry_point);
+        EXPECT_EQ(accumulate(latencies.begin(), latencies.end(), 0ULL), 1);
+    }
+    latencies = hamming::latency_histogram(hamming_c::HAMMING_ENTRY_KNN_SEARCH);
+    EXPECT_EQ(accumulate(latencies.begin(), latencies.end(), 0ULL), 0);
+
+    hamming::reset_stats();
+    EXPECT_EQ(hamming::get_stats().impls[hamming_c::HAMMING_IMPL_LUT].n_calls, 0);
+}
+
+TEST(hamming, histogram)
+{
+    const size_t code_bytes = 3, n_queries = 7, n_codes = 2500;
+    auto data = rand_vect(code_bytes * (n_queries + n_codes));
+    auto queries = hamming::make_code_set(data.data(), n_queries, code_bytes);
+    auto codes = hamming::make_code_set(data.data() + code_bytes * n_queries, n_codes, code_bytes);
+
+    vector<unsigned long long> expected(8 * code_bytes + 1, 0), expected_self(8 * code_bytes + 1, 0);
+    for (size_t query_idx = 0; query_idx < n_queries; ++query_idx)
+        for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+            ++expected[hamming::distance(data.data() + code_bytes * query_idx,
+                                         data.data() + code_bytes * (n_queries + code_idx), code_bytes)];
+    for (size_t code_idx1 = 0; code_idx1 < n_codes; ++code_idx1)
+        for (size_t code_idx2 = code_idx1 + 1; code_idx2 < n_codes; ++code_idx2)
+            ++expected_self[hamming::distance(codes.data + code_bytes * code_idx1,
+                                              codes.data + code_bytes * code_idx2, code_bytes)];
+
+    EXPECT_EQ(hamming::distance_histogram(queries, codes), expected);
+    EXPECT_EQ(hamming::distance_histogram(codes), expected_self);
+
+    // sampling: the requested number of pairs, reproducible from the seed
+    auto sampled = hamming::distance_histogram(queries, codes, 10000, 42);
+    EXPECT_EQ(accumulate(sampled.begin(), sampled.end(), 0ULL), 10000);
+    EXPECT_EQ(hamming::distance_histogram(queries, codes, 10000, 42), sampled);
+
+    auto sampled_self = hamming::distance_histogram(codes, 100000, 7);
+    EXPECT_EQ(accumulate(sampled_self.begin(), sampled_self.end(), 0ULL), 100000);
+    // the mode of a sample this large matches the one of the population
+    EXPECT_EQ(max_element(sampled_self.begin(), sampled_self.end()) - sampled_self.begin(),
+              max_element(expected_self.begin(), expected_self.end()) - expected_self.begin());
+}
+
+TEST(hamming, masked)
+{
+    const size_t code_bytes = 20, n_codes = 30;
+    auto data = rand_vect(code_bytes * n_codes);
+    auto masks = rand_vect(code_bytes * (n_codes + 1));
+    auto query = rand_vect(code_bytes);
+    const unsigned char* query_mask = masks.data() + code_bytes * n_codes;
+
+    vector<size_t> dists(n_codes), n_valid(n_codes);
+    vector<double> scores(n_codes);
+    auto code_set = hamming::make_code_set(data.data(), n_codes, code_bytes);
+    auto mask_set = hamming::make_code_set(masks.data(), n_codes, code_bytes);
+    ASSERT_EQ(hamming_c::hamming_masked_distance_batch(query.data(), query_mask, &code_set, &mask_set,
+                                                       dists.data(), n_valid.data(), scores.data()),
+              hamming_c::HAMMING_STATUS_SUCCESS);
+
+    for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+    {
+        size_t expected_dist = 0, expected_valid = 0;
+        for (size_t bit = 0; bit < 8 * code_bytes; ++bit)
+        {
+            const vector<unsigned char> code(data.begin() + code_bytes * code_idx,
+                                             data.begin() + code_bytes * (code_idx + 1));
+            const vector<unsigned char> mask(masks.begin() + code_bytes * code_idx,
+                                             masks.begin() + code_bytes * (code_idx + 1));
+            const vector<unsigned char> qmask(query_mask, query_mask + code_bytes);
+            if (get_bit(mask, bit) && get_bit(qmask, bit))
+            {
+                ++expected_valid;
+                expected_dist += get_bit(code, bit) != get_bit(query, bit);
+            }
+        }
+        EXPECT_EQ(dists[code_idx], expected_dist);
+        EXPECT_EQ(n_valid[code_idx], expected_valid);
+        EXPECT_DOUBLE_EQ(scores[code_idx], static_cast<double>(expected_dist) / expected_valid);
+        EXPECT_DOUBLE_EQ(hamming::masked_distance(query.data(), query_mask, data.data() + code_bytes * code_idx,
+                                                  masks.data() + code_bytes * code_idx, code_bytes),
+                         scores[code_idx]);
+    }
+
+    // full masks give the plain distance; empty ones a score of 1
+    const vector<unsigned char> full(code_bytes, 0xFF), empty(code_bytes, 0);
+    EXPECT_DOUBLE_EQ(hamming::masked_distance(query.data(), full.data(), data.data(), full.data(), code_bytes),
+                     hamming::distance(query.data(), data.data(), code_bytes) / (8.0 * code_bytes));
+    EXPECT_DOUBLE_EQ(hamming::masked_distance(query.data(), empty.data(), data.data(), full.data(), code_bytes), 1.0);
+}
+
+TEST(hamming, weighted)
+{
+    const size_t code_bytes = 11, n_codes = 25;
+    auto data = rand_vect(code_bytes * n_codes);
+    auto query = rand_vect(code_bytes + 1);
+    query.erase(query.begin());
+    vector<float> weights(8 * code_bytes);
+    for (size_t bit = 0; bit < weights.size(); ++bit)
+        weights[bit] = 0.25f * (bit % 7);
+
+    hamming::weighted_query weighted(query.data(), weights.data(), code_bytes);
+    auto dists = weighted.distance(hamming::make_code_set(data.data(), n_codes, code_bytes));
+    ASSERT_EQ(dists.size(), n_codes);
+    for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+    {
+        const vector<unsigned char> code(data.begin() + code_bytes * code_idx,
+                                         data.begin() + code_bytes * (code_idx + 1));
+        float expected = 0;
+        for (size_t bit = 0; bit < weights.size(); ++bit)
+            if (get_bit(code, bit) != get_bit(query, bit))
+                expected += weights[bit];
+        EXPECT_FLOAT_EQ(dists[code_idx], expected);
+        EXPECT_FLOAT_EQ(weighted.distance(code.data()), expected);
+    }
+
+    EXPECT_FLOAT_EQ(weighted.distance(query.data()), 0);
+    EXPECT_THROW(hamming::weighted_query(query.data(), weights.data(), 0), system_error);
+}
+
+TEST(hamming, similarity)
+{
+    const unsigned char str1[2] = {0x0F, 0x01}, str2[2] = {0x03, 0x03};
+    // common = 3, weights = 5 and 4
+    EXPECT_DOUBLE_EQ(hamming::similarity(str1, str2, 2), 3.0 / 6.0);
+    EXPECT_DOUBLE_EQ(hamming::similarity(str1, str2, 2, hamming::similarity_metric::Dice), 6.0 / 9.0);
+
+    // fingerprints of various densities, so the weight buckets differ
+    const size_t code_bytes = 128, n_codes = 300;
+    default_random_engine generator;
+    vector<unsigned char> data(code_bytes * n_codes);
+    for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+    {
+        bernoulli_distribution bit_dist(0.05 + 0.3 * (code_idx % 10) / 10.0);
+        for (size_t byte_idx = 0; byte_idx < code_bytes; ++byte_idx)
+            for (unsigned int bit = 0; bit < 8; ++bit)
+                data[code_bytes * code_idx + byte_idx] |= bit_dist(generator) << bit;
+    }
+    // duplicates, to exercise ties
+    copy(data.begin(), data.begin() + code_bytes, data.begin() + code_bytes * 7);
+
+    auto codes = hamming::make_code_set(data.data(), n_codes, code_bytes);
+    hamming::tanimoto_index index(codes);
+    // too small for huge pages
+    EXPECT_EQ(index.page_kind(), hamming_c::HAMMING_PAGES_NORMAL);
+
+    for (size_t query_idx : {0, 13, 42})
+    {
+        const unsigned char* query = data.data() + code_bytes * query_idx;
+        auto similarities = hamming::similarity_batch(query, codes);
+
+        vector<hamming::similarity_match> expected;
+        for (size_t code_idx = 0; code_idx < n_codes; ++code_idx)
+        {
+            EXPECT_DOUBLE_EQ(similarities[code_idx], hamming::similarity(query, data.data() + code_bytes * code_idx,
+                                                                         code_bytes));
+            hamming::similarity_match match = {code_idx, similarities[code_idx]};
+            expected.push_back(match);
+        }
+        sort(expected.begin(), expected.end(), [](const hamming::similarity_match& m1, const hamming::similarity_match& m2)
+        {
+            return m1.similarity > m2.similarity || (m1.similarity == m2.similarity && m1.index < m2.index);
+        });
+
+        auto top = index.top_k(query, 10);
+        ASSERT_EQ(top.size(), 10);
+        for (size_t rank = 0; rank < top.size(); ++rank)
+        {
+            EXPECT_EQ(top[rank].index, expected[rank].index);
+            EXPECT_DOUBLE_EQ(top[rank].similarity, expected[rank].similarity);
+        }
+        EXPECT_EQ(top[0].index, query_idx);
+
+        const double min_similarity = 0.3;
+        auto above = index.threshold(query, min_similarity);
+        size_t n_expected = 0;
+        while (n_expected < expected.size() && expected[n_expected].similarity >= min_similarity)
+            ++n_expected;
+        ASSERT_EQ(above.size(), n_expected);
+        for (size_t rank = 0; rank < above.size(); ++rank)
+            EXPECT_EQ(above[rank].index, expected[rank].index);
+
+        // the threshold also prunes top-k
+        auto top_above = index.top_k(query, n_codes, min_similarity);
+        EXPECT_EQ(top_above.size(), n_expected);
+    }
+
+    // ties across weight buckets: with a query of the first 8 bits, codes of
+    // bits 0-3, of bits 0-15 and of bits 0-5 and 8-11 are all at 0.5, and
+    // the lowest indexes win whichever bucket they are in
+    const size_t tie_bytes = 2, n_ties = 30;
+    const unsigned char tie_query[tie_bytes] = {0xFF, 0x00};
+    const unsigned char tie_codes[3][tie_bytes] = {{0x0F, 0x00}, {0xFF, 0xFF}, {0x3F, 0x0F}};
+    vector<unsigned char> ties(tie_bytes * n_ties);
+    for (size_t code_idx = 0; code_idx < n_ties; ++code_idx)
+        copy(tie_codes[(code_idx * 7) % 3], tie_codes[(code_idx * 7) % 3] + tie_bytes,
+             ties.begin() + tie_bytes * code_idx);
+    hamming::tanimoto_index tie_index(hamming::make_code_set(ties.data(), n_ties, tie_bytes));
+    for (size_t k : {1, 5, 29})
+    {
+        auto top = tie_index.top_k(tie_query, k);
+        ASSERT_EQ(top.size(), k);
+        for (size_t rank = 0; rank < k; ++rank)
+        {
+            EXPECT_EQ(top[rank].index, rank) << k;
+            EXPECT_DOUBLE_EQ(top[rank].similarity, 0.5);
+        }
+    }
+    auto tie_above = tie_index.threshold(tie_query, 0.5);
+    ASSERT_EQ(tie_above.size(), n_ties);
+    for (size_t rank = 0; rank < n_ties; ++rank)
+        EXPECT_EQ(tie_above[rank].index, rank);
+    EXPECT_TRUE(tie_index.threshold(tie_query, 0.51).empty());
+}
+
+TEST(hamming, sliding_window)
+{
+    auto stream = rand_vect(300);
+    vector<unsigned char> pattern(stream.begin() + 100, stream.begin() + 113);
+    pattern[3] ^= 0x11; // plant a near match at byte offset 100
+
+    auto byte_dists = hamming::sliding_distance(pattern.data(), pattern.size(), stream.data(), stream.size());
+    ASSERT_EQ(byte_dists.size(), stream.size() - pattern.size() + 1);
+    for (size_t offset = 0; offset < byte_dists.size(); ++offset)
+        EXPECT_EQ(byte_dists[offset], hamming::distance(pattern.data(), stream.data() + offset, pattern.size()));
+    EXPECT_EQ(byte_dists[100], 2);
+
+    auto bit_dists = hamming::sliding_distance(pattern.data(), pattern.size(), stream.data(), stream.size(),
+                                               hamming::slide::Bits);
+    ASSERT_EQ(bit_dists.size(), 8 * (stream.size() - pattern.size()) + 1);
+    for (size_t offset = 0; offset < bit_dists.size(); ++offset)
+        EXPECT_EQ(bit_dists[offset], hamming::distance_bits(pattern.data(), 0, stream.data(), offset,
+                                                            8 * pattern.size()));
+
+    for (auto granularity : {hamming::slide::Bytes, hamming::slide::Bits})
+    {
+        const auto& dists = granularity == hamming::slide::Bits ? bit_dists : byte_dists;
+        const size_t max_distance = 40;
+        vector<size_t> expected;
+        for (size_t offset = 0; offset < dists.size(); ++offset)
+            if (dists[offset] <= max_distance)
+                expected.push_back(offset);
+        ASSERT_FALSE(expected.empty());
+
+        EXPECT_EQ(hamming::sliding_search(pattern.data(), pattern.size(), stream.data(), stream.size(),
+                                          max_distance, granularity), expected);
+
+        // streaming, in chunks of various sizes (including empty ones)
+        hamming::sliding_stream matcher(pattern.data(), pattern.size(), max_distance, granularity);
+        vector<size_t> streamed;
+        const size_t chunk_sizes[] = {0, 1, 5, 13, 14, 40, 2};
+        for (size_t pos = 0, chunk_idx = 0; pos < stream.size(); ++chunk_idx)
+        {
+            const size_t chunk_bytes = min(chunk_sizes[chunk_idx % 7], stream.size() - pos);
+            for (const auto& match : matcher.feed(stream.data() + pos, chunk_bytes))
+            {
+                EXPECT_EQ(match.second, dists[match.first]);
+                streamed.push_back(match.first);
+            }
+            pos += chunk_bytes;
+        }
+        EXPECT_EQ(streamed, expected);
+    }
+
+    // patterns long enough to go through the kernels' sums, in several
+    // blocks, with every implementation
+    auto long_stream = rand_vect(700);
+    for (size_t pattern_bytes : {40, 300})
+    {
+        vector<unsigned char> long_pattern(long_stream.begin() + 200, long_stream.begin() + 200 + pattern_bytes);
+        long_pattern[7] ^= 0x01;
+        for (int impl_idx = 0; impl_idx < HAMMING_N_IMPLS; ++impl_idx)
+        {
+            const auto impl = static_cast<hamming::implementation>(impl_idx);
+            const char* impl_name = hamming_c::hamming_impl_name(static_cast<hamming_c::hamming_impl_t>(impl_idx));
+            vector<size_t> dists;
+            try
+            {
+                dists = hamming::sliding_distance(long_pattern.data(), pattern_bytes, long_stream.data(),
+                                                  long_stream.size(), hamming::slide::Bits, impl);
+            }
+            catch (const system_error& error)
+            {
+                ASSERT_EQ(error.code().value(), hamming_c::HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE);
+                continue;
+            }
+            ASSERT_EQ(dists.size(), 8 * (long_stream.size() - pattern_bytes) + 1);
+            vector<size_t> expected;
+            for (size_t offset = 0; offset < dists.size(); ++offset)
+            {
+                const size_t dist = hamming::distance_bits(long_pattern.data(), 0, long_stream.data(), offset,
+                                                           8 * pattern_bytes);
+                EXPECT_EQ(dists[offset], dist) << impl_name;
+                if (dist <= 100)
+                    expected.push_back(offset);
+            }
+            EXPECT_EQ(expected, vector<size_t>(1, 8 * 200)) << impl_name;
+            EXPECT_EQ(hamming::sliding_search(long_pattern.data(), pattern_bytes, long_stream.data(),
+                                              long_stream.size(), 100, hamming::slide::Bits, impl), expected)
+                    << impl_name;
+        }
+    }
+
+    // pattern longer than the stream: no offsets
+    EXPECT_TRUE(hamming::sliding_distance(stream.data(), stream.size(), pattern.data(), pattern.size()).empty());
+    EXPECT_THROW(hamming::sliding_distance(pattern.data(), 0, stream.data(), stream.size()), system_error);
+}
+
+TEST(hamming, rank_select)
+{
+    default_random_engine generator;
+    for (double density : {0.001, 0.1, 0.5, 0.99})
+        for (size_t n_bits : {0, 1, 511, 512, 513, 70000})
+        {
+            bernoulli_distribution coin(density);
+            hamming::dynamic_bitset bits(n_bits);
+            for (size_t bit = 0; bit < n_bits; ++bit)
+                bits.set(bit, coin(generator));
+
+            const hamming::rank_select_bitvector original(bits);
+            // copies must re-align their bits, moves keep the buffer
+            hamming::rank_select_bitvector copy;
+            copy = original;
+            hamming::rank_select_bitvector rs(std::move(copy));
+            EXPECT_EQ(copy.size(), 0);
+            copy = std::move(rs);
+            rs = std::move(copy);
+            ASSERT_EQ(rs.size(), n_bits);
+
+            size_t ones = 0;
+            for (size_t pos = 0; pos <= n_bits; ++pos)
+            {
+                ASSERT_EQ(rs.rank1(pos), ones) << n_bits << " " << pos;
+                EXPECT_EQ(rs.rank0(pos), pos - ones);
+                if (pos < n_bits && bits[pos])
+                {
+                    EXPECT_TRUE(rs[pos]);
+                    ASSERT_EQ(rs.select1(ones), pos);
+                    ++ones;
+                }
+            }
+            EXPECT_EQ(rs.count(), ones);
+            EXPECT_THROW(rs.select1(ones), out_of_range);
+        }
+
+    const unsigned char bytes[3] = {0x81, 0x00, 0xFF};
+    hamming::rank_select_bitvector from_bytes(bytes, 20);
+    EXPECT_EQ(from_bytes.count(), 6);
+    EXPECT_EQ(from_bytes.select1(1), 7);
+    EXPECT_EQ(from_bytes.select1(2), 16);
+    EXPECT_EQ(from_bytes.rank1(20), 6);
+
+    const hamming::rank_select_bitvector no_bytes(nullptr, 0);
+    EXPECT_EQ(no_bytes.size(), 0);
+    EXPECT_EQ(no_bytes.count(), 0);
+}
+
+TEST(hamming, high_level_bitsets)
+{
+    default_random_engine generator;
+    bernoulli_distribution coin;
+
+    // sizes that are not a multiple of the word size exercise the tail masks
+    for (size_t n_bits : {1, 63, 64, 65, 200, 1000})
+    {
+        vector<bool> v1(n_bits), v2(n_bits);
+        hamming::dynamic_bitset d1(n_bits), d2(n_bits);
+        size_t expected = 0;
+        for (size_t bit = 0; bit < n_bits; ++bit)
+        {
+            v1[bit] = coin(generator);
+            v2[bit] = coin(generator);
+            d1.set(bit, v1[bit]);
+            d2.set(bit, v2[bit]);
+            expected += v1[bit] != v2[bit];
+        }
+
+        EXPECT_EQ(hamming::distance(v1, v2), expected);
+        EXPECT_EQ(hamming::distance(d1, d2), expected);
+
+        // stale bits left behind past size() must not be counted
+        v1.push_back(true);
+        v2.push_back(false);
+        v1.pop_back();
+        v2.pop_back();
+        EXPECT_EQ(hamming::distance(v1, v2), expected);
+    }
+
+    bitset<100> b1, b2;
+    b1.set(0).set(50).set(99);
+    b2.set(50).set(98);
+    EXPECT_EQ(hamming::distance(b1, b2), 3);
+    EXPECT_EQ(hamming::distance(bitset<0>(), bitset<0>()), 0);
+
+    const unsigned char bytes[3] = {0xFF, 0x0F, 0x01};
+    hamming::dynamic_bitset from_bytes(bytes, 3);
+    EXPECT_EQ(from_bytes.size(), 24);
+    EXPECT_EQ(hamming::distance(from_bytes, hamming::dynamic_bitset(24)), 13);
+
+    hamming::dynamic_bitset ones(70, true);
+    ones.resize(130, true);
+    EXPECT_EQ(hamming::distance(ones, hamming::dynamic_bitset(130)), 130);
+
+    EXPECT_THROW(hamming::distance(vector<bool>(3), vector<bool>(4)), invalid_argument);
+    EXPECT_THROW(hamming::distance(ones, hamming::dynamic_bitset(3)), invalid_argument);
+}
+
 int main(int argc, char* argv[]) {
 //    unsigned char* lut = init_lut<unsigned char>();
 //
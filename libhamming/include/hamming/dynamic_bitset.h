@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+namespace hamming
+{
+    // Minimal runtime-sized bitset. Unlike std::vector<bool>, the storage is
+    // guaranteed to be a contiguous array of 64 bit words, so it can be
+    // handed to the word-level kernels as it is.
+    // Invariant: the bits past size() in the last word are always 0, so they
+    // never contribute to a distance.
+    class dynamic_bitset
+    {
+    public:
+        typedef unsigned long long int block_type;
+        static const size_t bits_per_block = 8 * sizeof(block_type);
+
+        dynamic_bitset() : n_bits_(0) {}
+
+        explicit dynamic_bitset(size_t n_bits, bool value = false)
+            : n_bits_(n_bits),
+              blocks_(n_blocks_for(n_bits), value ? ~block_type(0) : block_type(0))
+        {
+            clear_padding();
+        }
+
+        // copies the raw bytes; the resulting bitset has 8 * n_bytes bits
+        dynamic_bitset(const unsigned char bytes[], size_t n_bytes)
+            : n_bits_(8 * n_bytes),
+              blocks_(n_blocks_for(8 * n_bytes), block_type(0))
+        {
+            if (n_bytes)
+                std::memcpy(blocks_.data(), bytes, n_bytes);
+        }
+
+        size_t size() const {return n_bits_;}
+        bool empty() const {return !n_bits_;}
+        size_t num_blocks() const {return blocks_.size();}
+        // number of bytes backing the bitset (always a multiple of 8)
+        size_t num_bytes() const {return blocks_.size() * sizeof(block_type);}
+
+        const block_type* data() const {return blocks_.data();}
+        const unsigned char* bytes() const
+        {
+            return reinterpret_cast<const unsigned char*>(blocks_.data());
+        }
+
+        bool test(size_t pos) const
+        {
+            check_pos(pos);
+            return (blocks_[pos / bits_per_block] >> (pos % bits_per_block)) & 1;
+        }
+
+        bool operator[](size_t pos) const {return test(pos);}
+
+        dynamic_bitset& set(size_t pos, bool value = true)
+        {
+            check_pos(pos);
+            const block_type mask = block_type(1) << (pos % bits_per_block);
+            if (value)
+                blocks_[pos / bits_per_block] |= mask;
+            else
+                blocks_[pos / bits_per_block] &= ~mask;
+            return *this;
+        }
+
+        dynamic_bitset& reset(size_t pos) {return set(pos, false);}
+
+        dynamic_bitset& flip(size_t pos)
+        {
+            check_pos(pos);
+            blocks_[pos / bits_per_block] ^= block_type(1) << (pos % bits_per_block);
+            return *this;
+        }
+
+        void resize(size_t n_bits, bool value = false)
+        {
+            const size_t old_n_bits = n_bits_;
+            blocks_.resize(n_blocks_for(n_bits), value ? ~block_type(0) : block_type(0));
+            n_bits_ = n_bits;
+            if (value)
+                // the tail of the previously last block was kept at 0
+                for (size_t pos = old_n_bits; pos < n_bits && pos % bits_per_block; ++pos)
+                    set(pos);
+            clear_padding();
+        }
+
+        void push_back(bool value)
+        {
+            resize(n_bits_ + 1);
+            set(n_bits_ - 1, value);
+        }
+
+        bool operator==(const dynamic_bitset& other) const
+        {
+            return n_bits_ == other.n_bits_ && blocks_ == other.blocks_;
+        }
+
+        bool operator!=(const dynamic_bitset& other) const {return !(*this == other);}
+
+    private:
+        static size_t n_blocks_for(size_t n_bits)
+        {
+            return (n_bits + bits_per_block - 1) / bits_per_block;
+        }
+
+        void check_pos(size_t pos) const
+        {
+            if (pos >= n_bits_)
+                throw std::out_of_range("dynamic_bitset: bit position out of range");
+        }
+
+        void clear_padding()
+        {
+            const size_t used_bits = n_bits_ % bits_per_block;
+            if (used_bits)
+                blocks_.back() &= (block_type(1) << used_bits) - 1;
+        }
+
+        size_t n_bits_;
+        std::vector<block_type> blocks_;
+    };
+}
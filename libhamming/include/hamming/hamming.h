@@ -5,6 +5,10 @@
 #include <vector>
 #include <stdexcept>
 #include <algorithm>
+#include <utility>
+#include <new>
+#include <bitset>
+#include <hamming/dynamic_bitset.h>
 
 namespace hamming_c{
 #include "hamming_c.h"
@@ -16,7 +20,9 @@ namespace hamming
 {
     enum class implementation: int
     {
-#if defined(HAMMING_WITH_VANILLA) || defined(HAMMING_WITH_2x32) || defined(HAMMING_WITH_LUT) || defined(HAMMING_WITH_SPARSE) || defined(HAMMING_WITH_INTRINSICS)
+#if defined(HAMMING_WITH_VANILLA) || defined(HAMMING_WITH_2x32) || defined(HAMMING_WITH_LUT) || defined(HAMMING_WITH_SPARSE) || defined(HAMMING_WITH_INTRINSICS) || \
+    defined(HAMMING_WITH_UNROLLED) || defined(HAMMING_WITH_HARLEY_SEAL) || defined(HAMMING_WITH_VECTOR) || \
+    defined(HAMMING_WITH_INTERLEAVED)
         Default_impl = hamming_c::HAMMING_IMPL_DEFAULT,
 #endif
 
@@ -33,8 +39,78 @@ namespace hamming
 #endif
 
 #ifdef HAMMING_WITH_SPARSE
-        Sparse = hamming_c::HAMMING_IMPL_SPARSE
+        Sparse = hamming_c::HAMMING_IMPL_SPARSE,
 #endif
+
+#ifdef HAMMING_WITH_LUT
+        Lut16 = hamming_c::HAMMING_IMPL_LUT16,
+#endif
+
+#ifdef HAMMING_WITH_UNROLLED
+        Unrolled = hamming_c::HAMMING_IMPL_UNROLLED,
+#endif
+
+#ifdef HAMMING_WITH_HARLEY_SEAL
+        Harley_seal = hamming_c::HAMMING_IMPL_HARLEY_SEAL,
+#endif
+
+#ifdef HAMMING_WITH_VECTOR
+        Vector = hamming_c::HAMMING_IMPL_VECTOR,
+#endif
+
+#ifdef HAMMING_WITH_INTERLEAVED
+        Interleaved = hamming_c::HAMMING_IMPL_INTERLEAVED,
+#endif
+    };
+
+    enum class slide: int
+    {
+        Bytes = hamming_c::HAMMING_SLIDE_BYTES,
+        Bits = hamming_c::HAMMING_SLIDE_BITS
+    };
+
+    enum class similarity_metric: int
+    {
+        Tanimoto = hamming_c::HAMMING_SIMILARITY_TANIMOTO,
+        Jaccard = hamming_c::HAMMING_SIMILARITY_JACCARD,
+        Dice = hamming_c::HAMMING_SIMILARITY_DICE
+    };
+
+    typedef hamming_c::hamming_similarity_match_t similarity_match;
+    typedef hamming_c::hamming_match_t match;
+
+    // non-owning view of a set of equally sized codes (see hamming_c.h)
+    typedef hamming_c::hamming_code_set_t code_set_view;
+
+    inline code_set_view make_code_set(const unsigned char data[], size_t n_codes,
+                                       size_t code_bytes, size_t stride = 0)
+    {
+        code_set_view codes = {data, n_codes, code_bytes, stride};
+        return codes;
+    }
+
+    typedef hamming_c::hamming_pages_t pages;
+
+    // zeroed buffer on huge pages, if available (see hamming_buffer_t)
+    class buffer
+    {
+    public:
+        explicit buffer(size_t n_bytes);
+        ~buffer();
+
+        unsigned char* data() {return hamming_c::hamming_buffer_data(buffer_);}
+        const unsigned char* data() const {return hamming_c::hamming_buffer_data(buffer_);}
+        size_t size() const {return hamming_c::hamming_buffer_size(buffer_);}
+        // the kind of pages obtained
+        pages page_kind() const {return hamming_c::hamming_buffer_pages(buffer_);}
+        // the bytes backed by huge pages at the moment
+        size_t huge_page_bytes() const;
+
+    private:
+        buffer(const buffer&);
+        buffer& operator=(const buffer&);
+
+        hamming_c::hamming_buffer_t* buffer_;
     };
 
     class hamming_error_category : public std::error_category
@@ -51,7 +127,344 @@ namespace hamming
     size_t distance(const unsigned char str1[], const unsigned char str2[],
                     size_t n_bytes, implementation impl = implementation::Default_impl);
 
+    // compares n_bits bits starting at bit offsets bit_offset1 and
+    // bit_offset2 (counted lsb first) of str1 and str2, respectively
+    size_t distance_bits(const unsigned char str1[], size_t bit_offset1,
+                         const unsigned char str2[], size_t bit_offset2,
+                         size_t n_bits, implementation impl = implementation::Default_impl);
+
+    // distances between the query and every code of the set
+    std::vector<size_t> distance_batch(const unsigned char query[], const code_set_view& codes,
+                                       implementation impl = implementation::Default_impl);
+
+    // see hamming_scan_options_t
+    typedef hamming_c::hamming_scan_options_t scan_options;
+    void set_scan_options(const scan_options& options);
+    scan_options get_scan_options();
+
+    // copy of a code set partitioned across the NUMA nodes (see
+    // hamming_numa_code_set_t); n_nodes != 0 emulates that many nodes
+    class numa_code_set
+    {
+    public:
+        explicit numa_code_set(const code_set_view& codes, size_t n_nodes = 0);
+        ~numa_code_set();
+
+        size_t nodes() const {return hamming_c::hamming_numa_code_set_nodes(codes_);}
+        // the codes on a node, and the index of the first of them
+        code_set_view shard(size_t node, size_t* first_code = nullptr) const;
+
+        std::vector<size_t> distance_batch(const unsigned char query[],
+                                           implementation impl = implementation::Default_impl);
+
+    private:
+        numa_code_set(const numa_code_set&);
+        numa_code_set& operator=(const numa_code_set&);
+
+        hamming_c::hamming_numa_code_set_t* codes_;
+        size_t n_codes_;
+    };
+
+    // the (at most) k codes closest to the query, by increasing distance
+    std::vector<match> knn_search(const unsigned char query[], const code_set_view& codes, size_t k,
+                                  implementation impl = implementation::Default_impl);
+
+    // all the codes within max_distance of the query, by increasing distance
+    std::vector<match> radius_search(const unsigned char query[], const code_set_view& codes, size_t max_distance,
+                                     implementation impl = implementation::Default_impl);
+
+    enum class search_kind: int
+    {
+        Knn = hamming_c::HAMMING_SEARCH_KNN,
+        Radius = hamming_c::HAMMING_SEARCH_RADIUS
+    };
+
+    struct search_query
+    {
+        const unsigned char* query;
+        search_kind kind;
+        // k, or max_distance
+        size_t param;
+    };
+
+    // the results of every search, from a single shared scan over the codes
+    // (see hamming_search_batch)
+    std::vector<std::vector<match> > search_batch(const std::vector<search_query>& queries,
+                                                  const code_set_view& codes,
+                                                  implementation impl = implementation::Default_impl);
+
+    // merges the (ordered) results of searches over several shards, adding
+    // offsets[i] (if given) to the indexes of lists[i]; at most k of them,
+    // if k != 0
+    std::vector<match> merge_matches(const std::vector<std::vector<match> >& lists,
+                                     const std::vector<size_t>& offsets = std::vector<size_t>(), size_t k = 0);
+
+    // the current version of a code set, replaced while it is read (see
+    // hamming_versioned_t)
+    class versioned_database
+    {
+    public:
+        versioned_database();
+        ~versioned_database();
+
+        // in the background; wait() tells how it went
+        void load(const std::string& path, bool verify = false);
+        // throws if the last load failed
+        void wait();
+        // a copy of the codes becomes the current version
+        void publish(const code_set_view& codes);
+
+        // the version current when it was taken, pinned for its lifetime
+        class snapshot
+        {
+        public:
+            explicit snapshot(versioned_database& handle);
+            ~snapshot();
+
+            unsigned long long version() const {return hamming_c::hamming_snapshot_version(snapshot_);}
+            code_set_view codes() const;
+            // null if the version has none
+            const unsigned long long* ids() const {return hamming_c::hamming_snapshot_ids(snapshot_);}
+
+        private:
+            snapshot(const snapshot&);
+            snapshot& operator=(const snapshot&);
+
+            hamming_c::hamming_snapshot_t* snapshot_;
+        };
+
+    private:
+        versioned_database(const versioned_database&);
+        versioned_database& operator=(const versioned_database&);
+
+        hamming_c::hamming_versioned_t* handle_;
+    };
+
+    // code set which is appended to and deleted from while it is searched
+    // (see hamming_mutable_set_t); the codes are known by the ids append
+    // assigns them, which are the indexes the searches report
+    class mutable_code_set
+    {
+    public:
+        explicit mutable_code_set(size_t code_bytes, bool background_compaction = false);
+        ~mutable_code_set();
+
+        // the id of the first code; the others follow
+        size_t append(const code_set_view& codes);
+        // the number of codes deleted (the others weren't in the set)
+        size_t remove(const std::vector<size_t>& ids);
+        void compact();
+
+        size_t size() const;
+        // the rows the codes take, including those of deleted codes which
+        // weren't reclaimed yet
+        size_t slots() const;
+
+        std::vector<match> knn_search(const unsigned char query[], size_t k,
+                                      implementation impl = implementation::Default_impl) const;
+        std::vector<match> radius_search(const unsigned char query[], size_t max_distance,
+                                         implementation impl = implementation::Default_impl) const;
+
+    private:
+        mutable_code_set(const mutable_code_set&);
+        mutable_code_set& operator=(const mutable_code_set&);
+
+        hamming_c::hamming_mutable_set_t* set_;
+    };
+
+    // writes the codes as a code database (see hamming_db_write); ids, if
+    // not empty, must have one id per code
+    void write_database(const std::string& path, const code_set_view& codes,
+                        const std::vector<unsigned long long>& ids = std::vector<unsigned long long>(),
+                        bool with_weights = false);
+
+    // a code database, mapped for the life of the object (see
+    // hamming_db_open)
+    class database
+    {
+    public:
+        explicit database(const std::string& path, bool verify = false);
+        ~database();
+
+        // the codes, in place
+        code_set_view codes() const;
+        // null if the database has none
+        const unsigned long long* ids() const {return hamming_c::hamming_db_ids(db_);}
+        const unsigned int* weights() const {return hamming_c::hamming_db_weights(db_);}
+        int version() const {return hamming_c::hamming_db_version(db_);}
+
+        // throws if the contents don't match the checksum
+        void verify() const;
+
+    private:
+        database(const database&);
+        database& operator=(const database&);
+
+        hamming_c::hamming_db_t* db_;
+    };
+
+    // histogram of the distances between every query and every code (8 *
+    // code_bytes + 1 bins); with n_samples != 0, only that many randomly
+    // drawn pairs are binned
+    std::vector<unsigned long long> distance_histogram(const code_set_view& queries, const code_set_view& codes,
+                                                       unsigned long long n_samples = 0,
+                                                       unsigned long long seed = 0,
+                                                       implementation impl = implementation::Default_impl);
+
+    // same, for the pairs of distinct codes of one set
+    std::vector<unsigned long long> distance_histogram(const code_set_view& codes,
+                                                       unsigned long long n_samples = 0,
+                                                       unsigned long long seed = 0,
+                                                       implementation impl = implementation::Default_impl);
+
+    // population count of a buffer
+    size_t weight(const unsigned char str[], size_t n_bytes,
+                  implementation impl = implementation::Default_impl);
+
+    // population count of every code of the set
+    std::vector<size_t> weights(const code_set_view& codes,
+                                implementation impl = implementation::Default_impl);
+
+    // popcount((str1 ^ str2) & mask1 & mask2) / popcount(mask1 & mask2); 1 if
+    // the masks have no common bits
+    double masked_distance(const unsigned char str1[], const unsigned char mask1[],
+                           const unsigned char str2[], const unsigned char mask2[],
+                           size_t n_bytes, implementation impl = implementation::Default_impl);
+
+    std::vector<double> masked_distance_batch(const unsigned char query[], const unsigned char query_mask[],
+                                              const code_set_view& codes, const code_set_view& masks,
+                                              implementation impl = implementation::Default_impl);
+
+    // distance in which every bit counts with its own weight (8 * n_bytes
+    // weights, lsb first); the lookup tables are built once per query
+    class weighted_query
+    {
+    public:
+        weighted_query(const unsigned char query[], const float weights[], size_t n_bytes);
+        ~weighted_query();
+
+        float distance(const unsigned char code[]) const;
+        std::vector<float> distance(const code_set_view& codes) const;
+
+    private:
+        weighted_query(const weighted_query&);
+        weighted_query& operator=(const weighted_query&);
+
+        hamming_c::hamming_weighted_query_t* query_;
+    };
+
+    double similarity(const unsigned char str1[], const unsigned char str2[], size_t n_bytes,
+                      similarity_metric metric = similarity_metric::Tanimoto,
+                      implementation impl = implementation::Default_impl);
+
+    std::vector<double> similarity_batch(const unsigned char query[], const code_set_view& codes,
+                                         similarity_metric metric = similarity_metric::Tanimoto,
+                                         implementation impl = implementation::Default_impl);
+
+    // tanimoto similarity search over a (copied) set of fingerprints
+    class tanimoto_index
+    {
+    public:
+        explicit tanimoto_index(const code_set_view& codes);
+        ~tanimoto_index();
+
+        std::vector<similarity_match> top_k(const unsigned char query[], size_t k,
+                                            double min_similarity = 0.0,
+                                            implementation impl = implementation::Default_impl) const;
+
+        std::vector<similarity_match> threshold(const unsigned char query[], double min_similarity,
+                                                implementation impl = implementation::Default_impl) const;
+
+        // of the rows
+        pages page_kind() const;
+
+    private:
+        tanimoto_index(const tanimoto_index&);
+        tanimoto_index& operator=(const tanimoto_index&);
+
+        hamming_c::hamming_tanimoto_index_t* index_;
+    };
+
+    // distance of the pattern at every byte (or bit) offset of the stream
+    std::vector<size_t> sliding_distance(const unsigned char pattern[], size_t pattern_bytes,
+                                         const unsigned char stream[], size_t stream_bytes,
+                                         slide granularity = slide::Bytes,
+                                         implementation impl = implementation::Default_impl);
+
+    // offsets at which the distance of the pattern is at most max_distance
+    std::vector<size_t> sliding_search(const unsigned char pattern[], size_t pattern_bytes,
+                                       const unsigned char stream[], size_t stream_bytes,
+                                       size_t max_distance, slide granularity = slide::Bytes,
+                                       implementation impl = implementation::Default_impl);
+
+    // streaming version of sliding_search: the stream is fed chunk by chunk,
+    // and matches straddling chunk boundaries are found as well
+    class sliding_stream
+    {
+    public:
+        // (absolute position, distance)
+        typedef std::pair<size_t, size_t> match;
+
+        sliding_stream(const unsigned char pattern[], size_t pattern_bytes, size_t max_distance,
+                       slide granularity = slide::Bytes,
+                       implementation impl = implementation::Default_impl);
+        ~sliding_stream();
+
+        std::vector<match> feed(const unsigned char chunk[], size_t chunk_bytes);
+
+    private:
+        sliding_stream(const sliding_stream&);
+        sliding_stream& operator=(const sliding_stream&);
+
+        hamming_c::hamming_sliding_stream_t* stream_;
+    };
+
+    // usage counters per implementation, indexed by implementation; only
+    // kept when libhamming is built with HAMMING_WITH_STATS (otherwise, these
+    // throw)
+    typedef hamming_c::hamming_stats_t stats;
+    stats get_stats();
+    void reset_stats();
+    // Prometheus text format
+    std::string stats_text();
+
+    const char* implementation_name(implementation impl);
+
+    typedef hamming_c::hamming_entry_point_t entry_point;
+
+    // calls per latency bucket (see hamming_latency_bucket_lower); also only
+    // with HAMMING_WITH_STATS
+    std::vector<unsigned long long> latency_histogram(entry_point entry);
+
+    // upper bound (in ns) of the q-quantile (0 < q <= 1) of a latency
+    // histogram, within the width of a bucket; 0 for an empty histogram
+    unsigned long long latency_quantile(const std::vector<unsigned long long>& histogram, double q);
+
+    // word-level and allocation-free; on libstdc++ the word storage of the
+    // vectors is handed directly to the kernels
     size_t distance(const std::vector<bool>& v1, const std::vector<bool>& v2);
+
+    size_t distance(const dynamic_bitset& b1, const dynamic_bitset& b2,
+                    implementation impl = implementation::Default_impl);
+
+    template<size_t N>
+    size_t distance(const std::bitset<N>& b1, const std::bitset<N>& b2,
+                    implementation impl = implementation::Default_impl)
+    {
+        if (!N)
+            return 0;
+#if defined(__GLIBCXX__) || defined(_LIBCPP_VERSION) || defined(_MSC_VER)
+        // all of the major standard libraries store a bitset as a plain array
+        // of words and keep the bits past N cleared, so the object
+        // representation can be handed to the kernels directly
+        return distance(reinterpret_cast<const unsigned char*>(&b1),
+                        reinterpret_cast<const unsigned char*>(&b2),
+                        sizeof(b1), impl);
+#else
+        (void)impl;
+        return (b1 ^ b2).count();
+#endif
+    }
 }
 
 // In every module you want to use this API, make sure to include the hpp ONLY ONCE.
@@ -17,6 +17,29 @@ const hamming::hamming_error_category& hamming::hamming_error_category::instance
     return instance_;
 }
 
+hamming::buffer::buffer(size_t n_bytes)
+    : buffer_(nullptr)
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_buffer_create(n_bytes, &buffer_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::buffer::~buffer()
+{
+    hamming_c::hamming_buffer_destroy(buffer_);
+}
+
+size_t hamming::buffer::huge_page_bytes() const
+{
+    size_t huge_bytes = 0;
+    hamming_c::hamming_status_t status = hamming_c::hamming_buffer_huge_page_bytes(buffer_, &huge_bytes);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return huge_bytes;
+}
+
 size_t hamming::distance(const unsigned char str1[], const unsigned char str2[], size_t n_bytes, implementation impl)
 {
 
@@ -29,19 +52,895 @@ size_t hamming::distance(const unsigned char str1[], const unsigned char str2[],
     return dist;
 }
 
-size_t hamming::distance(const std::vector<bool>& v1, const std::vector<bool>& v2)
+size_t hamming::distance_bits(const unsigned char str1[], size_t bit_offset1,
+                              const unsigned char str2[], size_t bit_offset2,
+                              size_t n_bits, implementation impl)
+{
+    size_t dist = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_distance_bits(str1, bit_offset1, str2, bit_offset2, n_bits, &dist,
+                                             static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return dist;
+}
+
+std::vector<size_t> hamming::distance_batch(const unsigned char query[], const code_set_view& codes,
+                                            implementation impl)
+{
+    std::vector<size_t> distances(codes.n_codes);
+    size_t dummy = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_distance_batch(query, &codes, distances.empty() ? &dummy : distances.data(),
+                                              static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return distances;
+}
+
+void hamming::set_scan_options(const scan_options& options)
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_set_scan_options(&options);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::scan_options hamming::get_scan_options()
+{
+    scan_options options;
+    hamming_c::hamming_status_t status = hamming_c::hamming_get_scan_options(&options);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return options;
+}
+
+hamming::numa_code_set::numa_code_set(const code_set_view& codes, size_t n_nodes)
+    : codes_(nullptr), n_codes_(codes.n_codes)
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_numa_code_set_create(&codes, n_nodes, &codes_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::numa_code_set::~numa_code_set()
+{
+    hamming_c::hamming_numa_code_set_destroy(codes_);
+}
+
+hamming::code_set_view hamming::numa_code_set::shard(size_t node, size_t* first_code) const
+{
+    code_set_view result;
+    size_t first = 0;
+    hamming_c::hamming_status_t status = hamming_c::hamming_numa_code_set_shard(codes_, node, &result, &first);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    if (first_code)
+        *first_code = first;
+    return result;
+}
+
+std::vector<size_t> hamming::numa_code_set::distance_batch(const unsigned char query[], implementation impl)
+{
+    std::vector<size_t> distances(n_codes_);
+    size_t dummy = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_numa_distance_batch(codes_, query, distances.empty() ? &dummy : distances.data(),
+                                                   static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return distances;
+}
+
+std::vector<hamming::match> hamming::knn_search(const unsigned char query[], const code_set_view& codes, size_t k,
+                                                implementation impl)
+{
+    std::vector<match> results(k);
+    size_t n_results = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_knn_search(query, &codes, k, results.data(), &n_results,
+                                          static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    results.resize(n_results);
+    return results;
+}
+
+std::vector<hamming::match> hamming::radius_search(const unsigned char query[], const code_set_view& codes,
+                                                   size_t max_distance, implementation impl)
+{
+    // the number of matches is only known afterwards; a second call is
+    // only needed when the first guess was too small
+    std::vector<match> results(16);
+    size_t n_results = 0;
+    for (;;)
+    {
+        hamming_c::hamming_status_t status =
+                hamming_c::hamming_radius_search(query, &codes, max_distance, results.data(), results.size(),
+                                                 &n_results, static_cast<hamming_c::hamming_impl_t>(impl));
+        if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+            throw std::system_error(status, hamming_error_category::instance());
+
+        if (n_results <= results.size())
+            break;
+        results.resize(n_results);
+    }
+
+    results.resize(n_results);
+    return results;
+}
+
+std::vector<std::vector<hamming::match> > hamming::search_batch(const std::vector<search_query>& queries,
+                                                                const code_set_view& codes, implementation impl)
+{
+    std::vector<std::vector<match> > results(queries.size());
+    std::vector<const unsigned char*> query_data(queries.size());
+    std::vector<hamming_c::hamming_search_t> searches(queries.size());
+    for (size_t search_idx = 0; search_idx < queries.size(); ++search_idx)
+    {
+        query_data[search_idx] = queries[search_idx].query;
+        // the number of radius matches is only known afterwards
+        results[search_idx].resize(queries[search_idx].kind == search_kind::Knn ?
+                                   std::min(queries[search_idx].param, codes.n_codes) : 16);
+    }
+
+    for (size_t search_idx = 0; search_idx < queries.size(); ++search_idx)
+    {
+        searches[search_idx].kind = static_cast<hamming_c::hamming_search_kind_t>(queries[search_idx].kind);
+        searches[search_idx].param = queries[search_idx].param;
+        searches[search_idx].results = results[search_idx].data();
+        searches[search_idx].capacity = results[search_idx].size();
+        searches[search_idx].n_results = 0;
+    }
+
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_search_batch(query_data.data(), searches.data(), searches.size(), &codes,
+                                            static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    // the radius searches which found more matches than there was room for
+    // are run again, alone, with room for all they reported
+    std::vector<const unsigned char*> overflowed_data;
+    std::vector<hamming_c::hamming_search_t> overflowed;
+    std::vector<size_t> overflowed_idxs;
+    for (size_t search_idx = 0; search_idx < queries.size(); ++search_idx)
+    {
+        if (searches[search_idx].n_results > results[search_idx].size())
+        {
+            results[search_idx].resize(searches[search_idx].n_results);
+            searches[search_idx].results = results[search_idx].data();
+            searches[search_idx].capacity = results[search_idx].size();
+            searches[search_idx].n_results = 0;
+            overflowed_data.push_back(query_data[search_idx]);
+            overflowed.push_back(searches[search_idx]);
+            overflowed_idxs.push_back(search_idx);
+        }
+        else
+            results[search_idx].resize(searches[search_idx].n_results);
+    }
+    if (overflowed.empty())
+        return results;
+
+    status = hamming_c::hamming_search_batch(overflowed_data.data(), overflowed.data(), overflowed.size(), &codes,
+                                             static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    for (size_t overflowed_idx = 0; overflowed_idx < overflowed.size(); ++overflowed_idx)
+        results[overflowed_idxs[overflowed_idx]].resize(overflowed[overflowed_idx].n_results);
+
+    return results;
+}
+
+std::vector<hamming::match> hamming::merge_matches(const std::vector<std::vector<match> >& lists,
+                                                   const std::vector<size_t>& offsets, size_t k)
+{
+    std::vector<const match*> list_data(lists.size());
+    std::vector<size_t> sizes(lists.size());
+    size_t total = 0;
+    for (size_t list_idx = 0; list_idx < lists.size(); ++list_idx)
+    {
+        list_data[list_idx] = lists[list_idx].data();
+        sizes[list_idx] = lists[list_idx].size();
+        total += sizes[list_idx];
+    }
+
+    std::vector<match> results(k ? std::min(k, total) : total);
+    size_t n_results = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_merge_matches(list_data.data(), sizes.data(), offsets.empty() ? nullptr : offsets.data(),
+                                             lists.size(), results.data(), results.size(), &n_results);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return results;
+}
+
+hamming::versioned_database::versioned_database()
+    : handle_(nullptr)
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_versioned_create(&handle_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::versioned_database::~versioned_database()
+{
+    hamming_c::hamming_versioned_destroy(handle_);
+}
+
+void hamming::versioned_database::load(const std::string& path, bool verify)
+{
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_versioned_load(handle_, path.c_str(), verify ? HAMMING_DB_VERIFY : 0);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+void hamming::versioned_database::wait()
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_versioned_wait(handle_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+void hamming::versioned_database::publish(const code_set_view& codes)
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_versioned_publish(handle_, &codes);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::versioned_database::snapshot::snapshot(versioned_database& handle)
+    : snapshot_(nullptr)
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_snapshot_acquire(handle.handle_, &snapshot_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::versioned_database::snapshot::~snapshot()
+{
+    hamming_c::hamming_snapshot_release(snapshot_);
+}
+
+hamming::code_set_view hamming::versioned_database::snapshot::codes() const
+{
+    code_set_view result;
+    hamming_c::hamming_status_t status = hamming_c::hamming_snapshot_codes(snapshot_, &result);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return result;
+}
+
+hamming::mutable_code_set::mutable_code_set(size_t code_bytes, bool background_compaction)
+    : set_(nullptr)
+{
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_mutable_set_create(code_bytes,
+                                                  background_compaction ? HAMMING_MUTABLE_BACKGROUND_COMPACTION : 0,
+                                                  &set_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::mutable_code_set::~mutable_code_set()
+{
+    hamming_c::hamming_mutable_set_destroy(set_);
+}
+
+size_t hamming::mutable_code_set::append(const code_set_view& codes)
+{
+    size_t first_id = 0;
+    hamming_c::hamming_status_t status = hamming_c::hamming_mutable_set_append(set_, &codes, &first_id);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return first_id;
+}
+
+size_t hamming::mutable_code_set::remove(const std::vector<size_t>& ids)
+{
+    size_t n_removed = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_mutable_set_remove(set_, ids.data(), ids.size(), &n_removed);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return n_removed;
+}
+
+void hamming::mutable_code_set::compact()
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_mutable_set_compact(set_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+size_t hamming::mutable_code_set::size() const
+{
+    size_t n_codes = 0, n_slots = 0;
+    hamming_c::hamming_status_t status = hamming_c::hamming_mutable_set_size(set_, &n_codes, &n_slots);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return n_codes;
+}
+
+size_t hamming::mutable_code_set::slots() const
+{
+    size_t n_codes = 0, n_slots = 0;
+    hamming_c::hamming_status_t status = hamming_c::hamming_mutable_set_size(set_, &n_codes, &n_slots);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return n_slots;
+}
+
+std::vector<hamming::match> hamming::mutable_code_set::knn_search(const unsigned char query[], size_t k,
+                                                                  implementation impl) const
+{
+    std::vector<match> results(k);
+    size_t n_results = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_mutable_knn_search(query, set_, k, results.data(), &n_results,
+                                                  static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    results.resize(n_results);
+    return results;
+}
+
+std::vector<hamming::match> hamming::mutable_code_set::radius_search(const unsigned char query[],
+                                                                     size_t max_distance, implementation impl) const
+{
+    // a first guess, then a second search if there are more matches
+    std::vector<match> results(16);
+    for (;;)
+    {
+        size_t n_results = 0;
+        hamming_c::hamming_status_t status =
+                hamming_c::hamming_mutable_radius_search(query, set_, max_distance, results.data(), results.size(),
+                                                         &n_results, static_cast<hamming_c::hamming_impl_t>(impl));
+        if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+            throw std::system_error(status, hamming_error_category::instance());
+
+        const bool complete = n_results <= results.size();
+        results.resize(n_results);
+        if (complete)
+            return results;
+    }
+}
+
+void hamming::write_database(const std::string& path, const code_set_view& codes,
+                             const std::vector<unsigned long long>& ids, bool with_weights)
+{
+    if (!ids.empty() && ids.size() != codes.n_codes)
+        throw std::system_error(hamming_c::HAMMING_STATUS_BAD_PARAM_SIZE, hamming_error_category::instance());
+
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_db_write(path.c_str(), &codes, ids.empty() ? nullptr : ids.data(),
+                                        with_weights ? HAMMING_DB_WITH_WEIGHTS : 0);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::database::database(const std::string& path, bool verify)
+    : db_(nullptr)
+{
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_db_open(path.c_str(), verify ? HAMMING_DB_VERIFY : 0, &db_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::database::~database()
+{
+    hamming_c::hamming_db_close(db_);
+}
+
+hamming::code_set_view hamming::database::codes() const
 {
-    // there is no easy way of using std::vector<bool> to wrap around raw
-    // data from files
-    // @TODO: try boost::dynamic_bitset for an alternate implementation
+    code_set_view result;
+    hamming_c::hamming_status_t status = hamming_c::hamming_db_codes(db_, &result);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return result;
+}
+
+void hamming::database::verify() const
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_db_verify(db_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+std::vector<unsigned long long> hamming::distance_histogram(const code_set_view& queries,
+                                                            const code_set_view& codes,
+                                                            unsigned long long n_samples,
+                                                            unsigned long long seed,
+                                                            implementation impl)
+{
+    std::vector<unsigned long long> histogram(8 * codes.code_bytes + 1);
+    const hamming_c::hamming_histogram_options_t options = {n_samples, seed};
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_distance_histogram(&queries, &codes, histogram.data(), &options,
+                                                  static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return histogram;
+}
+
+std::vector<unsigned long long> hamming::distance_histogram(const code_set_view& codes,
+                                                            unsigned long long n_samples,
+                                                            unsigned long long seed,
+                                                            implementation impl)
+{
+    std::vector<unsigned long long> histogram(8 * codes.code_bytes + 1);
+    const hamming_c::hamming_histogram_options_t options = {n_samples, seed};
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_distance_histogram_self(&codes, histogram.data(), &options,
+                                                       static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return histogram;
+}
+
+size_t hamming::weight(const unsigned char str[], size_t n_bytes, implementation impl)
+{
+    size_t result = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_weight(str, n_bytes, &result, static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return result;
+}
+
+std::vector<size_t> hamming::weights(const code_set_view& codes, implementation impl)
+{
+    std::vector<size_t> result(codes.n_codes);
+    size_t dummy = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_weights(&codes, result.empty() ? &dummy : result.data(),
+                                       static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return result;
+}
+
+double hamming::masked_distance(const unsigned char str1[], const unsigned char mask1[],
+                                const unsigned char str2[], const unsigned char mask2[],
+                                size_t n_bytes, implementation impl)
+{
+    size_t dist = 0, n_valid = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_masked_distance(str1, mask1, str2, mask2, n_bytes, &dist, &n_valid,
+                                               static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return n_valid ? static_cast<double>(dist) / n_valid : 1.0;
+}
+
+std::vector<double> hamming::masked_distance_batch(const unsigned char query[], const unsigned char query_mask[],
+                                                   const code_set_view& codes, const code_set_view& masks,
+                                                   implementation impl)
+{
+    std::vector<double> scores(codes.n_codes);
+    double dummy = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_masked_distance_batch(query, query_mask, &codes, &masks, nullptr, nullptr,
+                                                     scores.empty() ? &dummy : scores.data(),
+                                                     static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return scores;
+}
+
+hamming::weighted_query::weighted_query(const unsigned char query[], const float weights[], size_t n_bytes)
+    : query_(nullptr)
+{
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_weighted_query_create(query, weights, n_bytes, &query_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::weighted_query::~weighted_query()
+{
+    hamming_c::hamming_weighted_query_destroy(query_);
+}
+
+float hamming::weighted_query::distance(const unsigned char code[]) const
+{
+    float dist = 0;
+    hamming_c::hamming_status_t status = hamming_c::hamming_weighted_distance(query_, code, &dist);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return dist;
+}
+
+std::vector<float> hamming::weighted_query::distance(const code_set_view& codes) const
+{
+    std::vector<float> distances(codes.n_codes);
+    float dummy = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_weighted_distance_batch(query_, &codes,
+                                                       distances.empty() ? &dummy : distances.data());
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return distances;
+}
+
+double hamming::similarity(const unsigned char str1[], const unsigned char str2[], size_t n_bytes,
+                           similarity_metric metric, implementation impl)
+{
+    double result = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_similarity(str1, str2, n_bytes, static_cast<hamming_c::hamming_similarity_t>(metric),
+                                          &result, static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return result;
+}
+
+std::vector<double> hamming::similarity_batch(const unsigned char query[], const code_set_view& codes,
+                                              similarity_metric metric, implementation impl)
+{
+    std::vector<double> similarities(codes.n_codes);
+    double dummy = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_similarity_batch(query, &codes, static_cast<hamming_c::hamming_similarity_t>(metric),
+                                                similarities.empty() ? &dummy : similarities.data(),
+                                                static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return similarities;
+}
+
+namespace hamming
+{
+    namespace
+    {
+        // what the match callbacks append to; an exception can't cross the
+        // C API, so a failed allocation is only recorded, and the matches
+        // which follow it are dropped
+        template<typename Match>
+        struct match_collector
+        {
+            match_collector() : out_of_memory(false) {}
+
+            void add(const Match& match)
+            {
+                if (out_of_memory)
+                    return;
+                try
+                {
+                    matches.push_back(match);
+                }
+                catch (const std::bad_alloc&)
+                {
+                    out_of_memory = true;
+                }
+            }
+
+            std::vector<Match> matches;
+            bool out_of_memory;
+        };
+
+        void HAMMING_CALL collect_similarity_match(similarity_match match, void* user_data)
+        {
+            static_cast<match_collector<similarity_match>*>(user_data)->add(match);
+        }
+
+        void HAMMING_CALL collect_position(size_t position, size_t, void* user_data)
+        {
+            static_cast<match_collector<size_t>*>(user_data)->add(position);
+        }
+
+        void HAMMING_CALL collect_match(size_t position, size_t distance, void* user_data)
+        {
+            static_cast<match_collector<sliding_stream::match>*>(user_data)->add(
+                    sliding_stream::match(position, distance));
+        }
+    }
+}
+
+hamming::tanimoto_index::tanimoto_index(const code_set_view& codes)
+    : index_(nullptr)
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_tanimoto_index_create(&codes, &index_);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
 
+hamming::tanimoto_index::~tanimoto_index()
+{
+    hamming_c::hamming_tanimoto_index_destroy(index_);
+}
+
+std::vector<hamming::similarity_match> hamming::tanimoto_index::top_k(const unsigned char query[], size_t k,
+                                                                      double min_similarity,
+                                                                      implementation impl) const
+{
+    std::vector<similarity_match> results(k);
+    size_t n_results = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_tanimoto_top_k(index_, query, k, min_similarity, results.data(), &n_results,
+                                              static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    results.resize(n_results);
+    return results;
+}
+
+std::vector<hamming::similarity_match> hamming::tanimoto_index::threshold(const unsigned char query[],
+                                                                          double min_similarity,
+                                                                          implementation impl) const
+{
+    // one pass, with the matches collected as they are handed over,
+    // instead of counting them first
+    match_collector<similarity_match> results;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_tanimoto_threshold_each(index_, query, min_similarity, collect_similarity_match,
+                                                       &results, static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status == hamming_c::HAMMING_STATUS_SUCCESS && results.out_of_memory)
+        status = hamming_c::HAMMING_STATUS_OUT_OF_MEMORY;
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return results.matches;
+}
+
+hamming::pages hamming::tanimoto_index::page_kind() const
+{
+    pages result = hamming_c::HAMMING_PAGES_NORMAL;
+    hamming_c::hamming_status_t status = hamming_c::hamming_tanimoto_index_pages(index_, &result);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return result;
+}
+
+std::vector<size_t> hamming::sliding_distance(const unsigned char pattern[], size_t pattern_bytes,
+                                              const unsigned char stream[], size_t stream_bytes,
+                                              slide granularity, implementation impl)
+{
+    const hamming_c::hamming_slide_t c_slide = static_cast<hamming_c::hamming_slide_t>(granularity);
+    std::vector<size_t> distances(hamming_c::hamming_sliding_offsets(pattern_bytes, stream_bytes, c_slide));
+    // the library rejects a null output pointer, even for 0 offsets
+    size_t dummy = 0;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_sliding_distance(pattern, pattern_bytes, stream, stream_bytes, c_slide,
+                                                distances.empty() ? &dummy : distances.data(),
+                                                static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return distances;
+}
+
+std::vector<size_t> hamming::sliding_search(const unsigned char pattern[], size_t pattern_bytes,
+                                            const unsigned char stream[], size_t stream_bytes,
+                                            size_t max_distance, slide granularity, implementation impl)
+{
+    // the whole stream as a single chunk: one pass, with the matches
+    // collected as they are found, instead of counting them first
+    hamming_c::hamming_sliding_stream_t* state = nullptr;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_sliding_stream_create(pattern, pattern_bytes,
+                                                     static_cast<hamming_c::hamming_slide_t>(granularity),
+                                                     max_distance, &state,
+                                                     static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    match_collector<size_t> positions;
+    status = hamming_c::hamming_sliding_stream_feed(state, stream, stream_bytes, collect_position, &positions);
+    hamming_c::hamming_sliding_stream_destroy(state);
+    if (status == hamming_c::HAMMING_STATUS_SUCCESS && positions.out_of_memory)
+        status = hamming_c::HAMMING_STATUS_OUT_OF_MEMORY;
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return positions.matches;
+}
+
+hamming::sliding_stream::sliding_stream(const unsigned char pattern[], size_t pattern_bytes,
+                                        size_t max_distance, slide granularity, implementation impl)
+    : stream_(nullptr)
+{
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_sliding_stream_create(pattern, pattern_bytes,
+                                                     static_cast<hamming_c::hamming_slide_t>(granularity),
+                                                     max_distance, &stream_,
+                                                     static_cast<hamming_c::hamming_impl_t>(impl));
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+hamming::sliding_stream::~sliding_stream()
+{
+    hamming_c::hamming_sliding_stream_destroy(stream_);
+}
+
+std::vector<hamming::sliding_stream::match> hamming::sliding_stream::feed(const unsigned char chunk[],
+                                                                          size_t chunk_bytes)
+{
+    match_collector<match> matches;
+    hamming_c::hamming_status_t status =
+            hamming_c::hamming_sliding_stream_feed(stream_, chunk, chunk_bytes, collect_match, &matches);
+    if (status == hamming_c::HAMMING_STATUS_SUCCESS && matches.out_of_memory)
+        status = hamming_c::HAMMING_STATUS_OUT_OF_MEMORY;
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return matches.matches;
+}
+
+hamming::stats hamming::get_stats()
+{
+    stats result;
+    hamming_c::hamming_status_t status = hamming_c::hamming_get_stats(&result);
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return result;
+}
+
+void hamming::reset_stats()
+{
+    hamming_c::hamming_status_t status = hamming_c::hamming_reset_stats();
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+}
+
+std::string hamming::stats_text()
+{
+    std::string text;
+    size_t length = 0;
+    // first pass measures, second pass fills; the counters may grow in
+    // between, hence the loop
+    do
+    {
+        text.resize(length + 1);
+        hamming_c::hamming_status_t status = hamming_c::hamming_stats_text(&text[0], text.size(), &length);
+        if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+            throw std::system_error(status, hamming_error_category::instance());
+    } while (length >= text.size());
+    text.resize(length);
+
+    return text;
+}
+
+const char* hamming::implementation_name(implementation impl)
+{
+    return hamming_c::hamming_impl_name(static_cast<hamming_c::hamming_impl_t>(impl));
+}
+
+std::vector<unsigned long long> hamming::latency_histogram(entry_point entry)
+{
+    std::vector<unsigned long long> counts(HAMMING_LATENCY_BUCKETS);
+    hamming_c::hamming_status_t status = hamming_c::hamming_get_latency_histogram(entry, counts.data());
+    if (status != hamming_c::HAMMING_STATUS_SUCCESS)
+        throw std::system_error(status, hamming_error_category::instance());
+
+    return counts;
+}
+
+unsigned long long hamming::latency_quantile(const std::vector<unsigned long long>& histogram, double q)
+{
+    unsigned long long n_calls = 0;
+    for (size_t bucket = 0; bucket < histogram.size(); ++bucket)
+        n_calls += histogram[bucket];
+    if (!n_calls)
+        return 0;
+
+    const double rank = q * n_calls;
+    unsigned long long cumulative = 0;
+    size_t bucket = 0;
+    for (; bucket + 1 < histogram.size(); ++bucket)
+        if ((cumulative += histogram[bucket]) >= rank)
+            break;
+    return hamming_c::hamming_latency_bucket_lower(bucket + 1) - 1;
+}
+
+size_t hamming::distance(const std::vector<bool>& v1, const std::vector<bool>& v2)
+{
     if(v1.size() != v2.size())
         throw std::invalid_argument("input blobs must have the same size");
 
-    std::vector<bool> xored;
-    xored.reserve(v1.size());
-    std::transform(v1.begin(), v1.end(), v2.begin(), xored.begin(),
-                   [](bool bit1, bool bit2){return bit1 ^ bit2;});
+    const size_t n_bits = v1.size();
+    if (!n_bits)
+        return 0;
+
+#if defined(__GLIBCXX__) && !defined(_GLIBCXX_DEBUG) && !defined(_GLIBCXX_ASSERTIONS)
+    // libstdc++ keeps the bits packed in an array of _Bit_type words,
+    // starting at bit 0 of the first word, and exposes the word pointer
+    // through the (public) members of the bit iterator; the checked
+    // containers of its debug modes wrap the iterators, and hide them
+    typedef std::_Bit_type word_t;
+    const size_t bits_per_word = static_cast<size_t>(std::_S_word_bit);
+    const word_t* words1 = v1.begin()._M_p;
+    const word_t* words2 = v2.begin()._M_p;
+
+    const size_t n_full_words = n_bits / bits_per_word;
+    size_t dist = 0;
+    if (n_full_words)
+        dist = distance(reinterpret_cast<const unsigned char*>(words1),
+                        reinterpret_cast<const unsigned char*>(words2),
+                        n_full_words * sizeof(word_t));
+
+    // the bits past size() in the last word are not guaranteed to be cleared
+    // (e.g. after pop_back()), so they have to be masked out
+    const size_t remaining_bits = n_bits % bits_per_word;
+    if (remaining_bits)
+    {
+        const word_t mask = (word_t(1) << remaining_bits) - 1;
+        const word_t last1 = words1[n_full_words] & mask;
+        const word_t last2 = words2[n_full_words] & mask;
+        dist += distance(reinterpret_cast<const unsigned char*>(&last1),
+                         reinterpret_cast<const unsigned char*>(&last2),
+                         sizeof(word_t));
+    }
+
+    return dist;
+#else
+    // the word storage is not reachable, so we pack the bits into 64 bit
+    // words on the stack and hand them to the kernels one buffer at a time
+    const size_t buffer_words = 64;
+    unsigned long long int buffer1[buffer_words], buffer2[buffer_words];
+
+    size_t dist = 0;
+    std::vector<bool>::const_iterator it1 = v1.begin(), it2 = v2.begin();
+    for (size_t bit_idx = 0; bit_idx < n_bits;)
+    {
+        size_t word_idx = 0;
+        for (; word_idx < buffer_words && bit_idx < n_bits; ++word_idx)
+        {
+            buffer1[word_idx] = buffer2[word_idx] = 0;
+            for (unsigned int shift = 0; shift < 64 && bit_idx < n_bits; ++shift, ++bit_idx, ++it1, ++it2)
+            {
+                buffer1[word_idx] |= static_cast<unsigned long long int>(*it1) << shift;
+                buffer2[word_idx] |= static_cast<unsigned long long int>(*it2) << shift;
+            }
+        }
+        dist += distance(reinterpret_cast<const unsigned char*>(buffer1),
+                         reinterpret_cast<const unsigned char*>(buffer2),
+                         word_idx * sizeof(buffer1[0]));
+    }
+
+    return dist;
+#endif
+}
+
+size_t hamming::distance(const dynamic_bitset& b1, const dynamic_bitset& b2, implementation impl)
+{
+    if(b1.size() != b2.size())
+        throw std::invalid_argument("input bitsets must have the same size");
+
+    if (b1.empty())
+        return 0;
 
-    return static_cast<size_t>(std::count(xored.begin(), xored.end(), true));
+    // bits past size() are kept cleared, so whole words can be compared
+    return distance(b1.bytes(), b2.bytes(), b1.num_bytes(), impl);
 }
\ No newline at end of file
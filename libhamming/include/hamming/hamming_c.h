@@ -11,7 +11,10 @@
 
 #ifdef _WIN32
 // we use _WIN32 instead of _MSC_VER, as mingw, cygwin understand __declspec
-#ifdef HAMMING_EXPORT
+#ifdef HAMMING_STATIC
+// static library (hamming_static): nothing to import or export
+#define HAMMING_API
+#elif defined(HAMMING_EXPORT)
 #define HAMMING_API __declspec(dllexport)
 #else
 #define HAMMING_API __declspec(dllimport)
@@ -38,7 +41,15 @@ typedef enum
     HAMMING_STATUS_BAD_PARAM_STR_2              = 2,
     HAMMING_STATUS_BAD_PARAM_DISTANCE           = 3,
     HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE = 4,
-    HAMMING_STATUS_UNKNOWN_IMPLEMENTATION       = 5
+    HAMMING_STATUS_UNKNOWN_IMPLEMENTATION       = 5,
+    HAMMING_STATUS_BAD_PARAM_SIZE               = 6,
+    HAMMING_STATUS_BAD_PARAM_OUTPUT             = 7,
+    HAMMING_STATUS_OUT_OF_MEMORY                = 8,
+    // a file couldn't be opened, read, written or mapped
+    HAMMING_STATUS_IO_ERROR                     = 9,
+    // a file isn't a code database (of a version this library can read),
+    // or is corrupt
+    HAMMING_STATUS_BAD_FORMAT                   = 10
 } hamming_status_t;
 
 // select implementation (useful for benchmarking)
@@ -48,7 +59,9 @@ typedef enum
 // processors, as modern arithmetic instructions take less than 1 cycle
 typedef enum
 {
-#if defined(HAMMING_WITH_VANILLA) || defined(HAMMING_WITH_2x32) || defined(HAMMING_WITH_LUT) || defined(HAMMING_WITH_SPARSE) || defined(HAMMING_WITH_INTRINSICS)
+#if defined(HAMMING_WITH_VANILLA) || defined(HAMMING_WITH_2x32) || defined(HAMMING_WITH_LUT) || defined(HAMMING_WITH_SPARSE) || defined(HAMMING_WITH_INTRINSICS) || \
+    defined(HAMMING_WITH_UNROLLED) || defined(HAMMING_WITH_HARLEY_SEAL) || defined(HAMMING_WITH_VECTOR) || \
+    defined(HAMMING_WITH_INTERLEAVED)
     HAMMING_IMPL_DEFAULT = 0,
 #endif
 
@@ -65,10 +78,209 @@ typedef enum
 #endif
 
 #ifdef HAMMING_WITH_SPARSE
-    HAMMING_IMPL_SPARSE = 4
+    HAMMING_IMPL_SPARSE = 4,
+#endif
+
+#ifdef HAMMING_WITH_LUT
+    // 64KB table, half the lookups of HAMMING_IMPL_LUT
+    HAMMING_IMPL_LUT16 = 5,
+#endif
+
+#ifdef HAMMING_WITH_UNROLLED
+    // the intrinsic, over 4 independent accumulators
+    HAMMING_IMPL_UNROLLED = 6,
+#endif
+
+#ifdef HAMMING_WITH_HARLEY_SEAL
+    // carry-save adders and vanilla popcounts, for targets without popcnt
+    HAMMING_IMPL_HARLEY_SEAL = 7,
+#endif
+
+#ifdef HAMMING_WITH_VECTOR
+    // SWAR on GCC / Clang generic vectors, for targets without intrinsics
+    HAMMING_IMPL_VECTOR = 8,
+#endif
+
+#ifdef HAMMING_WITH_INTERLEAVED
+    // the one-to-many scans (hamming_distance_batch) compare the query
+    // against 8 codes at a time, which pays off for short codes; the same as
+    // HAMMING_IMPL_DEFAULT for everything else
+    HAMMING_IMPL_INTERLEAVED = 9,
 #endif
 } hamming_impl_t;
 
+// one more than the largest hamming_impl_t value
+#define HAMMING_N_IMPLS 10
+
+// a set of equally sized codes, laid out one after the other; code i starts
+// at data + i * stride (a stride of 0 means tightly packed, i.e. code_bytes)
+typedef struct
+{
+    const unsigned char* data;
+    size_t n_codes;
+    size_t code_bytes;
+    size_t stride;
+} hamming_code_set_t;
+
+// pages backing a buffer; the huge ones cut the dTLB misses of the scans
+// over large code sets
+typedef enum
+{
+    HAMMING_PAGES_NORMAL      = 0,
+    // advised to the kernel as transparent huge pages (madvise), which it
+    // may or may not grant, now or later (see hamming_buffer_huge_page_bytes)
+    HAMMING_PAGES_TRANSPARENT = 1,
+    // reserved from the hugetlb pool (vm.nr_hugepages)
+    HAMMING_PAGES_HUGE_2MB    = 2,
+    HAMMING_PAGES_HUGE_1GB    = 3
+} hamming_pages_t;
+
+// a zeroed, page aligned buffer for code sets, backed by the largest huge
+// pages available for its size: hugetlb pages if the pool has enough of
+// them, then transparent huge pages, then normal pages. The tanimoto index
+// allocates its rows the same way.
+typedef struct hamming_buffer hamming_buffer_t;
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_buffer_create(const size_t n_bytes,
+                                                                hamming_buffer_t** buffer);
+
+HAMMING_API unsigned char* HAMMING_CALL hamming_buffer_data(hamming_buffer_t* buffer);
+
+HAMMING_API size_t HAMMING_CALL hamming_buffer_size(const hamming_buffer_t* buffer);
+
+// the kind of pages which were obtained
+HAMMING_API hamming_pages_t HAMMING_CALL hamming_buffer_pages(const hamming_buffer_t* buffer);
+
+// the bytes of the buffer which are backed by huge pages at the moment
+// (for transparent huge pages, only the touched ones can be);
+// HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE if that can't be told
+HAMMING_API hamming_status_t HAMMING_CALL hamming_buffer_huge_page_bytes(const hamming_buffer_t* buffer,
+                                                                         size_t* huge_bytes);
+
+HAMMING_API void HAMMING_CALL hamming_buffer_destroy(hamming_buffer_t* buffer);
+
+// for memory the library didn't allocate, e.g. a code set mapped from a
+// file: advises the whole 2MB pages of the range as transparent huge pages,
+// and measures how much of the range is backed by huge pages (of any kind).
+// HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE where the system can't do it
+// (e.g. file mappings on kernels without THP for files)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_advise_huge_pages(const void* data, const size_t n_bytes);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_huge_page_bytes(const void* data, const size_t n_bytes,
+                                                                  size_t* huge_bytes);
+
+// code databases: files holding a code set, laid out so that it is used in
+// place once mapped, with no parsing nor copying:
+//
+//     header (128 bytes): magic "HAMMDB\r\n", u32 version (the
+//         HAMMING_VERSION of the writer), u32 header bytes, u32 byte order
+//         mark (0x01020304), u32 flags, u64 code_bytes, u64 n_codes, u64
+//         stride, u64 alignment, u64 offsets of the codes, ids and weights
+//         sections (0 for the missing ones), u64 file bytes, u64 checksum
+//     codes: n_codes rows of stride bytes, the code then zero padding
+//     ids (optional): n_codes u64
+//     weights (optional): n_codes u32, the popcounts of the codes
+//
+// Sections start at multiples of 64 bytes. The rows are aligned to
+// alignment, the smallest power of two not less than code_bytes, up to 64
+// (i.e. codes up to 64 bytes never straddle a cache line), and to 64 bytes
+// for larger ones. The checksum covers everything after the header. The
+// integers are in the byte order of the writer, which the reader must share.
+#define HAMMING_DB_HEADER_BYTES 128
+// the first 8 bytes of every database
+#define HAMMING_DB_MAGIC "HAMMDB\r\n"
+
+// hamming_db_write flags
+// precompute the weights of the codes (the weights section)
+#define HAMMING_DB_WITH_WEIGHTS 1
+
+// ids (which may be null) are written as the ids section. The database
+// replaces path atomically and durably: a crash leaves the previous version
+// or the new one, whole
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_write(const char* path,
+                                                           const hamming_code_set_t* codes,
+                                                           const unsigned long long ids[],
+                                                           const int flags);
+
+typedef struct hamming_db hamming_db_t;
+
+// hamming_db_open flags
+// check the checksum, which reads the whole file, instead of only the header
+#define HAMMING_DB_VERIFY 1
+
+// maps the file read-only, and advises it as huge pages; the header is
+// checked for consistency with the size of the file
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_open(const char* path,
+                                                          const int flags,
+                                                          hamming_db_t** db);
+
+HAMMING_API void HAMMING_CALL hamming_db_close(hamming_db_t* db);
+
+// the codes, in place (valid until the database is closed)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_codes(const hamming_db_t* db, hamming_code_set_t* codes);
+
+// null if the database has no ids (or weights)
+HAMMING_API const unsigned long long* HAMMING_CALL hamming_db_ids(const hamming_db_t* db);
+
+HAMMING_API const unsigned int* HAMMING_CALL hamming_db_weights(const hamming_db_t* db);
+
+// HAMMING_VERSION of the library which wrote it
+HAMMING_API int HAMMING_CALL hamming_db_version(const hamming_db_t* db);
+
+// compares the checksum against the contents (HAMMING_STATUS_BAD_FORMAT on
+// a mismatch)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_verify(const hamming_db_t* db);
+
+// versioned handles: the current version of a code set, which is replaced
+// as a whole while it is being read. A new version is built aside (a
+// database is opened and its pages faulted in, or a code set is copied),
+// then swapped in atomically; the readers which pinned the old one keep
+// reading it, and it is freed once the last of them is done (epoch-based
+// reclamation). Readers never wait, neither for a load nor for each other.
+//
+// Loads run in a background thread, on a single core, so that the queries
+// keep the others; the retired versions are reclaimed by that thread too.
+typedef struct hamming_versioned hamming_versioned_t;
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_create(hamming_versioned_t** handle);
+
+// there must be no snapshots left
+HAMMING_API void HAMMING_CALL hamming_versioned_destroy(hamming_versioned_t* handle);
+
+// starts loading the database (flags as for hamming_db_open), which
+// replaces the current version once it is ready; a load requested while
+// another one is pending replaces the pending one
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_load(hamming_versioned_t* handle,
+                                                                 const char* path,
+                                                                 const int flags);
+
+// waits until no load is pending, and returns the status of the last one
+// (the current version is unchanged if it failed)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_wait(hamming_versioned_t* handle);
+
+// a copy of the codes becomes the current version, in the calling thread
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_publish(hamming_versioned_t* handle,
+                                                                    const hamming_code_set_t* codes);
+
+// a version, pinned by a reader until it releases it
+typedef struct hamming_snapshot hamming_snapshot_t;
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_snapshot_acquire(hamming_versioned_t* handle,
+                                                                   hamming_snapshot_t** snapshot);
+
+HAMMING_API void HAMMING_CALL hamming_snapshot_release(hamming_snapshot_t* snapshot);
+
+// 1 for the first version which was swapped in, then increasing; 0 (and no
+// codes) before that
+HAMMING_API unsigned long long HAMMING_CALL hamming_snapshot_version(const hamming_snapshot_t* snapshot);
+
+// the codes of the version (valid until the snapshot is released)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_snapshot_codes(const hamming_snapshot_t* snapshot,
+                                                                 hamming_code_set_t* codes);
+
+// those of a database, if it has them; null otherwise
+HAMMING_API const unsigned long long* HAMMING_CALL hamming_snapshot_ids(const hamming_snapshot_t* snapshot);
+
 // NOTE 1: we return primitive status codes, as we don't want to throw
 // exceptions across shared object boundaries
 
@@ -78,6 +290,539 @@ HAMMING_API hamming_status_t HAMMING_CALL hamming_distance(const unsigned char s
                                                            size_t* distance,
                                                            hamming_impl_t = HAMMING_IMPL_DEFAULT);
 
+// compares n_bits bits starting at arbitrary, independent bit offsets; bit k
+// of a buffer is bit (k % 8) of byte (k / 8), i.e. bytes are read lsb first
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_bits(const unsigned char str1[],
+                                                                const size_t bit_offset1,
+                                                                const unsigned char str2[],
+                                                                const size_t bit_offset2,
+                                                                const size_t n_bits,
+                                                                size_t* distance,
+                                                                hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// one-to-many: distances[i] = distance between query and code i of codes;
+// query has codes->code_bytes bytes
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_batch(const unsigned char query[],
+                                                                 const hamming_code_set_t* codes,
+                                                                 size_t distances[],
+                                                                 hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// process-wide options of the scans over code sets (the batch entry points
+// and the tanimoto index searches)
+typedef struct
+{
+    // prefetch the rows this many bytes ahead of the one being compared (0,
+    // the default, leaves it to the hardware prefetchers); worth it for
+    // sets much larger than the last level cache, in particular with
+    // strided rows, which the hardware prefetchers follow less well
+    size_t prefetch_bytes;
+    // nonzero: prefetch with the non-temporal hint (prefetchnta on x86), so
+    // that a one-pass scan of a large set evicts less of the caller's
+    // working set from the caches; only has effect along with
+    // prefetch_bytes
+    int non_temporal;
+} hamming_scan_options_t;
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_set_scan_options(const hamming_scan_options_t* options);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_get_scan_options(hamming_scan_options_t* options);
+
+// a copy of a code set, partitioned across the NUMA nodes of the machine:
+// each node gets a contiguous range of the codes (in proportion to its
+// cpus), stored in memory local to it, and a worker thread pinned to its
+// cpus, which scans that range. On machines with a single node (or where
+// the topology is unknown), it is a plain copy, scanned by the caller
+typedef struct hamming_numa_code_set hamming_numa_code_set_t;
+
+// n_nodes == 0 uses the nodes of the system; any other value emulates that
+// many nodes, by splitting the cpus the process may run on into as many
+// groups (which exercises the partitioning on single node machines).
+// The copy is packed, i.e. its shards have a stride of code_bytes
+HAMMING_API hamming_status_t HAMMING_CALL hamming_numa_code_set_create(const hamming_code_set_t* codes,
+                                                                       const size_t n_nodes,
+                                                                       hamming_numa_code_set_t** numa_codes);
+
+HAMMING_API void HAMMING_CALL hamming_numa_code_set_destroy(hamming_numa_code_set_t* numa_codes);
+
+HAMMING_API size_t HAMMING_CALL hamming_numa_code_set_nodes(const hamming_numa_code_set_t* numa_codes);
+
+// the codes placed on a node, which are codes first_code, first_code + 1,
+// ... of the original set; valid until the set is destroyed
+HAMMING_API hamming_status_t HAMMING_CALL hamming_numa_code_set_shard(const hamming_numa_code_set_t* numa_codes,
+                                                                      const size_t node,
+                                                                      hamming_code_set_t* shard,
+                                                                      size_t* first_code);
+
+// hamming_distance_batch over all the codes, each node scanning its own
+// shard; concurrent calls on the same set take turns
+HAMMING_API hamming_status_t HAMMING_CALL hamming_numa_distance_batch(hamming_numa_code_set_t* numa_codes,
+                                                                      const unsigned char query[],
+                                                                      size_t distances[],
+                                                                      hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// a code found by a search
+typedef struct
+{
+    size_t index; // of the code in the set
+    size_t distance;
+} hamming_match_t;
+
+// the (at most) k codes closest to the query, by increasing distance (ties
+// by increasing index); results must hold k elements, and n_results
+// receives their number
+HAMMING_API hamming_status_t HAMMING_CALL hamming_knn_search(const unsigned char query[],
+                                                             const hamming_code_set_t* codes,
+                                                             const size_t k,
+                                                             hamming_match_t results[],
+                                                             size_t* n_results,
+                                                             hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// all the codes within max_distance of the query, ordered as for k-NN; the
+// first (at most) capacity are written, and n_results receives the total
+// number of matches
+HAMMING_API hamming_status_t HAMMING_CALL hamming_radius_search(const unsigned char query[],
+                                                                const hamming_code_set_t* codes,
+                                                                const size_t max_distance,
+                                                                hamming_match_t results[],
+                                                                const size_t capacity,
+                                                                size_t* n_results,
+                                                                hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// many searches over the same set, in a single shared scan: every block of
+// codes is compared against all the queries while it is in the cache, so
+// the set is read from memory once for the whole batch (e.g. the queries a
+// server received while it was busy with the previous batch)
+typedef enum
+{
+    // the (at most) param closest codes, as hamming_knn_search
+    HAMMING_SEARCH_KNN    = 0,
+    // the codes within a distance of param, as hamming_radius_search
+    HAMMING_SEARCH_RADIUS = 1
+} hamming_search_kind_t;
+
+typedef struct
+{
+    hamming_search_kind_t kind;
+    size_t param;
+    // the first (at most) capacity results are written here
+    hamming_match_t* results;
+    size_t capacity;
+    // receives the number of results, which, for radius searches, may be
+    // larger than capacity
+    size_t n_results;
+} hamming_search_t;
+
+// queries[i] is the query of searches[i], of codes->code_bytes bytes
+HAMMING_API hamming_status_t HAMMING_CALL hamming_search_batch(const unsigned char* const queries[],
+                                                               hamming_search_t searches[],
+                                                               const size_t n_searches,
+                                                               const hamming_code_set_t* codes,
+                                                               hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// merges n_lists lists of matches, each ordered as the searches order them
+// (e.g. the results of the searches of the shards of a set), into a single
+// one; offsets (which may be null) are added to the indexes of each list,
+// e.g. the index of the first code of each shard. The first (at most)
+// capacity are written, and n_results receives the total number of matches
+HAMMING_API hamming_status_t HAMMING_CALL hamming_merge_matches(const hamming_match_t* const lists[],
+                                                                const size_t sizes[],
+                                                                const size_t offsets[],
+                                                                const size_t n_lists,
+                                                                hamming_match_t results[],
+                                                                const size_t capacity,
+                                                                size_t* n_results);
+
+// mutable code sets: codes are appended and deleted while searches run, and
+// the searches take no locks. The codes live in segments of a few thousand
+// rows; appends fill the last one, and deletions only mark the codes
+// (tombstones), whose slots are reclaimed by compaction: it rewrites the
+// segments which have deleted codes (merging neighbours which fit in one)
+// aside, and swaps them in. Every segment also keeps the range of the
+// weights of its codes, which bounds the distance between a query and any
+// of them, so the searches skip the segments which can't hold a match;
+// compaction tightens the ranges which deletions left loose.
+//
+// Searches and hamming_mutable_set_size never wait, and may run
+// concurrently with anything but hamming_mutable_set_destroy; appends,
+// deletions and the swaps of the compaction take turns. The segments
+// replaced by a compaction are freed after the last search which may be
+// reading them is done: by the background compactor, which retries every
+// few milliseconds, or else by the next append or compaction. The codes are
+// identified by the ids appends assign them (consecutive, from 0), which
+// compaction preserves; these are the indexes the searches report.
+typedef struct hamming_mutable_set hamming_mutable_set_t;
+
+// hamming_mutable_set_create flags
+// compact in a background thread, whenever deletions leave a quarter of
+// the slots of a (full) segment dead
+#define HAMMING_MUTABLE_BACKGROUND_COMPACTION 1
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_create(const size_t code_bytes,
+                                                                     const int flags,
+                                                                     hamming_mutable_set_t** set);
+
+HAMMING_API void HAMMING_CALL hamming_mutable_set_destroy(hamming_mutable_set_t* set);
+
+// codes->code_bytes must be the code size of the set; first_id receives
+// the id of the first code (the others follow). All or none are appended
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_append(hamming_mutable_set_t* set,
+                                                                     const hamming_code_set_t* codes,
+                                                                     size_t* first_id);
+
+// the ids which aren't in the set (any more) are skipped; n_removed (which
+// may be null) receives the number of codes deleted
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_remove(hamming_mutable_set_t* set,
+                                                                     const size_t ids[],
+                                                                     const size_t n_ids,
+                                                                     size_t* n_removed);
+
+// n_codes receives the number of codes in the set, and n_slots that of the
+// rows they take, deleted codes which weren't reclaimed yet included
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_size(hamming_mutable_set_t* set,
+                                                                   size_t* n_codes,
+                                                                   size_t* n_slots);
+
+// compacts now, in the calling thread
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_compact(hamming_mutable_set_t* set);
+
+// as hamming_knn_search and hamming_radius_search, over the codes of the
+// set at the time of the call (appends and deletions which run meanwhile
+// may or may not be seen)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_knn_search(const unsigned char query[],
+                                                                     hamming_mutable_set_t* set,
+                                                                     const size_t k,
+                                                                     hamming_match_t results[],
+                                                                     size_t* n_results,
+                                                                     hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_radius_search(const unsigned char query[],
+                                                                        hamming_mutable_set_t* set,
+                                                                        const size_t max_distance,
+                                                                        hamming_match_t results[],
+                                                                        const size_t capacity,
+                                                                        size_t* n_results,
+                                                                        hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// distance histograms: histogram[d] receives the number of pairs at
+// distance d, and must hold 8 * code_bytes + 1 bins. The distances are
+// binned as they are computed (in per-thread histograms, merged at the end),
+// so they are never materialized
+typedef struct
+{
+    // 0 for all pairs; otherwise, the number of pairs drawn uniformly at
+    // random (with replacement)
+    unsigned long long n_samples;
+    // the sampled pairs only depend on the seed, not on the number of threads
+    unsigned long long seed;
+} hamming_histogram_options_t;
+
+// all (or sampled) pairs of a query and a code; options may be null
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_histogram(const hamming_code_set_t* queries,
+                                                                     const hamming_code_set_t* codes,
+                                                                     unsigned long long histogram[],
+                                                                     const hamming_histogram_options_t* options,
+                                                                     hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// all (or sampled) pairs of distinct codes of the same set (each unordered
+// pair once)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_histogram_self(const hamming_code_set_t* codes,
+                                                                          unsigned long long histogram[],
+                                                                          const hamming_histogram_options_t* options,
+                                                                          hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// population count (hamming weight) of a buffer
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weight(const unsigned char str[],
+                                                         const size_t n_bytes,
+                                                         size_t* weight,
+                                                         hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// weights[i] = population count of code i of codes
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weights(const hamming_code_set_t* codes,
+                                                          size_t weights[],
+                                                          hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// masked distance, e.g. for iris codes with occlusion masks:
+// distance = popcount((str1 ^ str2) & mask1 & mask2)
+// n_valid  = popcount(mask1 & mask2)
+// the normalized distance is distance / n_valid
+HAMMING_API hamming_status_t HAMMING_CALL hamming_masked_distance(const unsigned char str1[],
+                                                                  const unsigned char mask1[],
+                                                                  const unsigned char str2[],
+                                                                  const unsigned char mask2[],
+                                                                  const size_t n_bytes,
+                                                                  size_t* distance,
+                                                                  size_t* n_valid,
+                                                                  hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// one-to-many masked distance; mask i of masks belongs to code i of codes,
+// and both sets must have the same number and size of codes. Any of the
+// outputs may be null, but not all of them; scores are the normalized
+// distances, and are 1 for pairs without common valid bits
+HAMMING_API hamming_status_t HAMMING_CALL hamming_masked_distance_batch(const unsigned char query[],
+                                                                        const unsigned char query_mask[],
+                                                                        const hamming_code_set_t* codes,
+                                                                        const hamming_code_set_t* masks,
+                                                                        size_t distances[],
+                                                                        size_t n_valid[],
+                                                                        double scores[],
+                                                                        hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// weighted distance: sum of weights[k] over the bits k in which the query
+// and a code differ. The query and its weights are folded into per-nibble
+// lookup tables once, so a comparison costs two table lookups per byte
+typedef struct hamming_weighted_query hamming_weighted_query_t;
+
+// weights has 8 * n_bytes elements, indexed by bit (lsb first)
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weighted_query_create(const unsigned char query[],
+                                                                        const float weights[],
+                                                                        const size_t n_bytes,
+                                                                        hamming_weighted_query_t** weighted_query);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weighted_distance(const hamming_weighted_query_t* weighted_query,
+                                                                    const unsigned char code[],
+                                                                    float* distance);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weighted_distance_batch(const hamming_weighted_query_t* weighted_query,
+                                                                          const hamming_code_set_t* codes,
+                                                                          float distances[]);
+
+HAMMING_API void HAMMING_CALL hamming_weighted_query_destroy(hamming_weighted_query_t* weighted_query);
+
+// similarity of binary fingerprints (e.g. chemical ones), with
+// c = popcount(str1 & str2), w1 = popcount(str1), w2 = popcount(str2):
+// tanimoto = c / (w1 + w2 - c) (equals jaccard for bit vectors)
+// dice     = 2c / (w1 + w2)
+// both are 0 if both fingerprints are empty
+typedef enum
+{
+    HAMMING_SIMILARITY_TANIMOTO = 0,
+    HAMMING_SIMILARITY_JACCARD  = 0,
+    HAMMING_SIMILARITY_DICE     = 1
+} hamming_similarity_t;
+
+typedef struct
+{
+    size_t index; // of the code in the set the index was built from
+    double similarity;
+} hamming_similarity_match_t;
+
+// fused kernel: the intersection count and both weights, in a single pass
+HAMMING_API hamming_status_t HAMMING_CALL hamming_similarity_counts(const unsigned char str1[],
+                                                                    const unsigned char str2[],
+                                                                    const size_t n_bytes,
+                                                                    size_t* n_common,
+                                                                    size_t* weight1,
+                                                                    size_t* weight2,
+                                                                    hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_similarity(const unsigned char str1[],
+                                                             const unsigned char str2[],
+                                                             const size_t n_bytes,
+                                                             hamming_similarity_t metric,
+                                                             double* similarity,
+                                                             hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_similarity_batch(const unsigned char query[],
+                                                                   const hamming_code_set_t* codes,
+                                                                   hamming_similarity_t metric,
+                                                                   double similarities[],
+                                                                   hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// tanimoto search index: a copy of the codes, sorted by weight, along with
+// their weights. Queries only visit the weights allowed by the
+// Swamidass-Baldi bound, tanimoto <= min(w1, w2) / max(w1, w2), and only
+// need popcount(query & code) per candidate
+typedef struct hamming_tanimoto_index hamming_tanimoto_index_t;
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_index_create(const hamming_code_set_t* codes,
+                                                                        hamming_tanimoto_index_t** index);
+
+HAMMING_API void HAMMING_CALL hamming_tanimoto_index_destroy(hamming_tanimoto_index_t* index);
+
+// the kind of pages backing the rows of the index
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_index_pages(const hamming_tanimoto_index_t* index,
+                                                                       hamming_pages_t* pages);
+
+// the (at most) k most similar codes with a similarity of at least
+// min_similarity, by decreasing similarity (ties by increasing index);
+// results must hold k elements, and n_results receives their number
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_top_k(const hamming_tanimoto_index_t* index,
+                                                                 const unsigned char query[],
+                                                                 const size_t k,
+                                                                 const double min_similarity,
+                                                                 hamming_similarity_match_t results[],
+                                                                 size_t* n_results,
+                                                                 hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// all the codes with a similarity of at least min_similarity, ordered as
+// for top-k; the first (at most) capacity are written, and n_results
+// receives the total number of matches
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_threshold(const hamming_tanimoto_index_t* index,
+                                                                     const unsigned char query[],
+                                                                     const double min_similarity,
+                                                                     hamming_similarity_match_t results[],
+                                                                     const size_t capacity,
+                                                                     size_t* n_results,
+                                                                     hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// called for every match, in the order of hamming_tanimoto_threshold
+typedef void (HAMMING_CALL *hamming_similarity_callback_t)(hamming_similarity_match_t match, void* user_data);
+
+// the same matches as hamming_tanimoto_threshold, handed to the callback,
+// so that they are collected without knowing their number in advance
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_threshold_each(const hamming_tanimoto_index_t* index,
+                                                                          const unsigned char query[],
+                                                                          const double min_similarity,
+                                                                          hamming_similarity_callback_t callback,
+                                                                          void* user_data,
+                                                                          hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// sliding window search: distance of a pattern at every offset of a stream
+// byte mode: offset i compares pattern[0..m) to stream[i..i+m), and there
+//            are n - m + 1 offsets
+// bit mode: offset b compares the 8*m pattern bits to the stream bits
+//           [b, b + 8*m) (lsb first, as in hamming_distance_bits), and there
+//           are 8*(n - m) + 1 offsets
+typedef enum
+{
+    HAMMING_SLIDE_BYTES = 0,
+    HAMMING_SLIDE_BITS  = 1
+} hamming_slide_t;
+
+// called for every match, in increasing order of position
+typedef void (HAMMING_CALL *hamming_match_callback_t)(size_t position, size_t distance, void* user_data);
+
+// opaque state of a streaming search
+typedef struct hamming_sliding_stream hamming_sliding_stream_t;
+
+// number of offsets at which a pattern fits in a stream (0 if it doesn't)
+HAMMING_API size_t HAMMING_CALL hamming_sliding_offsets(const size_t pattern_bytes,
+                                                        const size_t stream_bytes,
+                                                        hamming_slide_t slide);
+
+// distances must hold hamming_sliding_offsets(...) elements
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_distance(const unsigned char pattern[],
+                                                                   const size_t pattern_bytes,
+                                                                   const unsigned char stream[],
+                                                                   const size_t stream_bytes,
+                                                                   hamming_slide_t slide,
+                                                                   size_t distances[],
+                                                                   hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// writes the first (at most capacity) positions at which the distance is at
+// most max_distance; n_matches receives the total number of matches, which
+// may exceed capacity. Offsets are abandoned as soon as they exceed
+// max_distance.
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_search(const unsigned char pattern[],
+                                                                 const size_t pattern_bytes,
+                                                                 const unsigned char stream[],
+                                                                 const size_t stream_bytes,
+                                                                 hamming_slide_t slide,
+                                                                 const size_t max_distance,
+                                                                 size_t positions[],
+                                                                 const size_t capacity,
+                                                                 size_t* n_matches,
+                                                                 hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+// streaming mode: the stream is fed in chunks of any size; matches which
+// straddle chunk boundaries are reported, and positions are absolute
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_stream_create(const unsigned char pattern[],
+                                                                        const size_t pattern_bytes,
+                                                                        hamming_slide_t slide,
+                                                                        const size_t max_distance,
+                                                                        hamming_sliding_stream_t** stream,
+                                                                        hamming_impl_t = HAMMING_IMPL_DEFAULT);
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_stream_feed(hamming_sliding_stream_t* stream,
+                                                                      const unsigned char chunk[],
+                                                                      const size_t chunk_bytes,
+                                                                      hamming_match_callback_t callback,
+                                                                      void* user_data);
+
+HAMMING_API void HAMMING_CALL hamming_sliding_stream_destroy(hamming_sliding_stream_t* stream);
+
+// usage counters of one implementation: calls that succeeded, bytes of
+// codes they were given (for index queries, which only scan part of the
+// index, none) and the total time spent in them
+typedef struct
+{
+    unsigned long long n_calls;
+    unsigned long long n_bytes;
+    unsigned long long nanoseconds;
+} hamming_impl_stats_t;
+
+typedef struct
+{
+    // indexed by the hamming_impl_t which ran the calls: those made with
+    // HAMMING_IMPL_DEFAULT are counted under the implementation it resolves
+    // to, i.e. HAMMING_IMPL_VANILLA where the compiler has no popcount
+    // intrinsic; the intrinsic itself is counted as HAMMING_IMPL_DEFAULT
+    hamming_impl_stats_t impls[HAMMING_N_IMPLS];
+} hamming_stats_t;
+
+// the counters are only kept when libhamming is built with
+// HAMMING_WITH_STATS; otherwise, these return
+// HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE
+HAMMING_API hamming_status_t HAMMING_CALL hamming_get_stats(hamming_stats_t* stats);
+
+// calls running concurrently with the reset may or may not be counted
+HAMMING_API hamming_status_t HAMMING_CALL hamming_reset_stats();
+
+// the counters in the Prometheus text format, NUL terminated and truncated
+// to capacity bytes; length receives the length of the full text (without
+// the NUL), so the buffer may be sized with a first call with capacity 0
+HAMMING_API hamming_status_t HAMMING_CALL hamming_stats_text(char buffer[],
+                                                             const size_t capacity,
+                                                             size_t* length);
+
+// the entry points whose latencies are recorded (with HAMMING_WITH_STATS)
+typedef enum
+{
+    HAMMING_ENTRY_DISTANCE                = 0,
+    HAMMING_ENTRY_DISTANCE_BATCH          = 1,
+    HAMMING_ENTRY_WEIGHTS                 = 2,
+    // hamming_distance_histogram and hamming_distance_histogram_self
+    HAMMING_ENTRY_HISTOGRAM               = 3,
+    HAMMING_ENTRY_MASKED_DISTANCE_BATCH   = 4,
+    HAMMING_ENTRY_WEIGHTED_DISTANCE_BATCH = 5,
+    HAMMING_ENTRY_SIMILARITY_BATCH        = 6,
+    HAMMING_ENTRY_TANIMOTO_TOP_K          = 7,
+    HAMMING_ENTRY_TANIMOTO_THRESHOLD      = 8,
+    // hamming_sliding_distance, hamming_sliding_search and
+    // hamming_sliding_stream_feed
+    HAMMING_ENTRY_SLIDING                 = 9,
+    HAMMING_ENTRY_KNN_SEARCH              = 10,
+    HAMMING_ENTRY_RADIUS_SEARCH           = 11,
+    HAMMING_ENTRY_SEARCH_BATCH            = 12,
+    HAMMING_ENTRY_MUTABLE_KNN_SEARCH      = 13,
+    HAMMING_ENTRY_MUTABLE_RADIUS_SEARCH   = 14
+} hamming_entry_point_t;
+
+// one more than the largest hamming_entry_point_t value
+#define HAMMING_N_ENTRY_POINTS 15
+
+// latencies are binned in log-linear buckets: exact up to 32ns, then 16
+// buckets per power of two (at most 6.25% wide); the last one also holds
+// everything above 2^44ns (about 5 hours)
+#define HAMMING_LATENCY_BUCKETS 656
+
+// counts[b] receives the number of calls whose latency in nanoseconds was
+// in [hamming_latency_bucket_lower(b), hamming_latency_bucket_lower(b + 1));
+// calls that failed are included. The histograms are reset along with the
+// other stats.
+HAMMING_API hamming_status_t HAMMING_CALL hamming_get_latency_histogram(hamming_entry_point_t entry_point,
+                                                                        unsigned long long counts[]);
+
+// smallest latency (in ns) binned into a bucket; for bucket ==
+// HAMMING_LATENCY_BUCKETS, the end of the last bucket
+HAMMING_API unsigned long long HAMMING_CALL hamming_latency_bucket_lower(const size_t bucket);
+
+// short lowercase name of an entry point, e.g. "distance_batch"
+HAMMING_API const char* HAMMING_CALL hamming_entry_point_name(hamming_entry_point_t entry_point);
+
+// short lowercase name of an implementation, e.g. "lut"
+HAMMING_API const char* HAMMING_CALL hamming_impl_name(hamming_impl_t impl);
+
 HAMMING_API const char* HAMMING_CALL get_hamming_error_string(hamming_status_t);
 
 HAMMING_CALL int HAMMING_CALL hamming_version();
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+
+// helpers for walking the rows of a hamming_code_set_t
+
+inline size_t code_stride(const hamming_code_set_t& codes)
+{
+    return codes.stride ? codes.stride : codes.code_bytes;
+}
+
+inline const unsigned char* code_at(const hamming_code_set_t& codes, const size_t code_idx)
+{
+    return codes.data + code_idx * code_stride(codes);
+}
+
+// size of the codes themselves, without the padding between rows
+inline unsigned long long code_set_bytes(const hamming_code_set_t& codes)
+{
+    return static_cast<unsigned long long>(codes.n_codes) * codes.code_bytes;
+}
+
+// bad_pointer is the status reported for a missing set or missing data
+inline hamming_status_t check_code_set(const hamming_code_set_t* codes, hamming_status_t bad_pointer)
+{
+    if (!codes || (codes->n_codes && !codes->data))
+        return bad_pointer;
+
+    if (!codes->code_bytes || (codes->stride && codes->stride < codes->code_bytes))
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    return HAMMING_STATUS_SUCCESS;
+}
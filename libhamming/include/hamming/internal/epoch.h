@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// epoch-based reclamation: the structures the readers walk without locks
+// are unlinked by the writers, then retired, and freed once no reader can
+// still hold them; neither side ever waits for the other.
+//
+// Readers register in the counter of the parity of the current epoch (one of
+// several striped counters, picked by thread, so that concurrent readers
+// don't fight over a cache line). The epoch only advances when nobody is
+// left in the previous one, so what was retired in epoch e is unreachable
+// by everyone once the epoch is e + 2.
+class epoch_domain
+{
+public:
+    epoch_domain();
+    // frees everything retired; there must be no readers left
+    ~epoch_domain();
+
+    // a reader's registration, for its scope: what it reads from the
+    // structures guarded by the domain stays alive until it is destroyed
+    class guard
+    {
+    public:
+        explicit guard(epoch_domain& domain);
+        ~guard();
+
+    private:
+        guard(const guard&);
+        guard& operator=(const guard&);
+
+        epoch_domain& domain_;
+        std::atomic<size_t>* counter_;
+    };
+
+    // object has been unlinked (i.e. no new reader can reach it): it is
+    // passed to deleter once the readers which could have reached it are
+    // gone. Doesn't throw: without the memory to record it, the object is
+    // leaked rather than freed under a reader
+    void retire(void* object, void (*deleter)(void*));
+
+    template<typename T>
+    void retire(T* object)
+    {
+        retire(object, [](void* retired) {delete static_cast<T*>(retired);});
+    }
+
+    // frees what can be freed now; called by retire, and by writers which
+    // want the memory back sooner. Doesn't throw
+    void collect();
+
+    // the objects waiting for their readers
+    size_t n_retired();
+
+private:
+    epoch_domain(const epoch_domain&);
+    epoch_domain& operator=(const epoch_domain&);
+
+    struct retired
+    {
+        unsigned long long epoch;
+        void* object;
+        void (*deleter)(void*);
+    };
+
+    static const size_t n_stripes = 16;
+
+    struct stripe
+    {
+        // by epoch parity
+        std::atomic<size_t> readers[2];
+        // a cache line per stripe
+        char padding[64 - 2 * sizeof(std::atomic<size_t>)];
+    };
+
+    // advances the epoch if nobody is left in the previous one
+    void try_advance();
+
+    std::atomic<unsigned long long> epoch_;
+    stripe stripes_[n_stripes];
+    std::mutex retired_mutex_;
+    std::vector<retired> retired_;
+};
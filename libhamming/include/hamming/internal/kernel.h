@@ -0,0 +1,421 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <hamming/hamming_c.h>
+#include <hamming/kernels.hpp>
+#include <hamming/internal/stats.h>
+
+// building blocks shared by all the entry points of the library: aliasing-safe
+// word loads, the kernels that sum popcounts over streams of words, and the
+// dispatcher mapping a hamming_impl_t onto a kernel
+
+// the popcounts are the inline ones from kernels.hpp, so that they are
+// inlined into the loops below, instead of costing a call per word
+typedef hamming::kernels::popcount64_t popcount_ull_t;
+
+// memcpy is the only portable way to do an unaligned load that doesn't break
+// strict aliasing; compilers turn it into a single mov
+inline unsigned long long int load_ull(const unsigned char* src)
+{
+    return hamming::kernels::load64(src);
+}
+
+// loads n_bytes < 8 bytes into the low bytes of a word, zeroing the rest
+inline unsigned long long int load_ull_partial(const unsigned char* src, size_t n_bytes)
+{
+    return hamming::kernels::load64_partial(src, n_bytes);
+}
+
+// loads the n_bits <= 64 bits starting at bit_offset (counted from the lsb of
+// src[0]) into the low bits of a word, touching only the bytes that hold them
+inline unsigned long long int load_bits(const unsigned char* src, size_t bit_offset, size_t n_bits)
+{
+    if (!n_bits)
+        return 0;
+
+    src += bit_offset / 8;
+    const unsigned int shift = static_cast<unsigned int>(bit_offset % 8);
+    const size_t n_bytes = (shift + n_bits + 7) / 8; // at most 9
+
+    unsigned long long int x = n_bytes >= 8 ? load_ull(src) : load_ull_partial(src, n_bytes);
+    x >>= shift;
+    if (n_bytes > 8)
+        x |= static_cast<unsigned long long int>(src[8]) << (64 - shift);
+
+    return n_bits < 64 ? x & ((1ULL << n_bits) - 1) : x;
+}
+
+// word_idx-th full 64 bit word of a bit stream which starts at bit `shift`
+// (< 8) of src[0]; the funnel shift of two neighbouring loads compiles to a
+// single shrd on x86. Reads the 9th byte only if shift != 0.
+inline unsigned long long int load_shifted_ull(const unsigned char* src, unsigned int shift,
+                                               size_t word_idx)
+{
+    const unsigned char* word_src = src + 8 * word_idx;
+    unsigned long long int x = load_ull(word_src);
+    if (!shift)
+        return x;
+    return (x >> shift) | (static_cast<unsigned long long int>(word_src[8]) << (64 - shift));
+}
+
+// sums the popcounts of the n_words words returned by load(word_idx), using
+// the given popcount64 implementation; template by popcount function, so
+// that it is inlined
+template<popcount_ull_t popcount_ull>
+struct word_kernel
+{
+    static unsigned int popcount(const unsigned long long int x)
+    {
+        return popcount_ull(x);
+    }
+
+    template<typename Loader>
+    static size_t sum(const size_t n_words, const Loader& load)
+    {
+        size_t count = 0;
+        for (size_t word_idx = 0; word_idx < n_words; ++word_idx)
+            count += popcount_ull(load(word_idx));
+        return count;
+    }
+};
+
+// same, unrolled by 8 words into 4 independent accumulators, so that the
+// popcounts of consecutive words don't form a single dependency chain
+template<popcount_ull_t popcount_ull>
+struct unrolled_kernel
+{
+    static unsigned int popcount(const unsigned long long int x)
+    {
+        return popcount_ull(x);
+    }
+
+    template<typename Loader>
+    static size_t sum(const size_t n_words, const Loader& load)
+    {
+        size_t count0 = 0, count1 = 0, count2 = 0, count3 = 0;
+        size_t word_idx = 0;
+        for (; word_idx + 8 <= n_words; word_idx += 8)
+        {
+            count0 += popcount_ull(load(word_idx)) + popcount_ull(load(word_idx + 4));
+            count1 += popcount_ull(load(word_idx + 1)) + popcount_ull(load(word_idx + 5));
+            count2 += popcount_ull(load(word_idx + 2)) + popcount_ull(load(word_idx + 6));
+            count3 += popcount_ull(load(word_idx + 3)) + popcount_ull(load(word_idx + 7));
+        }
+        for (; word_idx < n_words; ++word_idx)
+            count0 += popcount_ull(load(word_idx));
+        return count0 + count1 + count2 + count3;
+    }
+};
+
+// Harley-Seal: the words are summed bitwise by a tree of carry-save adders,
+// so that only one word in 16 needs a popcount; meant for the targets
+// without a popcount instruction, where the popcount is the expensive part
+// (see "Faster Population Counts Using AVX2 Instructions", Mula, Kurz and
+// Lemire, whose scalar version this is)
+template<popcount_ull_t popcount_ull>
+struct harley_seal_kernel
+{
+    static unsigned int popcount(const unsigned long long int x)
+    {
+        return popcount_ull(x);
+    }
+
+    // full adder over every bit position: (high, low) = a + b + c
+    static void csa(unsigned long long int& high, unsigned long long int& low,
+                    const unsigned long long int a, const unsigned long long int b,
+                    const unsigned long long int c)
+    {
+        const unsigned long long int u = a ^ b;
+        high = (a & b) | (u & c);
+        low = u ^ c;
+    }
+
+    template<typename Loader>
+    static size_t sum(const size_t n_words, const Loader& load)
+    {
+        // bit k of ones, twos, fours and eights is the binary count of the
+        // bits k seen so far, modulo 16; the overflows go into count
+        unsigned long long int ones = 0, twos = 0, fours = 0, eights = 0;
+        unsigned long long int twos_a, twos_b, fours_a, fours_b, eights_a, eights_b, sixteens;
+        size_t count = 0;
+        size_t word_idx = 0;
+        for (; word_idx + 16 <= n_words; word_idx += 16)
+        {
+            csa(twos_a, ones, ones, load(word_idx), load(word_idx + 1));
+            csa(twos_b, ones, ones, load(word_idx + 2), load(word_idx + 3));
+            csa(fours_a, twos, twos, twos_a, twos_b);
+            csa(twos_a, ones, ones, load(word_idx + 4), load(word_idx + 5));
+            csa(twos_b, ones, ones, load(word_idx + 6), load(word_idx + 7));
+            csa(fours_b, twos, twos, twos_a, twos_b);
+            csa(eights_a, fours, fours, fours_a, fours_b);
+            csa(twos_a, ones, ones, load(word_idx + 8), load(word_idx + 9));
+            csa(twos_b, ones, ones, load(word_idx + 10), load(word_idx + 11));
+            csa(fours_a, twos, twos, twos_a, twos_b);
+            csa(twos_a, ones, ones, load(word_idx + 12), load(word_idx + 13));
+            csa(twos_b, ones, ones, load(word_idx + 14), load(word_idx + 15));
+            csa(fours_b, twos, twos, twos_a, twos_b);
+            csa(eights_b, fours, fours, fours_a, fours_b);
+            csa(sixteens, eights, eights, eights_a, eights_b);
+            count += popcount_ull(sixteens);
+        }
+        count = 16 * count + 8 * popcount_ull(eights) + 4 * popcount_ull(fours) +
+                2 * popcount_ull(twos) + popcount_ull(ones);
+
+        for (; word_idx < n_words; ++word_idx)
+            count += popcount_ull(load(word_idx));
+        return count;
+    }
+};
+
+#ifdef HAMMING_WITH_VECTOR
+// SWAR popcount on GCC / Clang generic vectors of 2 words, which the
+// compiler maps onto the 128 bit SIMD of the target (SSE2, NEON, AltiVec,
+// ...), or onto pairs of scalar registers if there is none. Two vectors are
+// processed per iteration, into independent accumulators of byte counts,
+// which are only widened to words every 31 iterations, so the horizontal
+// sums are paid once per 124 words; popcount_ull is only used for the tail.
+template<popcount_ull_t popcount_ull>
+struct vector_kernel
+{
+    typedef unsigned long long int word_vector __attribute__((vector_size(16)));
+
+    static unsigned int popcount(const unsigned long long int x)
+    {
+        return popcount_ull(x);
+    }
+
+    template<typename Loader>
+    static size_t sum(const size_t n_words, const Loader& load)
+    {
+        const size_t words_per_iteration = 4;
+        // 8 * 31 < 256, so that the byte counts don't overflow
+        const size_t max_iterations_per_block = 31;
+        const word_vector m1 = {0x5555555555555555ULL, 0x5555555555555555ULL};
+        const word_vector m2 = {0x3333333333333333ULL, 0x3333333333333333ULL};
+        const word_vector m4 = {0x0f0f0f0f0f0f0f0fULL, 0x0f0f0f0f0f0f0f0fULL};
+        const word_vector m8 = {0x00ff00ff00ff00ffULL, 0x00ff00ff00ff00ffULL};
+        const word_vector m16 = {0x0000ffff0000ffffULL, 0x0000ffff0000ffffULL};
+        const word_vector m32 = {0x00000000ffffffffULL, 0x00000000ffffffffULL};
+
+        word_vector counts = {0, 0};
+        size_t word_idx = 0;
+        while (word_idx + words_per_iteration <= n_words)
+        {
+            const size_t n_iterations = std::min((n_words - word_idx) / words_per_iteration,
+                                                 max_iterations_per_block);
+            word_vector byte_counts_a = {0, 0}, byte_counts_b = {0, 0};
+            for (size_t iteration = 0; iteration < n_iterations; ++iteration, word_idx += words_per_iteration)
+            {
+                word_vector a = {load(word_idx), load(word_idx + 1)};
+                word_vector b = {load(word_idx + 2), load(word_idx + 3)};
+                a -= (a >> 1) & m1;
+                b -= (b >> 1) & m1;
+                a = (a & m2) + ((a >> 2) & m2);
+                b = (b & m2) + ((b >> 2) & m2);
+                byte_counts_a += (a + (a >> 4)) & m4;
+                byte_counts_b += (b + (b >> 4)) & m4;
+            }
+
+            // bytes to 16 bit counts first, as the sum of both may not fit
+            word_vector block_counts = (byte_counts_a & m8) + ((byte_counts_a >> 8) & m8) +
+                                       (byte_counts_b & m8) + ((byte_counts_b >> 8) & m8);
+            block_counts = (block_counts & m16) + ((block_counts >> 16) & m16);
+            counts += (block_counts & m32) + (block_counts >> 32);
+        }
+
+        size_t count = static_cast<size_t>(counts[0] + counts[1]);
+        for (; word_idx < n_words; ++word_idx)
+            count += popcount_ull(load(word_idx));
+        return count;
+    }
+};
+#endif // HAMMING_WITH_VECTOR
+
+// popcount(str1 ^ str2) over n_bytes, on the calling thread; this is the
+// per-item kernel of the one-to-many scans, which parallelize over items
+template<typename Kernel>
+size_t xor_popcount(const unsigned char str1[], const unsigned char str2[], const size_t n_bytes)
+{
+    const size_t n_words = n_bytes / 8;
+    size_t dist = Kernel::sum(n_words, [=](size_t word_idx)
+    {
+        return load_ull(str1 + 8 * word_idx) ^ load_ull(str2 + 8 * word_idx);
+    });
+
+    const size_t remaining_bytes = n_bytes % 8;
+    if (remaining_bytes)
+        dist += Kernel::popcount(load_ull_partial(str1 + 8 * n_words, remaining_bytes) ^
+                                 load_ull_partial(str2 + 8 * n_words, remaining_bytes));
+    return dist;
+}
+
+#ifdef HAMMING_WITH_INTERLEAVED
+// a word_kernel for everything but the one-to-many scans, which compare the
+// query against group_size codes at a time (see xor_popcount_interleaved)
+template<popcount_ull_t popcount_ull>
+struct interleaved_kernel : word_kernel<popcount_ull>
+{
+    static const size_t group_size = 8;
+};
+#endif // HAMMING_WITH_INTERLEAVED
+
+// xor_popcount of the query against NCodes codes, the k-th of which starts at
+// first_code + k * stride, written to distances[0..NCodes). Every word of the
+// query is loaded once for all the codes, and every code has its own
+// accumulator, so that the NCodes popcounts of an iteration are independent;
+// for short codes, this also amortizes the loop overhead over the group.
+template<typename Kernel, size_t NCodes>
+void xor_popcount_interleaved(const unsigned char query[], const unsigned char* first_code,
+                              const size_t stride, const size_t n_bytes, size_t distances[])
+{
+    size_t dists[NCodes] = {};
+    const size_t n_words = n_bytes / 8;
+    for (size_t word_idx = 0; word_idx < n_words; ++word_idx)
+    {
+        const unsigned long long int query_word = load_ull(query + 8 * word_idx);
+        for (size_t code_idx = 0; code_idx < NCodes; ++code_idx)
+            dists[code_idx] += Kernel::popcount(query_word ^ load_ull(first_code + code_idx * stride + 8 * word_idx));
+    }
+
+    const size_t remaining_bytes = n_bytes % 8;
+    if (remaining_bytes)
+    {
+        const unsigned long long int query_word = load_ull_partial(query + 8 * n_words, remaining_bytes);
+        for (size_t code_idx = 0; code_idx < NCodes; ++code_idx)
+            dists[code_idx] += Kernel::popcount(query_word ^ load_ull_partial(first_code + code_idx * stride +
+                                                                              8 * n_words, remaining_bytes));
+    }
+
+    for (size_t code_idx = 0; code_idx < NCodes; ++code_idx)
+        distances[code_idx] = dists[code_idx];
+}
+
+// popcount over n_bytes, on the calling thread
+template<typename Kernel>
+size_t weight_popcount(const unsigned char str[], const size_t n_bytes)
+{
+    const size_t n_words = n_bytes / 8;
+    size_t weight = Kernel::sum(n_words, [=](size_t word_idx) {return load_ull(str + 8 * word_idx);});
+
+    const size_t remaining_bytes = n_bytes % 8;
+    if (remaining_bytes)
+        weight += Kernel::popcount(load_ull_partial(str + 8 * n_words, remaining_bytes));
+    return weight;
+}
+
+// calls Op<kernel>::run(args...) with the kernel selected by impl; Op is
+// instantiated once for every implementation which was compiled in
+template<template<typename> class Op, typename... Args>
+hamming_status_t dispatch_kernel(hamming_impl_t impl, Args&&... args)
+{
+    switch(impl)
+    {
+#if defined(HAMMING_WITH_VANILLA) || defined(HAMMING_WITH_2x32) || defined(HAMMING_WITH_LUT) || defined(HAMMING_WITH_SPARSE) || defined(HAMMING_WITH_INTRINSICS) || \
+    defined(HAMMING_WITH_UNROLLED) || defined(HAMMING_WITH_HARLEY_SEAL) || defined(HAMMING_WITH_VECTOR) || \
+    defined(HAMMING_WITH_INTERLEAVED)
+        case HAMMING_IMPL_DEFAULT:
+  #if HAMMING_KERNELS_POPCNT_ASM && !defined(__POPCNT__)
+            // the library is built for any x86-64, where __builtin_popcountll
+            // is a call into libgcc, so the cpu is asked for popcnt instead
+            if (hamming::kernels::cpu_has_popcnt())
+            {
+                Op<word_kernel<hamming::kernels::popcount64_popcnt> >::run(std::forward<Args>(args)...);
+                return HAMMING_STATUS_SUCCESS;
+            }
+  #endif
+            Op<word_kernel<hamming::kernels::popcount64> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_VANILLA
+        case HAMMING_IMPL_VANILLA:
+            Op<word_kernel<hamming::kernels::popcount64_vanilla> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_2x32
+        case HAMMING_IMPL_2x32:
+            Op<word_kernel<hamming::kernels::popcount64_2x32> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_LUT
+        case HAMMING_IMPL_LUT:
+            Op<word_kernel<hamming::kernels::popcount64_lut> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_SPARSE
+        case HAMMING_IMPL_SPARSE:
+            Op<word_kernel<hamming::kernels::popcount64_sparse> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_LUT
+        case HAMMING_IMPL_LUT16:
+            Op<word_kernel<hamming::kernels::popcount64_lut16> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_UNROLLED
+        case HAMMING_IMPL_UNROLLED:
+  #if HAMMING_KERNELS_POPCNT_ASM && !defined(__POPCNT__)
+            if (hamming::kernels::cpu_has_popcnt())
+            {
+                Op<unrolled_kernel<hamming::kernels::popcount64_popcnt> >::run(std::forward<Args>(args)...);
+                return HAMMING_STATUS_SUCCESS;
+            }
+  #endif
+            Op<unrolled_kernel<hamming::kernels::popcount64_nodep> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_HARLEY_SEAL
+        case HAMMING_IMPL_HARLEY_SEAL:
+            Op<harley_seal_kernel<hamming::kernels::popcount64_vanilla> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_VECTOR
+        case HAMMING_IMPL_VECTOR:
+            Op<vector_kernel<hamming::kernels::popcount64> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+#ifdef HAMMING_WITH_INTERLEAVED
+        case HAMMING_IMPL_INTERLEAVED:
+            Op<interleaved_kernel<hamming::kernels::popcount64> >::run(std::forward<Args>(args)...);
+            return HAMMING_STATUS_SUCCESS;
+#endif
+        default:
+            // the implementations which were not compiled in have no
+            // enumerator, hence no case
+            return static_cast<int>(impl) >= 0 && static_cast<int>(impl) < HAMMING_N_IMPLS ?
+                   HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE : HAMMING_STATUS_UNKNOWN_IMPLEMENTATION;
+    }
+}
+
+// the implementation whose kernel runs for impl: HAMMING_IMPL_DEFAULT runs
+// word_kernel<popcount64> (or popcount64_popcnt), which is the vanilla
+// implementation's where the compiler has no popcount intrinsic. The
+// intrinsic has no enumerator of its own, so it stays HAMMING_IMPL_DEFAULT
+inline hamming_impl_t kernel_impl(const hamming_impl_t impl)
+{
+#if !HAMMING_KERNELS_POPCOUNT_INTRINSIC && defined(HAMMING_WITH_VANILLA)
+    if (impl == HAMMING_IMPL_DEFAULT)
+        return HAMMING_IMPL_VANILLA;
+#endif
+    return impl;
+}
+
+// dispatch_kernel, accounting the call in the stats (if enabled) to the
+// implementation which ran it; n_bytes is the size of the codes the call
+// was given
+template<template<typename> class Op, typename... Args>
+hamming_status_t dispatch(hamming_impl_t impl, const unsigned long long n_bytes, Args&&... args)
+{
+#ifdef HAMMING_WITH_STATS
+    const stats_clock::time_point start = stats_clock::now();
+    const hamming_status_t status = dispatch_kernel<Op>(impl, std::forward<Args>(args)...);
+    if (status == HAMMING_STATUS_SUCCESS)
+        record_stats(kernel_impl(impl), n_bytes, stats_clock::now() - start);
+    return status;
+#else
+    (void)n_bytes;
+    return dispatch_kernel<Op>(impl, std::forward<Args>(args)...);
+#endif
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+
+// page-level allocations for the large arrays (code containers, index rows),
+// backed by huge pages when the system has them, which cuts the dTLB misses
+// of the scans over them
+
+struct page_allocation
+{
+    unsigned char* data;
+    // of the mapping, a whole number of pages
+    size_t length;
+    hamming_pages_t pages;
+};
+
+// n_bytes zeroed bytes, 64 byte aligned; from the largest huge pages the
+// system grants for the size (1GB, then 2MB hugetlb pages), else from
+// transparent huge pages (madvise), else from normal pages. data is null if
+// even that fails (and for n_bytes == 0)
+INTERNAL_HAMMING_API page_allocation HAMMING_CALL allocate_pages(size_t n_bytes);
+
+// allocation may be a failed (null) one
+INTERNAL_HAMMING_API void HAMMING_CALL free_pages(const page_allocation& allocation);
+
+// the bytes of the allocation which are backed by huge pages at the moment;
+// for transparent huge pages, this is read from /proc/self/smaps (false if
+// that is not possible, e.g. on other systems)
+INTERNAL_HAMMING_API bool HAMMING_CALL huge_page_bytes(const page_allocation& allocation, size_t* huge_bytes);
+
+// array of trivially copyable elements on page_allocation's; the whole
+// array is (re)allocated at once, which is all the indexes need
+template<typename T>
+class page_array
+{
+public:
+    page_array() : size_(0)
+    {
+        allocation_.data = nullptr;
+        allocation_.length = 0;
+        allocation_.pages = HAMMING_PAGES_NORMAL;
+    }
+
+    ~page_array()
+    {
+        free_pages(allocation_);
+    }
+
+    // discards the contents, for n zeroed elements; throws std::bad_alloc
+    void allocate(const size_t n)
+    {
+        if (n > static_cast<size_t>(-1) / sizeof(T))
+            throw std::bad_alloc();
+
+        const page_allocation allocation = allocate_pages(n * sizeof(T));
+        if (n && !allocation.data)
+            throw std::bad_alloc();
+
+        free_pages(allocation_);
+        allocation_ = allocation;
+        size_ = n;
+    }
+
+    size_t size() const {return size_;}
+    T* data() {return reinterpret_cast<T*>(allocation_.data);}
+    const T* data() const {return reinterpret_cast<const T*>(allocation_.data);}
+    T& operator[](const size_t idx) {return data()[idx];}
+    const T& operator[](const size_t idx) const {return data()[idx];}
+
+    const page_allocation& allocation() const {return allocation_;}
+
+private:
+    page_array(const page_array&);
+    page_array& operator=(const page_array&);
+
+    page_allocation allocation_;
+    size_t size_;
+};
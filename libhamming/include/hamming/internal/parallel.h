@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+
+// an exception which leaves an OpenMP region terminates the program, so the
+// regions which allocate run what may throw through run(), which records the
+// failure instead. Once failed(), the threads skip the rest of their work,
+// and rethrow(), after the region, throws bad_alloc to the caller's catch
+class parallel_failure
+{
+public:
+    parallel_failure() : failed_(false) {}
+
+    // false if body threw, or an earlier one did (then body isn't run)
+    template<typename Body>
+    bool run(Body body)
+    {
+        if (failed())
+            return false;
+        try
+        {
+            body();
+            return true;
+        }
+        catch (const std::bad_alloc&)
+        {
+            failed_.store(true, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    bool failed() const {return failed_.load(std::memory_order_relaxed);}
+
+    void rethrow() const
+    {
+        if (failed())
+            throw std::bad_alloc();
+    }
+
+private:
+    parallel_failure(const parallel_failure&);
+    parallel_failure& operator=(const parallel_failure&);
+
+    std::atomic<bool> failed_;
+};
@@ -2,7 +2,6 @@
 
 #include <cstddef>
 #include <hamming/hamming_c.h>
-#include <type_traits>
 
 #ifdef EXPORT_INTERNALS
 #define INTERNAL_HAMMING_API HAMMING_API
@@ -17,12 +16,10 @@
 #endif // ifdef _WIN32
 #endif // ifdef EXPORT_INTERNALS
 
-// @TODO: all functions here are supposed to have the inline specifier, but
-// @TODO: they are not exported any more when inline is added, although the
-// @TODO: gcc documentation states that the default visibility for inlines is
-// @TODO: public; the inline specifier is not very important nowadays anyway,
-// @TODO: and we expect the compiler to inline the functions, at least within
-// @TODO: the same module
+// NOTE: these are the exported, out-of-line versions of the kernels; inline
+// NOTE: can't be used here, as inline functions are not exported. The library
+// NOTE: itself calls the inline versions from <hamming/kernels.hpp>, which
+// NOTE: these forward to.
 
 // internal implementations
 #ifdef HAMMING_WITH_VANILLA
@@ -40,13 +37,9 @@ INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_sparse(cons
 #endif
 
 #ifdef HAMMING_WITH_LUT
-// helper for popcount64_lut
-// defined for IntegralType=unsigned char and short
-template<typename IntegralType> INTERNAL_HAMMING_API
-typename std::enable_if<std::is_integral<IntegralType>::value, IntegralType>::type* HAMMING_CALL
-init_lut(void);
-
+// 8 and 16 bit lookup tables, respectively
 INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_lut(const unsigned long long int&);
+INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_lut16(const unsigned long long int&);
 #endif
 
 #if defined(HAMMING_WITH_VANILLA) || defined(HAMMING_WITH_2x32) || defined(HAMMING_WITH_LUT) || defined(HAMMING_WITH_SPARSE)
@@ -0,0 +1,38 @@
+#pragma once
+
+// USDT (static user space tracepoints) of provider "hamming", built when
+// sys/sdt.h is available (e.g. from systemtap-sdt-dev) and
+// HAMMING_WITH_PROBES is on. Every probed entry point has a <name>__entry
+// probe, with the sizes and implementation as arguments, and a
+// <name>__return probe, e.g. with bpftrace:
+//
+//     bpftrace -e 'usdt:/usr/local/lib/libhamming.so:hamming:distance__entry {@bytes = hist(arg0);}'
+//
+// A probe compiles to a single nop until a tracer attaches; only its
+// arguments are computed, so they should be kept cheap.
+
+#ifdef HAMMING_WITH_PROBES
+#include <sys/sdt.h>
+
+#define HAMMING_PROBE_RETURN(name) \
+    struct name##_probe_return \
+    { \
+        ~name##_probe_return() {DTRACE_PROBE(hamming, name##__return);} \
+    } name##_probe_return_scope
+
+#define HAMMING_PROBE_SCOPE2(name, arg1, arg2) \
+    DTRACE_PROBE2(hamming, name##__entry, arg1, arg2); \
+    HAMMING_PROBE_RETURN(name)
+
+#define HAMMING_PROBE_SCOPE3(name, arg1, arg2, arg3) \
+    DTRACE_PROBE3(hamming, name##__entry, arg1, arg2, arg3); \
+    HAMMING_PROBE_RETURN(name)
+
+#define HAMMING_PROBE_SCOPE4(name, arg1, arg2, arg3, arg4) \
+    DTRACE_PROBE4(hamming, name##__entry, arg1, arg2, arg3, arg4); \
+    HAMMING_PROBE_RETURN(name)
+#else // HAMMING_WITH_PROBES
+#define HAMMING_PROBE_SCOPE2(name, arg1, arg2)
+#define HAMMING_PROBE_SCOPE3(name, arg1, arg2, arg3)
+#define HAMMING_PROBE_SCOPE4(name, arg1, arg2, arg3, arg4)
+#endif // HAMMING_WITH_PROBES
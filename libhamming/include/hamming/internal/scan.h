@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+#include <hamming/internal/code_set.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+// the options set by hamming_set_scan_options, read once per call
+INTERNAL_HAMMING_API hamming_scan_options_t HAMMING_CALL current_scan_options();
+
+inline void prefetch_line(const unsigned char* address, const bool non_temporal)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    if (non_temporal)
+        __builtin_prefetch(address, 0, 0);
+    else
+        __builtin_prefetch(address, 0, 3);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(reinterpret_cast<const char*>(address), non_temporal ? _MM_HINT_NTA : _MM_HINT_T0);
+#else
+    (void)address;
+    (void)non_temporal;
+#endif
+}
+
+// prefetches, for the row being compared, the row which is
+// prefetch_bytes further in the scan (rounded up to whole rows), so that
+// its cache misses overlap with the comparisons in between. Does nothing
+// if prefetching is disabled, which is the default.
+class row_prefetcher
+{
+public:
+    row_prefetcher(const hamming_code_set_t& codes, const hamming_scan_options_t& options)
+        : data_(codes.data), n_codes_(codes.n_codes), code_bytes_(codes.code_bytes),
+          stride_(code_stride(codes)), non_temporal_(options.non_temporal != 0),
+          rows_ahead_(options.prefetch_bytes && stride_ ? (options.prefetch_bytes + stride_ - 1) / stride_ : 0)
+    {
+    }
+
+    // rows past end (exclusive) are not prefetched, e.g. those of the next
+    // partition of a scan
+    void operator()(const size_t code_idx, const size_t end) const
+    {
+        if (!rows_ahead_ || code_idx + rows_ahead_ >= end)
+            return;
+        const unsigned char* row = data_ + (code_idx + rows_ahead_) * stride_;
+        for (size_t offset = 0; offset < code_bytes_; offset += 64)
+            prefetch_line(row + offset, non_temporal_);
+        // the last line, if the row straddles one more than the loop covers
+        prefetch_line(row + code_bytes_ - 1, non_temporal_);
+    }
+
+    void operator()(const size_t code_idx) const
+    {
+        (*this)(code_idx, n_codes_);
+    }
+
+private:
+    const unsigned char* data_;
+    size_t n_codes_;
+    size_t code_bytes_;
+    size_t stride_;
+    bool non_temporal_;
+    size_t rows_ahead_;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+#include <hamming/hamming_c.h>
+
+// the order of the search results: by distance, then by index
+
+inline bool closer_match(const hamming_match_t& match1, const hamming_match_t& match2)
+{
+    return match1.distance < match2.distance ||
+           (match1.distance == match2.distance && match1.index < match2.index);
+}
+
+// adds match to a heap of the (at most) k closest so far, with the farthest
+// one on top
+inline void push_bounded(std::vector<hamming_match_t>& heap, const size_t k, const hamming_match_t& match)
+{
+    if (heap.size() < k)
+    {
+        heap.push_back(match);
+        std::push_heap(heap.begin(), heap.end(), closer_match);
+    }
+    else if (closer_match(match, heap.front()))
+    {
+        std::pop_heap(heap.begin(), heap.end(), closer_match);
+        heap.back() = match;
+        std::push_heap(heap.begin(), heap.end(), closer_match);
+    }
+}
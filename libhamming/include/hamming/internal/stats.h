@@ -0,0 +1,44 @@
+#pragma once
+
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+
+#ifdef HAMMING_WITH_STATS
+#include <chrono>
+
+typedef std::chrono::steady_clock stats_clock;
+
+// adds a successful call to the counters of impl; cheap enough to be called
+// on every dispatch: a few relaxed atomic adds on a per-thread shard
+INTERNAL_HAMMING_API void HAMMING_CALL record_stats(hamming_impl_t impl, unsigned long long n_bytes,
+                                                    stats_clock::duration elapsed);
+
+// bins the latency of a call into the calling thread's own histogram of
+// entry_point, which only that thread writes
+INTERNAL_HAMMING_API void HAMMING_CALL record_latency(hamming_entry_point_t entry_point,
+                                                      stats_clock::duration elapsed);
+
+// times its scope, i.e. the whole call of an entry point
+class latency_scope
+{
+public:
+    explicit latency_scope(hamming_entry_point_t entry_point)
+        : entry_point_(entry_point), start_(stats_clock::now()) {}
+
+    ~latency_scope()
+    {
+        record_latency(entry_point_, stats_clock::now() - start_);
+    }
+
+private:
+    latency_scope(const latency_scope&);
+    latency_scope& operator=(const latency_scope&);
+
+    hamming_entry_point_t entry_point_;
+    stats_clock::time_point start_;
+};
+
+#define HAMMING_LATENCY_SCOPE(entry_point) latency_scope entry_latency_scope(entry_point)
+#else // HAMMING_WITH_STATS
+#define HAMMING_LATENCY_SCOPE(entry_point)
+#endif // HAMMING_WITH_STATS
@@ -0,0 +1,312 @@
+#pragma once
+
+// Header-only, inline versions of the library's kernels.
+// Unlike the rest of the API, nothing here goes through the shared library,
+// so there is no call (nor PLT indirection) per comparison, and short codes
+// can be compared inline in the caller's hot loops. There is also no
+// OpenMP, no parameter checking and no status codes: these are the raw
+// kernels. This header can be used without linking to libhamming, and may
+// be included in any number of translation units.
+//
+// The library itself is built on these kernels, so both give the same
+// results.
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__BMI2__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64) && defined(__AVX__)
+#include <intrin.h>
+#endif
+
+namespace hamming
+{
+    namespace kernels
+    {
+        // https://chessprogramming.wikispaces.com/Population+Count
+        inline unsigned int popcount64_vanilla(unsigned long long int x)
+        {
+            x -= (x >> 1) & 0x5555555555555555ULL;
+            x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+            x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+            return static_cast<unsigned int>((x * 0x0101010101010101ULL) >> 56);
+        }
+
+        inline unsigned int popcount32(unsigned int x)
+        {
+            x = x  - ((x >> 1)  & 033333333333U) - ((x >> 2)  & 011111111111U);
+            x = (x +  (x >> 3)) & 030707070707U;
+            return x % 63;
+        }
+
+        inline unsigned int popcount64_2x32(unsigned long long int x)
+        {
+            return popcount32(static_cast<unsigned int>(x & 0xFFFFFFFFULL)) +
+                   popcount32(static_cast<unsigned int>(x >> 32));
+        }
+
+        // efficient for small numbers of 1s
+        inline unsigned int popcount64_sparse(unsigned long long int x)
+        {
+            unsigned int count = 0;
+            for (; x; x &= x - 1)
+                ++count;
+            return count;
+        }
+
+        // popcount tables, generated at compile time: each level of the
+        // macros below appends the 2 bits which add 0, 1, 1 and 2 ones. The
+        // counts are incremented by token pasting rather than by arithmetic,
+        // so that the tables are made of plain literals, which are much
+        // cheaper to compile than 64K constant expressions.
+#define HAMMING_LUT_INC_0 1
+#define HAMMING_LUT_INC_1 2
+#define HAMMING_LUT_INC_2 3
+#define HAMMING_LUT_INC_3 4
+#define HAMMING_LUT_INC_4 5
+#define HAMMING_LUT_INC_5 6
+#define HAMMING_LUT_INC_6 7
+#define HAMMING_LUT_INC_7 8
+#define HAMMING_LUT_INC_8 9
+#define HAMMING_LUT_INC_9 10
+#define HAMMING_LUT_INC_10 11
+#define HAMMING_LUT_INC_11 12
+#define HAMMING_LUT_INC_12 13
+#define HAMMING_LUT_INC_13 14
+#define HAMMING_LUT_INC_14 15
+#define HAMMING_LUT_INC_15 16
+#define HAMMING_LUT_INC_(n) HAMMING_LUT_INC_##n
+#define HAMMING_LUT_INC(n) HAMMING_LUT_INC_(n)
+#define HAMMING_LUT_B2(n) n, HAMMING_LUT_INC(n), HAMMING_LUT_INC(n), HAMMING_LUT_INC(HAMMING_LUT_INC(n))
+#define HAMMING_LUT_B4(n) HAMMING_LUT_B2(n), HAMMING_LUT_B2(HAMMING_LUT_INC(n)), \
+                          HAMMING_LUT_B2(HAMMING_LUT_INC(n)), HAMMING_LUT_B2(HAMMING_LUT_INC(HAMMING_LUT_INC(n)))
+#define HAMMING_LUT_B6(n) HAMMING_LUT_B4(n), HAMMING_LUT_B4(HAMMING_LUT_INC(n)), \
+                          HAMMING_LUT_B4(HAMMING_LUT_INC(n)), HAMMING_LUT_B4(HAMMING_LUT_INC(HAMMING_LUT_INC(n)))
+#define HAMMING_LUT_B8(n) HAMMING_LUT_B6(n), HAMMING_LUT_B6(HAMMING_LUT_INC(n)), \
+                          HAMMING_LUT_B6(HAMMING_LUT_INC(n)), HAMMING_LUT_B6(HAMMING_LUT_INC(HAMMING_LUT_INC(n)))
+#define HAMMING_LUT_B10(n) HAMMING_LUT_B8(n), HAMMING_LUT_B8(HAMMING_LUT_INC(n)), \
+                           HAMMING_LUT_B8(HAMMING_LUT_INC(n)), HAMMING_LUT_B8(HAMMING_LUT_INC(HAMMING_LUT_INC(n)))
+#define HAMMING_LUT_B12(n) HAMMING_LUT_B10(n), HAMMING_LUT_B10(HAMMING_LUT_INC(n)), \
+                           HAMMING_LUT_B10(HAMMING_LUT_INC(n)), HAMMING_LUT_B10(HAMMING_LUT_INC(HAMMING_LUT_INC(n)))
+#define HAMMING_LUT_B14(n) HAMMING_LUT_B12(n), HAMMING_LUT_B12(HAMMING_LUT_INC(n)), \
+                           HAMMING_LUT_B12(HAMMING_LUT_INC(n)), HAMMING_LUT_B12(HAMMING_LUT_INC(HAMMING_LUT_INC(n)))
+#define HAMMING_LUT_B16(n) HAMMING_LUT_B14(n), HAMMING_LUT_B14(HAMMING_LUT_INC(n)), \
+                           HAMMING_LUT_B14(HAMMING_LUT_INC(n)), HAMMING_LUT_B14(HAMMING_LUT_INC(HAMMING_LUT_INC(n)))
+
+        // a template, so that the tables can be defined in a header, yet
+        // exist only once in a program (C++11 has no inline variables).
+        // Being constexpr, they are constant-initialized: there is no
+        // initialization guard to check on the lookups.
+        // The 256 byte table fits in L1; the 64KB one usually only fits in
+        // L2, but needs half the lookups and additions. Which one is faster
+        // depends on the target, and on what else competes for the caches.
+        template<typename T = void>
+        struct popcount_tables
+        {
+            static constexpr unsigned char lut8[256] = {HAMMING_LUT_B8(0)};
+            static constexpr unsigned char lut16[65536] = {HAMMING_LUT_B16(0)};
+        };
+
+        template<typename T> constexpr unsigned char popcount_tables<T>::lut8[256];
+        template<typename T> constexpr unsigned char popcount_tables<T>::lut16[65536];
+
+#undef HAMMING_LUT_B16
+#undef HAMMING_LUT_B14
+#undef HAMMING_LUT_B12
+#undef HAMMING_LUT_B10
+#undef HAMMING_LUT_B8
+#undef HAMMING_LUT_B6
+#undef HAMMING_LUT_B4
+#undef HAMMING_LUT_B2
+#undef HAMMING_LUT_INC
+#undef HAMMING_LUT_INC_
+#undef HAMMING_LUT_INC_0
+#undef HAMMING_LUT_INC_1
+#undef HAMMING_LUT_INC_2
+#undef HAMMING_LUT_INC_3
+#undef HAMMING_LUT_INC_4
+#undef HAMMING_LUT_INC_5
+#undef HAMMING_LUT_INC_6
+#undef HAMMING_LUT_INC_7
+#undef HAMMING_LUT_INC_8
+#undef HAMMING_LUT_INC_9
+#undef HAMMING_LUT_INC_10
+#undef HAMMING_LUT_INC_11
+#undef HAMMING_LUT_INC_12
+#undef HAMMING_LUT_INC_13
+#undef HAMMING_LUT_INC_14
+#undef HAMMING_LUT_INC_15
+
+        inline unsigned int popcount64_lut(unsigned long long int x)
+        {
+            const unsigned char* lut = popcount_tables<>::lut8;
+            return lut[x & 0xFF] + lut[(x >> 8) & 0xFF] + lut[(x >> 16) & 0xFF] + lut[(x >> 24) & 0xFF] +
+                   lut[(x >> 32) & 0xFF] + lut[(x >> 40) & 0xFF] + lut[(x >> 48) & 0xFF] + lut[x >> 56];
+        }
+
+        inline unsigned int popcount64_lut16(unsigned long long int x)
+        {
+            const unsigned char* lut = popcount_tables<>::lut16;
+            return lut[x & 0xFFFF] + lut[(x >> 16) & 0xFFFF] + lut[(x >> 32) & 0xFFFF] + lut[x >> 48];
+        }
+
+        // whether popcount64 is the compiler's intrinsic (1), or
+        // popcount64_vanilla (0)
+#if defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && defined(_M_X64) && defined(__AVX__))
+#define HAMMING_KERNELS_POPCOUNT_INTRINSIC 1
+#else
+#define HAMMING_KERNELS_POPCOUNT_INTRINSIC 0
+#endif
+
+        // the fastest one available for the target
+        inline unsigned int popcount64(unsigned long long int x)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            // a single popcnt if the target has it (e.g. -mpopcnt), and a
+            // fast fallback otherwise
+            return static_cast<unsigned int>(__builtin_popcountll(x));
+#elif defined(_MSC_VER) && defined(_M_X64) && defined(__AVX__)
+            // every AVX capable cpu has popcnt
+            return static_cast<unsigned int>(__popcnt64(x));
+#else
+            return popcount64_vanilla(x);
+#endif
+        }
+
+        // whether popcount64_popcnt is available (x86-64, GCC / clang)
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAMMING_KERNELS_POPCNT_ASM 1
+#else
+#define HAMMING_KERNELS_POPCNT_ASM 0
+#endif
+
+#if HAMMING_KERNELS_POPCNT_ASM
+        // the popcnt instruction, without the false dependency that it has on
+        // its destination register on many Intel cores (up to Skylake): the
+        // register is zeroed first, which the renamer resolves for free.
+        // Otherwise every popcnt waits for the last instruction to write the
+        // register it lands in, which the register allocator tends to make
+        // the previous popcnt of the loop. Being inline asm, it needs no
+        // -mpopcnt, but it must only run on cpus which have popcnt (see
+        // cpu_has_popcnt)
+        inline unsigned int popcount64_popcnt(unsigned long long int x)
+        {
+            unsigned long long int count;
+            __asm__("xorl %k0, %k0\n\tpopcntq %1, %0" : "=&r"(count) : "rm"(x) : "cc");
+            return static_cast<unsigned int>(count);
+        }
+
+        // whether the cpu running the program has popcnt; checked once
+        inline bool cpu_has_popcnt()
+        {
+            static const bool has_popcnt = (__builtin_cpu_init(), __builtin_cpu_supports("popcnt") != 0);
+            return has_popcnt;
+        }
+#endif
+
+        // popcount64_popcnt where the target is known to have popcnt (e.g.
+        // -mpopcnt), popcount64 otherwise
+        inline unsigned int popcount64_nodep(unsigned long long int x)
+        {
+#if HAMMING_KERNELS_POPCNT_ASM && defined(__POPCNT__)
+            return popcount64_popcnt(x);
+#else
+            return popcount64(x);
+#endif
+        }
+
+        // position of the rank-th (0 based) set bit of x; x must have more
+        // than rank set bits
+        inline unsigned int select64(unsigned long long int x, unsigned int rank)
+        {
+#if defined(__BMI2__) && (defined(__GNUC__) || defined(__clang__))
+            // deposit a single bit at the position of the rank-th one of x
+            return static_cast<unsigned int>(__builtin_ctzll(_pdep_u64(1ULL << rank, x)));
+#else
+            for (; rank; --rank)
+                x &= x - 1;
+  #if defined(__GNUC__) || defined(__clang__)
+            return static_cast<unsigned int>(__builtin_ctzll(x));
+  #else
+            unsigned int pos = 0;
+            for (; !(x & 1); x >>= 1)
+                ++pos;
+            return pos;
+  #endif
+#endif
+        }
+
+        // unaligned, aliasing-safe load; bit k of a buffer is bit k % 8 of
+        // byte k / 8 on all platforms
+        inline unsigned long long int load64(const unsigned char* src)
+        {
+            unsigned long long int x;
+            std::memcpy(&x, src, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            x = __builtin_bswap64(x);
+#endif
+            return x;
+        }
+
+        // loads n_bytes < 8 bytes into the low bytes of a word
+        inline unsigned long long int load64_partial(const unsigned char* src, size_t n_bytes)
+        {
+            unsigned long long int x = 0;
+            for (size_t byte_idx = 0; byte_idx < n_bytes; ++byte_idx)
+                x |= static_cast<unsigned long long int>(src[byte_idx]) << (8 * byte_idx);
+            return x;
+        }
+
+        typedef unsigned int(*popcount64_t)(unsigned long long int);
+
+        template<popcount64_t popcount>
+        inline size_t distance(const unsigned char str1[], const unsigned char str2[], size_t n_bytes)
+        {
+            const size_t n_words = n_bytes / 8;
+            size_t dist = 0;
+            for (size_t word_idx = 0; word_idx < n_words; ++word_idx)
+                dist += popcount(load64(str1 + 8 * word_idx) ^ load64(str2 + 8 * word_idx));
+
+            const size_t remaining_bytes = n_bytes % 8;
+            if (remaining_bytes)
+                dist += popcount(load64_partial(str1 + 8 * n_words, remaining_bytes) ^
+                                 load64_partial(str2 + 8 * n_words, remaining_bytes));
+            return dist;
+        }
+
+        inline size_t distance(const unsigned char str1[], const unsigned char str2[], size_t n_bytes)
+        {
+            return distance<popcount64>(str1, str2, n_bytes);
+        }
+
+        // for codes whose size is known at compile time: the loop is fully
+        // unrolled for short codes
+        template<size_t NBytes>
+        inline size_t distance(const unsigned char str1[], const unsigned char str2[])
+        {
+            return distance<popcount64>(str1, str2, NBytes);
+        }
+
+        template<popcount64_t popcount>
+        inline size_t weight(const unsigned char str[], size_t n_bytes)
+        {
+            const size_t n_words = n_bytes / 8;
+            size_t count = 0;
+            for (size_t word_idx = 0; word_idx < n_words; ++word_idx)
+                count += popcount(load64(str + 8 * word_idx));
+
+            const size_t remaining_bytes = n_bytes % 8;
+            if (remaining_bytes)
+                count += popcount(load64_partial(str + 8 * n_words, remaining_bytes));
+            return count;
+        }
+
+        inline size_t weight(const unsigned char str[], size_t n_bytes)
+        {
+            return weight<popcount64>(str, n_bytes);
+        }
+    }
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+#include <hamming/hamming.h>
+#include <hamming/kernels.hpp>
+
+namespace hamming
+{
+    // Static bitvector with O(1) rank and fast select.
+    // The counters follow the rank9 layout: for every 512 bit block (one
+    // cache line of bits) there are two interleaved 64 bit counters, the
+    // number of ones before the block, and the number of ones before each
+    // of the words 1..7 of the block, packed as 9 bit fields. A rank query
+    // thus touches one counter pair and one word of bits.
+    // Select binary searches the block counters in a range narrowed by a
+    // sample of every select_sample-th one, then resolves the word through
+    // the packed counts and the bit with pdep/tzcnt (when BMI2 is enabled).
+    class rank_select_bitvector
+    {
+    public:
+        static const size_t words_per_block = 8;
+        static const size_t bits_per_block = 64 * words_per_block;
+        static const size_t select_sample = 4096;
+
+        rank_select_bitvector() : n_bits_(0), n_ones_(0) {build();}
+
+        // bit k is bit (k % 8) of bytes[k / 8]
+        rank_select_bitvector(const unsigned char bytes[], size_t n_bits)
+            : n_bits_(n_bits), n_ones_(0)
+        {
+            words_.assign(padded_words(n_bits) + cache_line_words, 0);
+            if (n_bits)
+                std::memcpy(data(), bytes, (n_bits + 7) / 8);
+            const size_t remaining_bits = n_bits % 64;
+            if (remaining_bits)
+                data()[n_bits / 64] &= (1ULL << remaining_bits) - 1;
+            build();
+        }
+
+        explicit rank_select_bitvector(const dynamic_bitset& bits)
+            : n_bits_(bits.size()), n_ones_(0)
+        {
+            words_.assign(padded_words(bits.size()) + cache_line_words, 0);
+            std::copy(bits.data(), bits.data() + bits.num_blocks(), data());
+            build();
+        }
+
+        // the bits are copied to the aligned position of the new buffer
+        rank_select_bitvector(const rank_select_bitvector& other)
+            : n_bits_(other.n_bits_), n_ones_(other.n_ones_),
+              words_(other.words_.size(), 0),
+              counters_(other.counters_), samples_(other.samples_)
+        {
+            std::copy(other.data(), other.data() + (words_.size() - cache_line_words), data());
+        }
+
+        // the buffer, and with it the alignment, moves along; the moved-from
+        // bitvector can only be assigned to or destroyed
+        rank_select_bitvector(rank_select_bitvector&& other) noexcept
+            : n_bits_(other.n_bits_), n_ones_(other.n_ones_),
+              words_(std::move(other.words_)),
+              counters_(std::move(other.counters_)), samples_(std::move(other.samples_))
+        {
+            other.n_bits_ = other.n_ones_ = 0;
+        }
+
+        // copy or move assignment, depending on how other is constructed
+        rank_select_bitvector& operator=(rank_select_bitvector other)
+        {
+            std::swap(n_bits_, other.n_bits_);
+            std::swap(n_ones_, other.n_ones_);
+            words_.swap(other.words_);
+            counters_.swap(other.counters_);
+            samples_.swap(other.samples_);
+            return *this;
+        }
+
+        size_t size() const {return n_bits_;}
+        // number of ones
+        size_t count() const {return n_ones_;}
+
+        bool operator[](size_t pos) const
+        {
+            return (data()[pos / 64] >> (pos % 64)) & 1;
+        }
+
+        // number of ones in [0, pos), for pos <= size()
+        size_t rank1(size_t pos) const
+        {
+            const size_t block_idx = pos / bits_per_block;
+            const size_t word_in_block = (pos / 64) % words_per_block;
+            const unsigned long long int* counter = counters_.data() + 2 * block_idx;
+
+            size_t rank = static_cast<size_t>(counter[0]);
+            if (word_in_block)
+                rank += static_cast<size_t>((counter[1] >> (9 * (word_in_block - 1))) & 0x1FF);
+            if (pos % 64)
+                rank += kernels::popcount64(data()[pos / 64] & ((1ULL << (pos % 64)) - 1));
+            return rank;
+        }
+
+        // number of zeros in [0, pos)
+        size_t rank0(size_t pos) const {return pos - rank1(pos);}
+
+        // position of the rank-th (0 based) one, for rank < count()
+        size_t select1(size_t rank) const
+        {
+            if (rank >= n_ones_)
+                throw std::out_of_range("rank_select_bitvector: select past the last one");
+
+            // the last block whose ones-before counter is <= rank
+            const size_t sample_idx = rank / select_sample;
+            size_t lo = samples_[sample_idx], hi = samples_[sample_idx + 1] + 1;
+            while (hi - lo > 1)
+            {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (counters_[2 * mid] <= rank)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+
+            size_t remaining = rank - static_cast<size_t>(counters_[2 * lo]);
+            const unsigned long long int packed = counters_[2 * lo + 1];
+            size_t word_in_block = 0;
+            while (word_in_block + 1 < words_per_block &&
+                   ((packed >> (9 * word_in_block)) & 0x1FF) <= remaining)
+                ++word_in_block;
+            if (word_in_block)
+                remaining -= static_cast<size_t>((packed >> (9 * (word_in_block - 1))) & 0x1FF);
+
+            const size_t word_idx = lo * words_per_block + word_in_block;
+            return 64 * word_idx + kernels::select64(data()[word_idx], static_cast<unsigned int>(remaining));
+        }
+
+    private:
+        static const size_t cache_line_words = 8;
+
+        static size_t padded_words(size_t n_bits)
+        {
+            return (n_bits + bits_per_block - 1) / bits_per_block * words_per_block;
+        }
+
+        // the bits start on a cache line boundary, so a block is one line
+        unsigned long long int* data()
+        {
+            const size_t misalignment = reinterpret_cast<size_t>(words_.data()) % (8 * cache_line_words);
+            return words_.data() + (misalignment ? (8 * cache_line_words - misalignment) / 8 : 0);
+        }
+
+        const unsigned long long int* data() const
+        {
+            return const_cast<rank_select_bitvector*>(this)->data();
+        }
+
+        void build()
+        {
+            if (words_.empty())
+                words_.assign(cache_line_words, 0);
+
+            const size_t n_blocks = padded_words(n_bits_) / words_per_block;
+
+            // the per-word counts come from the library's (parallel) kernels;
+            // they are taken a slice at a time, to bound the temporary memory
+            counters_.assign(2 * (n_blocks + 1), 0);
+            const size_t slice_blocks = 1 << 13;
+            unsigned long long int ones = 0;
+            for (size_t first_block = 0; first_block < n_blocks; first_block += slice_blocks)
+            {
+                const size_t n_slice_blocks = std::min(slice_blocks, n_blocks - first_block);
+                const std::vector<size_t> word_weights = weights(make_code_set(
+                        reinterpret_cast<const unsigned char*>(data() + first_block * words_per_block),
+                        n_slice_blocks * words_per_block, 8));
+
+                for (size_t block_idx = 0; block_idx < n_slice_blocks; ++block_idx)
+                {
+                    unsigned long long int* counter = counters_.data() + 2 * (first_block + block_idx);
+                    counter[0] = ones;
+                    unsigned long long int in_block = 0, packed = 0;
+                    for (size_t word_in_block = 0; word_in_block < words_per_block; ++word_in_block)
+                    {
+                        if (word_in_block)
+                            packed |= in_block << (9 * (word_in_block - 1));
+                        in_block += word_weights[block_idx * words_per_block + word_in_block];
+                    }
+                    counter[1] = packed;
+                    ones += in_block;
+                }
+            }
+            // sentinel, so that rank1(size()) works for a full last block
+            counters_[2 * n_blocks] = ones;
+            n_ones_ = static_cast<size_t>(ones);
+
+            // samples_[j] is the block holding the (j * select_sample)-th one
+            samples_.assign(n_ones_ / select_sample + 2, n_blocks ? n_blocks - 1 : 0);
+            for (size_t block_idx = 0, sample_idx = 0; block_idx < n_blocks; ++block_idx)
+                for (; sample_idx * select_sample < n_ones_ &&
+                       counters_[2 * (block_idx + 1)] > sample_idx * select_sample; ++sample_idx)
+                    samples_[sample_idx] = block_idx;
+        }
+
+        size_t n_bits_;
+        size_t n_ones_;
+        // bits, padded to whole blocks, plus room for the alignment
+        std::vector<unsigned long long int> words_;
+        std::vector<unsigned long long int> counters_;
+        std::vector<size_t> samples_;
+    };
+}
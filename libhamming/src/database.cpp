@@ -0,0 +1,578 @@
+//# code databases: a file format for code sets, used in place once mapped
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/code_set.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace{
+    // HAMMING_DB_MAGIC, without the terminating null
+    const size_t magic_bytes = 8;
+    const unsigned int byte_order_mark = 0x01020304;
+    // of the sections
+    const unsigned long long section_alignment = 64;
+
+    enum header_flags
+    {
+        header_has_ids = 1,
+        header_has_weights = 2
+    };
+
+    struct db_header
+    {
+        char magic[magic_bytes];
+        unsigned int version;
+        unsigned int header_bytes;
+        unsigned int byte_order;
+        unsigned int flags;
+        unsigned long long code_bytes;
+        unsigned long long n_codes;
+        unsigned long long stride;
+        unsigned long long alignment;
+        unsigned long long codes_offset;
+        unsigned long long ids_offset;
+        unsigned long long weights_offset;
+        unsigned long long file_bytes;
+        unsigned long long checksum;
+        unsigned long long reserved[4];
+    };
+    static_assert(sizeof(db_header) == HAMMING_DB_HEADER_BYTES, "the header is 128 bytes");
+
+    unsigned long long round_up(const unsigned long long n_bytes, const unsigned long long alignment)
+    {
+        return (n_bytes + alignment - 1) / alignment * alignment;
+    }
+
+    // the checksum splits the data in 1MB blocks, hashed independently (so
+    // that verifying them is parallel), then folds the block hashes in order
+    const size_t checksum_block_bytes = 1 << 20;
+    const unsigned long long hash_multiplier = 0x9E3779B97F4A7C15ULL;
+
+    inline unsigned long long mix(unsigned long long hash, const unsigned long long word)
+    {
+        hash = (hash ^ word) * hash_multiplier;
+        return hash ^ (hash >> 29);
+    }
+
+    // hash of a block of n_bytes (a multiple of 8), over 4 independent lanes
+    // so that the multiplications overlap
+    unsigned long long block_hash(const unsigned char* data, const size_t n_bytes, const size_t block_idx)
+    {
+        unsigned long long lanes[4] = {1, 2, 3, 4};
+        const size_t n_words = n_bytes / 8;
+        size_t word_idx = 0;
+        for (; word_idx + 4 <= n_words; word_idx += 4)
+            for (size_t lane_idx = 0; lane_idx < 4; ++lane_idx)
+                lanes[lane_idx] = mix(lanes[lane_idx], load_ull(data + 8 * (word_idx + lane_idx)));
+        for (; word_idx < n_words; ++word_idx)
+            lanes[word_idx % 4] = mix(lanes[word_idx % 4], load_ull(data + 8 * word_idx));
+
+        unsigned long long hash = mix(block_idx, n_bytes);
+        for (size_t lane_idx = 0; lane_idx < 4; ++lane_idx)
+            hash = mix(hash, lanes[lane_idx]);
+        return hash;
+    }
+
+    // of data written piece by piece, gathered in blocks
+    class checksum_builder
+    {
+    public:
+        checksum_builder() : checksum_(0), n_blocks_(0) {block_.reserve(checksum_block_bytes);}
+
+        void update(const unsigned char* data, size_t n_bytes)
+        {
+            while (n_bytes)
+            {
+                const size_t n_taken = min(n_bytes, checksum_block_bytes - block_.size());
+                block_.insert(block_.end(), data, data + n_taken);
+                data += n_taken;
+                n_bytes -= n_taken;
+                if (block_.size() == checksum_block_bytes)
+                    flush();
+            }
+        }
+
+        unsigned long long finish()
+        {
+            if (!block_.empty())
+                flush();
+            return checksum_;
+        }
+
+    private:
+        void flush()
+        {
+            checksum_ = mix(checksum_, block_hash(block_.data(), block_.size(), n_blocks_++));
+            block_.clear();
+        }
+
+        vector<unsigned char> block_;
+        unsigned long long checksum_;
+        size_t n_blocks_;
+    };
+
+    unsigned long long data_checksum(const unsigned char* data, const size_t n_bytes)
+    {
+        const ptrdiff_t n_blocks = static_cast<ptrdiff_t>((n_bytes + checksum_block_bytes - 1) /
+                                                          checksum_block_bytes);
+        vector<unsigned long long> hashes(static_cast<size_t>(n_blocks));
+#pragma omp parallel for schedule(static)
+        for (ptrdiff_t block_idx = 0; block_idx < n_blocks; ++block_idx)
+        {
+            const size_t first = static_cast<size_t>(block_idx) * checksum_block_bytes;
+            hashes[block_idx] = block_hash(data + first, min(checksum_block_bytes, n_bytes - first),
+                                           static_cast<size_t>(block_idx));
+        }
+
+        unsigned long long checksum = 0;
+        for (size_t block_idx = 0; block_idx < hashes.size(); ++block_idx)
+            checksum = mix(checksum, hashes[block_idx]);
+        return checksum;
+    }
+
+    // writes and checksums the data after the header
+    class section_writer
+    {
+    public:
+        explicit section_writer(FILE* file) : file_(file), n_written_(HAMMING_DB_HEADER_BYTES), ok_(true) {}
+
+        void write(const unsigned char* data, const size_t n_bytes)
+        {
+            ok_ = ok_ && fwrite(data, 1, n_bytes, file_) == n_bytes;
+            checksum_.update(data, n_bytes);
+            n_written_ += n_bytes;
+        }
+
+        // zeros up to the next section boundary
+        void pad()
+        {
+            static const unsigned char zeros[section_alignment] = {0};
+            write(zeros, static_cast<size_t>(round_up(n_written_, section_alignment) - n_written_));
+        }
+
+        unsigned long long n_written() const {return n_written_;}
+        bool ok() const {return ok_;}
+        unsigned long long checksum() {return checksum_.finish();}
+
+    private:
+        FILE* file_;
+        checksum_builder checksum_;
+        unsigned long long n_written_;
+        bool ok_;
+    };
+
+    // a file written next to its destination, then renamed over it, so that
+    // the servers which have the previous version mapped keep it intact.
+    // The data reaches the disk before the rename, and the rename before
+    // commit() returns, so that a crash leaves either version whole; the
+    // file is removed unless it was committed
+    class replacement_file
+    {
+    public:
+        explicit replacement_file(const char* path) : path_(path), file_(nullptr)
+        {
+#ifdef _WIN32
+            temp_path_ = path_ + ".tmp";
+            file_ = fopen(temp_path_.c_str(), "wb");
+#else
+            // a unique name, so that concurrent writers don't share it
+            vector<char> temp_path(path_.begin(), path_.end());
+            static const char suffix[] = ".XXXXXX";
+            temp_path.insert(temp_path.end(), suffix, suffix + sizeof(suffix));
+            const int fd = mkstemp(temp_path.data());
+            if (fd < 0)
+                return;
+            temp_path_ = temp_path.data();
+            // mkstemp only lets the owner read it, and the servers may not be
+            fchmod(fd, 0644);
+            file_ = fdopen(fd, "wb");
+            if (!file_)
+            {
+                close(fd);
+                remove(temp_path_.c_str());
+                temp_path_.clear();
+            }
+#endif
+        }
+
+        ~replacement_file()
+        {
+            if (file_)
+                fclose(file_);
+            if (!temp_path_.empty())
+                remove(temp_path_.c_str());
+        }
+
+        FILE* file() const {return file_;}
+
+        bool commit()
+        {
+            bool ok = !fflush(file_);
+#ifdef _WIN32
+            ok = ok && !_commit(_fileno(file_));
+#else
+            ok = ok && !fsync(fileno(file_));
+#endif
+            ok = !fclose(file_) && ok;
+            file_ = nullptr;
+            if (!ok)
+                return false;
+
+#ifdef _WIN32
+            if (!MoveFileExA(temp_path_.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+                return false;
+            temp_path_.clear();
+            return true;
+#else
+            if (rename(temp_path_.c_str(), path_.c_str()))
+                return false;
+            temp_path_.clear();
+
+            // the rename is only durable once the directory is
+            const size_t slash = path_.rfind('/');
+            const string dir = slash == string::npos ? "." : slash ? path_.substr(0, slash) : "/";
+            const int dir_fd = open(dir.c_str(), O_RDONLY);
+            if (dir_fd < 0)
+                return false;
+            ok = !fsync(dir_fd);
+            close(dir_fd);
+            return ok;
+#endif
+        }
+
+    private:
+        replacement_file(const replacement_file&);
+        replacement_file& operator=(const replacement_file&);
+
+        string path_;
+        string temp_path_;
+        FILE* file_;
+    };
+
+    // layout of a code set of the given size; offsets are 0 for absent
+    // sections
+    db_header make_header(const size_t code_bytes, const size_t n_codes, const bool with_ids,
+                          const bool with_weights)
+    {
+        db_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HAMMING_DB_MAGIC, magic_bytes);
+        header.version = HAMMING_VERSION;
+        header.header_bytes = HAMMING_DB_HEADER_BYTES;
+        header.byte_order = byte_order_mark;
+        header.flags = (with_ids ? header_has_ids : 0) | (with_weights ? header_has_weights : 0);
+        header.code_bytes = code_bytes;
+        header.n_codes = n_codes;
+
+        header.alignment = 1;
+        while (header.alignment < min(code_bytes, static_cast<size_t>(section_alignment)))
+            header.alignment *= 2;
+        header.stride = round_up(code_bytes, header.alignment);
+
+        unsigned long long offset = HAMMING_DB_HEADER_BYTES;
+        header.codes_offset = offset;
+        offset = round_up(offset + header.n_codes * header.stride, section_alignment);
+        if (with_ids)
+        {
+            header.ids_offset = offset;
+            offset = round_up(offset + header.n_codes * sizeof(unsigned long long), section_alignment);
+        }
+        if (with_weights)
+        {
+            header.weights_offset = offset;
+            offset = round_up(offset + header.n_codes * sizeof(unsigned int), section_alignment);
+        }
+        header.file_bytes = offset;
+        return header;
+    }
+
+    // every section within the file, and no overflows
+    bool consistent(const db_header& header, const unsigned long long file_bytes)
+    {
+        if (memcmp(header.magic, HAMMING_DB_MAGIC, magic_bytes) || header.byte_order != byte_order_mark ||
+            header.version < 100 || header.version > HAMMING_VERSION ||
+            header.header_bytes != HAMMING_DB_HEADER_BYTES || header.file_bytes != file_bytes)
+            return false;
+
+        if (!header.code_bytes || !header.alignment || (header.alignment & (header.alignment - 1)) ||
+            header.stride < header.code_bytes || header.stride % header.alignment)
+            return false;
+
+        const unsigned long long sizes[3] = {header.stride, sizeof(unsigned long long), sizeof(unsigned int)};
+        const unsigned long long offsets[3] = {header.codes_offset, header.ids_offset, header.weights_offset};
+        const bool present[3] = {true, (header.flags & header_has_ids) != 0, (header.flags & header_has_weights) != 0};
+        for (size_t section_idx = 0; section_idx < 3; ++section_idx)
+        {
+            if (!present[section_idx])
+            {
+                if (offsets[section_idx])
+                    return false;
+                continue;
+            }
+            if (offsets[section_idx] < HAMMING_DB_HEADER_BYTES || offsets[section_idx] % section_alignment ||
+                offsets[section_idx] > file_bytes ||
+                header.n_codes > (file_bytes - offsets[section_idx]) / sizes[section_idx])
+                return false;
+        }
+        return true;
+    }
+}
+
+struct hamming_db
+{
+    const unsigned char* data;
+    size_t size;
+    db_header header;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_write(const char* path,
+                                                           const hamming_code_set_t* codes,
+                                                           const unsigned long long ids[],
+                                                           const int flags)
+{
+    if (!path)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    try
+    {
+        const bool with_weights = (flags & HAMMING_DB_WITH_WEIGHTS) != 0;
+        db_header header = make_header(codes->code_bytes, codes->n_codes, ids != nullptr, with_weights);
+
+        replacement_file output(path);
+        FILE* file = output.file();
+        if (!file)
+            return HAMMING_STATUS_IO_ERROR;
+
+        section_writer writer(file);
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+        // rows are padded in batches of about 1MB
+        const size_t batch_codes = max(static_cast<size_t>(1),
+                                       checksum_block_bytes / static_cast<size_t>(header.stride));
+        vector<unsigned char> rows;
+        for (size_t first = 0; first < codes->n_codes && ok; first += batch_codes)
+        {
+            const size_t n_batch = min(batch_codes, codes->n_codes - first);
+            rows.assign(n_batch * static_cast<size_t>(header.stride), 0);
+            for (size_t code_idx = 0; code_idx < n_batch; ++code_idx)
+                memcpy(rows.data() + code_idx * header.stride, code_at(*codes, first + code_idx), codes->code_bytes);
+            writer.write(rows.data(), rows.size());
+        }
+        writer.pad();
+
+        if (ids)
+        {
+            writer.write(reinterpret_cast<const unsigned char*>(ids), codes->n_codes * sizeof(unsigned long long));
+            writer.pad();
+        }
+
+        if (with_weights)
+        {
+            vector<size_t> weights;
+            vector<unsigned int> packed;
+            for (size_t first = 0; first < codes->n_codes && ok; first += batch_codes)
+            {
+                const size_t n_batch = min(batch_codes, codes->n_codes - first);
+                hamming_code_set_t batch = *codes;
+                batch.data = code_at(*codes, first);
+                batch.n_codes = n_batch;
+                weights.resize(n_batch);
+                status = hamming_weights(&batch, weights.data(), HAMMING_IMPL_DEFAULT);
+                ok = ok && status == HAMMING_STATUS_SUCCESS;
+                packed.assign(weights.begin(), weights.end());
+                writer.write(reinterpret_cast<const unsigned char*>(packed.data()), n_batch * sizeof(unsigned int));
+            }
+            writer.pad();
+        }
+
+        header.checksum = writer.checksum();
+        ok = ok && writer.ok() && writer.n_written() == header.file_bytes && !fseek(file, 0, SEEK_SET) &&
+             fwrite(&header, sizeof(header), 1, file) == 1;
+
+        if (!ok || !output.commit())
+            return status != HAMMING_STATUS_SUCCESS ? status : HAMMING_STATUS_IO_ERROR;
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_open(const char* path, const int flags, hamming_db_t** db)
+{
+    if (!path)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!db)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_db_t* result = new (nothrow) hamming_db_t();
+    if (!result)
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+
+#ifdef _WIN32
+    result->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                               nullptr);
+    LARGE_INTEGER file_size;
+    if (result->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(result->file, &file_size))
+    {
+        if (result->file != INVALID_HANDLE_VALUE)
+            CloseHandle(result->file);
+        delete result;
+        return HAMMING_STATUS_IO_ERROR;
+    }
+    result->size = static_cast<size_t>(file_size.QuadPart);
+    result->mapping = result->size ? CreateFileMappingA(result->file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    result->data = result->mapping ?
+                   static_cast<const unsigned char*>(MapViewOfFile(result->mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (result->size >= HAMMING_DB_HEADER_BYTES && !result->data)
+    {
+        hamming_db_close(result);
+        return HAMMING_STATUS_IO_ERROR;
+    }
+#else
+    const int file = open(path, O_RDONLY);
+    struct stat file_stat;
+    if (file < 0 || fstat(file, &file_stat))
+    {
+        if (file >= 0)
+            close(file);
+        delete result;
+        return HAMMING_STATUS_IO_ERROR;
+    }
+    result->size = static_cast<size_t>(file_stat.st_size);
+    if (result->size >= HAMMING_DB_HEADER_BYTES)
+    {
+        void* mapping = mmap(nullptr, result->size, PROT_READ, MAP_SHARED, file, 0);
+        result->data = mapping == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(mapping);
+    }
+    close(file);
+    if (result->size >= HAMMING_DB_HEADER_BYTES && !result->data)
+    {
+        delete result;
+        return HAMMING_STATUS_IO_ERROR;
+    }
+#endif
+
+    if (result->size < HAMMING_DB_HEADER_BYTES)
+    {
+        hamming_db_close(result);
+        return HAMMING_STATUS_BAD_FORMAT;
+    }
+
+    memcpy(&result->header, result->data, sizeof(result->header));
+    if (!consistent(result->header, result->size))
+    {
+        hamming_db_close(result);
+        return HAMMING_STATUS_BAD_FORMAT;
+    }
+
+    // best effort: only kernels with THP for files grant it
+    hamming_advise_huge_pages(result->data, result->size);
+
+    if (flags & HAMMING_DB_VERIFY)
+    {
+        const hamming_status_t status = hamming_db_verify(result);
+        if (status != HAMMING_STATUS_SUCCESS)
+        {
+            hamming_db_close(result);
+            return status;
+        }
+    }
+
+    *db = result;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API void HAMMING_CALL hamming_db_close(hamming_db_t* db)
+{
+    if (!db)
+        return;
+
+#ifdef _WIN32
+    if (db->data)
+        UnmapViewOfFile(db->data);
+    if (db->mapping)
+        CloseHandle(db->mapping);
+    CloseHandle(db->file);
+#else
+    if (db->data)
+        munmap(const_cast<unsigned char*>(db->data), db->size);
+#endif
+    delete db;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_codes(const hamming_db_t* db, hamming_code_set_t* codes)
+{
+    if (!db)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!codes)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    codes->data = db->data + db->header.codes_offset;
+    codes->n_codes = static_cast<size_t>(db->header.n_codes);
+    codes->code_bytes = static_cast<size_t>(db->header.code_bytes);
+    codes->stride = static_cast<size_t>(db->header.stride);
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API const unsigned long long* HAMMING_CALL hamming_db_ids(const hamming_db_t* db)
+{
+    return db && db->header.ids_offset ?
+           reinterpret_cast<const unsigned long long*>(db->data + db->header.ids_offset) : nullptr;
+}
+
+HAMMING_API const unsigned int* HAMMING_CALL hamming_db_weights(const hamming_db_t* db)
+{
+    return db && db->header.weights_offset ?
+           reinterpret_cast<const unsigned int*>(db->data + db->header.weights_offset) : nullptr;
+}
+
+HAMMING_API int HAMMING_CALL hamming_db_version(const hamming_db_t* db)
+{
+    return db ? static_cast<int>(db->header.version) : 0;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_db_verify(const hamming_db_t* db)
+{
+    if (!db)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    try
+    {
+        return data_checksum(db->data + HAMMING_DB_HEADER_BYTES, db->size - HAMMING_DB_HEADER_BYTES) ==
+               db->header.checksum ? HAMMING_STATUS_SUCCESS : HAMMING_STATUS_BAD_FORMAT;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
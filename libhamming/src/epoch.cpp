@@ -0,0 +1,119 @@
+//# epoch-based reclamation of the structures read without locks
+
+#include <cstddef>
+#include <hamming/internal/epoch.h>
+#include <functional>
+#include <new>
+#include <thread>
+
+using namespace std;
+
+epoch_domain::epoch_domain()
+    : epoch_(0)
+{
+    for (size_t stripe_idx = 0; stripe_idx < n_stripes; ++stripe_idx)
+    {
+        stripes_[stripe_idx].readers[0].store(0);
+        stripes_[stripe_idx].readers[1].store(0);
+    }
+}
+
+epoch_domain::~epoch_domain()
+{
+    for (size_t retired_idx = 0; retired_idx < retired_.size(); ++retired_idx)
+        retired_[retired_idx].deleter(retired_[retired_idx].object);
+}
+
+epoch_domain::guard::guard(epoch_domain& domain)
+    : domain_(domain)
+{
+    stripe& own = domain.stripes_[hash<thread::id>()(this_thread::get_id()) % n_stripes];
+    // the registration only counts if the epoch didn't move in between;
+    // otherwise the reclaimer may have checked the counter already
+    for (;;)
+    {
+        const unsigned long long epoch = domain.epoch_.load();
+        counter_ = &own.readers[epoch & 1];
+        counter_->fetch_add(1);
+        if (domain.epoch_.load() == epoch)
+            return;
+        counter_->fetch_sub(1);
+    }
+}
+
+epoch_domain::guard::~guard()
+{
+    counter_->fetch_sub(1);
+}
+
+void epoch_domain::retire(void* object, void (*deleter)(void*))
+{
+    {
+        lock_guard<mutex> lock(retired_mutex_);
+        // the epoch is read after the object was unlinked, so the readers
+        // which can hold it are registered in this epoch or an earlier one
+        const retired entry = {epoch_.load(), object, deleter};
+        try
+        {
+            retired_.push_back(entry);
+        }
+        catch (const bad_alloc&)
+        {
+            return;
+        }
+    }
+    collect();
+}
+
+void epoch_domain::try_advance()
+{
+    const unsigned long long epoch = epoch_.load();
+    const size_t previous = (epoch + 1) & 1;
+    for (size_t stripe_idx = 0; stripe_idx < n_stripes; ++stripe_idx)
+        if (stripes_[stripe_idx].readers[previous].load())
+            return;
+    unsigned long long expected = epoch;
+    epoch_.compare_exchange_strong(expected, epoch + 1);
+}
+
+void epoch_domain::collect()
+{
+    vector<retired> freed;
+    {
+        lock_guard<mutex> lock(retired_mutex_);
+        if (retired_.empty())
+            return;
+        // the only allocation, before anything moves; without memory, the
+        // objects wait for the next collection
+        try
+        {
+            freed.reserve(retired_.size());
+        }
+        catch (const bad_alloc&)
+        {
+            return;
+        }
+
+        // twice: with no readers around, what was just retired is freed now
+        try_advance();
+        try_advance();
+        const unsigned long long epoch = epoch_.load();
+        size_t n_kept = 0;
+        for (size_t retired_idx = 0; retired_idx < retired_.size(); ++retired_idx)
+            if (retired_[retired_idx].epoch + 2 <= epoch)
+                freed.push_back(retired_[retired_idx]);
+            else
+                retired_[n_kept++] = retired_[retired_idx];
+        retired_.resize(n_kept);
+    }
+
+    // outside the lock: deleters may retire more objects
+    for (size_t freed_idx = 0; freed_idx < freed.size(); ++freed_idx)
+        freed[freed_idx].deleter(freed[freed_idx].object);
+}
+
+size_t epoch_domain::n_retired()
+{
+    lock_guard<mutex> lock(retired_mutex_);
+    return retired_.size();
+}
@@ -1,6 +1,11 @@
 #include <cstddef>
 #include <hamming/hamming_c.h>
 #include <hamming/internal/popcount.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/stats.h>
+#include <hamming/internal/probes.h>
+#include <hamming/internal/code_set.h>
+#include <hamming/internal/scan.h>
 #include <algorithm>
 
 // we generally prefer using types like unsigned long long instead of
@@ -9,37 +14,145 @@
 using namespace std;
 
 namespace{
-    typedef unsigned int(*popcount_ull_t)(const unsigned long long int&);
-    // template by popcount function to give compiler a chance to inline
-    template<popcount_ull_t popcount_ull>
+    // split in word-aligned blocks, one per iteration of the parallel loop,
+    // each summed by the kernel; a block is large enough to amortize the
+    // scheduling, and keeps the kernel's unrolled loop busy
+    template<typename Kernel>
     size_t hamming_distance_impl (const unsigned char str1[],
                                   const unsigned char str2[],
                                   const size_t n_bytes)
     {
-        if (!n_bytes)
-            return 0;
-
-        const unsigned long long* str1_ull = reinterpret_cast<const unsigned long long*>(str1);
-        const unsigned long long* str2_ull = reinterpret_cast<const unsigned long long*>(str2);
-        const size_t n_longs = n_bytes / sizeof(str1_ull[0]);
+        const ptrdiff_t block_bytes = 1 << 16;
+        const ptrdiff_t n_blocks = static_cast<ptrdiff_t>((n_bytes + block_bytes - 1) / block_bytes);
         size_t dist = 0;
-#pragma omp parallel for reduction(+:dist)
-        for(ptrdiff_t ull_idx = 0; ull_idx < n_longs; ++ull_idx)
-            dist += popcount_ull(str1_ull[ull_idx] ^ str2_ull[ull_idx]);
+#pragma omp parallel for reduction(+:dist) if(n_blocks > 1)
+        for (ptrdiff_t block_idx = 0; block_idx < n_blocks; ++block_idx)
+        {
+            const size_t first = static_cast<size_t>(block_idx * block_bytes);
+            dist += xor_popcount<Kernel>(str1 + first, str2 + first,
+                                         min(n_bytes - first, static_cast<size_t>(block_bytes)));
+        }
+        return dist;
+    }
 
-        // remaining_bytes < 7
-        unsigned char remaining_bytes = static_cast<unsigned char>(n_bytes % sizeof(str1_ull[0]));
-        if (!remaining_bytes)
-            return dist;
+    template<typename Kernel>
+    struct distance_op
+    {
+        static void run(const unsigned char str1[], const unsigned char str2[],
+                        const size_t n_bytes, size_t* distance)
+        {
+            *distance = hamming_distance_impl<Kernel>(str1, str2, n_bytes);
+        }
+    };
 
-        unsigned long long int remaining_1(0), remaining_2(0);
-        copy(str1 + n_bytes - remaining_bytes, str1 + n_bytes, reinterpret_cast<unsigned char*>(&remaining_1));
-        copy(str2 + n_bytes - remaining_bytes, str2 + n_bytes, reinterpret_cast<unsigned char*>(&remaining_2));
+    template<typename Kernel>
+    struct distance_batch_op
+    {
+        static void run(const unsigned char query[], const hamming_code_set_t& codes, size_t distances[])
+        {
+            const row_prefetcher prefetch(codes, current_scan_options());
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+            {
+                prefetch(code_idx);
+                distances[code_idx] = xor_popcount<Kernel>(query, code_at(codes, code_idx), codes.code_bytes);
+            }
+        }
+    };
 
-        dist += popcount_ull(remaining_1 ^ remaining_2);
+#ifdef HAMMING_WITH_INTERLEAVED
+    template<popcount_ull_t popcount_ull>
+    struct distance_batch_op<interleaved_kernel<popcount_ull> >
+    {
+        typedef interleaved_kernel<popcount_ull> Kernel;
 
-        return dist;
-    }
+        static void run(const unsigned char query[], const hamming_code_set_t& codes, size_t distances[])
+        {
+            const row_prefetcher prefetch(codes, current_scan_options());
+            const size_t stride = code_stride(codes);
+            const ptrdiff_t n_groups = static_cast<ptrdiff_t>(codes.n_codes / Kernel::group_size);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t group_idx = 0; group_idx < n_groups; ++group_idx)
+            {
+                const size_t first = static_cast<size_t>(group_idx) * Kernel::group_size;
+                for (size_t code_idx = first; code_idx < first + Kernel::group_size; ++code_idx)
+                    prefetch(code_idx);
+                xor_popcount_interleaved<Kernel, Kernel::group_size>(query, code_at(codes, first), stride,
+                                                                     codes.code_bytes, distances + first);
+            }
+
+            for (size_t code_idx = n_groups * Kernel::group_size; code_idx < codes.n_codes; ++code_idx)
+                distances[code_idx] = xor_popcount<Kernel>(query, code_at(codes, code_idx), codes.code_bytes);
+        }
+    };
+#endif
+
+    template<typename Kernel>
+    struct weight_op
+    {
+        static void run(const unsigned char str[], const size_t n_bytes, size_t* weight)
+        {
+            // split in word-aligned blocks, like the distance
+            const ptrdiff_t block_bytes = 1 << 16;
+            const ptrdiff_t n_blocks = static_cast<ptrdiff_t>((n_bytes + block_bytes - 1) / block_bytes);
+            size_t total = 0;
+#pragma omp parallel for reduction(+:total) if(n_blocks > 1)
+            for (ptrdiff_t block_idx = 0; block_idx < n_blocks; ++block_idx)
+            {
+                const size_t first = static_cast<size_t>(block_idx * block_bytes);
+                total += weight_popcount<Kernel>(str + first, min(n_bytes - first, static_cast<size_t>(block_bytes)));
+            }
+            *weight = total;
+        }
+    };
+
+    template<typename Kernel>
+    struct weights_op
+    {
+        static void run(const hamming_code_set_t& codes, size_t weights[])
+        {
+            const row_prefetcher prefetch(codes, current_scan_options());
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+            {
+                prefetch(code_idx);
+                weights[code_idx] = weight_popcount<Kernel>(code_at(codes, code_idx), codes.code_bytes);
+            }
+        }
+    };
+
+    // both ranges are walked a full word at a time; the words are assembled
+    // by funnel shifting neighbouring bytes, so the cost is independent of
+    // the offsets
+    template<typename Kernel>
+    struct distance_bits_op
+    {
+        static void run(const unsigned char str1[], const size_t bit_offset1,
+                        const unsigned char str2[], const size_t bit_offset2,
+                        const size_t n_bits, size_t* distance)
+        {
+            const unsigned char* src1 = str1 + bit_offset1 / 8;
+            const unsigned char* src2 = str2 + bit_offset2 / 8;
+            const unsigned int shift1 = static_cast<unsigned int>(bit_offset1 % 8);
+            const unsigned int shift2 = static_cast<unsigned int>(bit_offset2 % 8);
+            const size_t n_words = n_bits / 64;
+
+            size_t dist = Kernel::sum(n_words, [=](size_t word_idx)
+            {
+                return load_shifted_ull(src1, shift1, word_idx) ^
+                       load_shifted_ull(src2, shift2, word_idx);
+            });
+
+            const size_t remaining_bits = n_bits % 64;
+            if (remaining_bits)
+                dist += Kernel::popcount(load_bits(src1, shift1 + 64 * n_words, remaining_bits) ^
+                                         load_bits(src2, shift2 + 64 * n_words, remaining_bits));
+
+            *distance = dist;
+        }
+    };
 }
 
 HAMMING_API hamming_status_t HAMMING_CALL hamming_distance(const unsigned char str1[],
@@ -48,6 +161,9 @@ HAMMING_API hamming_status_t HAMMING_CALL hamming_distance(const unsigned char s
                                                            size_t* distance,
                                                            hamming_impl_t impl)
 {
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_DISTANCE);
+    HAMMING_PROBE_SCOPE2(distance, n_bytes, static_cast<int>(impl));
+
     if (!str1)
         return HAMMING_STATUS_BAD_PARAM_STR_1;
 
@@ -57,46 +173,81 @@ HAMMING_API hamming_status_t HAMMING_CALL hamming_distance(const unsigned char s
     if (!distance)
         return HAMMING_STATUS_BAD_PARAM_DISTANCE;
 
-    switch(impl)
-    {
-        case HAMMING_IMPL_DEFAULT:
-#if defined(HAMMING_WITH_VANILLA) || defined(HAMMING_WITH_2x32) || defined(HAMMING_WITH_LUT) || defined(HAMMING_WITH_SPARSE) || defined(HAMMING_WITH_INTRINSICS)
-            *distance = hamming_distance_impl<popcount64>(str1, str2, n_bytes);
-            return HAMMING_STATUS_SUCCESS;
-#else
-            return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
-#endif
-        case HAMMING_IMPL_VANILLA:
-#ifdef HAMMING_WITH_VANILLA
-            *distance = hamming_distance_impl<popcount64_vanilla>(str1, str2, n_bytes);
-            return HAMMING_STATUS_SUCCESS;
-#else
-            return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
-#endif
-        case HAMMING_IMPL_2x32:
-#ifdef HAMMING_WITH_2x32
-            *distance = hamming_distance_impl<popcount64_vanilla>(str1, str2, n_bytes);
-            return HAMMING_STATUS_SUCCESS;
-#else
-            return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
-#endif
-        case HAMMING_IMPL_LUT:
-#ifdef HAMMING_WITH_LUT
-            *distance = hamming_distance_impl<popcount64_lut> (str1, str2, n_bytes);
-            return HAMMING_STATUS_SUCCESS;
-#else
-            return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
-#endif
-        case HAMMING_IMPL_SPARSE:
-#ifdef HAMMING_WITH_SPARSE
-            *distance = hamming_distance_impl<popcount64_sparse> (str1, str2, n_bytes);
-            return HAMMING_STATUS_SUCCESS;
-#else
-            return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
-#endif
-        default:
-            return HAMMING_STATUS_UNKNOWN_IMPLEMENTATION;
-    }
+    return dispatch<distance_op>(impl, n_bytes, str1, str2, n_bytes, distance);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_bits(const unsigned char str1[],
+                                                                const size_t bit_offset1,
+                                                                const unsigned char str2[],
+                                                                const size_t bit_offset2,
+                                                                const size_t n_bits,
+                                                                size_t* distance,
+                                                                hamming_impl_t impl)
+{
+    if (!str1)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!str2)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!distance)
+        return HAMMING_STATUS_BAD_PARAM_DISTANCE;
+
+    return dispatch<distance_bits_op>(impl, (n_bits + 7) / 8, str1, bit_offset1, str2, bit_offset2, n_bits, distance);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_batch(const unsigned char query[],
+                                                                 const hamming_code_set_t* codes,
+                                                                 size_t distances[],
+                                                                 hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_DISTANCE_BATCH);
+    HAMMING_PROBE_SCOPE3(distance_batch, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0,
+                         static_cast<int>(impl));
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (!distances)
+        return HAMMING_STATUS_BAD_PARAM_DISTANCE;
+
+    return dispatch<distance_batch_op>(impl, code_set_bytes(*codes), query, *codes, distances);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weight(const unsigned char str[],
+                                                         const size_t n_bytes,
+                                                         size_t* weight,
+                                                         hamming_impl_t impl)
+{
+    if (!str)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!weight)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    return dispatch<weight_op>(impl, n_bytes, str, n_bytes, weight);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weights(const hamming_code_set_t* codes,
+                                                          size_t weights[],
+                                                          hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_WEIGHTS);
+    HAMMING_PROBE_SCOPE3(weights, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0,
+                         static_cast<int>(impl));
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_1);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (!weights)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    return dispatch<weights_op>(impl, code_set_bytes(*codes), *codes, weights);
 }
 
 HAMMING_API const char* HAMMING_CALL get_hamming_error_string(hamming_status_t error)
@@ -118,6 +269,16 @@ HAMMING_API const char* HAMMING_CALL get_hamming_error_string(hamming_status_t e
             return "unknown implementation selected; maybe you have the headers "
                     "of a newer version of libhamming (i.e. mismatch between "
                     "header and lib)";
+        case HAMMING_STATUS_BAD_PARAM_SIZE:
+            return "the sizes of the inputs are invalid or inconsistent";
+        case HAMMING_STATUS_BAD_PARAM_OUTPUT:
+            return "an output parameter is an invalid pointer";
+        case HAMMING_STATUS_OUT_OF_MEMORY:
+            return "not enough memory";
+        case HAMMING_STATUS_IO_ERROR:
+            return "a file couldn't be opened, read, written or mapped";
+        case HAMMING_STATUS_BAD_FORMAT:
+            return "the file is not a code database this version can read, or it is corrupt";
         default:
             return "unknown error code; maybe you got it from a different "
                     "version of the library (i.e. mismatch between header and "
@@ -125,6 +286,17 @@ HAMMING_API const char* HAMMING_CALL get_hamming_error_string(hamming_status_t e
     }
 }
 
+HAMMING_API const char* HAMMING_CALL hamming_impl_name(hamming_impl_t impl)
+{
+    // by value, as the enumerators of the disabled implementations are not
+    // declared
+    static const char* const names[HAMMING_N_IMPLS] = {"default", "vanilla", "2x32", "lut", "sparse",
+                                                             "lut16", "unrolled", "harley_seal", "vector",
+                                                             "interleaved"};
+    const int impl_idx = static_cast<int>(impl);
+    return impl_idx >= 0 && impl_idx < HAMMING_N_IMPLS ? names[impl_idx] : "unknown";
+}
+
 HAMMING_CALL int HAMMING_CALL hamming_version()
 {
     return HAMMING_VERSION;
@@ -0,0 +1,248 @@
+//# histograms of the distances between code sets
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/stats.h>
+#include <hamming/internal/probes.h>
+#include <hamming/internal/code_set.h>
+#include <hamming/internal/parallel.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace{
+    // codes of the other set compared per tile, for cache reuse of the query
+    const size_t tile_codes = 1024;
+    // sampled pairs per generator, so that the samples don't depend on the
+    // way they are split between threads
+    const unsigned long long samples_per_stream = 4096;
+
+    // splitmix64: tiny, fast and good enough for picking pairs
+    inline unsigned long long int next_random(unsigned long long int& state)
+    {
+        unsigned long long int z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // uniform in [0, n); the modulo bias is negligible for set sizes << 2^64
+    inline size_t random_index(unsigned long long int& state, const size_t n)
+    {
+        return static_cast<size_t>(next_random(state) % n);
+    }
+
+    // a thread whose histogram couldn't be allocated merges an empty one
+    inline void merge_histogram(const vector<unsigned long long>& thread_histogram, unsigned long long histogram[])
+    {
+#pragma omp critical
+        for (size_t bin = 0; bin < thread_histogram.size(); ++bin)
+            histogram[bin] += thread_histogram[bin];
+    }
+
+    template<typename Kernel>
+    struct histogram_op
+    {
+        static void run(const hamming_code_set_t& queries, const hamming_code_set_t& codes,
+                        const hamming_histogram_options_t& options, unsigned long long histogram[])
+        {
+            const size_t n_bins = 8 * codes.code_bytes + 1;
+            fill(histogram, histogram + n_bins, 0ULL);
+
+            if (options.n_samples)
+            {
+                const ptrdiff_t n_streams = static_cast<ptrdiff_t>(
+                        (options.n_samples + samples_per_stream - 1) / samples_per_stream);
+                parallel_failure failure;
+#pragma omp parallel
+                {
+                    vector<unsigned long long> thread_histogram;
+                    failure.run([&] {thread_histogram.assign(n_bins, 0);});
+#pragma omp for schedule(static) nowait
+                    for (ptrdiff_t stream_idx = 0; stream_idx < n_streams; ++stream_idx)
+                    {
+                        if (failure.failed())
+                            continue;
+                        unsigned long long int state = options.seed ^ (0xD1B54A32D192ED03ULL * (stream_idx + 1));
+                        const unsigned long long first = stream_idx * samples_per_stream;
+                        const unsigned long long n = min(samples_per_stream, options.n_samples - first);
+                        for (unsigned long long sample = 0; sample < n; ++sample)
+                        {
+                            const size_t query_idx = random_index(state, queries.n_codes);
+                            const size_t code_idx = random_index(state, codes.n_codes);
+                            ++thread_histogram[xor_popcount<Kernel>(code_at(queries, query_idx),
+                                                                    code_at(codes, code_idx), codes.code_bytes)];
+                        }
+                    }
+                    merge_histogram(thread_histogram, histogram);
+                }
+                failure.rethrow();
+                return;
+            }
+
+            // tiles of (query, block of codes), so that one query and many
+            // codes also parallelize
+            const size_t n_code_tiles = (codes.n_codes + tile_codes - 1) / tile_codes;
+            const ptrdiff_t n_tiles = static_cast<ptrdiff_t>(queries.n_codes * n_code_tiles);
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                vector<unsigned long long> thread_histogram;
+                failure.run([&] {thread_histogram.assign(n_bins, 0);});
+#pragma omp for schedule(static) nowait
+                for (ptrdiff_t tile_idx = 0; tile_idx < n_tiles; ++tile_idx)
+                {
+                    if (failure.failed())
+                        continue;
+                    const unsigned char* query = code_at(queries, tile_idx / n_code_tiles);
+                    const size_t first = (tile_idx % n_code_tiles) * tile_codes;
+                    const size_t last = min(codes.n_codes, first + tile_codes);
+                    for (size_t code_idx = first; code_idx < last; ++code_idx)
+                        ++thread_histogram[xor_popcount<Kernel>(query, code_at(codes, code_idx), codes.code_bytes)];
+                }
+                merge_histogram(thread_histogram, histogram);
+            }
+            failure.rethrow();
+        }
+    };
+
+    template<typename Kernel>
+    struct histogram_self_op
+    {
+        static void run(const hamming_code_set_t& codes, const hamming_histogram_options_t& options,
+                        unsigned long long histogram[])
+        {
+            const size_t n_bins = 8 * codes.code_bytes + 1;
+            fill(histogram, histogram + n_bins, 0ULL);
+
+            if (codes.n_codes < 2)
+                return;
+
+            if (options.n_samples)
+            {
+                const ptrdiff_t n_streams = static_cast<ptrdiff_t>(
+                        (options.n_samples + samples_per_stream - 1) / samples_per_stream);
+                parallel_failure failure;
+#pragma omp parallel
+                {
+                    vector<unsigned long long> thread_histogram;
+                    failure.run([&] {thread_histogram.assign(n_bins, 0);});
+#pragma omp for schedule(static) nowait
+                    for (ptrdiff_t stream_idx = 0; stream_idx < n_streams; ++stream_idx)
+                    {
+                        if (failure.failed())
+                            continue;
+                        unsigned long long int state = options.seed ^ (0xD1B54A32D192ED03ULL * (stream_idx + 1));
+                        const unsigned long long first = stream_idx * samples_per_stream;
+                        const unsigned long long n = min(samples_per_stream, options.n_samples - first);
+                        for (unsigned long long sample = 0; sample < n; ++sample)
+                        {
+                            // uniform over the pairs of distinct codes
+                            const size_t code_idx1 = random_index(state, codes.n_codes);
+                            size_t code_idx2 = random_index(state, codes.n_codes - 1);
+                            if (code_idx2 >= code_idx1)
+                                ++code_idx2;
+                            ++thread_histogram[xor_popcount<Kernel>(code_at(codes, code_idx1),
+                                                                    code_at(codes, code_idx2), codes.code_bytes)];
+                        }
+                    }
+                    merge_histogram(thread_histogram, histogram);
+                }
+                failure.rethrow();
+                return;
+            }
+
+            // the rows get shorter, hence the dynamic schedule
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                vector<unsigned long long> thread_histogram;
+                failure.run([&] {thread_histogram.assign(n_bins, 0);});
+#pragma omp for schedule(dynamic, 16) nowait
+                for (ptrdiff_t code_idx1 = 0; code_idx1 < n_codes; ++code_idx1)
+                {
+                    if (failure.failed())
+                        continue;
+                    const unsigned char* code1 = code_at(codes, code_idx1);
+                    for (size_t code_idx2 = code_idx1 + 1; code_idx2 < codes.n_codes; ++code_idx2)
+                        ++thread_histogram[xor_popcount<Kernel>(code1, code_at(codes, code_idx2), codes.code_bytes)];
+                }
+                merge_histogram(thread_histogram, histogram);
+            }
+            failure.rethrow();
+        }
+    };
+
+    const hamming_histogram_options_t default_histogram_options = {0, 0};
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_histogram(const hamming_code_set_t* queries,
+                                                                     const hamming_code_set_t* codes,
+                                                                     unsigned long long histogram[],
+                                                                     const hamming_histogram_options_t* options,
+                                                                     hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_HISTOGRAM);
+    HAMMING_PROBE_SCOPE4(histogram, queries ? queries->n_codes : 0, codes ? codes->n_codes : 0,
+                         codes ? codes->code_bytes : 0, static_cast<int>(impl));
+
+    hamming_status_t status = check_code_set(queries, HAMMING_STATUS_BAD_PARAM_STR_1);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (queries->code_bytes != codes->code_bytes)
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    if (!histogram)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_histogram_options_t sampling = options ? *options : default_histogram_options;
+    if (!queries->n_codes || !codes->n_codes)
+        sampling.n_samples = 0; // nothing to sample from
+
+    try
+    {
+        return dispatch<histogram_op>(impl, code_set_bytes(*queries) + code_set_bytes(*codes),
+                                      *queries, *codes, sampling, histogram);
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_distance_histogram_self(const hamming_code_set_t* codes,
+                                                                          unsigned long long histogram[],
+                                                                          const hamming_histogram_options_t* options,
+                                                                          hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_HISTOGRAM);
+    HAMMING_PROBE_SCOPE4(histogram, codes ? codes->n_codes : 0, codes ? codes->n_codes : 0,
+                         codes ? codes->code_bytes : 0, static_cast<int>(impl));
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_1);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (!histogram)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        return dispatch<histogram_self_op>(impl, code_set_bytes(*codes), *codes,
+                                           options ? *options : default_histogram_options, histogram);
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
@@ -0,0 +1,265 @@
+//# masked and per-bit-weighted distances
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/stats.h>
+#include <hamming/internal/probes.h>
+#include <hamming/internal/code_set.h>
+#include <hamming/internal/scan.h>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace{
+    // both counts are taken in the same pass over the four inputs
+    template<typename Kernel>
+    void masked_counts(const unsigned char str1[], const unsigned char mask1[],
+                       const unsigned char str2[], const unsigned char mask2[],
+                       const size_t n_bytes, size_t& distance, size_t& n_valid)
+    {
+        size_t dist = 0, valid = 0;
+        const size_t n_words = n_bytes / 8;
+        for (size_t word_idx = 0; word_idx < n_words; ++word_idx)
+        {
+            const size_t offset = 8 * word_idx;
+            const unsigned long long int mask = load_ull(mask1 + offset) & load_ull(mask2 + offset);
+            dist += Kernel::popcount((load_ull(str1 + offset) ^ load_ull(str2 + offset)) & mask);
+            valid += Kernel::popcount(mask);
+        }
+
+        const size_t remaining_bytes = n_bytes % 8;
+        if (remaining_bytes)
+        {
+            const size_t offset = 8 * n_words;
+            const unsigned long long int mask = load_ull_partial(mask1 + offset, remaining_bytes) &
+                                                load_ull_partial(mask2 + offset, remaining_bytes);
+            dist += Kernel::popcount((load_ull_partial(str1 + offset, remaining_bytes) ^
+                                      load_ull_partial(str2 + offset, remaining_bytes)) & mask);
+            valid += Kernel::popcount(mask);
+        }
+
+        distance = dist;
+        n_valid = valid;
+    }
+
+    template<typename Kernel>
+    struct masked_distance_op
+    {
+        static void run(const unsigned char str1[], const unsigned char mask1[],
+                        const unsigned char str2[], const unsigned char mask2[],
+                        const size_t n_bytes, size_t* distance, size_t* n_valid)
+        {
+            masked_counts<Kernel>(str1, mask1, str2, mask2, n_bytes, *distance, *n_valid);
+        }
+    };
+
+    template<typename Kernel>
+    struct masked_distance_batch_op
+    {
+        static void run(const unsigned char query[], const unsigned char query_mask[],
+                        const hamming_code_set_t& codes, const hamming_code_set_t& masks,
+                        size_t distances[], size_t n_valid[], double scores[])
+        {
+            const hamming_scan_options_t options = current_scan_options();
+            const row_prefetcher prefetch_code(codes, options), prefetch_mask(masks, options);
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+            {
+                prefetch_code(code_idx);
+                prefetch_mask(code_idx);
+                size_t dist = 0, valid = 0;
+                masked_counts<Kernel>(query, query_mask, code_at(codes, code_idx), code_at(masks, code_idx),
+                                      codes.code_bytes, dist, valid);
+                if (distances)
+                    distances[code_idx] = dist;
+                if (n_valid)
+                    n_valid[code_idx] = valid;
+                if (scores)
+                    scores[code_idx] = valid ? static_cast<double>(dist) / valid : 1.0;
+            }
+        }
+    };
+}
+
+struct hamming_weighted_query
+{
+    size_t n_bytes;
+    // 32 entries per byte of code: 16 for the low nibble, then 16 for the
+    // high one; entry v holds the sum of the weights of the bits in which v
+    // differs from the corresponding nibble of the query
+    vector<float> lut;
+};
+
+namespace{
+    inline float weighted_distance(const hamming_weighted_query& weighted_query, const unsigned char code[])
+    {
+        const float* lut = weighted_query.lut.data();
+        float dist = 0;
+        for (size_t byte_idx = 0; byte_idx < weighted_query.n_bytes; ++byte_idx, lut += 32)
+            dist += lut[code[byte_idx] & 0x0F] + lut[16 + (code[byte_idx] >> 4)];
+        return dist;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_masked_distance(const unsigned char str1[],
+                                                                  const unsigned char mask1[],
+                                                                  const unsigned char str2[],
+                                                                  const unsigned char mask2[],
+                                                                  const size_t n_bytes,
+                                                                  size_t* distance,
+                                                                  size_t* n_valid,
+                                                                  hamming_impl_t impl)
+{
+    if (!str1 || !mask1)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!str2 || !mask2)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!distance)
+        return HAMMING_STATUS_BAD_PARAM_DISTANCE;
+
+    if (!n_valid)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    return dispatch<masked_distance_op>(impl, n_bytes, str1, mask1, str2, mask2, n_bytes, distance, n_valid);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_masked_distance_batch(const unsigned char query[],
+                                                                        const unsigned char query_mask[],
+                                                                        const hamming_code_set_t* codes,
+                                                                        const hamming_code_set_t* masks,
+                                                                        size_t distances[],
+                                                                        size_t n_valid[],
+                                                                        double scores[],
+                                                                        hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_MASKED_DISTANCE_BATCH);
+    HAMMING_PROBE_SCOPE3(masked_distance_batch, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0,
+                         static_cast<int>(impl));
+
+    if (!query || !query_mask)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    status = check_code_set(masks, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (codes->n_codes != masks->n_codes || codes->code_bytes != masks->code_bytes)
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    if (!distances && !n_valid && !scores)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    return dispatch<masked_distance_batch_op>(impl, code_set_bytes(*codes), query, query_mask,
+                                              *codes, *masks, distances, n_valid, scores);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weighted_query_create(const unsigned char query[],
+                                                                        const float weights[],
+                                                                        const size_t n_bytes,
+                                                                        hamming_weighted_query_t** weighted_query)
+{
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!weights)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!weighted_query)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    if (!n_bytes)
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    try
+    {
+        hamming_weighted_query_t* result = new hamming_weighted_query_t();
+        result->n_bytes = n_bytes;
+        result->lut.resize(32 * n_bytes);
+        for (size_t byte_idx = 0; byte_idx < n_bytes; ++byte_idx)
+            for (unsigned int half = 0; half < 2; ++half)
+            {
+                const unsigned int query_nibble = (query[byte_idx] >> (4 * half)) & 0x0F;
+                const float* nibble_weights = weights + 8 * byte_idx + 4 * half;
+                float* lut = result->lut.data() + 32 * byte_idx + 16 * half;
+                for (unsigned int value = 0; value < 16; ++value)
+                {
+                    float weight = 0;
+                    for (unsigned int bit = 0; bit < 4; ++bit)
+                        if (((value ^ query_nibble) >> bit) & 1)
+                            weight += nibble_weights[bit];
+                    lut[value] = weight;
+                }
+            }
+
+        *weighted_query = result;
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weighted_distance(const hamming_weighted_query_t* weighted_query,
+                                                                    const unsigned char code[],
+                                                                    float* distance)
+{
+    if (!weighted_query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!code)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!distance)
+        return HAMMING_STATUS_BAD_PARAM_DISTANCE;
+
+    *distance = weighted_distance(*weighted_query, code);
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_weighted_distance_batch(const hamming_weighted_query_t* weighted_query,
+                                                                          const hamming_code_set_t* codes,
+                                                                          float distances[])
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_WEIGHTED_DISTANCE_BATCH);
+    HAMMING_PROBE_SCOPE2(weighted_distance_batch, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0);
+
+    if (!weighted_query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (codes->code_bytes != weighted_query->n_bytes)
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    if (!distances)
+        return HAMMING_STATUS_BAD_PARAM_DISTANCE;
+
+    const row_prefetcher prefetch(*codes, current_scan_options());
+    const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes->n_codes);
+#pragma omp parallel for schedule(static)
+    for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+    {
+        prefetch(code_idx);
+        distances[code_idx] = weighted_distance(*weighted_query, code_at(*codes, code_idx));
+    }
+
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API void HAMMING_CALL hamming_weighted_query_destroy(hamming_weighted_query_t* weighted_query)
+{
+    delete weighted_query;
+}
@@ -0,0 +1,741 @@
+//# mutable code sets: appends and deletions while searches run
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/stats.h>
+#include <hamming/internal/probes.h>
+#include <hamming/internal/code_set.h>
+#include <hamming/internal/pages.h>
+#include <hamming/internal/search.h>
+#include <hamming/internal/epoch.h>
+#include <hamming/internal/parallel.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace{
+    // rows of the segments appends fill; small enough for a compaction to
+    // rewrite one in a blink, large enough to be scanned as one task
+    const size_t segment_codes = 4096;
+    // a full segment is compacted in the background once this fraction of
+    // its slots is dead
+    const size_t dead_fraction_divisor = 4;
+    // how often the compactor retries freeing what the searches still read
+    const chrono::milliseconds reclaim_period(10);
+
+    typedef word_kernel<hamming::kernels::popcount64> weight_kernel;
+
+    // rows [0, n_codes) are written, and published by the release store of
+    // n_codes; only the last segment of the set is still appended to, unless
+    // a compaction sealed it. The ids of a segment are increasing, and all of
+    // them are smaller than those of the next segment
+    struct segment
+    {
+        segment(const size_t capacity, const size_t code_bytes)
+            : capacity(capacity), ids(capacity), tombstones(new atomic<unsigned long long>[(capacity + 63) / 64]()),
+              n_codes(0), n_deleted(0), min_weight(8 * code_bytes), max_weight(0), sealed(false)
+        {
+            rows.allocate(capacity * code_bytes);
+        }
+
+        bool deleted(const size_t slot) const
+        {
+            return (tombstones[slot / 64].load(memory_order_relaxed) >> (slot % 64)) & 1;
+        }
+
+        // marks the slot; false if it was already
+        bool mark_deleted(const size_t slot)
+        {
+            const unsigned long long bit = 1ULL << (slot % 64);
+            if (tombstones[slot / 64].fetch_or(bit, memory_order_relaxed) & bit)
+                return false;
+            n_deleted.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+
+        // slot of the id, or capacity if it isn't in the segment
+        size_t find(const size_t id) const
+        {
+            const size_t n_written = n_codes.load(memory_order_acquire);
+            const size_t* const found = lower_bound(ids.data(), ids.data() + n_written, id);
+            return found != ids.data() + n_written && *found == id ?
+                   static_cast<size_t>(found - ids.data()) : capacity;
+        }
+
+        // the ranges bound the weights of the rows written so far (deleted
+        // ones included), so they only ever widen until a compaction
+        void add_weight(const size_t weight)
+        {
+            if (weight < min_weight.load(memory_order_relaxed))
+                min_weight.store(weight, memory_order_relaxed);
+            if (weight > max_weight.load(memory_order_relaxed))
+                max_weight.store(weight, memory_order_relaxed);
+        }
+
+        const size_t capacity;
+        page_array<unsigned char> rows;
+        vector<size_t> ids;
+        unique_ptr<atomic<unsigned long long>[]> tombstones;
+        atomic<size_t> n_codes;
+        atomic<size_t> n_deleted;
+        atomic<size_t> min_weight, max_weight;
+        // no more appends; guarded by the writer mutex
+        bool sealed;
+    };
+
+    // what the searches walk; replaced as a whole (and retired) whenever a
+    // segment is added or swapped
+    struct segment_table
+    {
+        vector<segment*> segments;
+
+        // codes written, and those of them which were not deleted since
+        void count(size_t& n_written, size_t& n_live) const
+        {
+            size_t n_deleted = 0;
+            n_written = 0;
+            for (size_t segment_idx = 0; segment_idx < segments.size(); ++segment_idx)
+            {
+                n_written += segments[segment_idx]->n_codes.load(memory_order_acquire);
+                n_deleted += segments[segment_idx]->n_deleted.load(memory_order_relaxed);
+            }
+            n_live = n_written - min(n_deleted, n_written);
+        }
+    };
+
+    // a segment as a search found it
+    struct segment_scan
+    {
+        const segment* seg;
+        size_t n_codes;
+        // no code of the segment is closer to the query
+        size_t min_distance;
+    };
+
+    // the segments of the table, with the lower bounds of their distances
+    // to a query of the given weight: |weight(q) - weight(c)| <= d(q, c)
+    vector<segment_scan> plan_scans(const segment_table& table, const size_t query_weight)
+    {
+        vector<segment_scan> scans;
+        scans.reserve(table.segments.size());
+        for (size_t segment_idx = 0; segment_idx < table.segments.size(); ++segment_idx)
+        {
+            const segment& seg = *table.segments[segment_idx];
+            segment_scan scan = {&seg, seg.n_codes.load(memory_order_acquire), 0};
+            if (!scan.n_codes)
+                continue;
+            const size_t min_weight = seg.min_weight.load(memory_order_relaxed);
+            const size_t max_weight = seg.max_weight.load(memory_order_relaxed);
+            scan.min_distance = query_weight < min_weight ? min_weight - query_weight :
+                                query_weight > max_weight ? query_weight - max_weight : 0;
+            scans.push_back(scan);
+        }
+        return scans;
+    }
+
+    // calls found(match) for every code of the segment which isn't deleted
+    template<typename Kernel, typename Found>
+    void scan_segment(const unsigned char query[], const segment_scan& scan, const size_t code_bytes,
+                      const Found& found)
+    {
+        const segment& seg = *scan.seg;
+        for (size_t first = 0; first < scan.n_codes; first += 64)
+        {
+            const unsigned long long dead = seg.tombstones[first / 64].load(memory_order_relaxed);
+            const size_t last = min(first + 64, scan.n_codes);
+            for (size_t slot = first; slot < last; ++slot)
+            {
+                if ((dead >> (slot - first)) & 1)
+                    continue;
+                hamming_match_t match;
+                match.index = seg.ids[slot];
+                match.distance = xor_popcount<Kernel>(query, seg.rows.data() + slot * code_bytes, code_bytes);
+                found(match);
+            }
+        }
+    }
+
+    template<typename Kernel>
+    struct mutable_knn_op
+    {
+        static void run(const unsigned char query[], const segment_table& table, const size_t code_bytes,
+                        size_t k, vector<hamming_match_t>& heap)
+        {
+            vector<segment_scan> scans = plan_scans(table, weight_popcount<weight_kernel>(query, code_bytes));
+            size_t n_slots = 0;
+            for (size_t scan_idx = 0; scan_idx < scans.size(); ++scan_idx)
+                n_slots += scans[scan_idx].n_codes;
+            k = min(k, n_slots);
+            if (!k)
+                return;
+            // the most promising segments first, so that the heaps fill
+            // with close codes early and the bound prunes the rest
+            stable_sort(scans.begin(), scans.end(),
+                        [](const segment_scan& scan1, const segment_scan& scan2)
+                        {return scan1.min_distance < scan2.min_distance;});
+            const ptrdiff_t n_scans = static_cast<ptrdiff_t>(scans.size());
+            heap.reserve(k);
+
+            // the heaps are reserved in the region, so push_bounded doesn't
+            // allocate, and the merge doesn't either
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                vector<hamming_match_t> thread_heap;
+                failure.run([&] {thread_heap.reserve(k);});
+#pragma omp for schedule(dynamic, 1) nowait
+                for (ptrdiff_t scan_idx = 0; scan_idx < n_scans; ++scan_idx)
+                {
+                    // none of its codes would make it into this thread's
+                    // best k, hence into the overall best k
+                    if (failure.failed() ||
+                        (thread_heap.size() == k && scans[scan_idx].min_distance > thread_heap.front().distance))
+                        continue;
+                    scan_segment<Kernel>(query, scans[scan_idx], code_bytes,
+                                         [&](const hamming_match_t& match) {push_bounded(thread_heap, k, match);});
+                }
+#pragma omp critical
+                for (size_t match_idx = 0; match_idx < thread_heap.size(); ++match_idx)
+                    push_bounded(heap, k, thread_heap[match_idx]);
+            }
+            failure.rethrow();
+
+            sort_heap(heap.begin(), heap.end(), closer_match);
+        }
+    };
+
+    template<typename Kernel>
+    struct mutable_radius_op
+    {
+        static void run(const unsigned char query[], const segment_table& table, const size_t code_bytes,
+                        const size_t max_distance, vector<hamming_match_t>& matches)
+        {
+            const vector<segment_scan> scans = plan_scans(table, weight_popcount<weight_kernel>(query, code_bytes));
+            const ptrdiff_t n_scans = static_cast<ptrdiff_t>(scans.size());
+
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                vector<hamming_match_t> thread_matches;
+#pragma omp for schedule(dynamic, 1) nowait
+                for (ptrdiff_t scan_idx = 0; scan_idx < n_scans; ++scan_idx)
+                    if (scans[scan_idx].min_distance <= max_distance)
+                        failure.run([&]
+                        {
+                            scan_segment<Kernel>(query, scans[scan_idx], code_bytes,
+                                                 [&](const hamming_match_t& match)
+                                                 {
+                                                     if (match.distance <= max_distance)
+                                                         thread_matches.push_back(match);
+                                                 });
+                        });
+#pragma omp critical
+                failure.run([&] {matches.insert(matches.end(), thread_matches.begin(), thread_matches.end());});
+            }
+            failure.rethrow();
+
+            sort(matches.begin(), matches.end(), closer_match);
+        }
+    };
+}
+
+struct hamming_mutable_set
+{
+    explicit hamming_mutable_set(const size_t code_bytes)
+        : code_bytes(code_bytes), table(new segment_table()), next_id(0), compaction_wanted(false), stop(false) {}
+
+    ~hamming_mutable_set()
+    {
+        if (compactor.joinable())
+        {
+            {
+                lock_guard<mutex> lock(writer_mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            compactor.join();
+        }
+
+        segment_table* current = table.load();
+        for (size_t segment_idx = 0; segment_idx < current->segments.size(); ++segment_idx)
+            delete current->segments[segment_idx];
+        delete current;
+    }
+
+    // the background compaction is due for the (sealed) segment; writer_mutex
+    // must be held
+    void check_dead_fraction(const segment& seg)
+    {
+        if (compactor.joinable() &&
+            seg.n_deleted.load(memory_order_relaxed) * dead_fraction_divisor >= seg.n_codes.load(memory_order_relaxed))
+        {
+            compaction_wanted = true;
+            wake.notify_one();
+        }
+    }
+
+    // the segments built aside are swapped in under writer_mutex
+    hamming_status_t compact();
+
+    void run_compactor()
+    {
+        unique_lock<mutex> lock(writer_mutex);
+        for (;;)
+        {
+            // what the searches still read when it was retired is retried
+            // now and then, and only while there is some
+            const auto due = [this] {return compaction_wanted || stop;};
+            if (epochs.n_retired())
+                wake.wait_for(lock, reclaim_period, due);
+            else
+                wake.wait(lock, due);
+            if (stop)
+                return;
+
+            const bool wanted = compaction_wanted;
+            compaction_wanted = false;
+            lock.unlock();
+            // on failure (out of memory), the next deletion retries
+            if (wanted)
+                compact();
+            epochs.collect();
+            lock.lock();
+        }
+    }
+
+    const size_t code_bytes;
+    atomic<segment_table*> table;
+    // the tables and segments the searches may still be reading
+    epoch_domain epochs;
+
+    // appends, deletions and the swaps of the compaction take turns; the
+    // searches never take it
+    mutex writer_mutex;
+    size_t next_id;
+    // one compaction at a time, which is then the only one to replace
+    // segments (the appends only add new ones at the end)
+    mutex compaction_mutex;
+
+    thread compactor;
+    condition_variable wake;
+    bool compaction_wanted;
+    bool stop;
+};
+
+hamming_status_t hamming_mutable_set::compact()
+{
+    try
+    {
+        lock_guard<mutex> compaction_lock(compaction_mutex);
+
+        // the segments stay alive while the compaction mutex is held, and
+        // the sealed ones only change by deletions; so does the last one,
+        // if it has deleted codes, from here on
+        vector<segment*> sealed;
+        {
+            lock_guard<mutex> lock(writer_mutex);
+            const segment_table& current = *table.load();
+            sealed = current.segments;
+            if (!sealed.empty() && !sealed.back()->n_deleted.load(memory_order_relaxed))
+                sealed.pop_back();
+            for (size_t segment_idx = 0; segment_idx < sealed.size(); ++segment_idx)
+                sealed[segment_idx]->sealed = true;
+        }
+
+        // runs of neighbouring segments whose codes fit in one, which are
+        // rewritten if that reclaims anything
+        struct rewrite
+        {
+            size_t first, last;
+            // null if none of its codes is left
+            segment* merged;
+            // for every row of merged, the segment and slot it came from
+            vector<pair<const segment*, size_t> > sources;
+        };
+        vector<rewrite> rewrites;
+        for (size_t first = 0; first < sealed.size();)
+        {
+            size_t last = first, n_live = 0, n_dead = 0;
+            for (; last < sealed.size(); ++last)
+            {
+                const size_t n_written = sealed[last]->n_codes.load(memory_order_relaxed);
+                const size_t n_deleted = sealed[last]->n_deleted.load(memory_order_relaxed);
+                if (last > first && n_live + n_written - n_deleted > segment_codes)
+                    break;
+                n_live += n_written - n_deleted;
+                n_dead += n_deleted;
+            }
+            if (n_dead || last - first > 1)
+            {
+                rewrite group;
+                group.first = first;
+                group.last = last;
+                group.merged = nullptr;
+                rewrites.push_back(group);
+            }
+            first = last;
+        }
+        if (rewrites.empty())
+            return HAMMING_STATUS_SUCCESS;
+
+        // the new segments are built without holding up the writers; the
+        // deletions which land meanwhile are carried over below
+        struct segments_deleter
+        {
+            vector<rewrite>& rewrites;
+            bool armed;
+            ~segments_deleter()
+            {
+                if (armed)
+                    for (size_t rewrite_idx = 0; rewrite_idx < rewrites.size(); ++rewrite_idx)
+                        delete rewrites[rewrite_idx].merged;
+            }
+        } cleanup = {rewrites, true};
+
+        for (size_t rewrite_idx = 0; rewrite_idx < rewrites.size(); ++rewrite_idx)
+        {
+            rewrite& group = rewrites[rewrite_idx];
+            for (size_t segment_idx = group.first; segment_idx < group.last; ++segment_idx)
+            {
+                const segment& seg = *sealed[segment_idx];
+                const size_t n_written = seg.n_codes.load(memory_order_relaxed);
+                for (size_t slot = 0; slot < n_written; ++slot)
+                    if (!seg.deleted(slot))
+                        group.sources.push_back(make_pair(&seg, slot));
+            }
+            if (group.sources.empty())
+                continue;
+
+            group.merged = new segment(group.sources.size(), code_bytes);
+            segment& merged = *group.merged;
+            for (size_t slot = 0; slot < group.sources.size(); ++slot)
+            {
+                const unsigned char* code = group.sources[slot].first->rows.data() +
+                                            group.sources[slot].second * code_bytes;
+                memcpy(merged.rows.data() + slot * code_bytes, code, code_bytes);
+                merged.ids[slot] = group.sources[slot].first->ids[group.sources[slot].second];
+                merged.add_weight(weight_popcount<weight_kernel>(code, code_bytes));
+            }
+            merged.n_codes.store(group.sources.size(), memory_order_relaxed);
+        }
+
+        {
+            lock_guard<mutex> lock(writer_mutex);
+            segment_table* current = table.load();
+            unique_ptr<segment_table> replacement(new segment_table());
+            replacement->segments.reserve(current->segments.size());
+            size_t segment_idx = 0;
+            for (size_t rewrite_idx = 0; rewrite_idx < rewrites.size(); ++rewrite_idx)
+            {
+                rewrite& group = rewrites[rewrite_idx];
+                replacement->segments.insert(replacement->segments.end(), current->segments.begin() + segment_idx,
+                                             current->segments.begin() + group.first);
+                if (group.merged)
+                {
+                    for (size_t slot = 0; slot < group.sources.size(); ++slot)
+                        if (group.sources[slot].first->deleted(group.sources[slot].second))
+                            group.merged->mark_deleted(slot);
+                    replacement->segments.push_back(group.merged);
+                }
+                segment_idx = group.last;
+            }
+            replacement->segments.insert(replacement->segments.end(), current->segments.begin() + segment_idx,
+                                         current->segments.end());
+
+            // from here on, nothing throws
+            cleanup.armed = false;
+            table.store(replacement.release(), memory_order_release);
+            epochs.retire(current);
+            for (size_t rewrite_idx = 0; rewrite_idx < rewrites.size(); ++rewrite_idx)
+                for (size_t segment_idx = rewrites[rewrite_idx].first; segment_idx < rewrites[rewrite_idx].last;
+                     ++segment_idx)
+                    epochs.retire(sealed[segment_idx]);
+        }
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_create(const size_t code_bytes,
+                                                                     const int flags,
+                                                                     hamming_mutable_set_t** set)
+{
+    if (!code_bytes)
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    if (!set)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_mutable_set_t* result = nullptr;
+    try
+    {
+        result = new hamming_mutable_set_t(code_bytes);
+        if (flags & HAMMING_MUTABLE_BACKGROUND_COMPACTION)
+            result->compactor = thread(&hamming_mutable_set::run_compactor, result);
+    }
+    catch (const bad_alloc&)
+    {
+        delete result;
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+    catch (const system_error&)
+    {
+        // no thread for the compactor
+        delete result;
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+
+    *set = result;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API void HAMMING_CALL hamming_mutable_set_destroy(hamming_mutable_set_t* set)
+{
+    delete set;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_append(hamming_mutable_set_t* set,
+                                                                     const hamming_code_set_t* codes,
+                                                                     size_t* first_id)
+{
+    if (!set)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (codes->code_bytes != set->code_bytes)
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    if (!first_id)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        lock_guard<mutex> lock(set->writer_mutex);
+        segment_table* current = set->table.load();
+        segment* tail = current->segments.empty() ? nullptr : current->segments.back();
+        const size_t n_free = tail && !tail->sealed ? tail->capacity - tail->n_codes.load(memory_order_relaxed) : 0;
+
+        // all the segments are allocated before anything is published
+        vector<unique_ptr<segment> > added;
+        unique_ptr<segment_table> replacement;
+        if (codes->n_codes > n_free)
+        {
+            for (size_t n_placed = n_free; n_placed < codes->n_codes; n_placed += segment_codes)
+                added.push_back(unique_ptr<segment>(new segment(segment_codes, set->code_bytes)));
+            replacement.reset(new segment_table(*current));
+            replacement->segments.reserve(current->segments.size() + added.size());
+        }
+
+        *first_id = set->next_id;
+        size_t code_idx = 0;
+        for (size_t segment_idx = 0; segment_idx <= added.size() && code_idx < codes->n_codes; ++segment_idx)
+        {
+            segment* seg = segment_idx ? added[segment_idx - 1].get() : n_free ? tail : nullptr;
+            if (!seg)
+                continue;
+            const size_t first_slot = seg->n_codes.load(memory_order_relaxed);
+            const size_t n_batch = min(seg->capacity - first_slot, codes->n_codes - code_idx);
+            for (size_t slot = first_slot; slot < first_slot + n_batch; ++slot, ++code_idx)
+            {
+                const unsigned char* code = code_at(*codes, code_idx);
+                memcpy(seg->rows.data() + slot * set->code_bytes, code, set->code_bytes);
+                seg->ids[slot] = set->next_id++;
+                seg->add_weight(weight_popcount<weight_kernel>(code, set->code_bytes));
+            }
+            // the searches see the rows, ids and weights from here on
+            seg->n_codes.store(first_slot + n_batch, memory_order_release);
+        }
+
+        if (replacement)
+        {
+            for (size_t segment_idx = 0; segment_idx < added.size(); ++segment_idx)
+                replacement->segments.push_back(added[segment_idx].release());
+            set->table.store(replacement.release(), memory_order_release);
+            set->epochs.retire(current);
+            // for the compactor to free it, if the searches hold it now
+            if (set->compactor.joinable())
+                set->wake.notify_one();
+            // the previous tail is sealed now
+            if (tail && !tail->sealed)
+            {
+                tail->sealed = true;
+                set->check_dead_fraction(*tail);
+            }
+        }
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_remove(hamming_mutable_set_t* set,
+                                                                     const size_t ids[],
+                                                                     const size_t n_ids,
+                                                                     size_t* n_removed)
+{
+    if (!set)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (n_ids && !ids)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    lock_guard<mutex> lock(set->writer_mutex);
+    const vector<segment*>& segments = set->table.load()->segments;
+    size_t n_marked = 0;
+    for (size_t id_idx = 0; id_idx < n_ids; ++id_idx)
+    {
+        // the last segment whose first id isn't larger
+        const vector<segment*>::const_iterator after =
+                upper_bound(segments.begin(), segments.end(), ids[id_idx],
+                            [](const size_t id, const segment* seg) {return id < seg->ids[0];});
+        if (after == segments.begin())
+            continue;
+        segment& seg = **(after - 1);
+        const size_t slot = seg.find(ids[id_idx]);
+        if (slot == seg.capacity || !seg.mark_deleted(slot))
+            continue;
+        ++n_marked;
+        if (after != segments.end())
+            set->check_dead_fraction(seg);
+    }
+
+    if (n_removed)
+        *n_removed = n_marked;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_size(hamming_mutable_set_t* set,
+                                                                   size_t* n_codes,
+                                                                   size_t* n_slots)
+{
+    if (!set)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!n_codes || !n_slots)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    epoch_domain::guard reading(set->epochs);
+    set->table.load(memory_order_acquire)->count(*n_slots, *n_codes);
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_set_compact(hamming_mutable_set_t* set)
+{
+    if (!set)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    const hamming_status_t status = set->compact();
+    // also frees what was retired earlier, and has been left by the
+    // searches since (without the compactor, nobody else retries)
+    set->epochs.collect();
+    return status;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_knn_search(const unsigned char query[],
+                                                                     hamming_mutable_set_t* set,
+                                                                     const size_t k,
+                                                                     hamming_match_t results[],
+                                                                     size_t* n_results,
+                                                                     hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_MUTABLE_KNN_SEARCH);
+    HAMMING_PROBE_SCOPE3(mutable_knn_search, set ? set->code_bytes : 0, k, static_cast<int>(impl));
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!set)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if ((k && !results) || !n_results)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    *n_results = 0;
+    if (!k)
+        return HAMMING_STATUS_SUCCESS;
+
+    try
+    {
+        epoch_domain::guard reading(set->epochs);
+        const segment_table& current = *set->table.load(memory_order_acquire);
+        // the live codes, rather than the capacity of the segments
+        size_t n_written = 0, n_live = 0;
+        current.count(n_written, n_live);
+        vector<hamming_match_t> heap;
+        const hamming_status_t status =
+                dispatch<mutable_knn_op>(impl, static_cast<unsigned long long>(n_live) * set->code_bytes,
+                                         query, current, set->code_bytes, k, heap);
+        if (status != HAMMING_STATUS_SUCCESS)
+            return status;
+
+        copy(heap.begin(), heap.end(), results);
+        *n_results = heap.size();
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_mutable_radius_search(const unsigned char query[],
+                                                                        hamming_mutable_set_t* set,
+                                                                        const size_t max_distance,
+                                                                        hamming_match_t results[],
+                                                                        const size_t capacity,
+                                                                        size_t* n_results,
+                                                                        hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_MUTABLE_RADIUS_SEARCH);
+    HAMMING_PROBE_SCOPE3(mutable_radius_search, set ? set->code_bytes : 0, max_distance, static_cast<int>(impl));
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!set)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if ((capacity && !results) || !n_results)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        epoch_domain::guard reading(set->epochs);
+        const segment_table& current = *set->table.load(memory_order_acquire);
+        size_t n_written = 0, n_live = 0;
+        current.count(n_written, n_live);
+        vector<hamming_match_t> matches;
+        const hamming_status_t status =
+                dispatch<mutable_radius_op>(impl, static_cast<unsigned long long>(n_live) * set->code_bytes,
+                                            query, current, set->code_bytes, max_distance, matches);
+        if (status != HAMMING_STATUS_SUCCESS)
+            return status;
+
+        copy(matches.begin(), matches.begin() + min(capacity, matches.size()), results);
+        *n_results = matches.size();
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
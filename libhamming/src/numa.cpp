@@ -0,0 +1,411 @@
+//# code sets partitioned across NUMA nodes, scanned by workers pinned to them
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/pages.h>
+#include <hamming/internal/code_set.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+namespace{
+    // cpus of every node, in node order
+    typedef vector<vector<int> > node_cpus_t;
+
+    // "0-3,8,10-11" (the format of the sysfs cpu and node lists)
+    vector<int> parse_list(const string& text)
+    {
+        vector<int> values;
+        const char* pos = text.c_str();
+        while (*pos)
+        {
+            int first = 0, last = 0, n_chars = 0;
+            if (sscanf(pos, "%d%n", &first, &n_chars) != 1)
+                break;
+            pos += n_chars;
+            last = first;
+            if (*pos == '-' && sscanf(pos + 1, "%d%n", &last, &n_chars) == 1)
+                pos += 1 + n_chars;
+            for (int value = first; value <= last; ++value)
+                values.push_back(value);
+            if (*pos != ',')
+                break;
+            ++pos;
+        }
+        return values;
+    }
+
+    string read_line(const string& path)
+    {
+        FILE* file = fopen(path.c_str(), "r");
+        if (!file)
+            return string();
+        char line[4096] = "";
+        if (!fgets(line, sizeof(line), file))
+            line[0] = 0;
+        fclose(file);
+        return line;
+    }
+
+    // the nodes of the system, restricted to the cpus the process may run
+    // on; empty if the topology is unknown
+    node_cpus_t system_nodes()
+    {
+        node_cpus_t nodes;
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))
+            return nodes;
+
+        const vector<int> node_ids = parse_list(read_line("/sys/devices/system/node/online"));
+        for (size_t node_idx = 0; node_idx < node_ids.size(); ++node_idx)
+        {
+            const vector<int> cpus = parse_list(read_line("/sys/devices/system/node/node" +
+                                                          to_string(node_ids[node_idx]) + "/cpulist"));
+            vector<int> node;
+            for (size_t cpu_idx = 0; cpu_idx < cpus.size(); ++cpu_idx)
+                if (cpus[cpu_idx] < CPU_SETSIZE && CPU_ISSET(cpus[cpu_idx], &allowed))
+                    node.push_back(cpus[cpu_idx]);
+            // memory-only nodes, and the ones the process may not run on
+            if (!node.empty())
+                nodes.push_back(node);
+        }
+
+        // no sysfs node information (e.g. a kernel without NUMA)
+        if (nodes.empty())
+        {
+            vector<int> node;
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &allowed))
+                    node.push_back(cpu);
+            nodes.push_back(node);
+        }
+#endif
+        return nodes;
+    }
+
+    // n_nodes emulated nodes, made of contiguous runs of the cpus of the
+    // real ones; with fewer cpus than nodes, the cpus are shared round robin
+    node_cpus_t emulated_nodes(const node_cpus_t& real_nodes, const size_t n_nodes)
+    {
+        vector<int> cpus;
+        for (size_t node_idx = 0; node_idx < real_nodes.size(); ++node_idx)
+            cpus.insert(cpus.end(), real_nodes[node_idx].begin(), real_nodes[node_idx].end());
+
+        node_cpus_t nodes(n_nodes);
+        if (cpus.empty())
+            return nodes;
+        for (size_t node_idx = 0; node_idx < n_nodes; ++node_idx)
+        {
+            const size_t first = cpus.size() * node_idx / n_nodes, last = cpus.size() * (node_idx + 1) / n_nodes;
+            if (first < last)
+                nodes[node_idx].assign(cpus.begin() + first, cpus.begin() + last);
+            else
+                nodes[node_idx].push_back(cpus[node_idx % cpus.size()]);
+        }
+        return nodes;
+    }
+
+    // a thread pinned to the cpus of a node, running one job at a time;
+    // being long lived, it also keeps its own OpenMP team, whose threads
+    // inherit its affinity
+    class node_worker
+    {
+    public:
+        explicit node_worker(const vector<int>& cpus)
+            : cpus_(cpus), has_job_(false), stop_(false)
+        {
+            thread_ = thread(&node_worker::run, this);
+        }
+
+        ~node_worker()
+        {
+            {
+                lock_guard<mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            thread_.join();
+        }
+
+        void post(const function<void()>& job)
+        {
+            {
+                lock_guard<mutex> lock(mutex_);
+                job_ = job;
+                has_job_ = true;
+            }
+            wake_.notify_all();
+        }
+
+        void wait()
+        {
+            unique_lock<mutex> lock(mutex_);
+            done_.wait(lock, [this] {return !has_job_;});
+        }
+
+    private:
+        node_worker(const node_worker&);
+        node_worker& operator=(const node_worker&);
+
+        void pin()
+        {
+#ifdef __linux__
+            if (cpus_.empty())
+                return;
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (size_t cpu_idx = 0; cpu_idx < cpus_.size(); ++cpu_idx)
+                CPU_SET(cpus_[cpu_idx], &cpu_set);
+            // best effort: unpinned, the results are the same, only slower
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#endif
+#ifdef _OPENMP
+            // one OpenMP thread per cpu of the node, instead of one per cpu
+            // of the machine in every node's team
+            omp_set_num_threads(static_cast<int>(cpus_.size()));
+#endif
+        }
+
+        void run()
+        {
+            pin();
+            unique_lock<mutex> lock(mutex_);
+            for (;;)
+            {
+                wake_.wait(lock, [this] {return has_job_ || stop_;});
+                if (stop_)
+                    return;
+
+                lock.unlock();
+                job_();
+                lock.lock();
+                has_job_ = false;
+                done_.notify_all();
+            }
+        }
+
+        vector<int> cpus_;
+        thread thread_;
+        mutex mutex_;
+        condition_variable wake_, done_;
+        function<void()> job_;
+        bool has_job_;
+        bool stop_;
+    };
+
+    struct numa_shard
+    {
+        size_t first_code;
+        size_t n_codes;
+        page_array<unsigned char> data;
+    };
+}
+
+struct hamming_numa_code_set
+{
+    size_t code_bytes;
+    vector<unique_ptr<numa_shard> > shards;
+    // none with a single node, which is scanned by the calling thread
+    vector<unique_ptr<node_worker> > workers;
+    // the workers run one call at a time
+    mutex call_mutex;
+
+    hamming_code_set_t shard_set(const size_t node) const
+    {
+        hamming_code_set_t set = {shards[node]->data.data(), shards[node]->n_codes, code_bytes, 0};
+        return set;
+    }
+
+    // runs job(node) for every node, on its worker, and waits for all of them
+    void for_each_node(const function<void(size_t)>& job)
+    {
+        if (workers.empty())
+        {
+            job(0);
+            return;
+        }
+
+        // the posted jobs refer to job, so if a post fails (handing the job
+        // to a worker may allocate), the ones already posted are waited for
+        // before unwinding
+        size_t n_posted = 0;
+        try
+        {
+            for (; n_posted < workers.size(); ++n_posted)
+                workers[n_posted]->post([&job, n_posted] {job(n_posted);});
+        }
+        catch (...)
+        {
+            for (size_t node = 0; node < n_posted; ++node)
+                workers[node]->wait();
+            throw;
+        }
+        for (size_t node = 0; node < workers.size(); ++node)
+            workers[node]->wait();
+    }
+};
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_numa_code_set_create(const hamming_code_set_t* codes,
+                                                                       const size_t n_nodes,
+                                                                       hamming_numa_code_set_t** numa_codes)
+{
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_1);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (!numa_codes)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_numa_code_set_t* result = nullptr;
+    try
+    {
+        const node_cpus_t real_nodes = system_nodes();
+        const node_cpus_t nodes = n_nodes ? emulated_nodes(real_nodes, n_nodes) :
+                                  real_nodes.empty() ? node_cpus_t(1) : real_nodes;
+
+        result = new hamming_numa_code_set_t();
+        result->code_bytes = codes->code_bytes;
+
+        // shards in proportion to the cpus of the nodes
+        size_t total_cpus = 0;
+        for (size_t node = 0; node < nodes.size(); ++node)
+            total_cpus += max(nodes[node].size(), static_cast<size_t>(1));
+        size_t cpus_before = 0;
+        for (size_t node = 0; node < nodes.size(); ++node)
+        {
+            unique_ptr<numa_shard> shard(new numa_shard());
+            shard->first_code = codes->n_codes * cpus_before / total_cpus;
+            cpus_before += max(nodes[node].size(), static_cast<size_t>(1));
+            shard->n_codes = codes->n_codes * cpus_before / total_cpus - shard->first_code;
+            result->shards.push_back(move(shard));
+        }
+
+        if (nodes.size() > 1)
+            for (size_t node = 0; node < nodes.size(); ++node)
+                result->workers.push_back(unique_ptr<node_worker>(new node_worker(nodes[node])));
+
+        // every shard is allocated and written (i.e. first touched) by the
+        // worker of its node, so that its pages are placed on that node
+        vector<hamming_status_t> statuses(nodes.size(), HAMMING_STATUS_SUCCESS);
+        result->for_each_node([&](size_t node)
+        {
+            numa_shard& shard = *result->shards[node];
+            try
+            {
+                shard.data.allocate(shard.n_codes * codes->code_bytes);
+            }
+            catch (const bad_alloc&)
+            {
+                statuses[node] = HAMMING_STATUS_OUT_OF_MEMORY;
+                return;
+            }
+            for (size_t code_idx = 0; code_idx < shard.n_codes; ++code_idx)
+                memcpy(shard.data.data() + code_idx * codes->code_bytes,
+                       code_at(*codes, shard.first_code + code_idx), codes->code_bytes);
+        });
+
+        for (size_t node = 0; node < nodes.size(); ++node)
+            if (statuses[node] != HAMMING_STATUS_SUCCESS)
+                status = statuses[node];
+    }
+    catch (const bad_alloc&)
+    {
+        status = HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+    catch (const system_error&)
+    {
+        // no thread for a worker
+        status = HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+
+    if (status != HAMMING_STATUS_SUCCESS)
+    {
+        delete result;
+        return status;
+    }
+
+    *numa_codes = result;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API void HAMMING_CALL hamming_numa_code_set_destroy(hamming_numa_code_set_t* numa_codes)
+{
+    delete numa_codes;
+}
+
+HAMMING_API size_t HAMMING_CALL hamming_numa_code_set_nodes(const hamming_numa_code_set_t* numa_codes)
+{
+    return numa_codes ? numa_codes->shards.size() : 0;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_numa_code_set_shard(const hamming_numa_code_set_t* numa_codes,
+                                                                      const size_t node,
+                                                                      hamming_code_set_t* shard,
+                                                                      size_t* first_code)
+{
+    if (!numa_codes)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (node >= numa_codes->shards.size())
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    if (!shard || !first_code)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    *shard = numa_codes->shard_set(node);
+    *first_code = numa_codes->shards[node]->first_code;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_numa_distance_batch(hamming_numa_code_set_t* numa_codes,
+                                                                      const unsigned char query[],
+                                                                      size_t distances[],
+                                                                      hamming_impl_t impl)
+{
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!numa_codes)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!distances)
+        return HAMMING_STATUS_BAD_PARAM_DISTANCE;
+
+    lock_guard<mutex> lock(numa_codes->call_mutex);
+    vector<hamming_status_t> statuses(numa_codes->shards.size(), HAMMING_STATUS_SUCCESS);
+    numa_codes->for_each_node([&](size_t node)
+    {
+        const hamming_code_set_t shard = numa_codes->shard_set(node);
+        // the shards are disjoint ranges of the output, so the results are
+        // merged by writing them in place
+        if (shard.n_codes)
+            statuses[node] = hamming_distance_batch(query, &shard,
+                                                    distances + numa_codes->shards[node]->first_code, impl);
+    });
+
+    for (size_t node = 0; node < statuses.size(); ++node)
+        if (statuses[node] != HAMMING_STATUS_SUCCESS)
+            return statuses[node];
+    return HAMMING_STATUS_SUCCESS;
+}
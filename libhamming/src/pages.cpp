@@ -0,0 +1,290 @@
+//# page-level allocations, backed by huge pages when available
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/pages.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(MAP_HUGE_SHIFT)
+// older headers; the kernel has had them since 3.8
+#define MAP_HUGE_SHIFT 26
+#endif
+#if defined(__linux__) && !defined(MAP_HUGE_2MB)
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#if defined(__linux__) && !defined(MAP_HUGE_1GB)
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+using namespace std;
+
+namespace{
+    const size_t huge_page_2mb = static_cast<size_t>(1) << 21;
+    const size_t huge_page_1gb = static_cast<size_t>(1) << 30;
+
+    size_t round_up(const size_t n_bytes, const size_t page_bytes)
+    {
+        return (n_bytes + page_bytes - 1) / page_bytes * page_bytes;
+    }
+
+    // the huge pages are a scarce, reserved pool, so a size only gets them
+    // if rounding it up wastes at most an eighth of it
+    bool worth_huge_pages(const size_t n_bytes, const size_t page_bytes)
+    {
+        return n_bytes >= page_bytes && round_up(n_bytes, page_bytes) - n_bytes <= n_bytes / 8;
+    }
+
+#ifndef _WIN32
+    unsigned char* map_anonymous(const size_t length, const int flags)
+    {
+        void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+        return data == MAP_FAILED ? nullptr : static_cast<unsigned char*>(data);
+    }
+#endif
+
+#ifdef __linux__
+    // a mapping of length bytes, aligned to 2MB, so that transparent huge
+    // pages can back all of it
+    unsigned char* map_aligned_2mb(const size_t length)
+    {
+        unsigned char* mapping = map_anonymous(length + huge_page_2mb, 0);
+        if (!mapping)
+            return nullptr;
+
+        const size_t address = reinterpret_cast<size_t>(mapping);
+        unsigned char* data = mapping + (round_up(address, huge_page_2mb) - address);
+        if (data != mapping)
+            munmap(mapping, data - mapping);
+        munmap(data + length, mapping + length + huge_page_2mb - (data + length));
+        return data;
+    }
+
+    // sum of the huge page fields of the mappings which overlap [begin, end),
+    // each clipped to the overlap
+    bool smaps_huge_page_bytes(const size_t begin, const size_t end, size_t* huge_bytes)
+    {
+        FILE* smaps = fopen("/proc/self/smaps", "r");
+        if (!smaps)
+            return false;
+
+        static const char* const huge_fields[] = {"AnonHugePages:", "ShmemPmdMapped:", "FilePmdMapped:",
+                                                  "Shared_Hugetlb:", "Private_Hugetlb:"};
+        size_t total = 0, overlap = 0;
+        char line[512];
+        while (fgets(line, sizeof(line), smaps))
+        {
+            unsigned long long mapping_begin = 0, mapping_end = 0;
+            if (sscanf(line, "%llx-%llx ", &mapping_begin, &mapping_end) == 2)
+            {
+                const size_t first = max(begin, static_cast<size_t>(mapping_begin));
+                const size_t last = min(end, static_cast<size_t>(mapping_end));
+                overlap = first < last ? last - first : 0;
+                continue;
+            }
+            if (!overlap)
+                continue;
+
+            for (size_t field_idx = 0; field_idx < sizeof(huge_fields) / sizeof(huge_fields[0]); ++field_idx)
+            {
+                const size_t field_length = strlen(huge_fields[field_idx]);
+                unsigned long long kb = 0;
+                if (!strncmp(line, huge_fields[field_idx], field_length) &&
+                    sscanf(line + field_length, "%llu", &kb) == 1)
+                    total += min(static_cast<size_t>(kb) * 1024, overlap);
+            }
+        }
+        fclose(smaps);
+
+        *huge_bytes = total;
+        return true;
+    }
+#endif
+}
+
+INTERNAL_HAMMING_API page_allocation HAMMING_CALL allocate_pages(const size_t n_bytes)
+{
+    page_allocation allocation = {nullptr, 0, HAMMING_PAGES_NORMAL};
+    if (!n_bytes)
+        return allocation;
+
+#ifdef _WIN32
+    // large pages need the SeLockMemoryPrivilege, which processes don't
+    // normally hold, so only normal pages
+    allocation.length = n_bytes;
+    allocation.data = static_cast<unsigned char*>(VirtualAlloc(nullptr, n_bytes, MEM_RESERVE | MEM_COMMIT,
+                                                               PAGE_READWRITE));
+    return allocation;
+#else
+#ifdef __linux__
+    if (worth_huge_pages(n_bytes, huge_page_1gb))
+    {
+        allocation.length = round_up(n_bytes, huge_page_1gb);
+        allocation.data = map_anonymous(allocation.length, MAP_HUGETLB | MAP_HUGE_1GB);
+        allocation.pages = HAMMING_PAGES_HUGE_1GB;
+        if (allocation.data)
+            return allocation;
+    }
+
+    if (worth_huge_pages(n_bytes, huge_page_2mb))
+    {
+        allocation.length = round_up(n_bytes, huge_page_2mb);
+        allocation.data = map_anonymous(allocation.length, MAP_HUGETLB | MAP_HUGE_2MB);
+        allocation.pages = HAMMING_PAGES_HUGE_2MB;
+        if (allocation.data)
+            return allocation;
+    }
+
+    if (n_bytes >= huge_page_2mb)
+    {
+        allocation.length = round_up(n_bytes, huge_page_2mb);
+        allocation.data = map_aligned_2mb(allocation.length);
+        // fails if THP is disabled (or unknown to the kernel)
+        allocation.pages = allocation.data && !madvise(allocation.data, allocation.length, MADV_HUGEPAGE) ?
+                           HAMMING_PAGES_TRANSPARENT : HAMMING_PAGES_NORMAL;
+        return allocation;
+    }
+#endif
+    allocation.length = round_up(n_bytes, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+    allocation.data = map_anonymous(allocation.length, 0);
+    allocation.pages = HAMMING_PAGES_NORMAL;
+    return allocation;
+#endif
+}
+
+INTERNAL_HAMMING_API void HAMMING_CALL free_pages(const page_allocation& allocation)
+{
+    if (!allocation.data)
+        return;
+#ifdef _WIN32
+    VirtualFree(allocation.data, 0, MEM_RELEASE);
+#else
+    munmap(allocation.data, allocation.length);
+#endif
+}
+
+INTERNAL_HAMMING_API bool HAMMING_CALL huge_page_bytes(const page_allocation& allocation, size_t* huge_bytes)
+{
+    if (!allocation.data || allocation.pages == HAMMING_PAGES_HUGE_2MB || allocation.pages == HAMMING_PAGES_HUGE_1GB)
+    {
+        *huge_bytes = allocation.data ? allocation.length : 0;
+        return true;
+    }
+
+#ifdef __linux__
+    const size_t begin = reinterpret_cast<size_t>(allocation.data);
+    return smaps_huge_page_bytes(begin, begin + allocation.length, huge_bytes);
+#else
+    *huge_bytes = 0;
+    return true;
+#endif
+}
+
+struct hamming_buffer
+{
+    page_allocation allocation;
+    size_t n_bytes;
+};
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_buffer_create(const size_t n_bytes, hamming_buffer_t** buffer)
+{
+    if (!buffer)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_buffer_t* result = new (nothrow) hamming_buffer_t();
+    if (!result)
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+
+    result->allocation = allocate_pages(n_bytes);
+    result->n_bytes = n_bytes;
+    if (n_bytes && !result->allocation.data)
+    {
+        delete result;
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+
+    *buffer = result;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API unsigned char* HAMMING_CALL hamming_buffer_data(hamming_buffer_t* buffer)
+{
+    return buffer ? buffer->allocation.data : nullptr;
+}
+
+HAMMING_API size_t HAMMING_CALL hamming_buffer_size(const hamming_buffer_t* buffer)
+{
+    return buffer ? buffer->n_bytes : 0;
+}
+
+HAMMING_API hamming_pages_t HAMMING_CALL hamming_buffer_pages(const hamming_buffer_t* buffer)
+{
+    return buffer ? buffer->allocation.pages : HAMMING_PAGES_NORMAL;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_buffer_huge_page_bytes(const hamming_buffer_t* buffer,
+                                                                         size_t* huge_bytes)
+{
+    if (!buffer)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!huge_bytes)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    return huge_page_bytes(buffer->allocation, huge_bytes) ?
+           HAMMING_STATUS_SUCCESS : HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+}
+
+HAMMING_API void HAMMING_CALL hamming_buffer_destroy(hamming_buffer_t* buffer)
+{
+    if (!buffer)
+        return;
+
+    free_pages(buffer->allocation);
+    delete buffer;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_advise_huge_pages(const void* data, const size_t n_bytes)
+{
+    if (!data && n_bytes)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+#ifdef __linux__
+    // only the whole 2MB pages within the range can be huge
+    const size_t begin = round_up(reinterpret_cast<size_t>(data), huge_page_2mb);
+    const size_t end = (reinterpret_cast<size_t>(data) + n_bytes) / huge_page_2mb * huge_page_2mb;
+    if (begin >= end)
+        return HAMMING_STATUS_SUCCESS;
+    return madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE) ?
+           HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE : HAMMING_STATUS_SUCCESS;
+#else
+    return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+#endif
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_huge_page_bytes(const void* data, const size_t n_bytes,
+                                                                  size_t* huge_bytes)
+{
+    if (!data && n_bytes)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!huge_bytes)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+#ifdef __linux__
+    const size_t begin = reinterpret_cast<size_t>(data);
+    return smaps_huge_page_bytes(begin, begin + n_bytes, huge_bytes) ?
+           HAMMING_STATUS_SUCCESS : HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+#else
+    return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+#endif
+}
@@ -1,7 +1,7 @@
 //# several implementations for popcount (hamming weight) of uint64
 
 #include <hamming/internal/popcount.h>
-#include <limits>
+#include <hamming/kernels.hpp>
 
 #if defined(_MSC_VER) && (defined(_M_AMD64) || defined(_M_IX86))
 #include <array>
@@ -17,23 +17,16 @@ using namespace std;
 // CPUs, even though it has a multiplication, which is usually less than
 // 5 times slower than simple ops (we could replace it by 5 simple ops)
 
-INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_vanilla(const unsigned long long int& x_param)
+INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_vanilla(const unsigned long long int& x)
 {
-    unsigned long long int x = x_param;
-    x -= (x >> 1) & 0x5555555555555555ULL;
-    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
-    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
-    return static_cast<unsigned char>((x * 0x0101010101010101ULL) >> 56);
+    return hamming::kernels::popcount64_vanilla(x);
 }
 #endif // HAMMING_WITH_VANILLA
 
 #ifdef HAMMING_WITH_2x32
-INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount32(const unsigned int& x_param)
+INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount32(const unsigned int& x)
 {
-    unsigned int x = x_param;
-    x = x  - ((x >> 1)  & 033333333333U) - ((x >> 2)  & 011111111111U);
-    x = (x +  (x >> 3)) & 030707070707U;
-    return static_cast<unsigned char>(x % 63);
+    return hamming::kernels::popcount32(x);
 }
 
 // @TODO: benchmark this against popcount64. Probably slower, as %
@@ -41,126 +34,28 @@ INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount32(const unsig
 // @TODO: most processors optimize for 32bit integers...
 INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_2x32(const unsigned long long int& x)
 {
-    // return popcount32(static_cast<unsigned int>(x & 0xFFFFFFFF)) +
-    //        popcount32(static_cast<unsigned int>(x >> 32));
-    const unsigned int* u32 = reinterpret_cast<const unsigned int*>(&x);
-    return popcount32(u32[0]) + popcount32(u32[1]);
+    return hamming::kernels::popcount64_2x32(x);
 }
 #endif // HAMMING_WITH_2x32
 
 #ifdef HAMMING_WITH_SPARSE
-INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_sparse(const unsigned long long int& x_param)
+INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_sparse(const unsigned long long int& x)
 {
-    unsigned int count = 0;
-    for (unsigned long long int x = x_param; x; x &= x - 1)
-        ++count;
-    return count;
+    return hamming::kernels::popcount64_sparse(x);
 }
 #endif
 
 #ifdef HAMMING_WITH_LUT
-
-// if T is unsigned short, we will have a 64KB lookup table, which should
-// fit in most L2 caches
-// if T is unsigned char, we will have a 256B lut, which would fit in
-// L1 caches, but the number of lookups would be doubled; anyway, L1 cache
-// latency is more than twice as low as the one of L2 cache, but there are
-// also more additions; I think the only way to figure out which is better
-// is through a benchmark on the deployment platform
-template<typename IntegralType> INTERNAL_HAMMING_API
-typename std::enable_if<std::is_integral<IntegralType>::value, IntegralType>::type*
-HAMMING_CALL init_lut(void)
+// the tables are generated at compile time, in kernels.hpp; that's also where
+// the trade-offs between the 8 and 16 bit tables are discussed
+INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_lut(const unsigned long long int& x)
 {
-    // in C++ 14 this function can be constexpr; C++11 doesn't allow local
-    // variables and loops; constexpr would allow the compile-time init
-    static IntegralType lut[static_cast<long long int>(numeric_limits<IntegralType>::max()) -
-                            static_cast<long long int>(numeric_limits<IntegralType>::min()) + 1];
-
-    // if we wouldn't use openmp, which requires a signed integer loop var,
-    // we would have looped using a pointer, like this:
-    // for (IntegralType* k = lut; k < lut + sizeof(lut) / sizeof(lut[0]);++ k)
-    //     //...
-    //     ++(*k);
-#pragma omp parallel for
-    for (int i=0; i <= sizeof(lut) / sizeof(lut[0]); ++i)
-        for (IntegralType x = static_cast<IntegralType>(i); x; x &= x - 1)
-            ++lut[i];
-
-    return lut;
+    return hamming::kernels::popcount64_lut(x);
 }
 
-// template specialization for byte-sized lut generation
-// also instantiates the template for unsigned char
-template<> INTERNAL_HAMMING_API unsigned char* HAMMING_CALL init_lut<unsigned char>(void)
-{
-    static unsigned char lut[256] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3,
-                                     3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4,
-                                     3, 4, 4, 5, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3,
-                                     3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5,
-                                     3, 4, 4, 5, 4, 5, 5, 6, 1, 2, 2, 3, 2, 3,
-                                     3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4,
-                                     3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3,
-                                     3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-                                     3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6,
-                                     6, 7, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4,
-                                     3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4,
-                                     4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5,
-                                     3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5,
-                                     5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 2, 3, 3, 4,
-                                     3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4,
-                                     4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-                                     3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6,
-                                     6, 7, 4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7,
-                                     6, 7, 7, 8};
-    return lut;
-};
-
-// explicit instantiation
-template INTERNAL_HAMMING_API unsigned short* HAMMING_CALL init_lut<unsigned short>(void);
-
-
-// // helper type for strict-aliasing-safe implementation of lookup
-// union U64
-// {
-//     unsigned long long u64;
-//     unsigned short u16[4];
-// };
-
-
-INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_lut(const unsigned long long int& x)
+INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_lut16(const unsigned long long int& x)
 {
-    // NOTE 1: if C++11 (MSVC2015 / gcc 4.6), magic statics should make sure
-    // the init code is only called once; however, even if the compiler is
-    // not standard compliant, the result will still be correct, as the
-    // concurrent threads will try to write the same values at the same
-    // locations, although it might be a bit slow, due to too much overhead
-    // for context switching so many threads
-    // @TODO: investigate whether concurrently writing the same value
-    // @TODO: corrupts memory
-    //
-    // NOTE 2: /*inline*/ functions only declare statics once, so it's ok to use them
-
-    // static unsigned short* lut = init_lut<unsigned short>();
-    static unsigned char* lut = init_lut<unsigned char>();
-
-    // Type punning is regarded as bad practice, but we don't write to the
-    // type-punned x, so there should be no trouble caused by aliasing.
-    // For what it's worth, here's how a safe implementation would look
-    // like. We don't use it, as it hurts performance on some compilers.
-    // http://cellperformance.beyond3d.com/articles/2006/06/understanding-strict-aliasing.html
-    //
-    // const U64* combined = reinterpret_cast<const U64*>(&x);
-    // return lut[combined->u16[0]] + lut[combined->u16[1]] +
-    //        lut[combined->u16[2]] + lut[combined->u16[3]];
-
-    // shorts:
-    // const unsigned short* u16 = const_cast<const unsigned short*>(&x);
-    // return lut[u16[0]] + lut[u16[1]] + lut[u16[2]] + lut[u16[3]];
-
-    // type punning to [unsigned] char is aliasing-safe
-    const unsigned char* u8 = reinterpret_cast<const unsigned char*>(&x);
-    return lut[u8[0]] + lut[u8[1]] + lut[u8[2]] + lut[u8[3]] +
-           lut[u8[4]] + lut[u8[5]] + lut[u8[6]] + lut[u8[7]];
+    return hamming::kernels::popcount64_lut16(x);
 }
 #endif // HAMMING_WITH_LUT
 
@@ -198,7 +93,7 @@ INTERNAL_HAMMING_API /*inline*/ unsigned int HAMMING_CALL popcount64_gcc(const u
     // implementation for the operation. We decide to trust them for now...
     // Also, the builtin is documented to be available for all platforms
     // (e.g. x86, x64, arm etc.)
-    return __builtin_popcountll (x);
+    return hamming::kernels::popcount64(x);
 }
 #elif defined(_MSC_VER) && (defined(_M_AMD64) || defined(_M_IX86))
 INTERNAL_HAMMING_API /*inline*/ bool HAMMING_CALL has_popcnt()
@@ -0,0 +1,42 @@
+//# options of the one-to-many scans (see hamming_set_scan_options)
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/scan.h>
+#include <atomic>
+
+using namespace std;
+
+namespace{
+    // read at the start of every scan; relaxed, as a scan that starts
+    // concurrently with a change may use either the old or the new options
+    atomic<size_t> prefetch_bytes(0);
+    atomic<int> non_temporal(0);
+}
+
+INTERNAL_HAMMING_API hamming_scan_options_t HAMMING_CALL current_scan_options()
+{
+    hamming_scan_options_t options;
+    options.prefetch_bytes = prefetch_bytes.load(memory_order_relaxed);
+    options.non_temporal = non_temporal.load(memory_order_relaxed);
+    return options;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_set_scan_options(const hamming_scan_options_t* options)
+{
+    if (!options)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    prefetch_bytes.store(options->prefetch_bytes, memory_order_relaxed);
+    non_temporal.store(options->non_temporal ? 1 : 0, memory_order_relaxed);
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_get_scan_options(hamming_scan_options_t* options)
+{
+    if (!options)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    *options = current_scan_options();
+    return HAMMING_STATUS_SUCCESS;
+}
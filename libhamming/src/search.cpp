@@ -0,0 +1,380 @@
+//# k nearest neighbour and radius searches over code sets
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/stats.h>
+#include <hamming/internal/probes.h>
+#include <hamming/internal/code_set.h>
+#include <hamming/internal/scan.h>
+#include <hamming/internal/search.h>
+#include <hamming/internal/parallel.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace{
+    template<typename Kernel>
+    struct knn_op
+    {
+        static void run(const unsigned char query[], const hamming_code_set_t& codes, const size_t k,
+                        hamming_match_t results[], size_t* n_results)
+        {
+            const row_prefetcher prefetch(codes, current_scan_options());
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+            vector<hamming_match_t> heap;
+            heap.reserve(k);
+
+            // the heaps are reserved in the region, so push_bounded doesn't
+            // allocate, and the merge doesn't either
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                // every thread keeps the best k of its range, and the
+                // heaps are merged at the end
+#ifdef _OPENMP
+                const size_t n_threads = static_cast<size_t>(omp_get_num_threads());
+#else
+                const size_t n_threads = 1;
+#endif
+                // the static schedule gives a thread at most this many codes,
+                // so with k close to n_codes the heaps don't take a set's
+                // worth each
+                const size_t range_codes = (codes.n_codes + n_threads - 1) / n_threads;
+                vector<hamming_match_t> thread_heap;
+                failure.run([&] {thread_heap.reserve(min(k, range_codes));});
+#pragma omp for schedule(static) nowait
+                for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+                {
+                    if (failure.failed())
+                        continue;
+                    prefetch(code_idx);
+                    hamming_match_t match;
+                    match.index = static_cast<size_t>(code_idx);
+                    match.distance = xor_popcount<Kernel>(query, code_at(codes, code_idx), codes.code_bytes);
+                    push_bounded(thread_heap, k, match);
+                }
+#pragma omp critical
+                for (size_t match_idx = 0; match_idx < thread_heap.size(); ++match_idx)
+                    push_bounded(heap, k, thread_heap[match_idx]);
+            }
+            failure.rethrow();
+
+            sort_heap(heap.begin(), heap.end(), closer_match);
+            copy(heap.begin(), heap.end(), results);
+            *n_results = heap.size();
+        }
+    };
+
+    template<typename Kernel>
+    struct radius_op
+    {
+        static void run(const unsigned char query[], const hamming_code_set_t& codes, const size_t max_distance,
+                        vector<hamming_match_t>& matches)
+        {
+            const row_prefetcher prefetch(codes, current_scan_options());
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                vector<hamming_match_t> thread_matches;
+#pragma omp for schedule(static) nowait
+                for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+                {
+                    if (failure.failed())
+                        continue;
+                    prefetch(code_idx);
+                    hamming_match_t match;
+                    match.index = static_cast<size_t>(code_idx);
+                    match.distance = xor_popcount<Kernel>(query, code_at(codes, code_idx), codes.code_bytes);
+                    if (match.distance <= max_distance)
+                        failure.run([&] {thread_matches.push_back(match);});
+                }
+#pragma omp critical
+                failure.run([&] {matches.insert(matches.end(), thread_matches.begin(), thread_matches.end());});
+            }
+            failure.rethrow();
+
+            sort(matches.begin(), matches.end(), closer_match);
+        }
+    };
+
+    // a shared scan: the codes are walked in blocks small enough to stay in
+    // the L2 cache, and every block is compared against all the queries
+    // before moving on, so a batch of searches reads the set from memory once
+    template<typename Kernel>
+    struct search_batch_op
+    {
+        static void run(const unsigned char* const queries[], const hamming_search_t searches[],
+                        const size_t n_searches, const hamming_code_set_t& codes,
+                        vector<vector<hamming_match_t> >& found)
+        {
+            const row_prefetcher prefetch(codes, current_scan_options());
+            const size_t block_codes = max(static_cast<size_t>(1),
+                                           (static_cast<size_t>(1) << 16) / code_stride(codes));
+            const ptrdiff_t n_blocks = static_cast<ptrdiff_t>((codes.n_codes + block_codes - 1) / block_codes);
+            found.assign(n_searches, vector<hamming_match_t>());
+
+            // the heaps and the lists grow as they go: every block, and the
+            // merge, runs through failure
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                vector<vector<hamming_match_t> > thread_found;
+                failure.run([&] {thread_found.resize(n_searches);});
+#pragma omp for schedule(static) nowait
+                for (ptrdiff_t block_idx = 0; block_idx < n_blocks; ++block_idx)
+                    failure.run([&]
+                    {
+                        const size_t first = static_cast<size_t>(block_idx) * block_codes;
+                        const size_t last = min(first + block_codes, codes.n_codes);
+                        for (size_t search_idx = 0; search_idx < n_searches; ++search_idx)
+                        {
+                            const hamming_search_t& search = searches[search_idx];
+                            const size_t k = min(search.param, codes.n_codes);
+                            if (search.kind == HAMMING_SEARCH_KNN && !k)
+                                continue;
+                            for (size_t code_idx = first; code_idx < last; ++code_idx)
+                            {
+                                // the block is in the cache after the first query
+                                if (!search_idx)
+                                    prefetch(code_idx);
+                                hamming_match_t match;
+                                match.index = code_idx;
+                                match.distance = xor_popcount<Kernel>(queries[search_idx],
+                                                                      code_at(codes, code_idx), codes.code_bytes);
+                                if (search.kind == HAMMING_SEARCH_KNN)
+                                    push_bounded(thread_found[search_idx], k, match);
+                                else if (match.distance <= search.param)
+                                    thread_found[search_idx].push_back(match);
+                            }
+                        }
+                    });
+#pragma omp critical
+                failure.run([&]
+                {
+                    for (size_t search_idx = 0; search_idx < thread_found.size(); ++search_idx)
+                    {
+                        const vector<hamming_match_t>& matches = thread_found[search_idx];
+                        if (searches[search_idx].kind == HAMMING_SEARCH_KNN)
+                            for (size_t match_idx = 0; match_idx < matches.size(); ++match_idx)
+                                push_bounded(found[search_idx], min(searches[search_idx].param, codes.n_codes),
+                                             matches[match_idx]);
+                        else
+                            found[search_idx].insert(found[search_idx].end(), matches.begin(), matches.end());
+                    }
+                });
+            }
+            failure.rethrow();
+
+            for (size_t search_idx = 0; search_idx < n_searches; ++search_idx)
+                if (searches[search_idx].kind == HAMMING_SEARCH_KNN)
+                    sort_heap(found[search_idx].begin(), found[search_idx].end(), closer_match);
+                else
+                    sort(found[search_idx].begin(), found[search_idx].end(), closer_match);
+        }
+    };
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_knn_search(const unsigned char query[],
+                                                             const hamming_code_set_t* codes,
+                                                             const size_t k,
+                                                             hamming_match_t results[],
+                                                             size_t* n_results,
+                                                             hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_KNN_SEARCH);
+    HAMMING_PROBE_SCOPE4(knn_search, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0, k,
+                         static_cast<int>(impl));
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if ((k && !results) || !n_results)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    *n_results = 0;
+    if (!k)
+        return HAMMING_STATUS_SUCCESS;
+
+    try
+    {
+        return dispatch<knn_op>(impl, code_set_bytes(*codes), query, *codes, min(k, codes->n_codes), results,
+                                n_results);
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_radius_search(const unsigned char query[],
+                                                                const hamming_code_set_t* codes,
+                                                                const size_t max_distance,
+                                                                hamming_match_t results[],
+                                                                const size_t capacity,
+                                                                size_t* n_results,
+                                                                hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_RADIUS_SEARCH);
+    HAMMING_PROBE_SCOPE4(radius_search, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0, max_distance,
+                         static_cast<int>(impl));
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if ((capacity && !results) || !n_results)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        vector<hamming_match_t> matches;
+        status = dispatch<radius_op>(impl, code_set_bytes(*codes), query, *codes, max_distance, matches);
+        if (status != HAMMING_STATUS_SUCCESS)
+            return status;
+
+        copy(matches.begin(), matches.begin() + min(capacity, matches.size()), results);
+        *n_results = matches.size();
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_search_batch(const unsigned char* const queries[],
+                                                               hamming_search_t searches[],
+                                                               const size_t n_searches,
+                                                               const hamming_code_set_t* codes,
+                                                               hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_SEARCH_BATCH);
+    HAMMING_PROBE_SCOPE4(search_batch, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0, n_searches,
+                         static_cast<int>(impl));
+
+    if (n_searches && (!queries || !searches))
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    for (size_t search_idx = 0; search_idx < n_searches; ++search_idx)
+    {
+        if (!queries[search_idx])
+            return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+        if (searches[search_idx].kind != HAMMING_SEARCH_KNN && searches[search_idx].kind != HAMMING_SEARCH_RADIUS)
+            return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+        if (searches[search_idx].capacity && !searches[search_idx].results)
+            return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+    }
+
+    try
+    {
+        vector<vector<hamming_match_t> > found;
+        status = dispatch<search_batch_op>(impl, code_set_bytes(*codes) * n_searches, queries, searches, n_searches,
+                                           *codes, found);
+        if (status != HAMMING_STATUS_SUCCESS)
+            return status;
+
+        for (size_t search_idx = 0; search_idx < n_searches; ++search_idx)
+        {
+            hamming_search_t& search = searches[search_idx];
+            copy(found[search_idx].begin(), found[search_idx].begin() + min(search.capacity, found[search_idx].size()),
+                 search.results);
+            search.n_results = found[search_idx].size();
+        }
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_merge_matches(const hamming_match_t* const lists[],
+                                                                const size_t sizes[],
+                                                                const size_t offsets[],
+                                                                const size_t n_lists,
+                                                                hamming_match_t results[],
+                                                                const size_t capacity,
+                                                                size_t* n_results)
+{
+    if (n_lists && (!lists || !sizes))
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if ((capacity && !results) || !n_results)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    size_t total = 0;
+    for (size_t list_idx = 0; list_idx < n_lists; ++list_idx)
+    {
+        if (sizes[list_idx] && !lists[list_idx])
+            return HAMMING_STATUS_BAD_PARAM_STR_1;
+        total += sizes[list_idx];
+    }
+
+    // k-way merge, with a heap of the heads of the lists (closest on top)
+    try
+    {
+        struct head
+        {
+            hamming_match_t match;
+            size_t list_idx;
+            size_t position;
+        };
+        const auto farther = [](const head& head1, const head& head2) {return closer_match(head2.match, head1.match);};
+        vector<head> heads;
+        heads.reserve(n_lists);
+        for (size_t list_idx = 0; list_idx < n_lists; ++list_idx)
+            if (sizes[list_idx])
+            {
+                head list_head = {lists[list_idx][0], list_idx, 0};
+                list_head.match.index += offsets ? offsets[list_idx] : 0;
+                heads.push_back(list_head);
+            }
+        make_heap(heads.begin(), heads.end(), farther);
+
+        const size_t n_written = min(capacity, total);
+        for (size_t result_idx = 0; result_idx < n_written; ++result_idx)
+        {
+            pop_heap(heads.begin(), heads.end(), farther);
+            head& next = heads.back();
+            results[result_idx] = next.match;
+            if (++next.position < sizes[next.list_idx])
+            {
+                next.match = lists[next.list_idx][next.position];
+                next.match.index += offsets ? offsets[next.list_idx] : 0;
+                push_heap(heads.begin(), heads.end(), farther);
+            }
+            else
+                heads.pop_back();
+        }
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+
+    *n_results = total;
+    return HAMMING_STATUS_SUCCESS;
+}
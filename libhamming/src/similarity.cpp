@@ -0,0 +1,524 @@
+//# tanimoto / dice similarity and the weight-sorted tanimoto search index
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/stats.h>
+#include <hamming/internal/probes.h>
+#include <hamming/internal/code_set.h>
+#include <hamming/internal/scan.h>
+#include <hamming/internal/pages.h>
+#include <hamming/internal/parallel.h>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace{
+    // intersection count and both weights, in a single pass
+    template<typename Kernel>
+    void similarity_counts(const unsigned char str1[], const unsigned char str2[], const size_t n_bytes,
+                           size_t& n_common, size_t& weight1, size_t& weight2)
+    {
+        size_t common = 0, w1 = 0, w2 = 0;
+        const size_t n_words = n_bytes / 8;
+        for (size_t word_idx = 0; word_idx < n_words; ++word_idx)
+        {
+            const unsigned long long int x1 = load_ull(str1 + 8 * word_idx);
+            const unsigned long long int x2 = load_ull(str2 + 8 * word_idx);
+            common += Kernel::popcount(x1 & x2);
+            w1 += Kernel::popcount(x1);
+            w2 += Kernel::popcount(x2);
+        }
+
+        const size_t remaining_bytes = n_bytes % 8;
+        if (remaining_bytes)
+        {
+            const unsigned long long int x1 = load_ull_partial(str1 + 8 * n_words, remaining_bytes);
+            const unsigned long long int x2 = load_ull_partial(str2 + 8 * n_words, remaining_bytes);
+            common += Kernel::popcount(x1 & x2);
+            w1 += Kernel::popcount(x1);
+            w2 += Kernel::popcount(x2);
+        }
+
+        n_common = common;
+        weight1 = w1;
+        weight2 = w2;
+    }
+
+    template<typename Kernel>
+    size_t and_popcount(const unsigned char str1[], const unsigned char str2[], const size_t n_bytes)
+    {
+        const size_t n_words = n_bytes / 8;
+        size_t common = Kernel::sum(n_words, [=](size_t word_idx)
+        {
+            return load_ull(str1 + 8 * word_idx) & load_ull(str2 + 8 * word_idx);
+        });
+
+        const size_t remaining_bytes = n_bytes % 8;
+        if (remaining_bytes)
+            common += Kernel::popcount(load_ull_partial(str1 + 8 * n_words, remaining_bytes) &
+                                       load_ull_partial(str2 + 8 * n_words, remaining_bytes));
+        return common;
+    }
+
+    inline double similarity_from_counts(const size_t n_common, const size_t weight1, const size_t weight2,
+                                         hamming_similarity_t metric)
+    {
+        if (metric == HAMMING_SIMILARITY_DICE)
+            return weight1 + weight2 ? 2.0 * n_common / (weight1 + weight2) : 0.0;
+
+        const size_t n_union = weight1 + weight2 - n_common;
+        return n_union ? static_cast<double>(n_common) / n_union : 0.0;
+    }
+
+    // Swamidass-Baldi: tanimoto <= min(w1, w2) / max(w1, w2)
+    inline double tanimoto_bound(const size_t weight1, const size_t weight2)
+    {
+        const size_t max_weight = max(weight1, weight2);
+        return max_weight ? static_cast<double>(min(weight1, weight2)) / max_weight : 0.0;
+    }
+
+    // decreasing similarity, then increasing index
+    inline bool better_match(const hamming_similarity_match_t& match1, const hamming_similarity_match_t& match2)
+    {
+        return match1.similarity > match2.similarity ||
+               (match1.similarity == match2.similarity && match1.index < match2.index);
+    }
+
+    template<typename Kernel>
+    struct similarity_counts_op
+    {
+        static void run(const unsigned char str1[], const unsigned char str2[], const size_t n_bytes,
+                        size_t* n_common, size_t* weight1, size_t* weight2)
+        {
+            similarity_counts<Kernel>(str1, str2, n_bytes, *n_common, *weight1, *weight2);
+        }
+    };
+
+    template<typename Kernel>
+    struct similarity_batch_op
+    {
+        static void run(const unsigned char query[], const hamming_code_set_t& codes,
+                        hamming_similarity_t metric, double similarities[])
+        {
+            const row_prefetcher prefetch(codes, current_scan_options());
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+            {
+                prefetch(code_idx);
+                size_t n_common = 0, weight1 = 0, weight2 = 0;
+                similarity_counts<Kernel>(query, code_at(codes, code_idx), codes.code_bytes,
+                                          n_common, weight1, weight2);
+                similarities[code_idx] = similarity_from_counts(n_common, weight1, weight2, metric);
+            }
+        }
+    };
+}
+
+struct hamming_tanimoto_index
+{
+    size_t code_bytes;
+    // rows are padded to whole words
+    size_t stride;
+    page_array<unsigned char> rows;
+    // position of every row in the original set
+    page_array<size_t> ids;
+    // the rows of weight w are [weight_offsets[w], weight_offsets[w + 1])
+    vector<size_t> weight_offsets;
+
+    size_t max_weight() const {return 8 * code_bytes;}
+    const unsigned char* row(size_t row_idx) const {return rows.data() + row_idx * stride;}
+
+    hamming_code_set_t row_set() const
+    {
+        hamming_code_set_t set = {rows.data(), ids.size(), code_bytes, stride};
+        return set;
+    }
+};
+
+namespace{
+    template<typename Kernel>
+    struct tanimoto_index_build_op
+    {
+        static void run(const hamming_code_set_t& codes, hamming_tanimoto_index& index)
+        {
+            index.code_bytes = codes.code_bytes;
+            index.stride = (codes.code_bytes + 7) / 8 * 8;
+
+            const ptrdiff_t n_codes = static_cast<ptrdiff_t>(codes.n_codes);
+            vector<size_t> weights(codes.n_codes);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t code_idx = 0; code_idx < n_codes; ++code_idx)
+                weights[code_idx] = weight_popcount<Kernel>(code_at(codes, code_idx), codes.code_bytes);
+
+            // counting sort, which keeps the original order within a weight
+            index.weight_offsets.assign(index.max_weight() + 2, 0);
+            for (size_t code_idx = 0; code_idx < codes.n_codes; ++code_idx)
+                ++index.weight_offsets[weights[code_idx] + 1];
+            for (size_t weight = 1; weight < index.weight_offsets.size(); ++weight)
+                index.weight_offsets[weight] += index.weight_offsets[weight - 1];
+
+            vector<size_t> next_row(index.weight_offsets.begin(), index.weight_offsets.end() - 1);
+            index.ids.allocate(codes.n_codes);
+            if (codes.n_codes > static_cast<size_t>(-1) / index.stride)
+                throw bad_alloc();
+            index.rows.allocate(codes.n_codes * index.stride);
+            for (size_t code_idx = 0; code_idx < codes.n_codes; ++code_idx)
+            {
+                const size_t row_idx = next_row[weights[code_idx]]++;
+                index.ids[row_idx] = code_idx;
+                copy(code_at(codes, code_idx), code_at(codes, code_idx) + codes.code_bytes,
+                     index.rows.data() + row_idx * index.stride);
+            }
+        }
+    };
+
+    template<typename Kernel>
+    struct tanimoto_top_k_op
+    {
+        static void run(const hamming_tanimoto_index& index, const unsigned char query[], const size_t k,
+                        const double min_similarity, hamming_similarity_match_t results[], size_t* n_results)
+        {
+            const size_t query_weight = weight_popcount<Kernel>(query, index.code_bytes);
+            const row_prefetcher prefetch(index.row_set(), current_scan_options());
+
+            // heap of the best k so far, with the worst one on top
+            vector<hamming_similarity_match_t> heap;
+            heap.reserve(k);
+
+            // weights are visited by decreasing bound, expanding outwards
+            // from the weight of the query
+            ptrdiff_t lower = static_cast<ptrdiff_t>(min(query_weight, index.max_weight()));
+            size_t upper = query_weight + 1;
+            while (lower >= 0 || upper <= index.max_weight())
+            {
+                const double lower_bound = lower >= 0 ? tanimoto_bound(query_weight, lower) : -1.0;
+                const double upper_bound = upper <= index.max_weight() ? tanimoto_bound(query_weight, upper) : -1.0;
+                const bool take_lower = lower_bound >= upper_bound;
+                const size_t weight = take_lower ? static_cast<size_t>(lower) : upper;
+                const double bound = take_lower ? lower_bound : upper_bound;
+
+                // the best a row of the remaining buckets could be is one at
+                // the bound with the lowest index; the heap's own order
+                // decides whether that would still make it in (so at equal
+                // similarity, the lower indexes still get their chance)
+                hamming_similarity_match_t best_possible;
+                best_possible.index = 0;
+                best_possible.similarity = bound;
+                if (bound < min_similarity || (heap.size() == k && !better_match(best_possible, heap.front())))
+                    break;
+
+                if (take_lower)
+                    --lower;
+                else
+                    ++upper;
+
+                const size_t end_row = index.weight_offsets[weight + 1];
+                for (size_t row_idx = index.weight_offsets[weight]; row_idx < end_row; ++row_idx)
+                {
+                    prefetch(row_idx, end_row);
+                    const size_t n_common = and_popcount<Kernel>(query, index.row(row_idx), index.code_bytes);
+                    hamming_similarity_match_t match;
+                    match.index = index.ids[row_idx];
+                    match.similarity = similarity_from_counts(n_common, query_weight, weight,
+                                                              HAMMING_SIMILARITY_TANIMOTO);
+                    if (match.similarity < min_similarity)
+                        continue;
+
+                    if (heap.size() < k)
+                    {
+                        heap.push_back(match);
+                        push_heap(heap.begin(), heap.end(), better_match);
+                    }
+                    else if (better_match(match, heap.front()))
+                    {
+                        pop_heap(heap.begin(), heap.end(), better_match);
+                        heap.back() = match;
+                        push_heap(heap.begin(), heap.end(), better_match);
+                    }
+                }
+            }
+
+            sort_heap(heap.begin(), heap.end(), better_match);
+            copy(heap.begin(), heap.end(), results);
+            *n_results = heap.size();
+        }
+    };
+
+    template<typename Kernel>
+    struct tanimoto_threshold_op
+    {
+        static void run(const hamming_tanimoto_index& index, const unsigned char query[],
+                        const double min_similarity, vector<hamming_similarity_match_t>& matches)
+        {
+            const size_t query_weight = weight_popcount<Kernel>(query, index.code_bytes);
+
+            // the weights within the bound form a contiguous range of rows
+            size_t first_weight = 0, last_weight = index.max_weight() + 1;
+            while (first_weight < last_weight && tanimoto_bound(query_weight, first_weight) < min_similarity)
+                ++first_weight;
+            while (last_weight > first_weight && tanimoto_bound(query_weight, last_weight - 1) < min_similarity)
+                --last_weight;
+
+            const ptrdiff_t first_row = static_cast<ptrdiff_t>(index.weight_offsets[first_weight]);
+            const ptrdiff_t last_row = static_cast<ptrdiff_t>(index.weight_offsets[last_weight]);
+            const row_prefetcher prefetch(index.row_set(), current_scan_options());
+
+            parallel_failure failure;
+#pragma omp parallel
+            {
+                vector<hamming_similarity_match_t> thread_matches;
+                // the weight of the rows is that of their bucket; the static
+                // schedule hands every thread increasing rows, so it is only
+                // followed along
+                size_t weight = first_weight;
+#pragma omp for schedule(static) nowait
+                for (ptrdiff_t row_idx = first_row; row_idx < last_row; ++row_idx)
+                {
+                    if (failure.failed())
+                        continue;
+                    prefetch(row_idx, last_row);
+                    while (static_cast<size_t>(row_idx) >= index.weight_offsets[weight + 1])
+                        ++weight;
+                    const size_t n_common = and_popcount<Kernel>(query, index.row(row_idx), index.code_bytes);
+                    hamming_similarity_match_t match;
+                    match.index = index.ids[row_idx];
+                    match.similarity = similarity_from_counts(n_common, query_weight, weight,
+                                                              HAMMING_SIMILARITY_TANIMOTO);
+                    if (match.similarity >= min_similarity)
+                        failure.run([&] {thread_matches.push_back(match);});
+                }
+#pragma omp critical
+                failure.run([&] {matches.insert(matches.end(), thread_matches.begin(), thread_matches.end());});
+            }
+            failure.rethrow();
+
+            sort(matches.begin(), matches.end(), better_match);
+        }
+    };
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_similarity_counts(const unsigned char str1[],
+                                                                    const unsigned char str2[],
+                                                                    const size_t n_bytes,
+                                                                    size_t* n_common,
+                                                                    size_t* weight1,
+                                                                    size_t* weight2,
+                                                                    hamming_impl_t impl)
+{
+    if (!str1)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!str2)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!n_common || !weight1 || !weight2)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    return dispatch<similarity_counts_op>(impl, n_bytes, str1, str2, n_bytes, n_common, weight1, weight2);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_similarity(const unsigned char str1[],
+                                                             const unsigned char str2[],
+                                                             const size_t n_bytes,
+                                                             hamming_similarity_t metric,
+                                                             double* similarity,
+                                                             hamming_impl_t impl)
+{
+    if (!similarity)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    size_t n_common = 0, weight1 = 0, weight2 = 0;
+    hamming_status_t status = hamming_similarity_counts(str1, str2, n_bytes, &n_common, &weight1, &weight2, impl);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    *similarity = similarity_from_counts(n_common, weight1, weight2, metric);
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_similarity_batch(const unsigned char query[],
+                                                                   const hamming_code_set_t* codes,
+                                                                   hamming_similarity_t metric,
+                                                                   double similarities[],
+                                                                   hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_SIMILARITY_BATCH);
+    HAMMING_PROBE_SCOPE3(similarity_batch, codes ? codes->n_codes : 0, codes ? codes->code_bytes : 0,
+                         static_cast<int>(impl));
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (!similarities)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    return dispatch<similarity_batch_op>(impl, code_set_bytes(*codes), query, *codes, metric, similarities);
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_index_create(const hamming_code_set_t* codes,
+                                                                        hamming_tanimoto_index_t** index)
+{
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_1);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    if (!index)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_tanimoto_index_t* result = nullptr;
+    try
+    {
+        result = new hamming_tanimoto_index_t();
+        status = dispatch<tanimoto_index_build_op>(HAMMING_IMPL_DEFAULT, code_set_bytes(*codes), *codes, *result);
+    }
+    catch (const bad_alloc&)
+    {
+        status = HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+
+    if (status != HAMMING_STATUS_SUCCESS)
+    {
+        delete result;
+        return status;
+    }
+
+    *index = result;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API void HAMMING_CALL hamming_tanimoto_index_destroy(hamming_tanimoto_index_t* index)
+{
+    delete index;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_index_pages(const hamming_tanimoto_index_t* index,
+                                                                       hamming_pages_t* pages)
+{
+    if (!index)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!pages)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    *pages = index->rows.allocation().pages;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_top_k(const hamming_tanimoto_index_t* index,
+                                                                 const unsigned char query[],
+                                                                 const size_t k,
+                                                                 const double min_similarity,
+                                                                 hamming_similarity_match_t results[],
+                                                                 size_t* n_results,
+                                                                 hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_TANIMOTO_TOP_K);
+    HAMMING_PROBE_SCOPE4(tanimoto_top_k, index ? index->ids.size() : 0, index ? index->code_bytes : 0, k,
+                         static_cast<int>(impl));
+
+    if (!index)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if ((k && !results) || !n_results)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    *n_results = 0;
+    if (!k)
+        return HAMMING_STATUS_SUCCESS;
+
+    try
+    {
+        return dispatch<tanimoto_top_k_op>(impl, 0, *index, query, k, min_similarity, results, n_results);
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_threshold(const hamming_tanimoto_index_t* index,
+                                                                     const unsigned char query[],
+                                                                     const double min_similarity,
+                                                                     hamming_similarity_match_t results[],
+                                                                     const size_t capacity,
+                                                                     size_t* n_results,
+                                                                     hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_TANIMOTO_THRESHOLD);
+    HAMMING_PROBE_SCOPE3(tanimoto_threshold, index ? index->ids.size() : 0, index ? index->code_bytes : 0,
+                         static_cast<int>(impl));
+
+    if (!index)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if ((capacity && !results) || !n_results)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        vector<hamming_similarity_match_t> matches;
+        hamming_status_t status = dispatch<tanimoto_threshold_op>(impl, 0, *index, query, min_similarity, matches);
+        if (status != HAMMING_STATUS_SUCCESS)
+            return status;
+
+        copy(matches.begin(), matches.begin() + min(capacity, matches.size()), results);
+        *n_results = matches.size();
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_tanimoto_threshold_each(const hamming_tanimoto_index_t* index,
+                                                                          const unsigned char query[],
+                                                                          const double min_similarity,
+                                                                          hamming_similarity_callback_t callback,
+                                                                          void* user_data,
+                                                                          hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_TANIMOTO_THRESHOLD);
+    HAMMING_PROBE_SCOPE3(tanimoto_threshold, index ? index->ids.size() : 0, index ? index->code_bytes : 0,
+                         static_cast<int>(impl));
+
+    if (!index)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!query)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!callback)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        vector<hamming_similarity_match_t> matches;
+        hamming_status_t status = dispatch<tanimoto_threshold_op>(impl, 0, *index, query, min_similarity, matches);
+        if (status != HAMMING_STATUS_SUCCESS)
+            return status;
+
+        for (size_t match_idx = 0; match_idx < matches.size(); ++match_idx)
+            callback(matches[match_idx], user_data);
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
@@ -0,0 +1,489 @@
+//# sliding window search of a pattern over a stream
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/popcount.h>
+#include <hamming/internal/kernel.h>
+#include <hamming/internal/stats.h>
+#include <hamming/internal/probes.h>
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+namespace{
+    // the pattern shifted left by `shift` bits inside a window of stream bytes,
+    // as whole words (zero-padded); masks select the bits which are compared
+    struct shifted_pattern
+    {
+        size_t window_bytes;
+        vector<unsigned long long int> words;
+        vector<unsigned long long int> masks;
+    };
+
+    // all the shifts of a pattern are prepared once, so the scan only does
+    // loads, xors, ands and popcounts, whatever the offset
+    struct sliding_pattern
+    {
+        hamming_slide_t slide;
+        size_t pattern_bytes;
+        vector<shifted_pattern> shifts; // 1 in byte mode, 8 in bit mode
+
+        // positions per byte of stream
+        size_t unit() const {return slide == HAMMING_SLIDE_BITS ? 8 : 1;}
+        size_t max_window_bytes() const {return shifts.back().window_bytes;}
+    };
+
+    vector<unsigned long long int> to_words(vector<unsigned char> bytes)
+    {
+        bytes.resize((bytes.size() + 7) / 8 * 8, 0);
+        vector<unsigned long long int> words(bytes.size() / 8);
+        for (size_t word_idx = 0; word_idx < words.size(); ++word_idx)
+            words[word_idx] = load_ull(bytes.data() + 8 * word_idx);
+        return words;
+    }
+
+    void init_sliding_pattern(sliding_pattern& pat, const unsigned char pattern[],
+                              const size_t pattern_bytes, hamming_slide_t slide)
+    {
+        pat.slide = slide;
+        pat.pattern_bytes = pattern_bytes;
+        pat.shifts.resize(slide == HAMMING_SLIDE_BITS ? 8 : 1);
+
+        for (unsigned int shift = 0; shift < pat.shifts.size(); ++shift)
+        {
+            // a shifted pattern straddles one more byte of the stream
+            const size_t window_bytes = pattern_bytes + (shift ? 1 : 0);
+            vector<unsigned char> bytes(window_bytes), mask(window_bytes);
+            for (size_t byte_idx = 0; byte_idx < window_bytes; ++byte_idx)
+            {
+                const unsigned int cur = byte_idx < pattern_bytes ? pattern[byte_idx] : 0;
+                const unsigned int prev = byte_idx ? pattern[byte_idx - 1] : 0;
+                const unsigned int cur_mask = byte_idx < pattern_bytes ? 0xFF : 0;
+                const unsigned int prev_mask = byte_idx ? 0xFF : 0;
+                bytes[byte_idx] = static_cast<unsigned char>(shift ? (cur << shift) | (prev >> (8 - shift)) : cur);
+                mask[byte_idx] = static_cast<unsigned char>(shift ? (cur_mask << shift) | (prev_mask >> (8 - shift)) : cur_mask);
+            }
+
+            pat.shifts[shift].window_bytes = window_bytes;
+            pat.shifts[shift].words = to_words(bytes);
+            pat.shifts[shift].masks = to_words(mask);
+        }
+    }
+
+    // word load that never reads past the end of the buffer
+    inline unsigned long long int load_ull_bounded(const unsigned char buf[], const size_t buf_bytes,
+                                                   const size_t pos)
+    {
+        if (pos + 8 <= buf_bytes)
+            return load_ull(buf + pos);
+        return pos < buf_bytes ? load_ull_partial(buf + pos, buf_bytes - pos) : 0;
+    }
+
+    // patterns of up to this many words compare 4 windows at a time, sharing
+    // the loads of the pattern words; longer ones run the dispatched kernel's
+    // sum (unrolled, vectorized, ...) over each window
+    const size_t interleaved_words = 4;
+    // words summed between two checks against the limit
+    const size_t block_words = 32;
+
+    template<typename Kernel>
+    struct sliding_scan
+    {
+        // distance of the window starting at buf[start]; gives up as soon as
+        // the distance exceeds limit
+        static size_t window_distance(const shifted_pattern& pat, const unsigned char buf[],
+                                      const size_t buf_bytes, const size_t start, const size_t limit)
+        {
+            const size_t n_words = pat.words.size();
+            size_t dist = 0;
+            for (size_t first = 0; first < n_words && dist <= limit; first += block_words)
+                dist += Kernel::sum(min(block_words, n_words - first), [&](size_t word_idx)
+                {
+                    const size_t pattern_idx = first + word_idx;
+                    return (load_ull_bounded(buf, buf_bytes, start + 8 * pattern_idx) ^ pat.words[pattern_idx]) &
+                           pat.masks[pattern_idx];
+                });
+            return dist;
+        }
+
+        // distances of the 4 windows starting at window[0..3], which must all
+        // be readable
+        static void window_distance_x4(const shifted_pattern& pat, const unsigned char window[],
+                                       const size_t limit, size_t dist[4])
+        {
+            const size_t n_words = pat.words.size();
+            if (n_words > interleaved_words)
+            {
+                dist[0] = dist[1] = dist[2] = dist[3] = 0;
+                for (size_t first = 0; first < n_words; first += block_words)
+                {
+                    const size_t n_block = min(block_words, n_words - first);
+                    for (size_t k = 0; k < 4; ++k)
+                        dist[k] += Kernel::sum(n_block, [&](size_t word_idx)
+                        {
+                            const size_t pattern_idx = first + word_idx;
+                            return (load_ull(window + k + 8 * pattern_idx) ^ pat.words[pattern_idx]) &
+                                   pat.masks[pattern_idx];
+                        });
+                    if (min(min(dist[0], dist[1]), min(dist[2], dist[3])) > limit)
+                        break;
+                }
+                return;
+            }
+
+            // every pattern word is loaded once and compared against the 4
+            // overlapping windows, with independent accumulators
+            size_t dist0 = 0, dist1 = 0, dist2 = 0, dist3 = 0;
+            for (size_t word_idx = 0; word_idx < n_words; ++word_idx)
+            {
+                const unsigned long long int word = pat.words[word_idx];
+                const unsigned long long int mask = pat.masks[word_idx];
+                const unsigned char* src = window + 8 * word_idx;
+                dist0 += Kernel::popcount((load_ull(src) ^ word) & mask);
+                dist1 += Kernel::popcount((load_ull(src + 1) ^ word) & mask);
+                dist2 += Kernel::popcount((load_ull(src + 2) ^ word) & mask);
+                dist3 += Kernel::popcount((load_ull(src + 3) ^ word) & mask);
+            }
+            dist[0] = dist0;
+            dist[1] = dist1;
+            dist[2] = dist2;
+            dist[3] = dist3;
+        }
+
+        // computes the distances at the local positions [first, last) of buf
+        // and calls sink(base + position, distance) in increasing order of
+        // position; every position in the range must fit in buf
+        template<typename Sink>
+        static void run(const sliding_pattern& pat, const unsigned char buf[], const size_t buf_bytes,
+                        const size_t first, const size_t last, const size_t base, const size_t limit,
+                        Sink& sink)
+        {
+            if (first >= last)
+                return;
+
+            const size_t unit = pat.unit();
+            const size_t last_start = (last - 1) / unit + 1;
+            size_t dist[8][4];
+
+            for (size_t start = first / unit; start < last_start; start += 4)
+            {
+                const size_t n_starts = min<size_t>(4, last_start - start);
+                for (size_t shift = 0; shift < pat.shifts.size(); ++shift)
+                {
+                    const shifted_pattern& sp = pat.shifts[shift];
+                    if (n_starts == 4 && start + 3 + 8 * sp.words.size() <= buf_bytes)
+                        window_distance_x4(sp, buf + start, limit, dist[shift]);
+                    else
+                        for (size_t k = 0; k < n_starts; ++k)
+                        {
+                            const size_t pos = unit * (start + k) + shift;
+                            if (pos >= first && pos < last)
+                                dist[shift][k] = window_distance(sp, buf, buf_bytes, start + k, limit);
+                        }
+                }
+
+                for (size_t k = 0; k < n_starts; ++k)
+                    for (size_t shift = 0; shift < pat.shifts.size(); ++shift)
+                    {
+                        const size_t pos = unit * (start + k) + shift;
+                        if (pos >= first && pos < last)
+                            sink(base + pos, dist[shift][k]);
+                    }
+            }
+        }
+    };
+
+    struct store_sink
+    {
+        size_t* distances;
+        void operator()(size_t pos, size_t dist) {distances[pos] = dist;}
+    };
+
+    struct match_sink
+    {
+        size_t max_distance;
+        size_t* positions;
+        size_t capacity;
+        size_t n_matches;
+
+        void operator()(size_t pos, size_t dist)
+        {
+            if (dist > max_distance)
+                return;
+            if (n_matches < capacity)
+                positions[n_matches] = pos;
+            ++n_matches;
+        }
+    };
+
+    struct callback_sink
+    {
+        size_t max_distance;
+        hamming_match_callback_t callback;
+        void* user_data;
+
+        void operator()(size_t pos, size_t dist)
+        {
+            if (dist <= max_distance)
+                callback(pos, dist, user_data);
+        }
+    };
+
+    template<typename Kernel>
+    struct sliding_distance_op
+    {
+        static void run(const sliding_pattern& pat, const unsigned char stream[], const size_t stream_bytes,
+                        const size_t n_offsets, size_t distances[])
+        {
+            // blocks are a multiple of 8 positions, so that in bit mode no
+            // start is shared by two threads
+            const ptrdiff_t block = 4096;
+            const ptrdiff_t n_blocks = static_cast<ptrdiff_t>((n_offsets + block - 1) / block);
+#pragma omp parallel for schedule(static)
+            for (ptrdiff_t block_idx = 0; block_idx < n_blocks; ++block_idx)
+            {
+                store_sink sink = {distances};
+                const size_t first = static_cast<size_t>(block_idx * block);
+                sliding_scan<Kernel>::run(pat, stream, stream_bytes, first,
+                                          min(n_offsets, first + static_cast<size_t>(block)), 0,
+                                          numeric_limits<size_t>::max(), sink);
+            }
+        }
+    };
+
+    template<typename Kernel>
+    struct sliding_search_op
+    {
+        static void run(const sliding_pattern& pat, const unsigned char stream[], const size_t stream_bytes,
+                        const size_t n_offsets, match_sink& sink)
+        {
+            sliding_scan<Kernel>::run(pat, stream, stream_bytes, 0, n_offsets, 0, sink.max_distance, sink);
+        }
+    };
+}
+
+struct hamming_sliding_stream
+{
+    sliding_pattern pattern;
+    size_t max_distance;
+    hamming_impl_t impl;
+    // the bytes which are still needed by windows that were not scanned yet
+    // (at most max_window_bytes() - 1); tail[0] is byte tail_pos of the stream
+    vector<unsigned char> tail;
+    size_t tail_pos;
+    // first position which was not scanned yet
+    size_t next_pos;
+};
+
+namespace{
+    template<typename Kernel>
+    struct sliding_feed_op
+    {
+        static void run(hamming_sliding_stream& state, const unsigned char chunk[], const size_t chunk_bytes,
+                        callback_sink& sink)
+        {
+            const sliding_pattern& pat = state.pattern;
+            const size_t unit = pat.unit();
+            const size_t chunk_pos = state.tail_pos + state.tail.size();
+            const size_t end_pos = hamming_sliding_offsets(pat.pattern_bytes, chunk_pos + chunk_bytes, pat.slide);
+
+            // windows which start in the tail: they only need the first
+            // max_window_bytes() - 1 bytes of the chunk
+            if (state.next_pos < min(end_pos, unit * chunk_pos))
+            {
+                vector<unsigned char> joint(state.tail);
+                joint.insert(joint.end(), chunk, chunk + min(chunk_bytes, pat.max_window_bytes() - 1));
+                sliding_scan<Kernel>::run(pat, joint.data(), joint.size(),
+                                          state.next_pos - unit * state.tail_pos,
+                                          min(end_pos, unit * chunk_pos) - unit * state.tail_pos,
+                                          unit * state.tail_pos, state.max_distance, sink);
+            }
+
+            // windows which start in the chunk are scanned in place
+            const size_t first = max(state.next_pos, unit * chunk_pos);
+            if (first < end_pos)
+                sliding_scan<Kernel>::run(pat, chunk, chunk_bytes, first - unit * chunk_pos,
+                                          end_pos - unit * chunk_pos, unit * chunk_pos,
+                                          state.max_distance, sink);
+            state.next_pos = max(state.next_pos, end_pos);
+
+            // keep the last bytes, which the next windows will start in
+            const size_t keep = pat.max_window_bytes() - 1;
+            if (chunk_bytes >= keep)
+                state.tail.assign(chunk + chunk_bytes - keep, chunk + chunk_bytes);
+            else
+            {
+                state.tail.insert(state.tail.end(), chunk, chunk + chunk_bytes);
+                if (state.tail.size() > keep)
+                    state.tail.erase(state.tail.begin(), state.tail.end() - keep);
+            }
+            state.tail_pos = chunk_pos + chunk_bytes - state.tail.size();
+        }
+    };
+}
+
+HAMMING_API size_t HAMMING_CALL hamming_sliding_offsets(const size_t pattern_bytes,
+                                                        const size_t stream_bytes,
+                                                        hamming_slide_t slide)
+{
+    if (!pattern_bytes || stream_bytes < pattern_bytes)
+        return 0;
+    return slide == HAMMING_SLIDE_BITS ? 8 * (stream_bytes - pattern_bytes) + 1
+                                       : stream_bytes - pattern_bytes + 1;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_distance(const unsigned char pattern[],
+                                                                   const size_t pattern_bytes,
+                                                                   const unsigned char stream[],
+                                                                   const size_t stream_bytes,
+                                                                   hamming_slide_t slide,
+                                                                   size_t distances[],
+                                                                   hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_SLIDING);
+    HAMMING_PROBE_SCOPE3(sliding_distance, pattern_bytes, stream_bytes, static_cast<int>(impl));
+
+    if (!pattern)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!stream)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!distances)
+        return HAMMING_STATUS_BAD_PARAM_DISTANCE;
+
+    if (!pattern_bytes || (slide != HAMMING_SLIDE_BYTES && slide != HAMMING_SLIDE_BITS))
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    const size_t n_offsets = hamming_sliding_offsets(pattern_bytes, stream_bytes, slide);
+    if (!n_offsets)
+        return HAMMING_STATUS_SUCCESS;
+
+    try
+    {
+        sliding_pattern pat;
+        init_sliding_pattern(pat, pattern, pattern_bytes, slide);
+        return dispatch<sliding_distance_op>(impl, stream_bytes, pat, stream, stream_bytes, n_offsets, distances);
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_search(const unsigned char pattern[],
+                                                                 const size_t pattern_bytes,
+                                                                 const unsigned char stream[],
+                                                                 const size_t stream_bytes,
+                                                                 hamming_slide_t slide,
+                                                                 const size_t max_distance,
+                                                                 size_t positions[],
+                                                                 const size_t capacity,
+                                                                 size_t* n_matches,
+                                                                 hamming_impl_t impl)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_SLIDING);
+    HAMMING_PROBE_SCOPE3(sliding_search, pattern_bytes, stream_bytes, static_cast<int>(impl));
+
+    if (!pattern)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!stream)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!n_matches || (capacity && !positions))
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    if (!pattern_bytes || (slide != HAMMING_SLIDE_BYTES && slide != HAMMING_SLIDE_BITS))
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    *n_matches = 0;
+    const size_t n_offsets = hamming_sliding_offsets(pattern_bytes, stream_bytes, slide);
+    if (!n_offsets)
+        return HAMMING_STATUS_SUCCESS;
+
+    try
+    {
+        sliding_pattern pat;
+        init_sliding_pattern(pat, pattern, pattern_bytes, slide);
+        match_sink sink = {max_distance, positions, capacity, 0};
+        hamming_status_t status = dispatch<sliding_search_op>(impl, stream_bytes, pat, stream, stream_bytes, n_offsets, sink);
+        *n_matches = sink.n_matches;
+        return status;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_stream_create(const unsigned char pattern[],
+                                                                        const size_t pattern_bytes,
+                                                                        hamming_slide_t slide,
+                                                                        const size_t max_distance,
+                                                                        hamming_sliding_stream_t** stream,
+                                                                        hamming_impl_t impl)
+{
+    if (!pattern)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!stream)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    if (!pattern_bytes || (slide != HAMMING_SLIDE_BYTES && slide != HAMMING_SLIDE_BITS))
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    try
+    {
+        hamming_sliding_stream_t* state = new hamming_sliding_stream_t();
+        init_sliding_pattern(state->pattern, pattern, pattern_bytes, slide);
+        state->max_distance = max_distance;
+        state->impl = impl;
+        state->tail_pos = 0;
+        state->next_pos = 0;
+        *stream = state;
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_sliding_stream_feed(hamming_sliding_stream_t* stream,
+                                                                      const unsigned char chunk[],
+                                                                      const size_t chunk_bytes,
+                                                                      hamming_match_callback_t callback,
+                                                                      void* user_data)
+{
+    HAMMING_LATENCY_SCOPE(HAMMING_ENTRY_SLIDING);
+    HAMMING_PROBE_SCOPE3(sliding_stream_feed, stream ? stream->pattern.pattern_bytes : 0, chunk_bytes,
+                         stream ? static_cast<int>(stream->impl) : 0);
+
+    if (!stream)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!chunk && chunk_bytes)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    if (!callback)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        callback_sink sink = {stream->max_distance, callback, user_data};
+        return dispatch<sliding_feed_op>(stream->impl, chunk_bytes, *stream, chunk, chunk_bytes, sink);
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+}
+
+HAMMING_API void HAMMING_CALL hamming_sliding_stream_destroy(hamming_sliding_stream_t* stream)
+{
+    delete stream;
+}
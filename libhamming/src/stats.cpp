@@ -0,0 +1,361 @@
+//# usage counters of the implementations and latency histograms of the
+//# entry points (HAMMING_WITH_STATS)
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/stats.h>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+#ifdef HAMMING_WITH_STATS
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace{
+    // the threads are spread over shards, each on its own cache lines, so
+    // that concurrent calls don't bounce a shared counter between cores;
+    // the reads add up all the shards
+    const size_t n_stats_shards = 64;
+
+    struct alignas(64) stats_shard
+    {
+        atomic<unsigned long long> n_calls[HAMMING_N_IMPLS];
+        atomic<unsigned long long> n_bytes[HAMMING_N_IMPLS];
+        atomic<unsigned long long> nanoseconds[HAMMING_N_IMPLS];
+    };
+
+    // static storage, so the counters start zeroed
+    stats_shard stats_shards[n_stats_shards];
+    atomic<unsigned int> next_stats_shard(0);
+
+    stats_shard& thread_stats_shard()
+    {
+        static thread_local stats_shard* shard =
+                stats_shards + next_stats_shard.fetch_add(1, memory_order_relaxed) % n_stats_shards;
+        return *shard;
+    }
+
+    void collect_stats(hamming_stats_t& stats)
+    {
+        memset(&stats, 0, sizeof(stats));
+        for (size_t shard_idx = 0; shard_idx < n_stats_shards; ++shard_idx)
+        {
+            const stats_shard& shard = stats_shards[shard_idx];
+            for (size_t impl_idx = 0; impl_idx < HAMMING_N_IMPLS; ++impl_idx)
+            {
+                hamming_impl_stats_t& impl_stats = stats.impls[impl_idx];
+                impl_stats.n_calls += shard.n_calls[impl_idx].load(memory_order_relaxed);
+                impl_stats.n_bytes += shard.n_bytes[impl_idx].load(memory_order_relaxed);
+                impl_stats.nanoseconds += shard.nanoseconds[impl_idx].load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // the histograms of one thread; only that thread adds to them, so the
+    // adds never contend, and the reads merge all the threads. When a thread
+    // exits, its block goes to the free list, counts included, and the next
+    // thread to make a timed call takes it over, so threads which come and
+    // go (e.g. one per connection) don't add a block each.
+    struct latency_block
+    {
+        atomic<unsigned long long> counts[HAMMING_N_ENTRY_POINTS][HAMMING_LATENCY_BUCKETS];
+    };
+
+    mutex latency_blocks_mutex;
+    vector<unique_ptr<latency_block> > latency_blocks;
+    // holds latency_blocks.size() blocks, so that exiting threads never
+    // allocate to return theirs
+    vector<latency_block*> free_latency_blocks;
+
+    latency_block* register_latency_block()
+    {
+        lock_guard<mutex> lock(latency_blocks_mutex);
+        if (!free_latency_blocks.empty())
+        {
+            latency_block* block = free_latency_blocks.back();
+            free_latency_blocks.pop_back();
+            return block;
+        }
+
+        // value-initialized, i.e. zeroed
+        unique_ptr<latency_block> block(new latency_block());
+        free_latency_blocks.reserve(latency_blocks.size() + 1);
+        latency_blocks.push_back(move(block));
+        return latency_blocks.back().get();
+    }
+
+    // the block of the current thread, returned to the free list on exit
+    class thread_latency_block
+    {
+    public:
+        thread_latency_block() : block_(nullptr) {}
+
+        ~thread_latency_block()
+        {
+            if (!block_)
+                return;
+            lock_guard<mutex> lock(latency_blocks_mutex);
+            free_latency_blocks.push_back(block_);
+        }
+
+        latency_block* get()
+        {
+            if (!block_)
+                block_ = register_latency_block();
+            return block_;
+        }
+
+    private:
+        latency_block* block_;
+    };
+
+    size_t latency_bucket(unsigned long long nanoseconds)
+    {
+        if (nanoseconds < 32)
+            return static_cast<size_t>(nanoseconds);
+
+        unsigned int msb = 5;
+        while (msb < 63 && nanoseconds >> (msb + 1))
+            ++msb;
+        if (msb > 43)
+            return HAMMING_LATENCY_BUCKETS - 1;
+
+        // the 5 most significant bits select one of 16 buckets in the octave
+        const unsigned int shift = msb - 4;
+        return 16 * shift + static_cast<size_t>(nanoseconds >> shift);
+    }
+
+    void collect_latencies(size_t entry_idx, unsigned long long counts[])
+    {
+        fill(counts, counts + HAMMING_LATENCY_BUCKETS, 0ULL);
+        lock_guard<mutex> lock(latency_blocks_mutex);
+        for (size_t block_idx = 0; block_idx < latency_blocks.size(); ++block_idx)
+            for (size_t bucket = 0; bucket < HAMMING_LATENCY_BUCKETS; ++bucket)
+                counts[bucket] += latency_blocks[block_idx]->counts[entry_idx][bucket].load(memory_order_relaxed);
+    }
+}
+
+INTERNAL_HAMMING_API void HAMMING_CALL record_latency(hamming_entry_point_t entry_point,
+                                                      stats_clock::duration elapsed)
+{
+    const int entry_idx = static_cast<int>(entry_point);
+    if (entry_idx < 0 || entry_idx >= HAMMING_N_ENTRY_POINTS)
+        return;
+
+    static thread_local thread_latency_block thread_block;
+    latency_block* block = nullptr;
+    try
+    {
+        block = thread_block.get();
+    }
+    catch (const exception&)
+    {
+        // out of memory or resources: the sample is dropped, and the
+        // registration retried on the next call
+        return;
+    }
+
+    const long long nanoseconds = chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+    block->counts[entry_idx][latency_bucket(nanoseconds > 0 ? static_cast<unsigned long long>(nanoseconds) : 0)]
+            .fetch_add(1, memory_order_relaxed);
+}
+
+INTERNAL_HAMMING_API void HAMMING_CALL record_stats(hamming_impl_t impl, unsigned long long n_bytes,
+                                                    stats_clock::duration elapsed)
+{
+    const int impl_idx = static_cast<int>(impl);
+    if (impl_idx < 0 || impl_idx >= HAMMING_N_IMPLS)
+        return;
+
+    stats_shard& shard = thread_stats_shard();
+    shard.n_calls[impl_idx].fetch_add(1, memory_order_relaxed);
+    shard.n_bytes[impl_idx].fetch_add(n_bytes, memory_order_relaxed);
+    shard.nanoseconds[impl_idx].fetch_add(
+            static_cast<unsigned long long>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()),
+            memory_order_relaxed);
+}
+#endif // HAMMING_WITH_STATS
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_get_stats(hamming_stats_t* stats)
+{
+#ifdef HAMMING_WITH_STATS
+    if (!stats)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    collect_stats(*stats);
+    return HAMMING_STATUS_SUCCESS;
+#else
+    (void)stats;
+    return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+#endif
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_reset_stats()
+{
+#ifdef HAMMING_WITH_STATS
+    for (size_t shard_idx = 0; shard_idx < n_stats_shards; ++shard_idx)
+        for (size_t impl_idx = 0; impl_idx < HAMMING_N_IMPLS; ++impl_idx)
+        {
+            stats_shard& shard = stats_shards[shard_idx];
+            shard.n_calls[impl_idx].store(0, memory_order_relaxed);
+            shard.n_bytes[impl_idx].store(0, memory_order_relaxed);
+            shard.nanoseconds[impl_idx].store(0, memory_order_relaxed);
+        }
+
+    lock_guard<mutex> lock(latency_blocks_mutex);
+    for (size_t block_idx = 0; block_idx < latency_blocks.size(); ++block_idx)
+        for (size_t entry_idx = 0; entry_idx < HAMMING_N_ENTRY_POINTS; ++entry_idx)
+            for (size_t bucket = 0; bucket < HAMMING_LATENCY_BUCKETS; ++bucket)
+                latency_blocks[block_idx]->counts[entry_idx][bucket].store(0, memory_order_relaxed);
+    return HAMMING_STATUS_SUCCESS;
+#else
+    return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+#endif
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_get_latency_histogram(hamming_entry_point_t entry_point,
+                                                                        unsigned long long counts[])
+{
+#ifdef HAMMING_WITH_STATS
+    const int entry_idx = static_cast<int>(entry_point);
+    if (entry_idx < 0 || entry_idx >= HAMMING_N_ENTRY_POINTS)
+        return HAMMING_STATUS_BAD_PARAM_SIZE;
+
+    if (!counts)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    collect_latencies(entry_idx, counts);
+    return HAMMING_STATUS_SUCCESS;
+#else
+    (void)entry_point;
+    (void)counts;
+    return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+#endif
+}
+
+HAMMING_API unsigned long long HAMMING_CALL hamming_latency_bucket_lower(const size_t bucket)
+{
+    if (bucket < 32)
+        return bucket;
+
+    const size_t clamped = min(bucket, static_cast<size_t>(HAMMING_LATENCY_BUCKETS));
+    return (16ULL + clamped % 16) << (clamped / 16 - 1);
+}
+
+HAMMING_API const char* HAMMING_CALL hamming_entry_point_name(hamming_entry_point_t entry_point)
+{
+    static const char* const names[HAMMING_N_ENTRY_POINTS] = {
+        "distance", "distance_batch", "weights", "histogram", "masked_distance_batch",
+        "weighted_distance_batch", "similarity_batch", "tanimoto_top_k", "tanimoto_threshold", "sliding",
+        "knn_search", "radius_search", "search_batch", "mutable_knn_search", "mutable_radius_search"};
+    const int entry_idx = static_cast<int>(entry_point);
+    return entry_idx >= 0 && entry_idx < HAMMING_N_ENTRY_POINTS ? names[entry_idx] : "unknown";
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_stats_text(char buffer[],
+                                                             const size_t capacity,
+                                                             size_t* length)
+{
+#ifdef HAMMING_WITH_STATS
+    if (capacity && !buffer)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    if (!length)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    try
+    {
+        hamming_stats_t stats;
+        collect_stats(stats);
+
+        static const char* const metrics[3][2] = {
+            {"hamming_calls_total", "calls which completed successfully"},
+            {"hamming_bytes_total", "bytes of codes given to the calls"},
+            {"hamming_seconds_total", "time spent in the calls"}};
+
+        ostringstream text;
+        // seconds, to the nanosecond
+        text << fixed << setprecision(9);
+        for (size_t metric_idx = 0; metric_idx < 3; ++metric_idx)
+        {
+            text << "# HELP " << metrics[metric_idx][0] << ' ' << metrics[metric_idx][1] << '\n'
+                 << "# TYPE " << metrics[metric_idx][0] << " counter\n";
+            for (int impl_idx = 0; impl_idx < HAMMING_N_IMPLS; ++impl_idx)
+            {
+                const hamming_impl_stats_t& impl_stats = stats.impls[impl_idx];
+                text << metrics[metric_idx][0]
+                     << "{impl=\"" << hamming_impl_name(static_cast<hamming_impl_t>(impl_idx)) << "\"} ";
+                if (metric_idx == 0)
+                    text << impl_stats.n_calls;
+                else if (metric_idx == 1)
+                    text << impl_stats.n_bytes;
+                else
+                    text << impl_stats.nanoseconds * 1e-9;
+                text << '\n';
+            }
+        }
+
+        // the quantiles are the highest latency of the bucket they fall in
+        static const double quantiles[4] = {0.5, 0.9, 0.99, 0.999};
+        static const char* const quantile_labels[4] = {"0.5", "0.9", "0.99", "0.999"};
+        text << "# HELP hamming_latency_seconds latency of the calls of an entry point\n"
+             << "# TYPE hamming_latency_seconds summary\n";
+        vector<unsigned long long> counts(HAMMING_LATENCY_BUCKETS);
+        for (int entry_idx = 0; entry_idx < HAMMING_N_ENTRY_POINTS; ++entry_idx)
+        {
+            collect_latencies(entry_idx, counts.data());
+            unsigned long long n_calls = 0;
+            for (size_t bucket = 0; bucket < HAMMING_LATENCY_BUCKETS; ++bucket)
+                n_calls += counts[bucket];
+
+            const char* entry_name = hamming_entry_point_name(static_cast<hamming_entry_point_t>(entry_idx));
+            for (size_t quantile_idx = 0; quantile_idx < 4; ++quantile_idx)
+            {
+                text << "hamming_latency_seconds{entry_point=\"" << entry_name
+                     << "\",quantile=\"" << quantile_labels[quantile_idx] << "\"} ";
+                if (!n_calls)
+                {
+                    text << "NaN\n";
+                    continue;
+                }
+
+                const double rank = quantiles[quantile_idx] * n_calls;
+                unsigned long long cumulative = 0;
+                size_t bucket = 0;
+                for (; bucket + 1 < HAMMING_LATENCY_BUCKETS; ++bucket)
+                    if ((cumulative += counts[bucket]) >= rank)
+                        break;
+                text << (hamming_latency_bucket_lower(bucket + 1) - 1) * 1e-9 << '\n';
+            }
+            text << "hamming_latency_seconds_count{entry_point=\"" << entry_name << "\"} " << n_calls << '\n';
+        }
+
+        const string result = text.str();
+        *length = result.size();
+        if (capacity)
+        {
+            const size_t n_copied = min(result.size(), capacity - 1);
+            memcpy(buffer, result.data(), n_copied);
+            buffer[n_copied] = '\0';
+        }
+        return HAMMING_STATUS_SUCCESS;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+#else
+    (void)buffer;
+    (void)capacity;
+    (void)length;
+    return HAMMING_STATUS_IMPLEMENTATION_NOT_AVAILABLE;
+#endif
+}
@@ -0,0 +1,335 @@
+//# versioned handles: code sets replaced while they are read
+
+#include <cstddef>
+#include <hamming/hamming_c.h>
+#include <hamming/internal/code_set.h>
+#include <hamming/internal/pages.h>
+#include <hamming/internal/epoch.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace{
+    // a version only ever changes from being built to being freed
+    struct code_version
+    {
+        code_version() : number(0), db(nullptr), ids(nullptr)
+        {
+            memset(&codes, 0, sizeof(codes));
+        }
+
+        ~code_version()
+        {
+            hamming_db_close(db);
+        }
+
+        unsigned long long number;
+        // one or the other holds the codes
+        hamming_db_t* db;
+        page_array<unsigned char> copy;
+        hamming_code_set_t codes;
+        const unsigned long long* ids;
+    };
+
+    // reads a byte of every page, so that the first queries on the version
+    // don't pay for the page faults of a file just mapped
+    void fault_in(const unsigned char* data, const size_t n_bytes)
+    {
+        const size_t page_bytes = 4096;
+        volatile unsigned char sink = 0;
+        for (size_t offset = 0; offset < n_bytes; offset += page_bytes)
+            sink = static_cast<unsigned char>(sink + data[offset]);
+        (void)sink;
+    }
+
+    // how often the loader retries freeing the versions readers still hold
+    const chrono::milliseconds reclaim_period(10);
+}
+
+struct hamming_versioned
+{
+    hamming_versioned()
+        : current(new code_version()), next_number(1), pending_flags(0), has_pending(false), loading(false),
+          stop(false), last_status(HAMMING_STATUS_SUCCESS) {}
+
+    ~hamming_versioned()
+    {
+        if (loader.joinable())
+        {
+            {
+                lock_guard<mutex> lock(loader_mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            loader.join();
+        }
+        delete current.load();
+    }
+
+    // makes version the current one, numbering it; the previous one is
+    // freed after its last reader
+    void swap_in(code_version* version)
+    {
+        lock_guard<mutex> lock(swap_mutex);
+        version->number = next_number++;
+        code_version* previous = current.exchange(version);
+        epochs.retire(previous);
+    }
+
+    hamming_status_t load(const string& path, const int flags)
+    {
+        hamming_db_t* db = nullptr;
+        hamming_status_t status = hamming_db_open(path.c_str(), flags, &db);
+        if (status != HAMMING_STATUS_SUCCESS)
+            return status;
+
+        code_version* version = new (nothrow) code_version();
+        if (!version)
+        {
+            hamming_db_close(db);
+            return HAMMING_STATUS_OUT_OF_MEMORY;
+        }
+        version->db = db;
+        hamming_db_codes(db, &version->codes);
+        version->ids = hamming_db_ids(db);
+        fault_in(version->codes.data, version->codes.n_codes * code_stride(version->codes));
+        if (version->ids)
+            fault_in(reinterpret_cast<const unsigned char*>(version->ids),
+                     version->codes.n_codes * sizeof(unsigned long long));
+
+        swap_in(version);
+        return HAMMING_STATUS_SUCCESS;
+    }
+
+    void run_loader()
+    {
+#ifdef _OPENMP
+        // the checksums of the loads run on this core only, instead of
+        // taking all of them from the queries
+        omp_set_num_threads(1);
+#endif
+        unique_lock<mutex> lock(loader_mutex);
+        for (;;)
+        {
+            // the versions still read are retried now and then, and only
+            // while there are some
+            const auto due = [this] {return has_pending || stop;};
+            if (epochs.n_retired())
+                wake.wait_for(lock, reclaim_period, due);
+            else
+                wake.wait(lock, due);
+            if (stop)
+                return;
+
+            if (has_pending)
+            {
+                const string path = pending_path;
+                const int flags = pending_flags;
+                has_pending = false;
+                loading = true;
+                lock.unlock();
+                const hamming_status_t status = load(path, flags);
+                lock.lock();
+                loading = false;
+                last_status = status;
+                if (!has_pending)
+                    done.notify_all();
+            }
+
+            lock.unlock();
+            epochs.collect();
+            lock.lock();
+        }
+    }
+
+    atomic<code_version*> current;
+    epoch_domain epochs;
+
+    // the swaps take turns (publish runs in the callers' threads)
+    mutex swap_mutex;
+    unsigned long long next_number;
+
+    thread loader;
+    mutex loader_mutex;
+    condition_variable wake, done;
+    string pending_path;
+    int pending_flags;
+    bool has_pending;
+    bool loading;
+    bool stop;
+    hamming_status_t last_status;
+};
+
+struct hamming_snapshot
+{
+    explicit hamming_snapshot(hamming_versioned& handle)
+        : reading(handle.epochs), version(handle.current.load()) {}
+
+    // registered before the version is read, so that it can't be freed in
+    // between
+    epoch_domain::guard reading;
+    const code_version* version;
+};
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_create(hamming_versioned_t** handle)
+{
+    if (!handle)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_versioned_t* result = nullptr;
+    try
+    {
+        result = new hamming_versioned_t();
+        result->loader = thread(&hamming_versioned::run_loader, result);
+    }
+    catch (const bad_alloc&)
+    {
+        delete result;
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+    catch (const system_error&)
+    {
+        // no thread for the loader
+        delete result;
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+
+    *handle = result;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API void HAMMING_CALL hamming_versioned_destroy(hamming_versioned_t* handle)
+{
+    delete handle;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_load(hamming_versioned_t* handle,
+                                                                 const char* path,
+                                                                 const int flags)
+{
+    if (!handle)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!path)
+        return HAMMING_STATUS_BAD_PARAM_STR_2;
+
+    try
+    {
+        lock_guard<mutex> lock(handle->loader_mutex);
+        handle->pending_path = path;
+        handle->pending_flags = flags;
+        handle->has_pending = true;
+    }
+    catch (const bad_alloc&)
+    {
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+    handle->wake.notify_all();
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_wait(hamming_versioned_t* handle)
+{
+    if (!handle)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    unique_lock<mutex> lock(handle->loader_mutex);
+    handle->done.wait(lock, [handle] {return !handle->has_pending && !handle->loading;});
+    return handle->last_status;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_versioned_publish(hamming_versioned_t* handle,
+                                                                    const hamming_code_set_t* codes)
+{
+    if (!handle)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    hamming_status_t status = check_code_set(codes, HAMMING_STATUS_BAD_PARAM_STR_2);
+    if (status != HAMMING_STATUS_SUCCESS)
+        return status;
+
+    code_version* version = nullptr;
+    try
+    {
+        version = new code_version();
+        version->copy.allocate(codes->n_codes * codes->code_bytes);
+    }
+    catch (const bad_alloc&)
+    {
+        delete version;
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+    }
+
+    for (size_t code_idx = 0; code_idx < codes->n_codes; ++code_idx)
+        memcpy(version->copy.data() + code_idx * codes->code_bytes, code_at(*codes, code_idx), codes->code_bytes);
+    version->codes.data = version->copy.data();
+    version->codes.n_codes = codes->n_codes;
+    version->codes.code_bytes = codes->code_bytes;
+    version->codes.stride = 0;
+
+    handle->swap_in(version);
+    // wakes the loader, to reclaim the previous version if readers hold it;
+    // under its mutex, so that it can't be about to wait
+    {
+        lock_guard<mutex> lock(handle->loader_mutex);
+    }
+    handle->wake.notify_all();
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_snapshot_acquire(hamming_versioned_t* handle,
+                                                                   hamming_snapshot_t** snapshot)
+{
+    if (!handle)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!snapshot)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    hamming_snapshot_t* result = new (nothrow) hamming_snapshot_t(*handle);
+    if (!result)
+        return HAMMING_STATUS_OUT_OF_MEMORY;
+
+    *snapshot = result;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API void HAMMING_CALL hamming_snapshot_release(hamming_snapshot_t* snapshot)
+{
+    delete snapshot;
+}
+
+HAMMING_API unsigned long long HAMMING_CALL hamming_snapshot_version(const hamming_snapshot_t* snapshot)
+{
+    return snapshot ? snapshot->version->number : 0;
+}
+
+HAMMING_API hamming_status_t HAMMING_CALL hamming_snapshot_codes(const hamming_snapshot_t* snapshot,
+                                                                 hamming_code_set_t* codes)
+{
+    if (!snapshot)
+        return HAMMING_STATUS_BAD_PARAM_STR_1;
+
+    if (!codes)
+        return HAMMING_STATUS_BAD_PARAM_OUTPUT;
+
+    *codes = snapshot->version->codes;
+    return HAMMING_STATUS_SUCCESS;
+}
+
+HAMMING_API const unsigned long long* HAMMING_CALL hamming_snapshot_ids(const hamming_snapshot_t* snapshot)
+{
+    return snapshot ? snapshot->version->ids : nullptr;
+}